@@ -26,6 +26,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>		/* for size_t */
+#include <stdint.h>		/* for uintmax_t */
 #include <sys/types.h>		/* for ssize_t */
 
 struct msghdr;
@@ -50,9 +51,28 @@ void fd_delref_where(struct fd **fd, const struct where *where);
 
 void fd_leak(struct fd *fd, const struct where *where);
 
-/* return nr-bytes, or -ERRNO */
-ssize_t fd_sendmsg(const struct fd *fd, const struct msghdr *msg, int flags);
-ssize_t fd_read(const struct fd *fd, void *buf, size_t nbytes);
+/*
+ * Return nr-bytes, or -ERRNO.
+ *
+ * Once an output listener has been set, fd_sendmsg() doesn't block:
+ * output that can't be written immediately is buffered in FD and the
+ * listener is called so that it can arrange for fd_flush_output() to
+ * be called when FD is writable.  Past a cap (see fd.c) output is
+ * dropped and a truncation marker is written once the reader catches
+ * up.  The listener returns false when it can't do that (for
+ * instance, when not on the event-loop thread) and fd_sendmsg() then
+ * blocks.
+ */
+ssize_t fd_sendmsg(struct fd *fd, const struct msghdr *msg, int flags);
+ssize_t fd_read(struct fd *fd, void *buf, size_t nbytes);
+
+typedef bool (fd_output_listener_cb)(struct fd *fd);
+void fd_set_output_listener(fd_output_listener_cb *cb);
+/* true when drained; DROPPED is bytes thrown away since last call */
+bool fd_flush_output(struct fd *fd, uintmax_t *dropped);
+/* bytes buffered waiting for FD to become writable */
+size_t fd_output_backlog(struct fd *fd);
+int fd_fileno(const struct fd *fd);
 
 /*
  * Is FD valid (as in something non-negative)?
@@ -0,0 +1,49 @@
+/* keyed hash of bytes, for libreswan
+ *
+ * Copyright (C) 2015, 2017, 2019 Andrew Cagney
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef HASH_BYTES_H
+#define HASH_BYTES_H
+
+#include <stddef.h>		/* for size_t */
+
+#include "shunk.h"		/* has constant ptr */
+
+typedef struct { unsigned hash; } hash_t;
+extern const hash_t zero_hash;
+
+/*
+ * Hash LEN bytes at PTR, continuing on from HASH.
+ *
+ * The hash is keyed (SipHash-1-3) so that a peer can't pick values
+ * (for instance IKE SPIs) that all land in the same bucket.  Call
+ * init_hash_bytes_key() (which needs NSS) once, before anything is
+ * hashed; the key can't be changed after that.
+ */
+
+void init_hash_bytes_key(void);
+hash_t hash_bytes(const void *ptr, size_t len, hash_t hash);
+
+#define hash_hunk(HUNK, HASH)						\
+	({								\
+		typeof(HUNK) h_ = HUNK; /* evaluate once */		\
+		hash_bytes(h_.ptr, h_.len, HASH);			\
+	})
+#define hash_thing(THING, HASH)						\
+	({								\
+		shunk_t h_ = THING_AS_SHUNK(THING); /* evaluate once */	\
+		hash_bytes(h_.ptr, h_.len, HASH);			\
+	})
+
+#endif
@@ -78,6 +78,7 @@ enum keyword_numeric_config_field {
 	KBF_AUDIT_LOG,
 	KBF_IKEBUF,
 	KBF_IKE_ERRQUEUE,
+	KBF_IKE_BATCH,
 	KBF_PERPEERLOG,
 #ifdef XFRM_LIFETIME_DEFAULT
 	KBF_XFRMLIFETIME,
@@ -97,6 +98,10 @@ enum keyword_numeric_config_field {
 	KBF_KEEPALIVE,
 	KBF_PLUTODEBUG,
 	KBF_NHELPERS,
+	KBF_UPDOWN_CONCURRENCY,
+	KBF_SA_STATS_MAX_AGE_MS,
+	KBF_CERT_CHAIN_CACHE,
+	KBF_CRL_FETCH_THREADS,
 	KBF_SHUNTLIFETIME_MS,
 	KBF_FORCEBUSY, 		/* obsoleted for KBF_DDOS_MODE */
 	KBF_DDOS_IKE_THRESHOLD,
@@ -75,6 +75,8 @@ enum ike_version {
 #define SA_REPLACEMENT_FUZZ_DEFAULT 100 /* (IPSEC & IKE) 100% of MARGIN */
 
 #define IKE_BUF_AUTO 0 /* use system values for IKE socket buffer size */
+#define IKE_SOCKET_BATCH_DEFAULT 1 /* datagrams per IKE socket read; 1 disables recvmmsg() */
+#define IKE_SOCKET_BATCH_MAX 64
 
 #define DEFAULT_XFRM_IF_NAME "ipsec1"
 
@@ -29,4 +29,10 @@ extern void get_rnd_bytes(void *buffer, size_t size);
 extern uintmax_t get_rnd_uintmax(uintmax_t roof);
 extern chunk_t alloc_rnd_chunk(size_t size, const char *name);
 
+/*
+ * Serve small requests from a per-thread reservoir (not in FIPS
+ * mode); call once FIPS mode is known.
+ */
+void enable_rnd_reservoir(struct logger *logger);
+
 #endif
@@ -256,17 +256,30 @@ extern void pubkey_delref_where(struct pubkey **pkp, where_t where);
 
 bool secret_pubkey_same(struct secret *lhs, struct secret *rhs);
 
-extern void lsw_load_preshared_secrets(struct secret **psecrets, const char *secrets_file,
+/*
+ * The secrets are loaded into a list and then indexed by (kind, ID)
+ * (the index can be NULL).
+ */
+struct secret_index;
+
+extern void lsw_load_preshared_secrets(struct secret **psecrets,
+				       struct secret_index **pindex,
+				       const char *secrets_file,
+				       struct logger *logger);
+extern void lsw_free_preshared_secrets(struct secret **psecrets,
+				       struct secret_index **pindex,
 				       struct logger *logger);
-extern void lsw_free_preshared_secrets(struct secret **psecrets, struct logger *logger);
 
 extern struct secret *lsw_find_secret_by_id(struct secret *secrets,
+					    const struct secret_index *index,
 					    enum secret_kind kind,
 					    const struct id *my_id,
 					    const struct id *his_id,
 					    bool asym);
 
-extern struct secret *lsw_get_ppk_by_id(struct secret *secrets, chunk_t ppk_id);
+extern struct secret *lsw_get_ppk_by_id(struct secret *secrets,
+					const struct secret_index *index,
+					chunk_t ppk_id);
 
 /* err_t!=NULL -> neither found nor loaded; loaded->just pulled in */
 err_t find_or_load_private_key_by_cert(struct secret **secrets, const struct cert *cert,
@@ -63,7 +63,7 @@
  */
 
 #define WHACK_BASIC_MAGIC (((((('w' << 8) + 'h') << 8) + 'k') << 8) + 25)
-#define WHACK_MAGIC (((((('o' << 8) + 'h') << 8) + 'k') << 8) + 49)
+#define WHACK_MAGIC (((((('o' << 8) + 'h') << 8) + 'k') << 8) + 50)
 
 /* struct whack_end is a lot like connection.h's struct end
  * It differs because it is going to be shipped down a socket
@@ -369,6 +369,19 @@ struct whack_message {
 	bool whack_crash;
 	ip_address whack_crash_peer;
 
+	/* for WHACK_LIST_STATES - name is the connection */
+	bool whack_list_states;
+	struct whack_list_states {
+		ip_address peer;		/* unset matches any */
+		enum whack_sa_kind {
+			WHACK_ANY_SA,
+			WHACK_IKE_SA,
+			WHACK_CHILD_SA,
+		} kind;
+		unsigned long cursor;		/* list states after this serial */
+		uintmax_t pagesize;		/* 0 is no limit */
+	} list_states;
+
 	/* for WHACK_LIST */
 	bool whack_utc;
 	bool whack_checkpubkeys;	/* --checkpubkeys */
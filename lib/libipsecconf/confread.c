@@ -80,11 +80,16 @@ static void ipsecconf_default_values(struct starter_config *cfg)
 	SOPT(KBF_PERPEERLOG, false);
 	SOPT(KBF_IKEBUF, IKE_BUF_AUTO);
 	SOPT(KBF_IKE_ERRQUEUE, true);
+	SOPT(KBF_IKE_BATCH, IKE_SOCKET_BATCH_DEFAULT);
 	SOPT(KBF_NFLOG_ALL, 0); /* disabled per default */
 #ifdef XFRM_LIFETIME_DEFAULT
 	SOPT(KBF_XFRMLIFETIME, XFRM_LIFETIME_DEFAULT); /* not used by pluto itself */
 #endif
 	SOPT(KBF_NHELPERS, -1); /* see also plutomain.c */
+	SOPT(KBF_UPDOWN_CONCURRENCY, 0); /* run updown synchronously */
+	SOPT(KBF_SA_STATS_MAX_AGE_MS, 0); /* query each SA */
+	SOPT(KBF_CERT_CHAIN_CACHE, 0); /* verify each chain */
+	SOPT(KBF_CRL_FETCH_THREADS, 1); /* fetch one CRL at a time */
 
 	SOPT(KBF_KEEPALIVE, 0);                  /* config setup */
 	SOPT(KBF_DDOS_IKE_THRESHOLD, DEFAULT_IKE_SA_DDOS_THRESHOLD);
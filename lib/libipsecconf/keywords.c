@@ -438,6 +438,7 @@ const struct keyword_def ipsec_conf_keywords[] = {
   { "max-halfopen-ike",  kv_config,  kt_number,  KBF_MAX_HALFOPEN_IKE, NULL, NULL, },
   { "ike-socket-bufsize",  kv_config,  kt_number,  KBF_IKEBUF, NULL, NULL, },
   { "ike-socket-errqueue",  kv_config,  kt_bool,  KBF_IKE_ERRQUEUE, NULL, NULL, },
+  { "ike-socket-batch",  kv_config,  kt_number,  KBF_IKE_BATCH, NULL, NULL, },
 #if defined(HAVE_IPTABLES) || defined(HAVE_NFTABLES)
   { "nflog-all",  kv_config,  kt_number,  KBF_NFLOG_ALL, NULL, NULL, },
 #endif
@@ -455,6 +456,10 @@ const struct keyword_def ipsec_conf_keywords[] = {
   { "listen",  kv_config,  kt_string,  KSF_LISTEN, NULL, NULL, },
   { "protostack",  kv_config,  kt_string,  KSF_PROTOSTACK,  NULL, NULL, },
   { "nhelpers",  kv_config,  kt_number,  KBF_NHELPERS, NULL, NULL, },
+  { "updown-concurrency",  kv_config,  kt_number,  KBF_UPDOWN_CONCURRENCY, NULL, NULL, },
+  { "sa-stats-max-age",  kv_config,  kt_time,  KBF_SA_STATS_MAX_AGE_MS, NULL, NULL, },
+  { "cert-chain-cache",  kv_config,  kt_number,  KBF_CERT_CHAIN_CACHE, NULL, NULL, },
+  { "crl-fetch-threads",  kv_config,  kt_number,  KBF_CRL_FETCH_THREADS, NULL, NULL, },
   { "drop-oppo-null",  kv_config,  kt_bool,  KBF_DROP_OPPO_NULL, NULL, NULL, },
 #ifdef HAVE_LABELED_IPSEC
   { "ikev1-secctx-attr-type",  kv_config,  kt_number,  KBF_SECCTX, NULL, NULL, },  /* obsolete: not a value, a type */
@@ -19,6 +19,9 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>		/* for memcpy() */
 
 #include "fd.h"
 #include "lswalloc.h"
@@ -30,8 +33,47 @@ struct fd {
 	unsigned magic;
 	int fd;
 	refcnt_t refcnt;
+	/*
+	 * Output that couldn't be written immediately; .ptr[0..len)
+	 * is waiting to be sent.  Once the listener has been armed,
+	 * it is responsible for calling fd_flush_output() (and holds a
+	 * reference to FD until the output has drained).
+	 */
+	pthread_mutex_t mutex;
+	struct {
+		uint8_t *ptr;
+		size_t len;
+		size_t size;
+		bool armed;
+		bool stalled;	/* over the cap; dropping output */
+		uintmax_t truncated;	/* dropped while stalled */
+		uintmax_t dropped;
+	} output;
 };
 
+/*
+ * The event-loop never waits for a whack client.  Once the buffered
+ * output reaches FD_OUTPUT_MAX bytes the client is considered stalled
+ * and further output is dropped until the reader has drained half of
+ * the buffer; an explicit truncation marker is then written into the
+ * stream so that the gap is visible to whack.  Large producers
+ * should avoid getting this far by yielding while
+ * fd_output_backlog() is large.
+ *
+ * Only a thread that is going to block anyway (a helper thread, or
+ * fd_read() prompting) waits, for at most FD_OUTPUT_WAIT_MS, for
+ * output to drain.
+ */
+#define FD_OUTPUT_MAX (4 * 1024 * 1024)
+#define FD_OUTPUT_WAIT_MS (5 * 1000)
+
+static fd_output_listener_cb *output_listener;
+
+void fd_set_output_listener(fd_output_listener_cb *cb)
+{
+	output_listener = cb;
+}
+
 struct fd *fd_addref_where(struct fd *fd, const struct where *where)
 {
 	pexpect(fd == NULL || fd->magic == FD_MAGIC);
@@ -55,6 +97,8 @@ void fd_delref_where(struct fd **fdp, where_t where)
 			     pri_fd(fd), pri_where(where));
 		}
 		fd->magic = ~FD_MAGIC;
+		pfreeany(fd->output.ptr);
+		pthread_mutex_destroy(&fd->mutex);
 		pfree(fd);
 	}
 }
@@ -69,7 +113,116 @@ void fd_leak(struct fd *fd, where_t where)
 	}
 }
 
-ssize_t fd_sendmsg(const struct fd *fd, const struct msghdr *msg, int flags)
+/*
+ * Write as much of the pending output as the socket will take
+ * without blocking; return -ERRNO on a hard error.  Caller holds
+ * FD->mutex.
+ */
+
+static int write_output(struct fd *fd)
+{
+	size_t sent = 0;
+	int error = 0;
+	while (sent < fd->output.len) {
+		ssize_t s = send(fd->fd, fd->output.ptr + sent,
+				 fd->output.len - sent,
+				 MSG_NOSIGNAL|MSG_DONTWAIT);
+		if (s < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				error = -errno;
+			}
+			break;
+		}
+		sent += s;
+	}
+	if (error < 0) {
+		/* probably the other end hit cntrl-c; forget it all */
+		fd->output.dropped += fd->output.len - sent;
+		sent = fd->output.len;
+		fd->output.stalled = false;
+		fd->output.truncated = 0;
+	}
+	memmove(fd->output.ptr, fd->output.ptr + sent, fd->output.len - sent);
+	fd->output.len -= sent;
+	return error;
+}
+
+/*
+ * Wait, for at most TIMEOUT_MS, until the pending output has shrunk
+ * to LIMIT bytes.  Never called on the event-loop thread.  Caller
+ * holds FD->mutex.
+ */
+
+static int wait_for_output(struct fd *fd, size_t limit, int timeout_ms)
+{
+	int error = write_output(fd);
+	while (error == 0 && fd->output.len > limit && timeout_ms > 0) {
+		struct pollfd pfd = {
+			.fd = fd->fd,
+			.events = POLLOUT,
+		};
+		/* XXX: timeout is per-poll; good enough */
+		if (poll(&pfd, 1, timeout_ms) <= 0) {
+			break;
+		}
+		error = write_output(fd);
+	}
+	return error;
+}
+
+static void append_bytes(struct fd *fd, const void *ptr, size_t len)
+{
+	if (fd->output.len + len > fd->output.size) {
+		size_t size = fd->output.size;
+		while (fd->output.len + len > size) {
+			size = (size == 0 ? 4096 : size * 2);
+		}
+		realloc_bytes((void**)&fd->output.ptr, fd->output.size,
+			      size, "fd output");
+		fd->output.size = size;
+	}
+	memcpy(fd->output.ptr + fd->output.len, ptr, len);
+	fd->output.len += len;
+}
+
+static void append_output(struct fd *fd, const struct msghdr *msg, size_t skip)
+{
+	for (size_t i = 0; i < msg->msg_iovlen; i++) {
+		const struct iovec *iov = &msg->msg_iov[i];
+		if (skip >= iov->iov_len) {
+			skip -= iov->iov_len;
+			continue;
+		}
+		append_bytes(fd, (const uint8_t *)iov->iov_base + skip,
+			     iov->iov_len - skip);
+		skip = 0;
+	}
+}
+
+/*
+ * Once a stalled reader has caught up, mark the gap in the output
+ * with a line that whack will print.  Caller holds FD->mutex.
+ */
+
+static void resume_output(struct fd *fd)
+{
+	if (!fd->output.stalled || fd->output.len > FD_OUTPUT_MAX / 2) {
+		return;
+	}
+	char marker[100];
+	int len = snprintf(marker, sizeof(marker),
+			   "%03u output truncated: whack was not keeping up; %ju bytes dropped\n",
+			   RC_LOG_SERIOUS, fd->output.truncated);
+	passert(len > 0 && (size_t)len < sizeof(marker));
+	append_bytes(fd, marker, len);
+	fd->output.stalled = false;
+	fd->output.truncated = 0;
+}
+
+ssize_t fd_sendmsg(struct fd *fd, const struct msghdr *msg, int flags)
 {
 	if (fd == NULL || fd->magic != FD_MAGIC) {
 		/*
@@ -79,8 +232,114 @@ ssize_t fd_sendmsg(const struct fd *fd, const struct msghdr *msg, int flags)
 		 */
 		return -EFAULT;
 	}
-	ssize_t s = sendmsg(fd->fd, msg, flags);
-	return s < 0 ? -errno : s;
+
+	if (output_listener == NULL) {
+		/* no event-loop; block */
+		ssize_t s = sendmsg(fd->fd, msg, flags);
+		return s < 0 ? -errno : s;
+	}
+
+	size_t msg_len = 0;
+	for (size_t i = 0; i < msg->msg_iovlen; i++) {
+		msg_len += msg->msg_iov[i].iov_len;
+	}
+
+	ssize_t result = msg_len;
+	bool arm = false;
+	pthread_mutex_lock(&fd->mutex);
+	{
+		/*
+		 * Keep things in order: anything pending goes first;
+		 * when there's too much pending, drop (never wait
+		 * for the reader).
+		 */
+		int error = 0;
+		if (fd->output.len > 0) {
+			error = write_output(fd);
+		}
+		if (error == 0) {
+			resume_output(fd);
+		}
+
+		size_t sent = 0;
+		if (error < 0) {
+			result = error;
+			sent = msg_len;
+		} else if (fd->output.stalled || fd->output.len >= FD_OUTPUT_MAX) {
+			fd->output.stalled = true;
+			fd->output.truncated += msg_len;
+			fd->output.dropped += msg_len;
+			sent = msg_len;
+		} else if (fd->output.len == 0) {
+			ssize_t s = sendmsg(fd->fd, msg, flags|MSG_DONTWAIT);
+			if (s >= 0) {
+				sent = s;
+			} else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				result = -errno;
+				sent = msg_len;
+			}
+		}
+		if (sent < msg_len) {
+			append_output(fd, msg, sent);
+			if (!fd->output.armed) {
+				fd->output.armed = true;
+				arm = true;
+			}
+		}
+	}
+	pthread_mutex_unlock(&fd->mutex);
+
+	if (arm && !output_listener(fd)) {
+		/* helper thread, can't wait for the event-loop; block */
+		pthread_mutex_lock(&fd->mutex);
+		{
+			int error = wait_for_output(fd, 0, FD_OUTPUT_WAIT_MS);
+			if (error < 0) {
+				result = error;
+			}
+			fd->output.dropped += fd->output.len;
+			fd->output.len = 0;
+			fd->output.armed = false;
+		}
+		pthread_mutex_unlock(&fd->mutex);
+	}
+	return result;
+}
+
+bool fd_flush_output(struct fd *fd, uintmax_t *dropped)
+{
+	bool drained;
+	pthread_mutex_lock(&fd->mutex);
+	{
+		if (write_output(fd) == 0 && fd->output.stalled) {
+			resume_output(fd);
+			write_output(fd);
+		}
+		drained = (fd->output.len == 0);
+		if (drained) {
+			fd->output.armed = false;
+		}
+		*dropped = fd->output.dropped;
+		fd->output.dropped = 0;
+	}
+	pthread_mutex_unlock(&fd->mutex);
+	return drained;
+}
+
+size_t fd_output_backlog(struct fd *fd)
+{
+	size_t backlog;
+	pthread_mutex_lock(&fd->mutex);
+	{
+		backlog = fd->output.len;
+	}
+	pthread_mutex_unlock(&fd->mutex);
+	return backlog;
+}
+
+int fd_fileno(const struct fd *fd)
+{
+	return fd->fd;
 }
 
 struct fd *fd_accept(int socket, const struct where *where, struct logger *logger)
@@ -105,16 +364,21 @@ struct fd *fd_accept(int socket, const struct where *where, struct logger *logge
 	struct fd *fdt = refcnt_alloc(struct fd, where);
 	fdt->fd = fd;
 	fdt->magic = FD_MAGIC;
+	pthread_mutex_init(&fdt->mutex, NULL);
 	dbg("%s: new "PRI_FD" "PRI_WHERE"",
 	    __func__, pri_fd(fdt), pri_where(where));
 	return fdt;
 }
 
-ssize_t fd_read(const struct fd *fd, void *buf, size_t nbytes)
+ssize_t fd_read(struct fd *fd, void *buf, size_t nbytes)
 {
 	if (fd == NULL || fd->magic != FD_MAGIC) {
 		return -EFAULT;
 	}
+	/* about to block on the read; so push out any prompt */
+	pthread_mutex_lock(&fd->mutex);
+	wait_for_output(fd, 0, FD_OUTPUT_WAIT_MS);
+	pthread_mutex_unlock(&fd->mutex);
 	ssize_t s = read(fd->fd, buf, nbytes);
 	return s < 0 ? -errno : s;
 }
@@ -0,0 +1,89 @@
+/* keyed hash of bytes, for libreswan
+ *
+ * Copyright (C) 2015 Andrew Cagney <andrew.cagney@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <stdint.h>
+#include <string.h>		/* for memcpy() */
+
+#include "hash_bytes.h"
+#include "rnd.h"
+
+const hash_t zero_hash = { 0 };
+
+static struct {
+	uint64_t k0;
+	uint64_t k1;
+} hash_key;
+
+void init_hash_bytes_key(void)
+{
+	get_rnd_bytes(&hash_key, sizeof(hash_key));
+}
+
+/*
+ * SipHash-1-3 (one compression round per word, three finalization
+ * rounds); see https://www.aumasson.jp/siphash/.
+ *
+ * Words are loaded in native byte order - the hash is only ever used
+ * within this process so there's no need to byte swap.  The incoming
+ * HASH is folded into the key so that hashes can be chained.
+ */
+
+#define ROTL(X, B) (((X) << (B)) | ((X) >> (64 - (B))))
+
+#define SIPROUND							\
+	{								\
+		v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; v0 = ROTL(v0, 32); \
+		v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2;			\
+		v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0;			\
+		v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; v2 = ROTL(v2, 32); \
+	}
+
+hash_t hash_bytes(const void *ptr, size_t len, hash_t hash)
+{
+	uint64_t k0 = hash_key.k0 ^ hash.hash;
+	uint64_t k1 = hash_key.k1;
+	uint64_t v0 = k0 ^ UINT64_C(0x736f6d6570736575);
+	uint64_t v1 = k1 ^ UINT64_C(0x646f72616e646f6d);
+	uint64_t v2 = k0 ^ UINT64_C(0x6c7967656e657261);
+	uint64_t v3 = k1 ^ UINT64_C(0x7465646279746573);
+
+	const uint8_t *bytes = ptr;
+	size_t nr_words = len / sizeof(uint64_t);
+	for (size_t w = 0; w < nr_words; w++) {
+		uint64_t m;
+		memcpy(&m, bytes, sizeof(m));
+		bytes += sizeof(m);
+		v3 ^= m;
+		SIPROUND;
+		v0 ^= m;
+	}
+
+	/* the remaining 0-7 bytes and the length */
+	uint64_t b = ((uint64_t) len) << 56;
+	for (size_t i = 0; i < len % sizeof(uint64_t); i++) {
+		b |= ((uint64_t) bytes[i]) << (i * 8);
+	}
+	v3 ^= b;
+	SIPROUND;
+	v0 ^= b;
+
+	v2 ^= 0xff;
+	SIPROUND;
+	SIPROUND;
+	SIPROUND;
+
+	uint64_t h = v0 ^ v1 ^ v2 ^ v3;
+	return (hash_t) { .hash = (unsigned) (h ^ (h >> 32)), };
+}
@@ -19,11 +19,16 @@
  *
  */
 
+#include <pthread.h>		/* for pthread_atfork() */
+#include <string.h>		/* for memcpy() */
+
 #include <pk11pub.h>
 
 #include "rnd.h"
 #include "lswlog.h"		/* for global_logger */
 #include "lswnss.h"		/* for passert_nss_error() */
+#include "lswfips.h"		/* for libreswan_fipsmode() */
+#include "monotime.h"
 
 /* A true random number generator (we hope)
  *
@@ -62,13 +67,90 @@
  *   exchange.  Eventually, one per informational exchange.
  */
 
-void get_rnd_bytes(void *buffer, size_t length)
+static void generate_rnd_bytes(void *buffer, size_t length)
 {
 	if (PK11_GenerateRandom(buffer, length) != SECSuccess) {
 		passert_nss_error(&global_logger, HERE, "generating %zu random bytes", length);
 	}
 }
 
+/*
+ * A reservoir of random bytes.
+ *
+ * Nonces, SPIs, cookies, et.al. only need a few bytes at a time yet
+ * each PK11_GenerateRandom() call has a fixed overhead (slot lookup,
+ * locking the DRBG).  Instead, each thread (main and helpers) keeps
+ * a reservoir that is filled from NSS's DRBG in bulk and small
+ * requests are served from that.
+ *
+ * Bytes are wiped as they are handed out.  What remains is thrown
+ * away, and the reservoir refilled with fresh DRBG output, once it
+ * is older than RND_RESERVOIR_MAX_AGE_SECONDS; a forked child throws
+ * its copy away so that parent and child don't hand out the same
+ * bytes.
+ *
+ * In FIPS mode the reservoir isn't used and every request goes
+ * straight to NSS.
+ */
+
+#define RND_RESERVOIR_SIZE 4096
+#define RND_RESERVOIR_MAX_REQUEST 64
+#define RND_RESERVOIR_MAX_AGE_SECONDS 60
+
+static bool rnd_reservoir_enabled = false;
+
+static __thread struct {
+	uint8_t bytes[RND_RESERVOIR_SIZE];
+	size_t available;	/* at the end of BYTES */
+	monotime_t filled;
+} rnd_reservoir;
+
+static void drain_rnd_reservoir(void)
+{
+	memset(rnd_reservoir.bytes, 0, sizeof(rnd_reservoir.bytes));
+	rnd_reservoir.available = 0;
+}
+
+void enable_rnd_reservoir(struct logger *logger)
+{
+	if (libreswan_fipsmode()) {
+		ldbg(logger, "FIPS: random bytes are generated on demand");
+		return;
+	}
+	if (pthread_atfork(NULL, NULL, drain_rnd_reservoir) != 0) {
+		ldbg(logger, "pthread_atfork() failed; random bytes are generated on demand");
+		return;
+	}
+	ldbg(logger, "random bytes are served from a %u byte reservoir",
+	     RND_RESERVOIR_SIZE);
+	rnd_reservoir_enabled = true;
+}
+
+void get_rnd_bytes(void *buffer, size_t length)
+{
+	if (!rnd_reservoir_enabled || length > RND_RESERVOIR_MAX_REQUEST) {
+		generate_rnd_bytes(buffer, length);
+		return;
+	}
+
+	const monotime_t now = mononow();
+	if (rnd_reservoir.available > 0 &&
+	    deltasecs(monotimediff(now, rnd_reservoir.filled)) >= RND_RESERVOIR_MAX_AGE_SECONDS) {
+		drain_rnd_reservoir();
+	}
+	if (rnd_reservoir.available < length) {
+		drain_rnd_reservoir();
+		generate_rnd_bytes(rnd_reservoir.bytes, sizeof(rnd_reservoir.bytes));
+		rnd_reservoir.available = sizeof(rnd_reservoir.bytes);
+		rnd_reservoir.filled = now;
+	}
+
+	uint8_t *bytes = rnd_reservoir.bytes + sizeof(rnd_reservoir.bytes) - rnd_reservoir.available;
+	memcpy(buffer, bytes, length);
+	memset(bytes, 0, length);
+	rnd_reservoir.available -= length;
+}
+
 uintmax_t get_rnd_uintmax(uintmax_t roof)
 {
 	uintmax_t rnd;
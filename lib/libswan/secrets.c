@@ -58,6 +58,7 @@
 #include "lswconf.h"
 #include "lswnss.h"
 #include "ip_info.h"
+#include "hash_bytes.h"
 #include "nss_cert_load.h"
 #include "ike_alg.h"
 #include "ike_alg_hash.h"
@@ -107,6 +108,7 @@ struct secret {
 	struct secret *next;
 	struct id_list *ids;
 	struct secret_stuff stuff;
+	unsigned position;	/* in list, when indexed */
 };
 
 struct secret_stuff *get_secret_stuff(struct secret *secret)
@@ -282,183 +284,466 @@ bool secret_pubkey_same(struct secret *lhs, struct secret *rhs)
 							    &rhs->stuff.u.pubkey.content);
 }
 
-struct secret *lsw_find_secret_by_id(struct secret *secrets,
-				     enum secret_kind kind,
-				     const struct id *local_id,
-				     const struct id *remote_id,
-				     bool asym)
+/*
+ * Index of the secrets loaded from ipsec.secrets, by (kind, ID).
+ *
+ * With thousands of per-user PSK and XAUTH entries, scoring every
+ * secret against the IDs is too slow.  Instead only the secrets that
+ * can possibly match are scored:
+ *
+ *   WILDCARDS: secrets with an ID that matches anything (%any,
+ *   ID_NONE) or that can't be hashed (a DN); always scored
+ *
+ *   BY_ID: secrets indexed by each of their IDs; used to find
+ *   secrets matching the remote ID, and, when asymmetric, the local
+ *   ID
+ *
+ *   BY_SOLE_ID: secrets with exactly one ID; when symmetric, a
+ *   secret matching only the local ID counts only when it is the
+ *   sole ID (and becomes a default)
+ *
+ * The candidates are then scored in list order by match_secret()
+ * so the precedence rules of lsw_find_secret_by_id() are unchanged.
+ *
+ * Private keys added after the index was built (they are prepended
+ * to the list) are not indexed; they are the secrets in front of
+ * HEAD and are always scored.
+ */
+
+struct secret_index_entry {
+	struct secret *secret;
+	struct secret_index_entry *next;
+};
+
+struct secret_index {
+	const struct secret *head;	/* list when indexed */
+	unsigned nr_secrets;
+	unsigned nr_buckets;		/* power of 2 */
+	struct secret_index_entry **by_id;
+	struct secret_index_entry **by_sole_id;
+	struct secret_index_entry **by_ppk_id;
+	struct secret_index_entry *wildcards;
+};
+
+/*
+ * Hash (KIND, ID) so that IDs that are same_id() hash the same;
+ * return false when that isn't possible.
+ */
+
+static bool hash_secret_id(enum secret_kind kind, const struct id *id, hash_t *hash)
 {
-	enum {
-		match_none = 0,
-
-		/* bits */
-		match_default = 1,
-		match_any = 2,
-		match_remote = 4,
-		match_local = 8
-	};
-	lset_t best_match = match_none;
-	struct secret *best = NULL;
+	hash_t h = hash_thing(kind, zero_hash);
+	h = hash_thing(id->kind, h);
+	switch (id->kind) {
+	case ID_IPV4_ADDR:
+	case ID_IPV6_ADDR:
+		h = hash_hunk(address_as_shunk(&id->ip_addr), h);
+		break;
+	case ID_FQDN:
+	case ID_USER_FQDN:
+	{
+		/* like id_eq(): ignore case and trailing dots */
+		const char *name = (const char *)id->name.ptr;
+		size_t len = id->name.len;
+		while (len > 0 && name[len - 1] == '.') {
+			len--;
+		}
+		for (size_t i = 0; i < len; i++) {
+			char c = char_tolower(name[i]);
+			h = hash_thing(c, h);
+		}
+		break;
+	}
+	case ID_KEY_ID:
+		h = hash_hunk(id->name, h);
+		break;
+	case ID_NULL:
+		/* all ID_NULLs are the same */
+		break;
+	default:
+		/* ID_NONE, DNs, ... */
+		return false;
+	}
+	*hash = h;
+	return true;
+}
+
+static void add_secret_index_entry(struct secret_index *index,
+				   struct secret_index_entry **table,
+				   hash_t hash, struct secret *s)
+{
+	struct secret_index_entry **bucket = &table[hash.hash & (index->nr_buckets - 1)];
+	struct secret_index_entry *entry = alloc_thing(struct secret_index_entry, "secret index entry");
+	entry->secret = s;
+	entry->next = *bucket;
+	*bucket = entry;
+}
+
+static struct secret_index *index_secrets(struct secret *secrets)
+{
+	struct secret_index *index = alloc_thing(struct secret_index, "secret index");
+	index->head = secrets;
 
+	unsigned nr_ids = 0;
 	for (struct secret *s = secrets; s != NULL; s = s->next) {
-		if (DBGP(DBG_BASE)) {
-			id_buf idl;
-			DBG_log("line %d: key type %s(%s) to type %s",
-				s->stuff.line,
-				enum_name(&secret_kind_names, kind),
-				str_id(local_id, &idl),
-				enum_name(&secret_kind_names, s->stuff.kind));
+		s->position = index->nr_secrets++;
+		for (struct id_list *i = s->ids; i != NULL; i = i->next) {
+			nr_ids++;
 		}
+	}
+	index->nr_buckets = 64;
+	while (index->nr_buckets < nr_ids) {
+		index->nr_buckets *= 2;
+	}
+	index->by_id = alloc_things(struct secret_index_entry *, index->nr_buckets, "secrets by id");
+	index->by_sole_id = alloc_things(struct secret_index_entry *, index->nr_buckets, "secrets by sole id");
+	index->by_ppk_id = alloc_things(struct secret_index_entry *, index->nr_buckets, "secrets by ppk id");
 
-		if (s->stuff.kind != kind) {
-			dbg("  wrong kind");
+	for (struct secret *s = secrets; s != NULL; s = s->next) {
+		if (s->stuff.kind == SECRET_PPK) {
+			add_secret_index_entry(index, index->by_ppk_id,
+					       hash_hunk(s->stuff.ppk_id, zero_hash), s);
+		}
+		bool wildcard = false;
+		for (struct id_list *i = s->ids; i != NULL && !wildcard; i = i->next) {
+			hash_t hash;
+			wildcard = (id_is_any(&i->id) ||
+				    !hash_secret_id(s->stuff.kind, &i->id, &hash));
+		}
+		if (wildcard) {
+			struct secret_index_entry *entry = alloc_thing(struct secret_index_entry, "secret index entry");
+			entry->secret = s;
+			entry->next = index->wildcards;
+			index->wildcards = entry;
 			continue;
 		}
+		for (struct id_list *i = s->ids; i != NULL; i = i->next) {
+			hash_t hash;
+			hash_secret_id(s->stuff.kind, &i->id, &hash);
+			add_secret_index_entry(index, index->by_id, hash, s);
+			if (s->ids->next == NULL) {
+				add_secret_index_entry(index, index->by_sole_id, hash, s);
+			}
+		}
+	}
 
-		lset_t match = match_none;
+	dbg("indexed %u secrets with %u IDs using %u buckets",
+	    index->nr_secrets, nr_ids, index->nr_buckets);
+	return index;
+}
 
-		if (s->ids == NULL) {
-			/*
-			 * a default (signified by lack of ids):
-			 * accept if no more specific match found
-			 */
-			match = match_default;
-		} else {
-			/* check if both ends match ids */
-			struct id_list *i;
-			int idnum = 0;
-
-			for (i = s->ids; i != NULL; i = i->next) {
-				idnum++;
-				if (id_is_any(&i->id)) {
-					/*
-					 * match any will
-					 * automatically match
-					 * local and remote so
-					 * treat it as its own
-					 * match type so that
-					 * specific matches
-					 * get a higher
-					 * "match" value and
-					 * are used in
-					 * preference to "any"
-					 * matches.
-					 */
-					match |= match_any;
-				} else {
-					if (same_id(&i->id, local_id)) {
-						match |= match_local;
-					}
-
-					if (remote_id != NULL &&
-					    same_id(&i->id, remote_id)) {
-						match |= match_remote;
-					}
-				}
+static void free_secret_index_entries(struct secret_index_entry **entries)
+{
+	while (*entries != NULL) {
+		struct secret_index_entry *tbd = *entries;
+		*entries = tbd->next;
+		pfree(tbd);
+	}
+}
 
-				if (DBGP(DBG_BASE)) {
-					id_buf idi;
-					id_buf idl;
-					id_buf idr;
-					DBG_log("%d: compared key %s to %s / %s -> "PRI_LSET,
-						idnum,
-						str_id(&i->id, &idi),
-						str_id(local_id, &idl),
-						(remote_id == NULL ? "" : str_id(remote_id, &idr)),
-						match);
-				}
-			}
+static void free_secret_index(struct secret_index **index)
+{
+	if (*index == NULL) {
+		return;
+	}
+	for (unsigned b = 0; b < (*index)->nr_buckets; b++) {
+		free_secret_index_entries(&(*index)->by_id[b]);
+		free_secret_index_entries(&(*index)->by_sole_id[b]);
+		free_secret_index_entries(&(*index)->by_ppk_id[b]);
+	}
+	free_secret_index_entries(&(*index)->wildcards);
+	pfree((*index)->by_id);
+	pfree((*index)->by_sole_id);
+	pfree((*index)->by_ppk_id);
+	pfree(*index);
+	*index = NULL;
+}
 
-			/*
-			 * If our end matched the only id in the list,
-			 * default to matching any peer.
-			 * A more specific match will trump this.
-			 */
-			if (match == match_local &&
-			    s->ids->next == NULL)
-				match |= match_default;
+static int secret_position_cmp(const void *lp, const void *rp)
+{
+	const struct secret *const *l = lp;
+	const struct secret *const *r = rp;
+	return ((*l)->position > (*r)->position) - ((*l)->position < (*r)->position);
+}
+
+/*
+ * Collect the secrets that could match the IDs, in list order,
+ * starting with any added since the index was built.  Return false
+ * when the index can't help and every secret needs to be scored.
+ */
+
+static bool find_indexed_secrets(const struct secret_index *index,
+				 struct secret *secrets,
+				 enum secret_kind kind,
+				 const struct id *local_id,
+				 const struct id *remote_id,
+				 bool asym,
+				 struct secret ***candidates,
+				 unsigned *nr_candidates)
+{
+	hash_t local_hash, remote_hash;
+	if (index == NULL ||
+	    !hash_secret_id(kind, local_id, &local_hash) ||
+	    (remote_id != NULL && !hash_secret_id(kind, remote_id, &remote_hash))) {
+		return false;
+	}
+
+	unsigned mask = index->nr_buckets - 1;
+	struct secret_index_entry *chains[] = {
+		index->wildcards,
+		(asym ? index->by_id : index->by_sole_id)[local_hash.hash & mask],
+		(remote_id == NULL ? NULL : index->by_id[remote_hash.hash & mask]),
+	};
+
+	/* upper bound */
+	unsigned nr = 0;
+	for (const struct secret *s = secrets; s != index->head; s = s->next) {
+		nr++;
+	}
+	unsigned nr_added = nr;
+	FOR_EACH_ELEMENT(chain, chains) {
+		for (const struct secret_index_entry *e = *chain; e != NULL; e = e->next) {
+			nr++;
 		}
+	}
 
-		if (match == match_none) {
-			dbg("  id didn't match");
-			continue;
+	struct secret **c = alloc_things(struct secret *, nr + 1, "secret candidates");
+	nr = 0;
+	for (struct secret *s = secrets; s != index->head; s = s->next) {
+		c[nr++] = s;
+	}
+	FOR_EACH_ELEMENT(chain, chains) {
+		for (const struct secret_index_entry *e = *chain; e != NULL; e = e->next) {
+			if (e->secret->stuff.kind == kind) {
+				c[nr++] = e->secret;
+			}
 		}
+	}
 
-		dbg("  match="PRI_LSET, match);
-		if (match == best_match) {
-			/*
-			 * Two good matches are equally good: do they
-			 * agree?
-			 */
-			bool same = false;
-
-			switch (kind) {
-			case SECRET_NULL:
-				same = true;
-				break;
-			case SECRET_PSK:
-				same = hunk_eq(s->stuff.u.preshared_secret,
-					       best->stuff.u.preshared_secret);
-				break;
-			case SECRET_RSA:
-			case SECRET_ECDSA:
-				same = secret_pubkey_same(s, best);
-				break;
-			case SECRET_XAUTH:
+	/* into list order, dropping duplicates */
+	qsort(c + nr_added, nr - nr_added, sizeof(c[0]), secret_position_cmp);
+	unsigned n = nr_added;
+	for (unsigned i = nr_added; i < nr; i++) {
+		if (n == nr_added || c[n - 1] != c[i]) {
+			c[n++] = c[i];
+		}
+	}
+
+	*candidates = c;
+	*nr_candidates = n;
+	return true;
+}
+
+enum {
+	match_none = 0,
+
+	/* bits */
+	match_default = 1,
+	match_any = 2,
+	match_remote = 4,
+	match_local = 8
+};
+
+/*
+ * Score secret S against the IDs; when it beats (or ties with
+ * something different) update BEST.
+ *
+ * Secrets must be fed in list order.
+ */
+
+static void match_secret(struct secret *s,
+			 enum secret_kind kind,
+			 const struct id *local_id,
+			 const struct id *remote_id,
+			 bool asym,
+			 lset_t *best_match,
+			 struct secret **best)
+{
+	if (DBGP(DBG_BASE)) {
+		id_buf idl;
+		DBG_log("line %d: key type %s(%s) to type %s",
+			s->stuff.line,
+			enum_name(&secret_kind_names, kind),
+			str_id(local_id, &idl),
+			enum_name(&secret_kind_names, s->stuff.kind));
+	}
+
+	if (s->stuff.kind != kind) {
+		dbg("  wrong kind");
+		return;
+	}
+
+	lset_t match = match_none;
+
+	if (s->ids == NULL) {
+		/*
+		 * a default (signified by lack of ids):
+		 * accept if no more specific match found
+		 */
+		match = match_default;
+	} else {
+		/* check if both ends match ids */
+		struct id_list *i;
+		int idnum = 0;
+
+		for (i = s->ids; i != NULL; i = i->next) {
+			idnum++;
+			if (id_is_any(&i->id)) {
 				/*
-				 * We don't support this yet,
-				 * but no need to die.
+				 * match any will
+				 * automatically match
+				 * local and remote so
+				 * treat it as its own
+				 * match type so that
+				 * specific matches
+				 * get a higher
+				 * "match" value and
+				 * are used in
+				 * preference to "any"
+				 * matches.
 				 */
-				break;
-			case SECRET_PPK:
-				same = hunk_eq(s->stuff.ppk, best->stuff.ppk);
-				break;
-			default:
-				bad_case(kind);
+				match |= match_any;
+			} else {
+				if (same_id(&i->id, local_id)) {
+					match |= match_local;
+				}
+
+				if (remote_id != NULL &&
+				    same_id(&i->id, remote_id)) {
+					match |= match_remote;
+				}
 			}
-			if (!same) {
-				dbg("  multiple ipsec.secrets entries with distinct secrets match endpoints: first secret used");
-				/*
-				 * list is backwards: take latest in
-				 * list
-				 */
-				best = s;
+
+			if (DBGP(DBG_BASE)) {
+				id_buf idi;
+				id_buf idl;
+				id_buf idr;
+				DBG_log("%d: compared key %s to %s / %s -> "PRI_LSET,
+					idnum,
+					str_id(&i->id, &idi),
+					str_id(local_id, &idl),
+					(remote_id == NULL ? "" : str_id(remote_id, &idr)),
+					match);
 			}
-			continue;
 		}
 
-		if (match == match_local && !asym) {
+		/*
+		 * If our end matched the only id in the list,
+		 * default to matching any peer.
+		 * A more specific match will trump this.
+		 */
+		if (match == match_local &&
+		    s->ids->next == NULL)
+			match |= match_default;
+	}
+
+	if (match == match_none) {
+		dbg("  id didn't match");
+		return;
+	}
+
+	dbg("  match="PRI_LSET, match);
+	if (match == *best_match) {
+		/*
+		 * Two good matches are equally good: do they
+		 * agree?
+		 */
+		bool same = false;
+
+		switch (kind) {
+		case SECRET_NULL:
+			same = true;
+			break;
+		case SECRET_PSK:
+			same = hunk_eq(s->stuff.u.preshared_secret,
+				       (*best)->stuff.u.preshared_secret);
+			break;
+		case SECRET_RSA:
+		case SECRET_ECDSA:
+			same = secret_pubkey_same(s, *best);
+			break;
+		case SECRET_XAUTH:
 			/*
-			 * Only when this is an asymmetric (eg. public
-			 * key) system, allow this-side-only match to
-			 * count, even when there are other ids in the
-			 * list.
+			 * We don't support this yet,
+			 * but no need to die.
 			 */
-			dbg("  local match not asymetric");
-			continue;
+			break;
+		case SECRET_PPK:
+			same = hunk_eq(s->stuff.ppk, (*best)->stuff.ppk);
+			break;
+		default:
+			bad_case(kind);
 		}
-
-		switch (match) {
-		case match_local:
-		case match_default:	/* default all */
-		case match_any:	/* a wildcard */
-		case match_local | match_default:	/* default peer */
-		case match_local | match_any: /* %any/0.0.0.0 and local */
-		case match_remote | match_any: /* %any/0.0.0.0 and remote */
-		case match_local | match_remote:	/* explicit */
+		if (!same) {
+			dbg("  multiple ipsec.secrets entries with distinct secrets match endpoints: first secret used");
 			/*
-			 * XXX: what combinations are missing?
+			 * list is backwards: take latest in
+			 * list
 			 */
-			if (match > best_match) {
-				dbg("  match "PRI_LSET" beats previous best_match "PRI_LSET" match=%p (line=%d)",
-				    match, best_match, s, s->stuff.line);
-				/* this is the best match so far */
-				best_match = match;
-				best = s;
-			} else {
-				dbg("  match "PRI_LSET" loses to best_match "PRI_LSET,
-				    match, best_match);
-			}
+			*best = s;
+		}
+		return;
+	}
+
+	if (match == match_local && !asym) {
+		/*
+		 * Only when this is an asymmetric (eg. public
+		 * key) system, allow this-side-only match to
+		 * count, even when there are other ids in the
+		 * list.
+		 */
+		dbg("  local match not asymetric");
+		return;
+	}
+
+	switch (match) {
+	case match_local:
+	case match_default:	/* default all */
+	case match_any:	/* a wildcard */
+	case match_local | match_default:	/* default peer */
+	case match_local | match_any: /* %any/0.0.0.0 and local */
+	case match_remote | match_any: /* %any/0.0.0.0 and remote */
+	case match_local | match_remote:	/* explicit */
+		/*
+		 * XXX: what combinations are missing?
+		 */
+		if (match > *best_match) {
+			dbg("  match "PRI_LSET" beats previous best_match "PRI_LSET" match=%p (line=%d)",
+			    match, *best_match, s, s->stuff.line);
+			/* this is the best match so far */
+			*best_match = match;
+			*best = s;
+		} else {
+			dbg("  match "PRI_LSET" loses to best_match "PRI_LSET,
+			    match, *best_match);
+		}
+	}
+}
+
+struct secret *lsw_find_secret_by_id(struct secret *secrets,
+				     const struct secret_index *index,
+				     enum secret_kind kind,
+				     const struct id *local_id,
+				     const struct id *remote_id,
+				     bool asym)
+{
+	lset_t best_match = match_none;
+	struct secret *best = NULL;
+
+	struct secret **candidates = NULL;
+	unsigned nr_candidates = 0;
+	if (find_indexed_secrets(index, secrets, kind, local_id, remote_id, asym,
+				 &candidates, &nr_candidates)) {
+		dbg("searching %u of the secrets indexed by ID", nr_candidates);
+		for (unsigned c = 0; c < nr_candidates; c++) {
+			match_secret(candidates[c], kind, local_id, remote_id, asym,
+				     &best_match, &best);
+		}
+		pfreeany(candidates);
+	} else {
+		for (struct secret *s = secrets; s != NULL; s = s->next) {
+			match_secret(s, kind, local_id, remote_id, asym,
+				     &best_match, &best);
 		}
 	}
 
@@ -596,15 +881,32 @@ static err_t process_ppk_static_secret(struct file_lex_position *flp,
 	return ugh;
 }
 
-struct secret *lsw_get_ppk_by_id(struct secret *s, chunk_t ppk_id)
+struct secret *lsw_get_ppk_by_id(struct secret *s,
+				 const struct secret_index *index,
+				 chunk_t ppk_id)
 {
-	while (s != NULL) {
+	const struct secret *indexed = (index == NULL ? NULL : index->head);
+	while (s != NULL && s != indexed) {
 		struct secret_stuff pks = s->stuff;
 		if (pks.kind == SECRET_PPK && hunk_eq(pks.ppk_id, ppk_id))
 			return s;
 		s = s->next;
 	}
-	return NULL;
+	if (indexed == NULL) {
+		return NULL;
+	}
+
+	/* first in list */
+	hash_t hash = hash_hunk(ppk_id, zero_hash);
+	struct secret *best = NULL;
+	for (struct secret_index_entry *e = index->by_ppk_id[hash.hash & (index->nr_buckets - 1)];
+	     e != NULL; e = e->next) {
+		if (hunk_eq(e->secret->stuff.ppk_id, ppk_id) &&
+		    (best == NULL || e->secret->position < best->position)) {
+			best = e->secret;
+		}
+	}
+	return best;
 }
 
 static SECKEYPrivateKey *copy_private_key(SECKEYPrivateKey *private_key)
@@ -930,61 +1232,89 @@ static void process_secrets_file(struct file_lex_position *oflp,
 	globfree(&globbuf);
 }
 
-void lsw_free_preshared_secrets(struct secret **psecrets, struct logger *logger)
+static void free_secrets(struct secret **psecrets)
+{
+	struct secret *s, *ns;
+	for (s = *psecrets; s != NULL; s = ns) {
+		struct id_list *i, *ni;
+
+		ns = s->next;	/* grab before freeing s */
+		for (i = s->ids; i != NULL; i = ni) {
+			ni = i->next;	/* grab before freeing i */
+			free_id_content(&i->id);
+			pfree(i);
+		}
+		switch (s->stuff.kind) {
+		case SECRET_PSK:
+			pfree(s->stuff.u.preshared_secret.ptr);
+			break;
+		case SECRET_PPK:
+			pfree(s->stuff.ppk.ptr);
+			pfree(s->stuff.ppk_id.ptr);
+			break;
+		case SECRET_XAUTH:
+			pfree(s->stuff.u.preshared_secret.ptr);
+			break;
+		case SECRET_RSA:
+		case SECRET_ECDSA:
+			/* Note: pub is all there is */
+			SECKEY_DestroyPrivateKey(s->stuff.u.pubkey.private_key);
+			s->stuff.u.pubkey.content.type->free_pubkey_content(&s->stuff.u.pubkey.content);
+			break;
+		default:
+			bad_case(s->stuff.kind);
+		}
+		pfree(s);
+	}
+	*psecrets = NULL;
+}
+
+void lsw_free_preshared_secrets(struct secret **psecrets,
+				struct secret_index **pindex,
+				struct logger *logger)
 {
 	lock_certs_and_keys("free_preshared_secrets");
 
 	if (*psecrets != NULL) {
-		struct secret *s, *ns;
-
 		llog(RC_LOG, logger, "forgetting secrets");
-
-		for (s = *psecrets; s != NULL; s = ns) {
-			struct id_list *i, *ni;
-
-			ns = s->next;	/* grab before freeing s */
-			for (i = s->ids; i != NULL; i = ni) {
-				ni = i->next;	/* grab before freeing i */
-				free_id_content(&i->id);
-				pfree(i);
-			}
-			switch (s->stuff.kind) {
-			case SECRET_PSK:
-				pfree(s->stuff.u.preshared_secret.ptr);
-				break;
-			case SECRET_PPK:
-				pfree(s->stuff.ppk.ptr);
-				pfree(s->stuff.ppk_id.ptr);
-				break;
-			case SECRET_XAUTH:
-				pfree(s->stuff.u.preshared_secret.ptr);
-				break;
-			case SECRET_RSA:
-			case SECRET_ECDSA:
-				/* Note: pub is all there is */
-				SECKEY_DestroyPrivateKey(s->stuff.u.pubkey.private_key);
-				s->stuff.u.pubkey.content.type->free_pubkey_content(&s->stuff.u.pubkey.content);
-				break;
-			default:
-				bad_case(s->stuff.kind);
-			}
-			pfree(s);
-		}
-		*psecrets = NULL;
+		free_secrets(psecrets);
 	}
+	free_secret_index(pindex);
 
 	unlock_certs_and_keys("free_preshared_secrets");
 }
 
-void lsw_load_preshared_secrets(struct secret **psecrets, const char *secrets_file,
+/*
+ * Load the secrets into a new list and index, and only then swap
+ * them with the old ones; a lookup never sees a partial list.
+ */
+
+void lsw_load_preshared_secrets(struct secret **psecrets,
+				struct secret_index **pindex,
+				const char *secrets_file,
 				struct logger *logger)
 {
-	lsw_free_preshared_secrets(psecrets, logger);
+	if (*psecrets != NULL) {
+		llog(RC_LOG, logger, "forgetting secrets");
+	}
+
+	struct secret *secrets = NULL;
 	struct file_lex_position flp = {
 		.logger = logger,
 		.depth = 0,
 	};
-	process_secrets_file(&flp, psecrets, secrets_file);
+	process_secrets_file(&flp, &secrets, secrets_file);
+	struct secret_index *index = index_secrets(secrets);
+
+	lock_certs_and_keys("load_preshared_secrets");
+	struct secret *old_secrets = *psecrets;
+	struct secret_index *old_index = *pindex;
+	*psecrets = secrets;
+	*pindex = index;
+	unlock_certs_and_keys("load_preshared_secrets");
+
+	free_secrets(&old_secrets);
+	free_secret_index(&old_index);
 }
 
 struct pubkey *pubkey_addref_where(struct pubkey *pk, where_t where)
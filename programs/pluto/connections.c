@@ -101,6 +101,7 @@
 #include "routing.h"
 #include "timescale.h"
 #include "connection_event.h"
+#include "pubkey_db.h"
 
 static void discard_connection(struct connection **cp, bool connection_valid);
 
@@ -1328,11 +1329,14 @@ diag_t add_end_cert_and_preload_private_key(CERTCertificate *cert,
 	}
 
 	dbg("loading %s certificate \'%s\' pubkey", leftright, nickname);
-	if (!add_pubkey_from_nss_cert(&pluto_pubkeys, &host_end->id, cert, logger)) {
+	struct pubkey_list *pubkeys = NULL;
+	if (!add_pubkey_from_nss_cert(&pubkeys, &host_end->id, cert, logger)) {
 		/* XXX: push diag_t into add_pubkey_from_nss_cert()? */
+		free_public_keys(&pubkeys);
 		return diag("%s certificate \'%s\' pubkey could not be loaded",
 			    leftright, nickname);
 	}
+	replace_pluto_pubkeys(&pubkeys);
 
 	host_end_config->cert.nss_cert = cert;
 
@@ -32,13 +32,18 @@
  *
  * The main thread appends to these lists (with everything locked).
  *
- * The fetch thread traverses these lists.  While traversing these
- * structures the lock is held.  However once it reaches a node it
- * releases the lock (it then re-claims it when traversal is resumed).
+ * The fetch threads traverse these lists.  While traversing these
+ * structures the lock is held.  However once a thread claims a node
+ * (marking it BUSY) it releases the lock (it then re-claims it when
+ * the fetch is finished).  Only the thread that claimed the node
+ * can remove it.
  *
- * This means that, while the fetch thread is processing a node
+ * This means that, while a fetch thread is processing a node
  * (distribution point), the lists can be growing.  Hence the
  * volatile's sprinkled across this code.
+ *
+ * Each time requests are submitted, every node is marked PENDING so
+ * that the next idle thread will (re)try it.
  */
 
 struct crl_distribution_point {
@@ -51,6 +56,8 @@ struct crl_fetch_queue {
 	chunk_t issuer_dn;
 	struct crl_distribution_point *volatile distribution_points;
 	int trials;
+	bool pending;	/* waiting for a fetch thread */
+	bool busy;	/* a fetch thread is processing it */
 	struct logger *logger;
 	struct crl_fetch_queue *volatile next;
 };
@@ -183,8 +190,12 @@ void submit_crl_fetch_requests(struct crl_fetch_request **requests, struct logge
 			*entry = clone_thing(new_entry, "crl entry");
 		}
 	}
-	dbg("CRL: poke the sleeping dragon (fetch thread)");
-	pthread_cond_signal(&crl_queue_cond);
+	/* (re)try everything, including earlier failures */
+	for (struct crl_fetch_queue *entry = crl_fetch_queue; entry != NULL; entry = entry->next) {
+		entry->pending = true;
+	}
+	dbg("CRL: poke the sleeping dragons (fetch threads)");
+	pthread_cond_broadcast(&crl_queue_cond);
 	pthread_mutex_unlock(&crl_queue_mutex);
 
 	/* clean up */
@@ -267,51 +278,57 @@ void process_crl_fetch_requests(fetch_crl_fn *fetch_crl, struct logger *unused_l
 {
 	pthread_mutex_lock(&crl_queue_mutex);
 	while (!exiting_pluto) {
-		/* if there's something process it */
-		dbg("CRL: the sleeping dragon awakes");
-		unsigned requests_processed = 0;
-		for (struct crl_fetch_queue *volatile *volatile reqp = &crl_fetch_queue;
-		     *reqp != NULL && !exiting_pluto; ) {
-			requests_processed++;
-			struct crl_fetch_queue *req = *reqp;
-			pexpect(req->distribution_points != NULL);
-			bool fetched = false;
-			for (struct crl_distribution_point *volatile dp = req->distribution_points;
-			     dp != NULL && !fetched && !exiting_pluto; dp = dp->next) {
-				/*
-				 * While fetching unlock the QUEUE.
-				 *
-				 * While the table is unlocked, the
-				 * main thread can append to either
-				 * crl_fetch_request list, or its
-				 * crl_distribution_point list.
-				 */
-				dbg("CRL:   unlocking crl queue");
-				pthread_mutex_unlock(&crl_queue_mutex);
-				dn_buf dnb;
-				dbg("CRL:     fetching: %s",
-				    str_dn(ASN1(req->issuer_dn), &dnb));
-				if (fetch_crl(req->issuer_dn, dp->url, req->logger)) {
-					fetched = true;
-				}
-				dbg("CRL:   locked crl queue");
-				pthread_mutex_lock(&crl_queue_mutex);
+		/* if there's something, claim it */
+		struct crl_fetch_queue *req;
+		for (req = crl_fetch_queue; req != NULL; req = req->next) {
+			if (req->pending && !req->busy) {
+				break;
 			}
-			if (fetched) {
-				*reqp = req->next;
-				free_crl_fetch_request(&req);
-			} else {
-				req->trials++;
-				reqp = &req->next;
+		}
+		if (req == NULL) {
+			dbg("CRL: nothing pending, the dragon sleeps");
+			int status = pthread_cond_wait(&crl_queue_cond, &crl_queue_mutex);
+			passert(status == 0);
+			dbg("CRL: the sleeping dragon awakes");
+			continue;
+		}
+		req->pending = false;
+		req->busy = true;
+		pexpect(req->distribution_points != NULL);
+		bool fetched = false;
+		for (struct crl_distribution_point *volatile dp = req->distribution_points;
+		     dp != NULL && !fetched && !exiting_pluto; dp = dp->next) {
+			/*
+			 * While fetching unlock the QUEUE.
+			 *
+			 * While the table is unlocked, the main
+			 * thread can append to either
+			 * crl_fetch_request list, or its
+			 * crl_distribution_point list; and other
+			 * fetch threads can claim other requests.
+			 */
+			dbg("CRL:   unlocking crl queue");
+			pthread_mutex_unlock(&crl_queue_mutex);
+			dn_buf dnb;
+			dbg("CRL:     fetching: %s",
+			    str_dn(ASN1(req->issuer_dn), &dnb));
+			if (fetch_crl(req->issuer_dn, dp->url, req->logger)) {
+				fetched = true;
 			}
+			dbg("CRL:   locked crl queue");
+			pthread_mutex_lock(&crl_queue_mutex);
 		}
-		if (exiting_pluto) {
-			break;
+		req->busy = false;
+		if (fetched) {
+			struct crl_fetch_queue *volatile *reqp;
+			for (reqp = &crl_fetch_queue; *reqp != req; reqp = &(*reqp)->next) {
+				passert(*reqp != NULL);
+			}
+			*reqp = req->next;
+			free_crl_fetch_request(&req);
+		} else {
+			req->trials++;
 		}
-		dbg("CRL: %u requests processed, the dragon sleeps",
-		    requests_processed);
-		int status = pthread_cond_wait(&crl_queue_cond, &crl_queue_mutex);
-		passert(status == 0);
 	}
 	pthread_mutex_unlock(&crl_queue_mutex);
 }
@@ -341,9 +358,10 @@ void list_crl_fetch_requests(struct show *s, bool utc)
 			show_blank(s);
 			for (struct crl_fetch_queue *req = crl_fetch_queue; req != NULL; req = req->next) {
 				realtime_buf rtb;
-				show_comment(s, "%s, trials: %d",
+				show_comment(s, "%s, trials: %d%s",
 					     str_realtime(req->request_time, utc, &rtb),
-					     req->trials);
+					     req->trials,
+					     (req->busy ? ", fetching" : ""));
 				dn_buf buf;
 				show_comment(s, "       issuer:  '%s'",
 					     str_dn(ASN1(req->issuer_dn), &buf));
@@ -357,7 +375,7 @@ void list_crl_fetch_requests(struct show *s, bool utc)
 void free_crl_queue(void)
 {
 	pexpect(exiting_pluto);
-	/* technical overkill - thread is dead */
+	/* technical overkill - threads are dead */
 	pthread_mutex_lock(&crl_queue_mutex);
 	{
 		while (crl_fetch_queue != NULL) {
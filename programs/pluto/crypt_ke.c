@@ -53,12 +53,56 @@
 #include "ike_alg.h"
 #include "crypt_dh.h"
 #include "crypt_ke.h"
+#include "show.h"
+#include "server.h"		/* for schedule_timeout() */
+
+/*
+ * Pools of pre-computed KE (DH/ECDH local secret) and nonce values.
+ *
+ * A local secret is only ever used once so, rather than compute one
+ * each time an SA needs it, the helpers compute them in the
+ * background, when they have nothing better to do, and park them in
+ * a per-group pool.  A request that finds its pool non-empty skips
+ * the helper round trip (and keypair generation) entirely.
+ *
+ * A pool is created the first time its group is used.  Its target
+ * size follows demand: it doubles each time a request finds the pool
+ * empty and, driven by a timer so that it also happens when requests
+ * stop altogether, halves when there's been no such miss for
+ * KE_POOL_DECAY_SECONDS; entries above the new target are then
+ * released.
+ */
+
+#define KE_POOL_MAX 32
+#define KE_POOL_DECAY_SECONDS 60
+
+struct ke_pool {
+	const struct dh_desc *dh;
+	struct ke_pool_entry {
+		struct dh_local_secret *local_secret;
+		chunk_t nonce;
+	} entries[KE_POOL_MAX];
+	unsigned nr_entries;
+	unsigned target;
+	unsigned refilling;	/* background jobs outstanding */
+	monotime_t last_miss;
+	struct timeout *decay;	/* while there's a target or entries */
+	/* statistics */
+	uintmax_t hits;
+	uintmax_t misses;
+	uintmax_t refills;
+	uintmax_t discards;
+	struct ke_pool *next;
+};
+
+static struct ke_pool *ke_pools;
 
 struct task {
 	const struct dh_desc *dh;
 	chunk_t nonce;
 	struct dh_local_secret *local_secret;
 	ke_and_nonce_cb *cb;
+	struct ke_pool *pool;	/* background refill */
 };
 
 static void compute_ke_and_nonce(struct logger *logger,
@@ -102,13 +146,179 @@ static const struct task_handler ke_and_nonce_handler = {
 	.completed_cb = complete_ke_and_nonce,
 };
 
+/*
+ * Refilling a pool (in the background).
+ */
+
+static stf_status complete_ke_pool_refill(struct state *unused_st UNUSED,
+					  struct msg_digest *unused_md UNUSED,
+					  struct task *task)
+{
+	struct ke_pool *pool = task->pool;
+	passert(pool->refilling > 0);
+	pool->refilling--;
+	if (pool->nr_entries < pool->target &&
+	    pool->nr_entries < KE_POOL_MAX) {
+		struct ke_pool_entry *entry = &pool->entries[pool->nr_entries++];
+		entry->local_secret = task->local_secret;
+		entry->nonce = task->nonce;
+		task->local_secret = NULL;
+		task->nonce = empty_chunk;
+		pool->refills++;
+	}
+	/* else demand has dropped; cleanup throws it away */
+	return STF_OK;
+}
+
+static const struct task_handler ke_pool_refill_handler = {
+	.name = "dh pool",
+	.cleanup_cb = cleanup_ke_and_nonce,
+	.computer_fn = compute_ke_and_nonce,
+	.completed_cb = complete_ke_pool_refill,
+};
+
+static void refill_ke_pool(struct ke_pool *pool)
+{
+	while (pool->nr_entries + pool->refilling < pool->target) {
+		struct task *task = alloc_thing(struct task, "dh pool");
+		task->dh = pool->dh;
+		task->pool = pool;
+		if (!submit_background_task(&global_logger, task,
+					    &ke_pool_refill_handler, HERE)) {
+			/* no helpers; nothing to be gained */
+			pfree(task);
+			pool->target = 0;
+			return;
+		}
+		pool->refilling++;
+	}
+}
+
+/*
+ * Demand has dropped; release the entries above the target.
+ */
+
+static void trim_ke_pool(struct ke_pool *pool)
+{
+	while (pool->nr_entries > pool->target) {
+		struct ke_pool_entry *entry = &pool->entries[--pool->nr_entries];
+		dh_local_secret_delref(&entry->local_secret, HERE);
+		free_chunk_content(&entry->nonce);
+		zero(entry);
+		pool->discards++;
+	}
+}
+
+static void decay_ke_pool(void *arg, const struct timer_event *event UNUSED);
+
+static void schedule_ke_pool_decay(struct ke_pool *pool)
+{
+	if (pool->decay == NULL &&
+	    (pool->target > 0 || pool->nr_entries > 0)) {
+		schedule_timeout("ke pool decay", &pool->decay,
+				 deltatime(KE_POOL_DECAY_SECONDS),
+				 decay_ke_pool, pool);
+	}
+}
+
+static void decay_ke_pool(void *arg, const struct timer_event *event UNUSED)
+{
+	struct ke_pool *pool = arg;
+	destroy_timeout(&pool->decay);
+	const monotime_t now = mononow();
+	if (deltasecs(monotimediff(now, pool->last_miss)) >= KE_POOL_DECAY_SECONDS) {
+		pool->target /= 2;
+		pool->last_miss = now; /* restart decay */
+		trim_ke_pool(pool);
+	}
+	schedule_ke_pool_decay(pool);
+}
+
+static struct ke_pool *ke_pool(const struct dh_desc *dh)
+{
+	for (struct ke_pool *pool = ke_pools; pool != NULL; pool = pool->next) {
+		if (pool->dh == dh) {
+			return pool;
+		}
+	}
+	struct ke_pool *pool = alloc_thing(struct ke_pool, "dh pool");
+	pool->dh = dh;
+	pool->next = ke_pools;
+	ke_pools = pool;
+	return pool;
+}
+
+/*
+ * Take a pre-computed KE and nonce from DH's pool; adjust the pool's
+ * target and top it up.
+ */
+
+static bool take_ke_and_nonce(const struct dh_desc *dh, struct task *task)
+{
+	struct ke_pool *pool = ke_pool(dh);
+	const monotime_t now = mononow();
+	bool hit = (pool->nr_entries > 0);
+	if (hit) {
+		struct ke_pool_entry *entry = &pool->entries[--pool->nr_entries];
+		task->local_secret = entry->local_secret;
+		task->nonce = entry->nonce;
+		zero(entry);
+		pool->hits++;
+	} else {
+		pool->misses++;
+		pool->last_miss = now;
+		pool->target = (pool->target == 0 ? 1 :
+				min(pool->target * 2, (unsigned)KE_POOL_MAX));
+	}
+	refill_ke_pool(pool);
+	schedule_ke_pool_decay(pool);
+	return hit;
+}
+
 void submit_ke_and_nonce(struct state *st, const struct dh_desc *dh,
 			 ke_and_nonce_cb *cb, where_t where)
 {
 	struct task *task = alloc_thing(struct task, "dh");
 	task->dh = dh;
 	task->cb = cb;
-	submit_task(st->st_logger, st, task, &ke_and_nonce_handler, where);
+	if (dh == NULL) {
+		/* just a nonce; cheap */
+		task->nonce = alloc_rnd_chunk(DEFAULT_NONCE_SIZE, "nonce");
+		submit_completed_task(st->st_logger, st, task, &ke_and_nonce_handler, where);
+	} else if (take_ke_and_nonce(dh, task)) {
+		dbg("using pre-computed %s KE and nonce", dh->common.fqn);
+		submit_completed_task(st->st_logger, st, task, &ke_and_nonce_handler, where);
+	} else {
+		submit_task(st->st_logger, st, task, &ke_and_nonce_handler, where);
+	}
+}
+
+void show_ke_pool_status(struct show *s)
+{
+	for (struct ke_pool *pool = ke_pools; pool != NULL; pool = pool->next) {
+		const char *name = pool->dh->common.fqn;
+		show_raw(s, "current.ke_pool.%s.ready=%u", name, pool->nr_entries);
+		show_raw(s, "current.ke_pool.%s.target=%u", name, pool->target);
+		show_raw(s, "total.ke_pool.%s.hits=%ju", name, pool->hits);
+		show_raw(s, "total.ke_pool.%s.misses=%ju", name, pool->misses);
+		show_raw(s, "total.ke_pool.%s.refills=%ju", name, pool->refills);
+		show_raw(s, "total.ke_pool.%s.discards=%ju", name, pool->discards);
+	}
+}
+
+void free_ke_pools(void)
+{
+	while (ke_pools != NULL) {
+		struct ke_pool *pool = ke_pools;
+		ke_pools = pool->next;
+		destroy_timeout(&pool->decay);
+		for (unsigned i = 0; i < pool->nr_entries; i++) {
+			struct ke_pool_entry *entry = &pool->entries[i];
+			dh_local_secret_delref(&entry->local_secret, HERE);
+			free_chunk_content(&entry->nonce);
+		}
+		pfree(pool);
+	}
 }
 
 /*
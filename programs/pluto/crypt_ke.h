@@ -33,11 +33,18 @@ typedef stf_status (ke_and_nonce_cb)(struct state *st, struct msg_digest *md,
 
 /*
  * When DH is non-null, compute do_local_secret.  Compute nonce.
+ *
+ * When DH's pool of pre-computed values is non-empty, the result is
+ * taken from that and CB is resumed without a helper round trip.
  */
 
 void submit_ke_and_nonce(struct state *st, const struct dh_desc *dh,
 			 ke_and_nonce_cb *cb, where_t where);
 
+struct show;
+void show_ke_pool_status(struct show *s);
+void free_ke_pools(void);
+
 /*
  * KE and NONCE
  */
@@ -71,6 +71,7 @@
 #include "ikev1_send.h"
 #include "ikev2_send.h"
 #include "iface.h"
+#include "server.h"		/* for pluto_sock_batch */
 #include "impair_message.h"
 #include "log_limiter.h"
 
@@ -248,6 +249,44 @@ void process_md(struct msg_digest *md)
 
 static bool impair_incoming(struct msg_digest *md);
 
+static void process_packet_md(struct msg_digest **mdp, threadtime_t md_start)
+{
+	struct msg_digest *md = *mdp;
+
+	if (DBGP(DBG_BASE)) {
+		endpoint_buf sb;
+		endpoint_buf lb;
+		DBG_log("*received %d bytes from %s on %s %s using %s",
+			(int) pbs_room(&md->packet_pbs),
+			str_endpoint(&md->sender, &sb),
+			md->iface->ip_dev->id_rname,
+			str_endpoint(&md->iface->local_endpoint, &lb),
+			md->iface->io->protocol->name);
+		DBG_dump(NULL, md->packet_pbs.start, pbs_room(&md->packet_pbs));
+	}
+
+	pstats_ike_bytes.in += pbs_room(&md->packet_pbs);
+
+	md->md_inception = md_start;
+	if (!impair_incoming(md)) {
+		/*
+		 * If this needs to hang onto MD it will save a
+		 * reference (aka addref), and the below won't delete
+		 * MD.
+		 */
+		process_md(md);
+	}
+	md_delref(mdp);
+	pexpect(*mdp == NULL);
+}
+
+static void count_iface_packets(unsigned nr_packets)
+{
+	pstats_ike_recv.wakeups++;
+	pstats_ike_recv.datagrams += nr_packets;
+	pstats_batch_add(&pstats_ike_recv.batch, nr_packets);
+}
+
 void process_iface_packet(int fd, void *ifp_arg, struct logger *logger)
 {
 	struct iface_endpoint *ifp = ifp_arg;
@@ -258,6 +297,29 @@ void process_iface_packet(int fd, void *ifp_arg, struct logger *logger)
 
 	threadtime_t md_start = threadtime_start();
 
+	if (pluto_sock_batch > 1 && ifp->io->read_packets != NULL) {
+		/*
+		 * Drain several packets in one go.  Each MD holds a
+		 * reference to IFP so processing one packet can't
+		 * pull the interface out from under the next.
+		 */
+		struct msg_digest *mds[IKE_SOCKET_BATCH_MAX];
+		unsigned nr_mds = ifp->io->read_packets(ifp, mds,
+							min(pluto_sock_batch,
+							    (unsigned)elemsof(mds)),
+							logger);
+		count_iface_packets(nr_mds);
+		for (unsigned i = 0; i < nr_mds; i++) {
+			if (mds[i] != NULL) {
+				process_packet_md(&mds[i], md_start);
+			}
+		}
+		threadtime_stop(&md_start, SOS_NOBODY,
+				"%s() reading and processing %u packets",
+				__func__, nr_mds);
+		return;
+	}
+
 	/*
 	 *
 	 * Read the message into a message digest.
@@ -269,34 +331,10 @@ void process_iface_packet(int fd, void *ifp_arg, struct logger *logger)
 	 * zapped.
 	 */
 	struct msg_digest *md = ifp->io->read_packet(&ifp, logger);
+	count_iface_packets(md != NULL ? 1 : 0);
 
 	if (md != NULL) {
-
-		if (DBGP(DBG_BASE)) {
-			endpoint_buf sb;
-			endpoint_buf lb;
-			DBG_log("*received %d bytes from %s on %s %s using %s",
-				(int) pbs_room(&md->packet_pbs),
-				str_endpoint(&md->sender, &sb),
-				md->iface->ip_dev->id_rname,
-				str_endpoint(&md->iface->local_endpoint, &lb),
-				md->iface->io->protocol->name);
-			DBG_dump(NULL, md->packet_pbs.start, pbs_room(&md->packet_pbs));
-		}
-
-		pstats_ike_bytes.in += pbs_room(&md->packet_pbs);
-
-		md->md_inception = md_start;
-		if (!impair_incoming(md)) {
-			/*
-			 * If this needs to hang onto MD it will save
-			 * a reference (aka addref), and the below
-			 * won't delete MD.
-			 */
-			process_md(md);
-		}
-		md_delref(&md);
-		pexpect(md == NULL);
+		process_packet_md(&md, md_start);
 	}
 
 	threadtime_stop(&md_start, SOS_NOBODY,
@@ -534,4 +572,5 @@ void shutdown_demux(void)
 		remove_list_entry(&e->entry);
 		pfreeany(e);
 	}
+	free_md_pool();
 }
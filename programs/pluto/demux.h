@@ -33,6 +33,7 @@
 
 struct state;   /* forward declaration of tag */
 struct iface_endpoint;
+struct show;
 struct logger;
 
 /*
@@ -157,6 +158,8 @@ struct msg_digest {
 	bool ikev2;				/* Peer supports IKEv2 */
 	bool fragvid;				/* (v1) Peer supports FRAGMENTATION */
 	bool fake_clone;			/* is this a fake (clone) message */
+	bool pooled;				/* from (and returned to) the md pool */
+	unsigned pool_class;			/* when pooled */
 	unsigned v2_frags_total;		/* total fragments */
 
 	/*
@@ -232,6 +235,9 @@ extern struct msg_digest *alloc_md(struct iface_endpoint *ifp,
 				   const ip_endpoint *sender,
 				   const uint8_t *packet, size_t packet_len,
 				   where_t where);
+
+void show_md_pool_status(struct show *s);
+void free_md_pool(void);
 struct msg_digest *md_addref_where(struct msg_digest *md, where_t where);
 #define md_addref(MD) md_addref_where(MD, HERE)
 void md_delref_where(struct msg_digest **mdp, where_t where);
@@ -46,10 +46,102 @@
 #include "server.h"
 #include "lswnss.h"			/* for llog_nss_error() */
 #include "pluto_shutdown.h"		/* for exiting_pluto */
+#include "show.h"
+#include "pubkey_db.h"
 
 #define FETCH_CMD_TIMEOUT       5       /* seconds */
+#define FETCH_BACKOFF		deltatime(30)	/* after the first failure */
 
-static pthread_t fetch_thread_id;
+static pthread_t *fetch_thread_ids;	/* crl_fetch_threads */
+
+/*
+ * What is known about each distribution point (URL), kept for the
+ * life of pluto.
+ *
+ * The validators (ETag, Last-Modified) of the last imported CRL are
+ * sent with the next fetch so that an unchanged CRL isn't downloaded
+ * and imported again.  But only while NSS still has a current CRL
+ * from the issuer: once it has expired, or been purged (--purgecrls),
+ * a "not modified" answer would leave it missing forever.
+ *
+ * A URL that fails is skipped until RETRY_AFTER; the delay doubles
+ * with each consecutive failure, up to crlcheckinterval.
+ *
+ * Several fetch threads can be updating this at once, hence the
+ * mutex.
+ */
+
+struct crl_source {
+	char *url;
+	/* validators */
+	char *etag;		/* NULL when unknown */
+	long last_modified;	/* -1 when unknown */
+	/* backoff */
+	unsigned failures;	/* consecutive */
+	realtime_t retry_after;
+	/* stats */
+	unsigned fetches;
+	unsigned not_modified;
+	unsigned errors;
+	uintmax_t bytes;	/* total */
+	size_t last_bytes;
+	realtime_t last_time;
+	deltatime_t last_duration;
+	struct crl_source *next;
+};
+
+static pthread_mutex_t crl_source_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct crl_source *crl_sources;
+
+/* caller holds the lock; the source is never freed while pluto runs */
+static struct crl_source *crl_source(const char *url)
+{
+	struct crl_source **sp;
+	for (sp = &crl_sources; *sp != NULL; sp = &(*sp)->next) {
+		if (streq((*sp)->url, url)) {
+			return *sp;
+		}
+	}
+	struct crl_source new_source = {
+		.url = clone_str(url, "crl source url"),
+		.last_modified = -1,
+	};
+	*sp = clone_thing(new_source, "crl source");
+	return *sp;
+}
+
+/* caller holds the lock */
+static void forget_crl_validators(struct crl_source *source)
+{
+	pfreeany(source->etag);
+	source->last_modified = -1;
+}
+
+/* caller holds the lock */
+static void backoff_crl_source(struct crl_source *source)
+{
+	source->errors++;
+	source->failures++;
+	deltatime_t backoff = FETCH_BACKOFF;
+	for (unsigned f = 1; f < source->failures &&
+		     deltatime_cmp(backoff, <, crl_check_interval); f++) {
+		backoff = deltatime_mulu(backoff, 2);
+	}
+	backoff = deltatime_min(backoff, crl_check_interval);
+	source->retry_after = realtimesum(realnow(), backoff);
+}
+
+/*
+ * The result of a fetch: either a new blob, or NOT_MODIFIED.  When
+ * known, the blob's validators are returned as well.
+ */
+
+struct fetch_result {
+	chunk_t blob;
+	bool not_modified;
+	char *etag;		/* must free */
+	long last_modified;
+};
 
 #ifdef LIBCURL
 
@@ -79,13 +171,44 @@ static size_t write_buffer(void *ptr, size_t size, size_t nmemb, void *data)
 }
 
 /*
- * fetches a binary blob from a url with libcurl
+ * Saves the value of an ETag: header into (char **)data.
+ * A call-back used with libcurl.
  */
-static err_t fetch_curl(const char *url, chunk_t *blob, struct logger *logger)
+static size_t save_etag(char *ptr, size_t size, size_t nitems, void *data)
+{
+	size_t len = size * nitems;
+	char **etag = data;
+	static const char etag_header[] = "ETag:";
+	size_t hlen = sizeof(etag_header) - 1;
+
+	if (len > hlen && strncasecmp(ptr, etag_header, hlen) == 0) {
+		const char *start = ptr + hlen;
+		const char *end = ptr + len;
+		while (start < end && char_isblank(*start)) {
+			start++;
+		}
+		while (end > start && char_isspace(end[-1])) {
+			end--;
+		}
+		pfreeany(*etag);
+		if (end > start) {
+			*etag = clone_hunk_as_string(shunk2(start, end - start), "etag");
+		}
+	}
+	return len;
+}
+
+/*
+ * fetches a binary blob from a url with libcurl; when VALIDATORS are
+ * known, only if it has changed
+ */
+static err_t fetch_curl(const char *url, const struct fetch_result *validators,
+			struct fetch_result *result, struct logger *logger)
 {
 	char errorbuffer[CURL_ERROR_SIZE] = "?";
 	chunk_t response = EMPTY_CHUNK;	/* managed by realloc/free */
 	long timeout = curl_timeout > 0 ? curl_timeout : FETCH_CMD_TIMEOUT;
+	struct curl_slist *headers = NULL;
 
 	/* get it with libcurl */
 	CURL *curl = curl_easy_init();
@@ -122,20 +245,51 @@ static err_t fetch_curl(const char *url, chunk_t *blob, struct logger *logger)
 	if (curl_iface != NULL)
 		CESO(CURLOPT_INTERFACE, curl_iface);
 
+	/* collect the validators; send any from the last fetch */
+	CESO(CURLOPT_HEADERFUNCTION, save_etag);
+	CESO(CURLOPT_HEADERDATA, (void *)&result->etag);
+	CESO(CURLOPT_FILETIME, 1L);
+	if (validators->last_modified >= 0) {
+		CESO(CURLOPT_TIMECONDITION, (long)CURL_TIMECOND_IFMODSINCE);
+		CESO(CURLOPT_TIMEVALUE, validators->last_modified);
+	}
+	if (validators->etag != NULL) {
+		char *if_none_match = alloc_printf("If-None-Match: %s", validators->etag);
+		headers = curl_slist_append(headers, if_none_match);
+		pfree(if_none_match);
+		if (headers == NULL) {
+			res = CURLE_OUT_OF_MEMORY;
+		}
+		CESO(CURLOPT_HTTPHEADER, headers);
+	}
+
 #	undef CESO
 
 	if (res == CURLE_OK)
 		res = curl_easy_perform(curl);
 
 	if (res == CURLE_OK) {
-		/* clone from realloc(3)ed memory to pluto-allocated memory */
 		errorbuffer[0] = '\0';
-		*blob = clone_hunk(response, "curl blob");
+		long code = 0;
+		long unmet = 0;
+		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+		curl_easy_getinfo(curl, CURLINFO_CONDITION_UNMET, &unmet);
+		if (code == 304 || unmet) {
+			dbg("CRL: %s not modified", url);
+			result->not_modified = true;
+		} else {
+			/* clone from realloc(3)ed memory to pluto-allocated memory */
+			result->blob = clone_hunk(response, "curl blob");
+			long filetime = -1;
+			curl_easy_getinfo(curl, CURLINFO_FILETIME, &filetime);
+			result->last_modified = filetime;
+		}
 	} else {
 		llog(RC_LOG, logger,
 		     "fetching uri (%s) with libcurl failed: %s", url, errorbuffer);
 	}
 	curl_easy_cleanup(curl);
+	curl_slist_free_all(headers);
 
 	/* ??? where/how should this be logged? */
 	if (errorbuffer[0] != '\0') {
@@ -152,7 +306,9 @@ static err_t fetch_curl(const char *url, chunk_t *blob, struct logger *logger)
 #else	/* LIBCURL */
 
 static err_t fetch_curl(const char *url UNUSED,
-			chunk_t *blob UNUSED)
+			const struct fetch_result *validators UNUSED,
+			struct fetch_result *result UNUSED,
+			struct logger *logger UNUSED)
 {
 	return "not compiled with libcurl support";
 }
@@ -305,23 +461,29 @@ static err_t fetch_ldap_url(const char *url UNUSED,
 /*
  * fetch an ASN.1 blob coded in PEM or DER format from a URL
  * Returns error message or NULL.
- * Iff no error, *blob contains fetched ASN.1 blob (to be freed by caller).
+ * Iff no error, RESULT contains either the fetched ASN.1 blob or
+ * NOT_MODIFIED (to be freed by caller).
  */
 
-static err_t fetch_asn1_blob(const char *url, chunk_t *blob, struct logger *logger)
+static err_t fetch_asn1_blob(const char *url, const struct fetch_result *validators,
+			     struct fetch_result *result, struct logger *logger)
 {
 	err_t ugh = NULL;
+	chunk_t *blob = &result->blob;
 
 	*blob = EMPTY_CHUNK;
 	if (startswith(url, "ldap:")) {
 		ugh = fetch_ldap_url(url, blob, logger);
 	} else {
-		ugh = fetch_curl(url, blob, logger);
+		ugh = fetch_curl(url, validators, result, logger);
 	}
 	if (ugh != NULL) {
 		free_chunk_content(blob);
 		return ugh;
 	}
+	if (result->not_modified) {
+		return NULL;
+	}
 
 	ugh = asn1_ok(ASN1(*blob));
 	if (ugh == NULL) {
@@ -365,6 +527,33 @@ static bool insert_crl_nss(chunk_t blob, chunk_t issuer, const char *url, struct
 	return ret;
 }
 
+/*
+ * Does NSS have a CRL, that hasn't expired, from ISSUER_DN?
+ */
+
+static bool have_current_crl(chunk_t issuer_dn)
+{
+	if (issuer_dn.len == 0) {
+		return false;
+	}
+	CERTCertDBHandle *handle = CERT_GetDefaultCertDB();
+	CERTCrlHeadNode *crl_list = NULL;
+	if (SEC_LookupCrls(handle, &crl_list, SEC_CRL_TYPE) != SECSuccess) {
+		return false;
+	}
+	bool current = false;
+	SECItem issuer = same_chunk_as_secitem(issuer_dn, siBuffer);
+	for (CERTCrlNode *n = crl_list->first; n != NULL; n = n->next) {
+		if (n->crl != NULL &&
+		    SECITEM_ItemsAreEqual(&issuer, &n->crl->crl.derName)) {
+			current = (SEC_CheckCrlTimes(&n->crl->crl, PR_Now()) != secCertTimeExpired);
+			break;
+		}
+	}
+	PORT_FreeArena(crl_list->arena, PR_FALSE);
+	return current;
+}
+
 /*
  * try to fetch the crls defined by the fetch requests
  */
@@ -378,18 +567,112 @@ static bool fetch_crl(chunk_t issuer_dn, const char *url, struct logger *logger)
 		return false;
 	}
 
-	chunk_t blob = empty_chunk; /* must free */
-	err_t ugh = fetch_asn1_blob(url, &blob, logger);
+	/*
+	 * Skip a URL that is backing off; grab the validators of
+	 * the last import (unless that CRL is no longer usable).
+	 */
+	bool current = have_current_crl(issuer_dn);
+	struct fetch_result validators = { .last_modified = -1, };
+	pthread_mutex_lock(&crl_source_mutex);
+	struct crl_source *source = crl_source(url);
+	bool backing_off = realtime_cmp(realnow(), <, source->retry_after);
+	unsigned failures = source->failures;
+	if (!current) {
+		/* fetch unconditionally */
+		forget_crl_validators(source);
+	}
+	if (!backing_off) {
+		validators.etag = clone_str(source->etag, "etag");
+		validators.last_modified = source->last_modified;
+	}
+	pthread_mutex_unlock(&crl_source_mutex);
+	if (backing_off) {
+		dbg("CRL: skipping %s, backing off after %u failures",
+		    url, failures);
+		return false;
+	}
+
+	struct fetch_result result = { .last_modified = -1, }; /* must free */
+	monotime_t start = mononow();
+	err_t ugh = fetch_asn1_blob(url, &validators, &result, logger);
+	deltatime_t duration = monotimediff(mononow(), start);
+	pfreeany(validators.etag);
+
+	bool ok;
 	if (ugh != NULL) {
 		dbg("CRL: fetch failed:  %s", ugh);
-		return false;
+		ok = false;
+	} else if (result.not_modified) {
+		ok = true;
+	} else {
+		ok = insert_crl_nss(result.blob, issuer_dn, url, logger);
+	}
+
+	pthread_mutex_lock(&crl_source_mutex);
+	{
+		source->fetches++;
+		source->last_time = realnow();
+		source->last_duration = duration;
+		source->last_bytes = result.blob.len;
+		source->bytes += result.blob.len;
+		if (!ok) {
+			/* next time fetch everything */
+			forget_crl_validators(source);
+			backoff_crl_source(source);
+		} else if (result.not_modified) {
+			source->not_modified++;
+			source->failures = 0;
+		} else {
+			forget_crl_validators(source);
+			source->etag = result.etag;
+			result.etag = NULL;
+			source->last_modified = result.last_modified;
+			source->failures = 0;
+		}
 	}
+	pthread_mutex_unlock(&crl_source_mutex);
 
-	bool ok = insert_crl_nss(blob, issuer_dn, url, logger);
-	free_chunk_content(&blob);
+	pfreeany(result.etag);
+	free_chunk_content(&result.blob);
 	return ok;
 }
 
+void list_crl_fetch_sources(struct show *s, bool utc)
+{
+	pthread_mutex_lock(&crl_source_mutex);
+	{
+		if (crl_sources != NULL) {
+			show_blank(s);
+			show_comment(s, "List of CRL distribution points:");
+			show_blank(s);
+			for (const struct crl_source *source = crl_sources;
+			     source != NULL; source = source->next) {
+				show_comment(s, "'%s'", source->url);
+				show_comment(s, "       fetches: %u, not modified: %u, errors: %u, bytes: %ju",
+					     source->fetches, source->not_modified,
+					     source->errors, source->bytes);
+				if (!is_realtime_epoch(source->last_time)) {
+					SHOW_JAMBUF(RC_COMMENT, s, buf) {
+						jam(buf, "       last: ");
+						jam_realtime(buf, source->last_time, utc);
+						jam(buf, ", %zu bytes in ", source->last_bytes);
+						jam_deltatime(buf, source->last_duration);
+						jam(buf, "s");
+					}
+				}
+				if (source->failures > 0) {
+					SHOW_JAMBUF(RC_COMMENT, s, buf) {
+						jam(buf, "       retry after: ");
+						jam_realtime(buf, source->retry_after, utc);
+						jam(buf, " (%u consecutive failures)", source->failures);
+					}
+				}
+			}
+		}
+	}
+	pthread_mutex_unlock(&crl_source_mutex);
+}
+
 /*
  * Submit all known CRLS for processing using
  * append_crl_fetch_request().
@@ -446,11 +729,11 @@ static void check_crls(struct logger *logger)
 	 * Add the pubkeys distribution points to fetch list.
 	 */
 
-	for (struct pubkey_list *pkl = pluto_pubkeys; pkl != NULL; pkl = pkl->next) {
-		struct pubkey *key = pkl->key;
-		if (key != NULL) {
-			add_crl_fetch_request(key->issuer, null_shunk, &requests, logger);
-		}
+	struct pubkey_filter pubkeys = {
+		.where = HERE,
+	};
+	while (next_pluto_pubkey(NEW2OLD, &pubkeys)) {
+		add_crl_fetch_request(pubkeys.key->issuer, null_shunk, &requests, logger);
 	}
 
 	/*
@@ -526,12 +809,17 @@ void start_crl_fetch_helper(struct logger *logger)
 	}
 #endif
 
-	status = pthread_create(&fetch_thread_id, NULL,
-				fetch_thread, NULL);
-	if (status != 0) {
-		fatal(PLUTO_EXIT_FAIL, logger,
-		      "could not start thread for fetching certificate, status = %d", status);
+	/* each thread fetches one CRL at a time */
+	fetch_thread_ids = alloc_things(pthread_t, crl_fetch_threads, "crl fetch threads");
+	for (unsigned t = 0; t < crl_fetch_threads; t++) {
+		status = pthread_create(&fetch_thread_ids[t], NULL,
+					fetch_thread, NULL);
+		if (status != 0) {
+			fatal(PLUTO_EXIT_FAIL, logger,
+			      "could not start thread for fetching certificate, status = %d", status);
+		}
 	}
+	dbg("CRL: started %u fetch threads", crl_fetch_threads);
 
 	if (impair.event_check_crls) {
 		llog(RC_LOG, logger, "IMPAIR: not scheduling EVENT_CHECK_CRLS");
@@ -557,18 +845,29 @@ void stop_crl_fetch_helper(struct logger *logger)
 		 */
 		llog(RC_LOG, logger, "shutting down the CRL fetch helper thread");
 		pexpect(exiting_pluto);
-		/* wake the sleeping dragon from its slumber */
+		/* wake the sleeping dragons from their slumber */
 		submit_crl_fetch_requests(NULL, logger);
 		/* use a timer? */
-		int status = pthread_join(fetch_thread_id, NULL);
-		if (status != 0) {
-			llog_error(logger, status, "problem waiting for crl fetch thread to exit");
+		for (unsigned t = 0; t < crl_fetch_threads; t++) {
+			int status = pthread_join(fetch_thread_ids[t], NULL);
+			if (status != 0) {
+				llog_error(logger, status, "problem waiting for crl fetch thread to exit");
+			}
 		}
+		pfreeany(fetch_thread_ids);
 	}
 }
 
 void free_crl_fetch(void)
 {
+	/* threads are dead */
+	while (crl_sources != NULL) {
+		struct crl_source *tbd = crl_sources;
+		crl_sources = tbd->next;
+		forget_crl_validators(tbd);
+		pfree(tbd->url);
+		pfree(tbd);
+	}
 #ifdef LIBCURL
 	if (deltasecs(crl_check_interval) > 0) {
 		/* cleanup curl */
@@ -13,10 +13,17 @@
  * for more details.
  */
 
+struct show;
+
 extern void start_crl_fetch_helper(struct logger *logger);
 extern void stop_crl_fetch_helper(struct logger *logger);
 
 extern void free_crl_fetch(void);
+extern void list_crl_fetch_sources(struct show *s, bool utc);
+
+/* number of CRLs fetched in parallel */
+#define CRL_FETCH_THREADS_MAX 64
+extern unsigned crl_fetch_threads;
 
 extern char *curl_iface;
 extern long curl_timeout;
@@ -19,35 +19,158 @@
 #include "hash_table.h"
 
 #include "log.h"
+#include "server.h"		/* for schedule_timeout() */
+#include "show.h"
 
-const hash_t zero_hash = { 0 };
+/*
+ * Grow when the average chain exceeds MAX_LOAD entries; shrink (but
+ * never below the static slots) when it drops below 1/MIN_LOAD.
+ *
+ * Each resize step, run from the event-loop, migrates
+ * REHASH_SLOTS old slots.
+ */
 
-void init_hash_table(struct hash_table *table, struct logger *logger)
+#define HASH_TABLE_MAX_LOAD 2
+#define HASH_TABLE_MIN_LOAD 4
+#define HASH_TABLE_REHASH_SLOTS 64
+
+static struct hash_table *hash_tables;
+
+static void init_slots(struct hash_table *table,
+		       struct list_head *slots, unsigned long nr_slots)
 {
-	ldbg(logger, "initialize %s hash table", table->info->name);
-	for (unsigned i = 0; i < table->nr_slots; i++) {
-		struct list_head *slot = &table->slots[i];
+	for (unsigned long i = 0; i < nr_slots; i++) {
+		struct list_head *slot = &slots[i];
 		*slot = (struct list_head) INIT_LIST_HEAD(slot, table->info);
 	}
 }
 
-hash_t hash_bytes(const void *ptr, size_t len, hash_t hash)
+void init_hash_table(struct hash_table *table, struct logger *logger)
+{
+	ldbg(logger, "initialize %s hash table", table->name);
+	init_slots(table, table->slots, table->nr_slots);
+	table->next = hash_tables;
+	hash_tables = table;
+}
+
+struct list_head *hash_table_bucket(struct hash_table *table, hash_t hash)
+{
+	if (table->old.slots != NULL) {
+		unsigned long i = hash.hash % table->old.nr_slots;
+		if (i >= table->old.cursor) {
+			/* not yet migrated */
+			return &table->old.slots[i];
+		}
+	}
+	return &table->slots[hash.hash % table->nr_slots];
+}
+
+/*
+ * Move the entries in old slot [.cursor] to the new slots.
+ *
+ * Lookups such as state_by_reqid() rely on each bucket being
+ * newest-first.  Walking the old slot OLD2NEW and inserting each
+ * entry at the front of its new bucket keeps that order.  Entries
+ * already in the new bucket can't share a hash with these (they came
+ * from other old slots) so their relative order doesn't matter.
+ */
+
+static void migrate_old_slot(struct hash_table *table)
+{
+	struct list_head *old_slot = &table->old.slots[table->old.cursor++];
+	void *data;
+	FOR_EACH_LIST_ENTRY_OLD2NEW(data, old_slot) {
+		struct list_entry *entry = table->entry(data);
+		remove_list_entry(entry);
+		/* cursor has advanced; this finds the new slot */
+		insert_list_entry(hash_table_bucket(table, table->hasher(data)), entry);
+	}
+}
+
+static void finish_resize(struct hash_table *table)
+{
+	while (table->old.cursor < table->old.nr_slots) {
+		migrate_old_slot(table);
+	}
+	if (table->old.slots != table->min_slots) {
+		pfree(table->old.slots);
+	}
+	destroy_timeout(&table->old.timeout);
+	table->old.slots = NULL;
+	table->old.nr_slots = 0;
+	table->old.cursor = 0;
+	dbg("%s hash table: resized to %lu slots holding %ld entries",
+	    table->name, table->nr_slots, table->nr_entries);
+}
+
+static void resize_hash_table(struct hash_table *table);
+
+static void resize_hash_table_step(void *arg, const struct timer_event *event UNUSED)
+{
+	struct hash_table *table = arg;
+	destroy_timeout(&table->old.timeout);
+	for (unsigned n = 0; n < HASH_TABLE_REHASH_SLOTS &&
+		     table->old.cursor < table->old.nr_slots; n++) {
+		migrate_old_slot(table);
+	}
+	if (table->old.cursor < table->old.nr_slots) {
+		schedule_timeout("resize hash table", &table->old.timeout,
+				 deltatime(0), resize_hash_table_step, table);
+		return;
+	}
+	finish_resize(table);
+	/* did things change while migrating? */
+	resize_hash_table(table);
+}
+
+static void start_resize(struct hash_table *table, unsigned long nr_slots)
 {
+	passert(table->old.slots == NULL);
+	dbg("%s hash table: resizing from %lu to %lu slots holding %ld entries",
+	    table->name, table->nr_slots, nr_slots, table->nr_entries);
+	table->old.slots = table->slots;
+	table->old.nr_slots = table->nr_slots;
+	table->old.cursor = 0;
+	table->nr_slots = nr_slots;
+	table->slots = (nr_slots == table->min_nr_slots ? table->min_slots :
+			alloc_things(struct list_head, nr_slots, "hash table slots"));
+	init_slots(table, table->slots, table->nr_slots);
 	/*
-	 * 251 is a prime close to 256 (so like <<8).
-	 *
-	 * There's no real rationale for doing this.
+	 * No event-loop (still starting up) means no way to spread
+	 * the work out.
 	 */
-	const uint8_t *bytes = ptr;
-	for (unsigned j = 0; j < len; j++) {
-		hash.hash = hash.hash * 251 + bytes[j];
+	if (get_pluto_event_base() == NULL) {
+		finish_resize(table);
+		return;
 	}
-	return hash;
+	schedule_timeout("resize hash table", &table->old.timeout,
+			 deltatime(0), resize_hash_table_step, table);
 }
 
-struct list_head *hash_table_bucket(struct hash_table *table, hash_t hash)
+/*
+ * Sizes go N, 2N+1, 4N+3, ...; keeping them odd when the static
+ * size is odd and allowing shrink to land exactly back on N.
+ */
+
+static void resize_hash_table(struct hash_table *table)
 {
-	return &table->slots[hash.hash % table->nr_slots];
+	if (table->old.slots != NULL) {
+		/* one at a time; checked again once done */
+		return;
+	}
+	if (table->nr_entries > (long) (table->nr_slots * HASH_TABLE_MAX_LOAD)) {
+		table->nr_grows++;
+		start_resize(table, table->nr_slots * 2 + 1);
+		return;
+	}
+	if (table->nr_slots > table->min_nr_slots &&
+	    table->nr_entries < (long) (table->nr_slots / HASH_TABLE_MIN_LOAD)) {
+		unsigned long nr_slots = (table->nr_slots - 1) / 2;
+		table->nr_shrinks++;
+		start_resize(table, (nr_slots < table->min_nr_slots ?
+				     table->min_nr_slots : nr_slots));
+		return;
+	}
 }
 
 void init_hash_table_entry(struct hash_table *table, void *data)
@@ -73,6 +196,7 @@ void add_hash_table_entry(struct hash_table *table, void *data)
 		table->info->jam(buf, data);
 		jam(buf, " added to hash table bucket %p", bucket);
 	}
+	resize_hash_table(table);
 }
 
 void del_hash_table_entry(struct hash_table *table, void *data)
@@ -86,6 +210,7 @@ void del_hash_table_entry(struct hash_table *table, void *data)
 	struct list_entry *entry = table->entry(data);
 	remove_list_entry(entry);
 	table->nr_entries--;
+	resize_hash_table(table);
 }
 
 /*
@@ -114,8 +239,7 @@ static void check_hash_table_entry(struct hash_table *table, void *data,
 		}
 	}
 	/* ... but plan for the worst */
-	for (unsigned n = 0; n < table->nr_slots; n++) {
-		const struct list_head *table_bucket = &table->slots[n];
+	FOR_EACH_HASH_TABLE_BUCKET(table_bucket, table) {
 		void *bucket_data;
 		FOR_EACH_LIST_ENTRY_NEW2OLD(bucket_data, table_bucket) {
 			if (data == bucket_data) {
@@ -137,12 +261,88 @@ static void check_hash_table_entry(struct hash_table *table, void *data,
 
 void check_hash_table(struct hash_table *table, struct logger *logger)
 {
-	for (unsigned n = 0; n < table->nr_slots; n++) {
-		const struct list_head *table_bucket = &table->slots[n];
+	long nr_entries = 0;
+	FOR_EACH_HASH_TABLE_BUCKET(table_bucket, table) {
 		void *bucket_data;
 		FOR_EACH_LIST_ENTRY_NEW2OLD(bucket_data, table_bucket) {
 			/* overkill */
 			check_hash_table_entry(table, bucket_data, logger, HERE);
+			nr_entries++;
+		}
+	}
+	if (nr_entries != table->nr_entries) {
+		LLOG_PEXPECT_JAMBUF(logger, HERE, buf) {
+			jam(buf, "%s hash table contains %ld entries but expecting %ld",
+			    table->name, nr_entries, table->nr_entries);
+		}
+	}
+}
+
+void free_hash_tables(struct logger *logger)
+{
+	for (struct hash_table *table = hash_tables; table != NULL; table = table->next) {
+		if (table->old.slots != NULL) {
+			finish_resize(table);
+		}
+		if (table->slots != table->min_slots) {
+			ldbg(logger, "%s hash table: shrinking %lu slots holding %ld entries",
+			     table->name, table->nr_slots, table->nr_entries);
+			table->old.slots = table->slots;
+			table->old.nr_slots = table->nr_slots;
+			table->nr_slots = table->min_nr_slots;
+			table->slots = table->min_slots;
+			init_slots(table, table->slots, table->nr_slots);
+			finish_resize(table);
+		}
+	}
+}
+
+/*
+ * Chain lengths: 0, 1, 2, 3-4, 5-8, 9-16, 17+.
+ */
+
+#define NR_CHAIN_LENGTHS 7
+
+static unsigned chain_length_index(unsigned long length)
+{
+	unsigned i = 0;
+	for (unsigned long l = length; l > 1 && i < NR_CHAIN_LENGTHS - 2; l = (l + 1) / 2) {
+		i++;
+	}
+	return (length == 0 ? 0 : i + 1);
+}
+
+void show_hash_tables_status(struct show *s)
+{
+	static const char *chain_length_names[NR_CHAIN_LENGTHS] = {
+		"0", "1", "2", "3-4", "5-8", "9-16", "17+",
+	};
+	show_separator(s);
+	for (struct hash_table *table = hash_tables; table != NULL; table = table->next) {
+		unsigned long chains[NR_CHAIN_LENGTHS] = {0};
+		unsigned long max_chain = 0;
+		FOR_EACH_HASH_TABLE_BUCKET(bucket, table) {
+			unsigned long length = 0;
+			void *data;
+			FOR_EACH_LIST_ENTRY_NEW2OLD(data, bucket) {
+				length++;
+			}
+			chains[chain_length_index(length)]++;
+			max_chain = (length > max_chain ? length : max_chain);
+		}
+		SHOW_JAMBUF(RC_COMMENT, s, buf) {
+			jam(buf, "hash table %s: entries=%ld slots=%lu",
+			    table->name, table->nr_entries, table->nr_slots);
+			if (table->old.slots != NULL) {
+				jam(buf, " (resizing from %lu, %lu%% done)",
+				    table->old.nr_slots,
+				    table->old.cursor * 100 / table->old.nr_slots);
+			}
+			jam(buf, " grows=%lu shrinks=%lu max-chain=%lu chains:",
+			    table->nr_grows, table->nr_shrinks, max_chain);
+			for (unsigned i = 0; i < NR_CHAIN_LENGTHS; i++) {
+				jam(buf, " %s=%lu", chain_length_names[i], chains[i]);
+			}
 		}
 	}
 }
@@ -17,23 +17,49 @@
 #define HASH_TABLE_H
 
 #include "list_entry.h"
-#include "shunk.h"		/* has constant ptr */
+#include "hash_bytes.h"
 #include "where.h"
 
 /*
  * Generic hash table.
  */
 
-typedef struct { unsigned hash; } hash_t;
-extern const hash_t zero_hash;
+struct show;
+struct timeout;
+
+/*
+ * The table starts out using the statically allocated NR_BUCKETS
+ * slots.
+ *
+ * When the load (entries per slot) gets too high (or too low) a
+ * bigger (or smaller) set of slots is allocated and the entries are
+ * migrated across, a few old slots at a time, from the event-loop.
+ * While this is happening lookups need to check both: an old slot
+ * below .old.cursor has been emptied into the new slots; an old slot
+ * at or above .old.cursor still holds its entries.
+ */
 
 struct hash_table {
+	const char *const name;
 	const struct list_info *const info;
 	hash_t (*hasher)(const void *data);
 	struct list_entry *(*entry)(void *data);
 	long nr_entries; /* approx? */
 	unsigned long nr_slots;
 	struct list_head *slots;
+	/* the static slots; never shrink below this */
+	const unsigned long min_nr_slots;
+	struct list_head *const min_slots;
+	/* when resizing, the slots being drained */
+	struct {
+		unsigned long nr_slots;
+		struct list_head *slots;
+		unsigned long cursor;
+		struct timeout *timeout;
+	} old;
+	unsigned long nr_grows;
+	unsigned long nr_shrinks;
+	struct hash_table *next; /* all tables */
 };
 
 #define HASH_TABLE(STRUCT, NAME, FIELD, NR_BUCKETS)			\
@@ -56,27 +82,27 @@ struct hash_table {
 	}								\
 									\
 	struct hash_table STRUCT##_##NAME##_hash_table = {		\
+		.name = #STRUCT " " #NAME,				\
 		.hasher = hash_table_hash_##STRUCT##_##NAME,		\
 		.entry = hash_table_entry_##STRUCT##_##NAME,		\
 		.nr_slots = NR_BUCKETS,					\
 		.slots = STRUCT##_##NAME##_buckets,			\
+		.min_nr_slots = NR_BUCKETS,				\
+		.min_slots = STRUCT##_##NAME##_buckets,			\
 		.info = &STRUCT##_##NAME##_hash_info,			\
 	}
 
 void init_hash_table(struct hash_table *table, struct logger *logger);
 void check_hash_table(struct hash_table *table, struct logger *logger);
 
-hash_t hash_bytes(const void *ptr, size_t len, hash_t hash);
-#define hash_hunk(HUNK, HASH)						\
-	({								\
-		typeof(HUNK) h_ = HUNK; /* evaluate once */		\
-		hash_bytes(h_.ptr, h_.len, HASH);			\
-	})
-#define hash_thing(THING, HASH)						\
-	({								\
-		shunk_t h_ = THING_AS_SHUNK(THING); /* evaluate once */	\
-		hash_bytes(h_.ptr, h_.len, HASH);			\
-	})
+/*
+ * Finish any resize and return every table to its static slots
+ * (cancelling the event-loop work); call before the event-loop is
+ * torn down.
+ */
+void free_hash_tables(struct logger *logger);
+
+void show_hash_tables_status(struct show *s);
 
 /*
  * Maintain the table.
@@ -174,4 +200,21 @@ void del_hash_table_entry(struct hash_table *table, void *data);
 
 struct list_head *hash_table_bucket(struct hash_table *table, hash_t hash);
 
+/*
+ * Iterate over every bucket in the table, including, when resizing,
+ * those in the old slots.
+ *
+ * Use this, in conjunction with FOR_EACH_LIST_ENTRY, when the entire
+ * table needs to be searched.
+ */
+
+#define FOR_EACH_HASH_TABLE_BUCKET(BUCKET, TABLE)			\
+	for (unsigned old_ = 2; old_-- > 0; )				\
+		for (struct list_head *BUCKET =				\
+			     (old_ ? (TABLE)->old.slots : (TABLE)->slots), \
+			     *end_ = (BUCKET == NULL ? NULL :		\
+				      BUCKET + (old_ ? (TABLE)->old.nr_slots : \
+						(TABLE)->nr_slots));	\
+		     BUCKET < end_; BUCKET++)
+
 #endif
@@ -0,0 +1,374 @@
+/* dnshostname= lookups, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include "defs.h"
+#include "log.h"
+#include "hash_table.h"
+#include "connections.h"
+#include "ip_info.h"
+#include "host_lookup.h"
+
+#ifdef USE_DNSSEC
+# include <ldns/ldns.h>		/* rpm:ldns-devel deb:libldns-dev */
+# include <unbound.h>		/* rpm:unbound-devel */
+# include "unbound-event.h"
+# include "dnssec.h"		/* for get_unbound_ctx() */
+#endif
+
+/*
+ * How long to cache answers.
+ *
+ * When the TTL isn't known (the answer came from getaddrinfo())
+ * positive answers are kept for the DDNS interval and negative
+ * answers for half that.
+ */
+
+#define HOST_LOOKUP_MIN_TTL 10			/* seconds */
+#define HOST_LOOKUP_MAX_TTL secs_per_hour
+#define HOST_LOOKUP_MAX_NEGATIVE_TTL (5 * secs_per_minute)
+#define HOST_LOOKUP_TTL secs_per_minute
+#define HOST_LOOKUP_NEGATIVE_TTL 30
+
+struct host_lookup_waiter {
+	co_serial_t connection;
+	host_lookup_cb *cb;
+	struct host_lookup_waiter *next;
+};
+
+struct host_lookup {
+	char *name;
+	const struct ip_info *afi;	/* NULL: either */
+	/* the answer; unset when negative */
+	ip_address address;
+	monotime_t expires;
+	/* in progress */
+	bool pending;
+	struct host_lookup_waiter *waiters;
+#ifdef USE_DNSSEC
+	int qtype;
+	int ub_async_id;
+	unsigned nr_queries;
+#endif
+	struct {
+		struct list_entry list;
+		struct list_entry name;
+	} host_lookup_db_entries;
+};
+
+static void jam_host_lookup(struct jambuf *buf, const struct host_lookup *h)
+{
+	jam_string(buf, h->name);
+	jam_string(buf, " ");
+	jam_string(buf, (h->afi == NULL ? "IPv4|IPv6" : h->afi->ip_name));
+}
+
+/* DNS names are case insensitive */
+
+static hash_t hash_host_lookup_name(char *const *name)
+{
+	hash_t hash = zero_hash;
+	for (const char *c = *name; *c != '\0'; c++) {
+		char l = char_tolower(*c);
+		hash = hash_thing(l, hash);
+	}
+	return hash;
+}
+
+HASH_TABLE(host_lookup, name, .name, 23);
+
+HASH_DB(host_lookup,
+	&host_lookup_name_hash_table);
+
+static struct host_lookup *host_lookup_by_name(const char *name,
+					       const struct ip_info *afi)
+{
+	char *const key = (char *)name;
+	hash_t hash = hash_host_lookup_name(&key);
+	struct list_head *bucket = hash_table_bucket(&host_lookup_name_hash_table, hash);
+	struct host_lookup *h;
+	FOR_EACH_LIST_ENTRY_NEW2OLD(h, bucket) {
+		if (h->afi == afi && strcaseeq(h->name, name)) {
+			return h;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Save the answer and then wake up anything waiting on it.
+ */
+
+static void host_lookup_done(struct host_lookup *h, ip_address address,
+			     deltatime_t ttl)
+{
+	address_buf ab;
+	deltatime_buf tb;
+	dbg("host lookup: %s is %s for %s seconds", h->name,
+	    str_address_sensitive(&address, &ab), str_deltatime(ttl, &tb));
+
+	h->address = address;
+	h->expires = monotime_add(mononow(), ttl);
+	h->pending = false;
+
+	struct host_lookup_waiter *waiters = h->waiters;
+	h->waiters = NULL;
+	while (waiters != NULL) {
+		struct host_lookup_waiter *w = waiters;
+		waiters = w->next;
+		struct connection *c = connection_by_serialno(w->connection);
+		if (c == NULL) {
+			dbg("host lookup: connection "PRI_CO" for %s disappeared",
+			    pri_co(w->connection), h->name);
+		} else {
+			w->cb(c, address, c->logger);
+		}
+		pfree(w);
+	}
+}
+
+#ifdef USE_DNSSEC
+
+static bool start_ub_host_lookup(struct host_lookup *h);
+
+static deltatime_t clamp_ttl(uint32_t ttl, uint32_t max_ttl)
+{
+	return deltatime(ttl < HOST_LOOKUP_MIN_TTL ? HOST_LOOKUP_MIN_TTL :
+			 ttl > max_ttl ? max_ttl : ttl);
+}
+
+/*
+ * Extract the address, and the TTL, from the answer; when there's no
+ * address use the SOA's negative TTL (RFC 2308).
+ */
+
+static ip_address parse_host_lookup(struct host_lookup *h, ldns_pkt *pkt,
+				    deltatime_t *ttl)
+{
+	const struct ip_info *afi = (h->qtype == LDNS_RR_TYPE_AAAA ? &ipv6_info : &ipv4_info);
+	ip_address address = unset_address;
+	uint32_t min_ttl = UINT32_MAX;
+
+	ldns_rr_list *answers = ldns_pkt_answer(pkt);
+	for (size_t i = 0; i < ldns_rr_list_rr_count(answers); i++) {
+		ldns_rr *rr = ldns_rr_list_rr(answers, i);
+		/* includes any CNAMEs */
+		min_ttl = min(min_ttl, ldns_rr_ttl(rr));
+		if (address_is_specified(address) ||
+		    ldns_rr_get_type(rr) != (ldns_rr_type)h->qtype) {
+			continue;
+		}
+		ldns_rdf *rdf = ldns_rr_rdf(rr, 0);
+		if (rdf == NULL || ldns_rdf_size(rdf) != afi->ip_size) {
+			llog_pexpect(&global_logger, HERE,
+				     "dns record for %s is not %zu bytes",
+				     h->name, afi->ip_size);
+			continue;
+		}
+		struct ip_bytes bytes = unset_ip_bytes;
+		memcpy(bytes.byte, ldns_rdf_data(rdf), afi->ip_size);
+		address = address_from_raw(HERE, afi->ip_version, bytes);
+	}
+
+	if (address_is_specified(address)) {
+		*ttl = clamp_ttl(min_ttl, HOST_LOOKUP_MAX_TTL);
+		return address;
+	}
+
+	ldns_rr_list *authority = ldns_pkt_authority(pkt);
+	for (size_t i = 0; i < ldns_rr_list_rr_count(authority); i++) {
+		ldns_rr *rr = ldns_rr_list_rr(authority, i);
+		if (ldns_rr_get_type(rr) == LDNS_RR_TYPE_SOA &&
+		    ldns_rr_rd_count(rr) >= 7) {
+			uint32_t minimum = ldns_rdf2native_int32(ldns_rr_rdf(rr, 6));
+			*ttl = clamp_ttl(min(minimum, ldns_rr_ttl(rr)),
+					 HOST_LOOKUP_MAX_NEGATIVE_TTL);
+			return unset_address;
+		}
+	}
+	*ttl = deltatime(HOST_LOOKUP_NEGATIVE_TTL);
+	return unset_address;
+}
+
+static void host_lookup_ub_cb(void *mydata, int rcode,
+			      void *wire, int wire_len, int secure, char *why_bogus
+#if (UNBOUND_VERSION_MAJOR == 1 && UNBOUND_VERSION_MINOR >= 8) || UNBOUND_VERSION_MAJOR > 1
+			      , int was_ratelimited UNUSED
+#endif
+	)
+{
+	struct host_lookup *h = mydata;
+	h->ub_async_id = 0;
+
+	ip_address address = unset_address;
+	deltatime_t ttl = deltatime(HOST_LOOKUP_NEGATIVE_TTL);
+
+	if (secure == UB_EVENT_BOGUS) {
+		llog(RC_LOG_SERIOUS, &global_logger,
+		     "host lookup: %s failed DNSSEC validation: %s",
+		     h->name, (why_bogus == NULL ? "" : why_bogus));
+	} else if (rcode != LDNS_RCODE_NOERROR && rcode != LDNS_RCODE_NXDOMAIN) {
+		/* SERVFAIL et.al.; don't trust any TTL */
+		dbg("host lookup: %s failed with rcode %d", h->name, rcode);
+	} else {
+		/* do not free WIRE */
+		ldns_pkt *pkt = NULL;
+		if (ldns_wire2pkt(&pkt, wire, wire_len) != LDNS_STATUS_OK) {
+			dbg("host lookup: %s returned an unparsable response", h->name);
+		} else {
+			address = parse_host_lookup(h, pkt, &ttl);
+			ldns_pkt_free(pkt);
+		}
+		if (secure == UB_EVENT_INSECURE) {
+			dbg("host lookup: %s was not protected by DNSSEC", h->name);
+		}
+	}
+
+	if (!address_is_specified(address) &&
+	    h->afi == NULL && h->qtype == LDNS_RR_TYPE_A) {
+		/* no IPv4; try IPv6 */
+		h->qtype = LDNS_RR_TYPE_AAAA;
+		if (start_ub_host_lookup(h)) {
+			return;
+		}
+	}
+
+	host_lookup_done(h, address, ttl);
+}
+
+static bool start_ub_host_lookup(struct host_lookup *h)
+{
+	dbg("host lookup: querying %s %s", h->name,
+	    (h->qtype == LDNS_RR_TYPE_AAAA ? "AAAA" : "A"));
+	/*
+	 * The callback can run before ub_resolve_event() returns
+	 * (for instance, when the answer is cached); only remember
+	 * the query's ID when it is still outstanding.
+	 */
+	unsigned query = ++h->nr_queries;
+	int async_id = 0;
+	int ret = ub_resolve_event(get_unbound_ctx(), h->name, h->qtype,
+				   LDNS_RR_CLASS_IN, h, host_lookup_ub_cb,
+				   &async_id);
+	if (ret != 0) {
+		llog(RC_LOG_SERIOUS, &global_logger,
+		     "host lookup: unbound resolve call failed for %s: %s",
+		     h->name, ub_strerror(ret));
+		return false;
+	}
+	if (h->pending && h->nr_queries == query) {
+		h->ub_async_id = async_id;
+	}
+	return true;
+}
+
+#endif
+
+static void start_host_lookup(struct host_lookup *h)
+{
+	h->pending = true;
+
+#ifdef USE_DNSSEC
+	if (get_unbound_ctx() != NULL) {
+		h->qtype = (h->afi == &ipv6_info ? LDNS_RR_TYPE_AAAA : LDNS_RR_TYPE_A);
+		if (start_ub_host_lookup(h)) {
+			return;
+		}
+	}
+#endif
+
+	/* XXX: blocking call */
+	ip_address address;
+	err_t e = ttoaddress_dns(shunk1(h->name), h->afi, &address);
+	if (e != NULL) {
+		dbg("host lookup: %s failed: %s", h->name, e);
+		host_lookup_done(h, unset_address, deltatime(HOST_LOOKUP_NEGATIVE_TTL));
+		return;
+	}
+	host_lookup_done(h, address, deltatime(HOST_LOOKUP_TTL));
+}
+
+void lookup_host(struct connection *c, const struct ip_info *afi,
+		 host_lookup_cb *cb, struct logger *logger)
+{
+	const char *name = c->config->dnshostname;
+	passert(name != NULL);
+
+	struct host_lookup *h = host_lookup_by_name(name, afi);
+	if (h == NULL) {
+		h = alloc_thing(struct host_lookup, "host lookup");
+		h->name = clone_str(name, "host lookup name");
+		h->afi = afi;
+		h->address = unset_address;
+		h->expires = monotime_epoch;
+		host_lookup_db_init_host_lookup(h);
+		host_lookup_db_add(h);
+	}
+
+	if (!h->pending && monotime_cmp(mononow(), <, h->expires)) {
+		ldbg(logger, "host lookup: %s is cached", name);
+		cb(c, h->address, logger);
+		return;
+	}
+
+	/* only wait once */
+	bool waiting = false;
+	for (struct host_lookup_waiter *w = h->waiters; w != NULL; w = w->next) {
+		if (w->connection == c->serialno && w->cb == cb) {
+			waiting = true;
+			break;
+		}
+	}
+	if (!waiting) {
+		struct host_lookup_waiter *w = alloc_thing(struct host_lookup_waiter,
+							   "host lookup waiter");
+		w->connection = c->serialno;
+		w->cb = cb;
+		w->next = h->waiters;
+		h->waiters = w;
+	}
+
+	if (h->pending) {
+		ldbg(logger, "host lookup: %s is in progress", name);
+		return;
+	}
+
+	start_host_lookup(h);
+}
+
+void flush_host_lookups(void)
+{
+	struct host_lookup *h;
+	FOR_EACH_LIST_ENTRY_OLD2NEW(h, &host_lookup_db_list_head) {
+		h->expires = monotime_epoch;
+	}
+}
+
+void free_host_lookups(void)
+{
+	struct host_lookup *h;
+	FOR_EACH_LIST_ENTRY_NEW2OLD(h, &host_lookup_db_list_head) {
+#ifdef USE_DNSSEC
+		if (h->ub_async_id != 0 && get_unbound_ctx() != NULL) {
+			ub_cancel(get_unbound_ctx(), h->ub_async_id);
+		}
+#endif
+		while (h->waiters != NULL) {
+			struct host_lookup_waiter *w = h->waiters;
+			h->waiters = w->next;
+			pfree(w);
+		}
+		host_lookup_db_del(h);
+		pfree(h->name);
+		pfree(h);
+	}
+}
@@ -0,0 +1,55 @@
+/* dnshostname= lookups, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef HOST_LOOKUP_H
+#define HOST_LOOKUP_H
+
+#include "ip_address.h"
+
+struct connection;
+struct ip_info;
+struct logger;
+struct host_lookup;
+
+/*
+ * Look up the connection's dnshostname= without blocking the
+ * event-loop (when pluto has libunbound).
+ *
+ * Answers, both good and bad, are cached for their DNS TTL.  When
+ * the answer is cached, CB is called before lookup_host() returns;
+ * otherwise a query is started and CB is called, provided the
+ * connection still exists, once it completes.  ADDRESS is unset when
+ * the lookup failed.
+ *
+ * AFI is the address family wanted; NULL accepts either (preferring
+ * IPv4).
+ */
+
+typedef void (host_lookup_cb)(struct connection *c, ip_address address,
+			      struct logger *logger);
+
+void lookup_host(struct connection *c, const struct ip_info *afi,
+		 host_lookup_cb *cb, struct logger *logger);
+
+/* forget the cached answers; for instance, whack --ddns */
+void flush_host_lookups(void);
+
+void host_lookup_db_init(struct logger *logger);
+void host_lookup_db_check(struct logger *logger);
+void free_host_lookups(void);
+
+void host_lookup_db_init_host_lookup(struct host_lookup *h);
+void host_lookup_db_add(struct host_lookup *h);
+void host_lookup_db_del(struct host_lookup *h);
+
+#endif
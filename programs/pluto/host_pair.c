@@ -366,7 +366,7 @@ void host_pair_remove_connection(struct connection *c, bool connection_valid)
 }
 
 /* update the host pairs with the latest DNS ip address */
-void update_host_pairs(struct connection *c)
+void update_host_pairs(struct connection *c, ip_address new_addr)
 {
 	struct host_pair *hp = c->host_pair;
 	const char *dnshostname = c->config->dnshostname;
@@ -384,11 +384,8 @@ void update_host_pairs(struct connection *c)
 
 	pexpect(dnshostname == d->config->dnshostname || streq(dnshostname, d->config->dnshostname));
 
-	ip_address new_addr;
-
 	if (d->config->dnshostname == NULL ||
-	    ttoaddress_dns(shunk1(d->config->dnshostname),
-			      address_type(&d->remote->host.addr), &new_addr) != NULL ||
+	    !address_is_specified(new_addr) ||
 	    sameaddr(&new_addr, &hp->remote))
 		return;
 
@@ -448,26 +445,34 @@ void update_host_pairs(struct connection *c)
 }
 
 /*
- * Adjust orientations of connections to reflect newly added
- * interfaces.
+ * Try to orient unoriented connections by re-building the unoriented
+ * connections list.
+ *
+ * The list is emptied, then as each connection fails to orient it
+ * goes back on the list.  When ADDRESS is non-NULL only connections
+ * with an end using that address are tried, the rest go straight
+ * back.
  */
 
-void check_orientations(struct logger *logger)
+static bool connection_uses_address(const struct connection *c,
+				    const ip_address *address)
+{
+	return (sameaddr(&c->end[LEFT_END].host.addr, address) ||
+		sameaddr(&c->end[RIGHT_END].host.addr, address));
+}
+
+static void orient_unoriented_connections(const ip_address *address,
+					  struct logger *logger)
 {
-	/*
-	 * Try to orient unoriented connections by re-building the
-	 * unoriented connections list.
-	 *
-	 * The list is emptied, then as each connection fails to
-	 * orient it goes back on the list.
-	 */
 	dbg("FOR_EACH_UNORIENTED_CONNECTION_... in %s", __func__);
 	struct connection *c = unoriented_connections;
 	unoriented_connections = NULL;
 	while (c != NULL) {
 		/* step off */
 		struct connection *nxt = c->hp_next;
-		orient(&c, logger);
+		if (address == NULL || connection_uses_address(c, address)) {
+			orient(&c, logger);
+		}
 		/*
 		 * Either put C back on unoriented, or add to a host
 		 * pair.
@@ -475,58 +480,81 @@ void check_orientations(struct logger *logger)
 		connect_to_host_pair(c);
 		c = nxt;
 	}
+}
 
-	/*
-	 * Check that no oriented connection has become double-oriented.
-	 * In other words, the far side must not match one of our new
-	 * interfaces.
-	 */
+/*
+ * Check that no oriented connection has become double-oriented.  In
+ * other words, the far side must not match the new interface
+ * ADDRESS.
+ */
+
+static void reorient_host_pairs_by_remote(const ip_address *address,
+					  struct logger *logger)
+{
+	FOR_EACH_HASH_TABLE_BUCKET(bucket, &host_pair_addresses_hash_table) {
+		struct host_pair *hp = NULL;
+		FOR_EACH_LIST_ENTRY_NEW2OLD(hp, bucket) {
+			/*
+			 * XXX: what's with the maybe compare the port
+			 * logic?
+			 */
+			if (!sameaddr(&hp->remote, address)) {
+				continue;
+			}
+			/*
+			 * bad news: the whole chain of connections
+			 * hanging off this host pair has both sides
+			 * matching an interface.  We'll get rid of
+			 * them, using orient and connect_to_host_pair.
+			 */
+			struct connection *c = hp->connections;
+			hp->connections = NULL;
+			while (c != NULL) {
+				struct connection *nxt = c->hp_next;
+				iface_endpoint_delref(&c->interface);
+				c->host_pair = NULL;
+				c->hp_next = NULL;
+				orient(&c, logger);
+				connect_to_host_pair(c);
+				c = nxt;
+			}
+			/*
+			 * XXX: is this ever not the case?
+			 */
+			if (hp->connections == NULL) {
+				free_host_pair(&hp, HERE);
+			}
+		}
+	}
+}
+
+/*
+ * Adjust orientations of connections to reflect newly added
+ * interfaces.
+ */
+
+void check_orientations(struct logger *logger)
+{
+	orient_unoriented_connections(NULL, logger);
 	for (struct iface_endpoint *i = interfaces; i != NULL; i = i->next) {
 		if (i->ip_dev->ifd_change != IFD_ADD) {
 			continue;
 		}
-		for (unsigned u = 0; u < host_pair_addresses_hash_table.nr_slots; u++) {
-			struct list_head *bucket = &host_pair_addresses_hash_table.slots[u];
-			struct host_pair *hp = NULL;
-			FOR_EACH_LIST_ENTRY_NEW2OLD(hp, bucket) {
-				/*
-				 * XXX: what's with the maybe compare
-				 * the port logic?
-				 */
-				if (sameaddr(&hp->remote,
-					     &i->ip_dev->id_address)) {
-					/*
-					 * bad news: the whole chain
-					 * of connections hanging off
-					 * this host pair has both
-					 * sides matching an
-					 * interface.  We'll get rid
-					 * of them, using orient and
-					 * connect_to_host_pair.
-					 */
-					struct connection *c =
-						hp->connections;
-					hp->connections = NULL;
-					while (c != NULL) {
-						struct connection *nxt =
-							c->hp_next;
-						iface_endpoint_delref(&c->interface);
-						c->host_pair = NULL;
-						c->hp_next = NULL;
-						orient(&c, logger);
-						connect_to_host_pair(c);
-						c = nxt;
-					}
-					/*
-					 * XXX: is this ever not the
-					 * case?
-					 */
-					if (hp->connections == NULL) {
-						free_host_pair(&hp, HERE);
-					}
-				}
-			}
-		}
+		reorient_host_pairs_by_remote(&i->ip_dev->id_address, logger);
+	}
+}
+
+/*
+ * Same, but only for the one interface address that was just added
+ * (or deleted).
+ */
+
+void check_address_orientations(ip_address address, bool added,
+				struct logger *logger)
+{
+	orient_unoriented_connections(&address, logger);
+	if (added) {
+		reorient_host_pairs_by_remote(&address, logger);
 	}
 }
 
@@ -56,10 +56,12 @@ extern void connect_to_host_pair(struct connection *c);
 void delete_oriented_hp(struct connection *c);
 void host_pair_remove_connection(struct connection *c, bool connection_valid);
 
-extern void update_host_pairs(struct connection *c);
+extern void update_host_pairs(struct connection *c, ip_address new_addr);
 
 extern void release_dead_interfaces(struct logger *logger);
 extern void check_orientations(struct logger *logger);
+void check_address_orientations(ip_address address, bool added,
+				struct logger *logger);
 
 void host_pair_db_init(struct logger *logger);
 
@@ -80,7 +80,7 @@ LIST_INFO(iface_dev, ifd_entry, iface_dev_info, jam_iface_dev);
 static struct list_head interface_dev = INIT_LIST_HEAD(&interface_dev,
 						       &iface_dev_info);
 
-static void add_iface_dev(const struct raw_iface *ifp, struct logger *logger)
+static struct iface_dev *add_iface_dev(const struct raw_iface *ifp, struct logger *logger)
 {
 	struct iface_dev *ifd = refcnt_alloc(struct iface_dev, HERE);
 	ifd->id_rname = clone_str(ifp->name, "real device name");
@@ -90,6 +90,7 @@ static void add_iface_dev(const struct raw_iface *ifp, struct logger *logger)
 	init_list_entry(&iface_dev_info, ifd, &ifd->ifd_entry);
 	insert_list_entry(&interface_dev, &ifd->ifd_entry);
 	dbg("iface: marking %s add", ifd->id_rname);
+	return ifd;
 }
 
 struct iface_dev *find_iface_dev_by_address(const ip_address *address)
@@ -139,11 +140,15 @@ void release_iface_dev(struct iface_dev **ifdp)
 	}
 }
 
-static void free_dead_ifaces(struct logger *logger)
+/*
+ * Remove the interfaces marked IFD_DELETE (and anything using them);
+ * return true when there were some.
+ */
+
+static bool remove_dead_ifaces(struct logger *logger)
 {
 	struct iface_endpoint *p;
 	bool some_dead = false;
-	bool some_new = false;
 
 	/*
 	 * XXX: this iterates over the interface, and not the
@@ -159,8 +164,6 @@ static void free_dead_ifaces(struct logger *logger)
 			     p->ip_dev->id_rname,
 			     str_endpoint(&p->local_endpoint, &b));
 			some_dead = true;
-		} else if (p->ip_dev->ifd_change == IFD_ADD) {
-			some_new = true;
 		}
 	}
 
@@ -170,35 +173,50 @@ static void free_dead_ifaces(struct logger *logger)
 	 * connections.
 	 */
 
-	if (some_dead) {
-		dbg("updating interfaces - deleting the dead");
-		/*
-		 * Delete any iface_port's pointing at the dead
-		 * iface_dev.
-		 */
-		release_dead_interfaces(logger);
-		delete_states_dead_interfaces(logger);
-		for (struct iface_endpoint **pp = &interfaces; (p = *pp) != NULL; ) {
-			if (p->ip_dev->ifd_change == IFD_DELETE) {
-				*pp = p->next; /* advance *pp (skip p) */
-				p->next = NULL;
-				iface_endpoint_delref(&p);
-			} else {
-				pp = &p->next; /* advance pp */
-			}
+	if (!some_dead) {
+		return false;
+	}
+
+	dbg("updating interfaces - deleting the dead");
+	/*
+	 * Delete any iface_port's pointing at the dead
+	 * iface_dev.
+	 */
+	release_dead_interfaces(logger);
+	delete_states_dead_interfaces(logger);
+	for (struct iface_endpoint **pp = &interfaces; (p = *pp) != NULL; ) {
+		if (p->ip_dev->ifd_change == IFD_DELETE) {
+			*pp = p->next; /* advance *pp (skip p) */
+			p->next = NULL;
+			iface_endpoint_delref(&p);
+		} else {
+			pp = &p->next; /* advance pp */
 		}
+	}
 
-		/*
-		 * Finally, release the iface_dev, from its linked
-		 * list of iface devs.
-		 */
-		struct iface_dev *ifd;
-		FOR_EACH_LIST_ENTRY_OLD2NEW(ifd, &interface_dev) {
-			if (ifd->ifd_change == IFD_DELETE) {
-				release_iface_dev(&ifd);
-			}
+	/*
+	 * Finally, release the iface_dev, from its linked
+	 * list of iface devs.
+	 */
+	struct iface_dev *ifd;
+	FOR_EACH_LIST_ENTRY_OLD2NEW(ifd, &interface_dev) {
+		if (ifd->ifd_change == IFD_DELETE) {
+			release_iface_dev(&ifd);
 		}
 	}
+	return true;
+}
+
+static void free_dead_ifaces(struct logger *logger)
+{
+	bool some_new = false;
+	for (struct iface_endpoint *p = interfaces; p != NULL; p = p->next) {
+		if (p->ip_dev->ifd_change == IFD_ADD) {
+			some_new = true;
+		}
+	}
+
+	bool some_dead = remove_dead_ifaces(logger);
 
 	/*
 	 * Finally go through all connections and see if any can
@@ -419,61 +437,67 @@ struct iface_endpoint *bind_iface_endpoint(struct iface_dev *ifd,
 }
 
 /*
- * Open new interfaces.
+ * Open a new interface; false when port 500 can't be bound.
  */
 
+static bool bind_iface_dev(struct iface_dev *ifd, struct logger *logger)
+{
+	/*
+	 * Port 500 must not add the ESP encapsulation prefix.
+	 * And, when NAT is detected, float away.
+	 */
+	if (pluto_listen_udp) {
+		if (bind_iface_endpoint(ifd, &udp_iface_io,
+					ip_hport(IKE_UDP_PORT),
+					false /*esp_encapsulation_enabled*/,
+					true /*float_nat_initiator*/,
+					logger) == NULL) {
+			return false;
+		}
+	}
+
+	/*
+	 * Port 4500 must add the ESP encapsulation
+	 * prefix.  Let it float to itself - code
+	 * might rely on it?
+	 */
+	if (pluto_listen_udp) {
+		/* XXX: ignore any errors!?! */
+		bind_iface_endpoint(ifd, &udp_iface_io,
+				    ip_hport(NAT_IKE_UDP_PORT),
+				    true /*esp_encapsulation_enabled*/,
+				    true /*float_nat_initiator*/,
+				    logger);
+	}
+
+	/*
+	 * An explicit {left,right} IKE TCP PORT must enable
+	 * ESPINUDP so that it can tunnel NAT.  This means
+	 * that incoming packets must add the ESP=0 prefix,
+	 * which in turn means that it can't interop with port
+	 * 500 as that port will never send the ESP=0 prefix.
+	 *
+	 * See comments in iface.h.
+	 */
+	if (pluto_listen_tcp) {
+		/* XXX: ignore any errors!?! */
+		bind_iface_endpoint(ifd, &iketcp_iface_io,
+				    ip_hport(NAT_IKE_UDP_PORT),
+				    true /*esp_encapsulation_enabled*/,
+				    false /*float_nat_initiator*/,
+				    logger);
+	}
+	return true;
+}
+
 static void add_new_ifaces(struct logger *logger)
 {
 	struct iface_dev *ifd;
 	FOR_EACH_LIST_ENTRY_OLD2NEW(ifd, &interface_dev) {
 		if (ifd->ifd_change != IFD_ADD)
 			continue;
-
-		/*
-		 * Port 500 must not add the ESP encapsulation prefix.
-		 * And, when NAT is detected, float away.
-		 */
-		if (pluto_listen_udp) {
-			if (bind_iface_endpoint(ifd, &udp_iface_io,
-						ip_hport(IKE_UDP_PORT),
-						false /*esp_encapsulation_enabled*/,
-						true /*float_nat_initiator*/,
-						logger) == NULL) {
-				ifd->ifd_change = IFD_DELETE;
-				continue;
-			}
-		}
-
-		/*
-		 * Port 4500 must add the ESP encapsulation
-		 * prefix.  Let it float to itself - code
-		 * might rely on it?
-		 */
-		if (pluto_listen_udp) {
-			/* XXX: ignore any errors!?! */
-			bind_iface_endpoint(ifd, &udp_iface_io,
-					    ip_hport(NAT_IKE_UDP_PORT),
-					    true /*esp_encapsulation_enabled*/,
-					    true /*float_nat_initiator*/,
-					    logger);
-		}
-
-		/*
-		 * An explicit {left,right} IKE TCP PORT must enable
-		 * ESPINUDP so that it can tunnel NAT.  This means
-		 * that incoming packets must add the ESP=0 prefix,
-		 * which in turn means that it can't interop with port
-		 * 500 as that port will never send the ESP=0 prefix.
-		 *
-		 * See comments in iface.h.
-		 */
-		if (pluto_listen_tcp) {
-			/* XXX: ignore any errors!?! */
-			bind_iface_endpoint(ifd, &iketcp_iface_io,
-					    ip_hport(NAT_IKE_UDP_PORT),
-					    true /*esp_encapsulation_enabled*/,
-					    false /*float_nat_initiator*/,
-					    logger);
+		if (!bind_iface_dev(ifd, logger)) {
+			ifd->ifd_change = IFD_DELETE;
 		}
 	}
 }
@@ -584,6 +608,115 @@ void find_ifaces(bool rm_dead, struct logger *logger)
 	}
 }
 
+/*
+ * Incremental updates, driven by the kernel's address and link
+ * notifications.
+ *
+ * Unlike find_ifaces() only the one interface is bound (or unbound)
+ * and only connections using its address are re-oriented.  Nothing
+ * happens until whack --listen has done the first full scan.
+ *
+ * A deleted interface lingers on the list, marked IFD_DELETE, until
+ * the last reference is released; these updates ignore it so that,
+ * for instance, an address that is deleted and then re-added is
+ * bound again.
+ */
+
+struct iface_dev *find_live_iface_dev(const char *name, ip_address address)
+{
+	struct iface_dev *ifd;
+	FOR_EACH_LIST_ENTRY_OLD2NEW(ifd, &interface_dev) {
+		if (ifd->ifd_change != IFD_DELETE &&
+		    (name == NULL || streq(ifd->id_rname, name)) &&
+		    sameaddr(&address, &ifd->id_address)) {
+			return ifd;
+		}
+	}
+	return NULL;
+}
+
+void add_iface_address(const char *name, ip_address address, struct logger *logger)
+{
+	address_buf ab;
+	if (!listening) {
+		dbg("iface: ignoring %s %s, not yet listening",
+		    name, str_address(&address, &ab));
+		return;
+	}
+
+	if (find_live_iface_dev(name, address) != NULL) {
+		dbg("iface: already have %s %s",
+		    name, str_address(&address, &ab));
+		return;
+	}
+
+	if (pluto_listen != NULL) {
+		ip_address lip;
+		if (ttoaddress_num(shunk1(pluto_listen), NULL/*UNSPEC*/, &lip) != NULL ||
+		    !sameaddr(&lip, &address)) {
+			dbg("iface: skipping %s %s, not --listen address",
+			    name, str_address(&address, &ab));
+			return;
+		}
+	}
+
+	struct raw_iface *ri = over_alloc_thing(struct raw_iface, strlen(name) + 1);
+	ri->addr = address;
+	strcpy(ri->name, name);
+	struct iface_dev *ifd = add_iface_dev(ri, logger);
+	pfree(ri);
+
+	if (!bind_iface_dev(ifd, logger)) {
+		/* nothing references IFD */
+		release_iface_dev(&ifd);
+		return;
+	}
+
+	for (struct iface_endpoint *ifp = interfaces; ifp != NULL; ifp = ifp->next) {
+		if (ifp->ip_dev == ifd) {
+			listen_on_iface_endpoint(ifp, logger);
+		}
+	}
+
+	check_address_orientations(address, /*added*/true, logger);
+}
+
+void delete_iface_address(struct iface_dev *ifd, struct logger *logger)
+{
+	/* IFD may be released */
+	ip_address address = ifd->id_address;
+	ifd->ifd_change = IFD_DELETE;
+	remove_dead_ifaces(logger);
+	check_address_orientations(address, /*added*/false, logger);
+}
+
+void delete_iface_device(const char *name, const struct ip_info *afi,
+			 struct logger *logger)
+{
+	/*
+	 * Each pass marks one more device IFD_DELETE (dead interfaces
+	 * linger while still referenced, and are skipped) so this
+	 * terminates; the list can change under remove_dead_ifaces()
+	 * so start again after each.
+	 */
+	while (true) {
+		struct iface_dev *found = NULL;
+		struct iface_dev *ifd;
+		FOR_EACH_LIST_ENTRY_OLD2NEW(ifd, &interface_dev) {
+			if (ifd->ifd_change != IFD_DELETE &&
+			    streq(ifd->id_rname, name) &&
+			    (afi == NULL || address_type(&ifd->id_address) == afi)) {
+				found = ifd;
+				break;
+			}
+		}
+		if (found == NULL) {
+			return;
+		}
+		delete_iface_address(found, logger);
+	}
+}
+
 struct iface_endpoint *find_iface_endpoint_by_local_endpoint(ip_endpoint local_endpoint)
 {
 	for (struct iface_endpoint *p = interfaces; p != NULL; p = p->next) {
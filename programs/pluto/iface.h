@@ -47,6 +47,14 @@ struct iface_io {
 	const struct ip_protocol *protocol;
 	struct msg_digest *(*read_packet)(struct iface_endpoint **ifp,
 					  struct logger *logger);
+	/*
+	 * Optional: read up to NR_MDS packets in one go, returning
+	 * the number of MDS filled in (some may be NULL).  Used when
+	 * ike-socket-batch= is greater than one.
+	 */
+	unsigned (*read_packets)(struct iface_endpoint *ifp,
+				 struct msg_digest **mds, unsigned nr_mds,
+				 struct logger *logger);
 	ssize_t (*write_packet)(const struct iface_endpoint *ifp,
 				const void *ptr, size_t len,
 				const ip_endpoint *remote_endpoint,
@@ -151,6 +159,7 @@ struct iface_endpoint {
 	/* udp only */
 	struct {
 		struct fd_read_listener *read_listener;
+		struct udp_send_queue *send_queue; /* when ike-socket-batch>1 */
 	} udp;
 	struct {
 		/* tcp port only */
@@ -181,6 +190,13 @@ extern struct iface_endpoint *interfaces;   /* public interfaces */
 
 extern struct iface_endpoint *find_iface_endpoint_by_local_endpoint(ip_endpoint local_endpoint);
 extern void find_ifaces(bool rm_dead, struct logger *logger);
+/* ignores IFD_DELETE devices; NAME==NULL matches all */
+struct iface_dev *find_live_iface_dev(const char *name, ip_address address);
+void add_iface_address(const char *name, ip_address address, struct logger *logger);
+void delete_iface_address(struct iface_dev *ifd, struct logger *logger);
+/* AFI==NULL matches all */
+void delete_iface_device(const char *name, const struct ip_info *afi,
+			 struct logger *logger);
 extern void show_ifaces_status(struct show *s);
 void listen_on_iface_endpoint(struct iface_endpoint *ifp, struct logger *logger);
 struct iface_endpoint *bind_iface_endpoint(struct iface_dev *ifd, const struct iface_io *io,
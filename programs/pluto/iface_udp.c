@@ -23,6 +23,8 @@
  * for more details.
  */
 
+#define _GNU_SOURCE		/* for recvmmsg() */
+
 #include <sys/types.h>
 #include <sys/socket.h>		/* MSG_ERRQUEUE if defined */
 #include <netinet/udp.h>
@@ -47,6 +49,7 @@
 #include "log.h"
 #include "ip_info.h"
 #include "ip_sockaddr.h"
+#include "pluto_stats.h"		/* for pstats_ike_send */
 
 #ifdef UDP_ENCAP
 static bool nat_traversal_espinudp(const struct iface_endpoint *ifp,
@@ -99,10 +102,9 @@ static bool check_msg_errqueue(const struct iface_endpoint *ifp,
 			       struct logger *logger);
 #endif
 
-static struct msg_digest * udp_read_packet(struct iface_endpoint **ifpp,
-					   struct logger *logger)
+static bool udp_check_errqueue(struct iface_endpoint *ifp, const char *func,
+			       struct logger *logger)
 {
-	struct iface_endpoint *ifp = *ifpp; /*never closed? */
 #ifdef MSG_ERRQUEUE
 	/*
 	 * Even though select(2) says that there is a message, it
@@ -116,30 +118,30 @@ static struct msg_digest * udp_read_packet(struct iface_endpoint **ifpp,
 	 */
 	if (pluto_sock_errqueue) {
 		threadtime_t errqueue_start = threadtime_start();
-		bool errqueue_ok = check_msg_errqueue(ifp, POLLIN, __func__,
+		bool errqueue_ok = check_msg_errqueue(ifp, POLLIN, func,
 						      logger);
 		threadtime_stop(&errqueue_start, SOS_NOBODY,
-				"%s() calling check_incoming_msg_errqueue()", __func__);
+				"%s() calling check_incoming_msg_errqueue()", func);
 		if (!errqueue_ok) {
 			return false; /* no normal message to read */
 		}
 	}
 #endif
+	return true;
+}
 
-	/*
-	 * COVERITY reports an overflow because FROM.LEN (aka
-	 * sizeof(FROM.SA)) > sizeof(from.sa.sa).  That's the point.
-	 * The FROM.SA union is big enough to hold sockaddr,
-	 * sockaddr_in and sockaddr_in6.
-	 */
-	ip_sockaddr from = {
-		.len = sizeof(from.sa),
-	};
-	uint8_t bigbuffer[MAX_INPUT_UDP_SIZE]; /* ??? this buffer seems *way* too big */
-	ssize_t packet_len = recvfrom(ifp->fd, bigbuffer, sizeof(bigbuffer),
-				      /*flags*/ 0, &from.sa.sa, &from.len);
-	uint8_t *packet_ptr = bigbuffer;
-	int packet_errno = errno; /* save!!! */
+/*
+ * Turn the datagram returned by recvfrom() or recvmmsg() into a
+ * message digest.
+ */
+
+static struct msg_digest *udp_packet_to_md(struct iface_endpoint *ifp,
+					   const ip_sockaddr *fromp,
+					   uint8_t *packet_ptr, ssize_t packet_len,
+					   int packet_errno,
+					   struct logger *logger)
+{
+	ip_sockaddr from = *fromp;
 
 	/*
 	 * Try to decode the from address.
@@ -250,6 +252,107 @@ static struct msg_digest * udp_read_packet(struct iface_endpoint **ifpp,
 	return md;
 }
 
+/*
+ * Receive buffers, for recvfrom() and recvmmsg().
+ *
+ * The buffers are static: only the main thread reads IKE sockets,
+ * and each datagram is copied into its (pooled, right-sized) message
+ * digest by alloc_md() before the next wakeup.  Since the kernel
+ * only writes the bytes it receives, untouched buffer pages cost
+ * nothing.
+ */
+
+static struct {
+	uint8_t buffer[MAX_INPUT_UDP_SIZE];
+	ip_sockaddr from;
+	struct iovec iov;
+} udp_batch[IKE_SOCKET_BATCH_MAX];
+
+static struct msg_digest *udp_read_packet(struct iface_endpoint **ifpp,
+					  struct logger *logger)
+{
+	struct iface_endpoint *ifp = *ifpp; /*never closed? */
+
+	if (!udp_check_errqueue(ifp, __func__, logger)) {
+		return NULL;
+	}
+
+	/*
+	 * COVERITY reports an overflow because FROM.LEN (aka
+	 * sizeof(FROM.SA)) > sizeof(from.sa.sa).  That's the point.
+	 * The FROM.SA union is big enough to hold sockaddr,
+	 * sockaddr_in and sockaddr_in6.
+	 */
+	ip_sockaddr from = {
+		.len = sizeof(from.sa),
+	};
+	uint8_t *buffer = udp_batch[0].buffer;
+	ssize_t packet_len = recvfrom(ifp->fd, buffer, sizeof(udp_batch[0].buffer),
+				      /*flags*/ 0, &from.sa.sa, &from.len);
+	int packet_errno = errno; /* save!!! */
+
+	return udp_packet_to_md(ifp, &from, buffer, packet_len,
+				packet_errno, logger);
+}
+
+/*
+ * Drain up to NR_MDS datagrams using a single recvmmsg() call.
+ */
+
+static unsigned udp_read_packets(struct iface_endpoint *ifp,
+				 struct msg_digest **mds, unsigned nr_mds,
+				 struct logger *logger)
+{
+	if (!udp_check_errqueue(ifp, __func__, logger)) {
+		return 0;
+	}
+
+	nr_mds = min(nr_mds, (unsigned)elemsof(udp_batch));
+	struct mmsghdr msgs[IKE_SOCKET_BATCH_MAX];
+	for (unsigned i = 0; i < nr_mds; i++) {
+		udp_batch[i].from = (ip_sockaddr) {
+			.len = sizeof(udp_batch[i].from.sa),
+		};
+		udp_batch[i].iov = (struct iovec) {
+			.iov_base = udp_batch[i].buffer,
+			.iov_len = sizeof(udp_batch[i].buffer),
+		};
+		msgs[i] = (struct mmsghdr) {
+			.msg_hdr = {
+				.msg_name = &udp_batch[i].from.sa.sa,
+				.msg_namelen = udp_batch[i].from.len,
+				.msg_iov = &udp_batch[i].iov,
+				.msg_iovlen = 1,
+			},
+		};
+	}
+
+	int nr_packets = recvmmsg(ifp->fd, msgs, nr_mds, MSG_DONTWAIT, NULL);
+	if (nr_packets < 0) {
+		int packet_errno = errno; /* save!!! */
+		if (packet_errno == EAGAIN || packet_errno == EWOULDBLOCK) {
+			return 0;
+		}
+		/*
+		 * Let the single packet code, which knows how to
+		 * tone down the likes of ECONNREFUSED, report the
+		 * error.
+		 */
+		mds[0] = udp_packet_to_md(ifp, &udp_batch[0].from,
+					  udp_batch[0].buffer, -1,
+					  packet_errno, logger);
+		return 1;
+	}
+
+	for (int i = 0; i < nr_packets; i++) {
+		udp_batch[i].from.len = msgs[i].msg_hdr.msg_namelen;
+		mds[i] = udp_packet_to_md(ifp, &udp_batch[i].from,
+					  udp_batch[i].buffer, msgs[i].msg_len,
+					  /*packet_errno*/0, logger);
+	}
+	return nr_packets;
+}
+
 #ifdef USE_XFRM_INTERFACE
 static uint32_t set_mark_out(const struct logger *logger, uint32_t mark, int fd)
 {
@@ -270,11 +373,243 @@ static uint32_t set_mark_out(const struct logger *logger, uint32_t mark, int fd)
 }
 #endif
 
+/*
+ * Outgoing datagrams are gathered during one event-loop iteration and
+ * then, when the zero-delay timeout fires, flushed using a single
+ * sendmmsg() call (see ike-socket-batch=).  The likes of fragmented
+ * IKE_AUTH messages, and retransmits fired by the same timer tick,
+ * end up in one system call.
+ *
+ * Where the kernel supports it, a run of equal sized datagrams to the
+ * same peer (the last can be shorter), such as IKEv2 fragments, is
+ * sent as a single UDP GSO message.
+ *
+ * Since a queued datagram is only sent later, write_packet() can only
+ * report that it was queued.  A failed send is logged against a clone
+ * of the sender's logger (so it is still attributed to the state) and,
+ * like any other lost datagram, left to the retransmit timer.
+ */
+
+struct udp_send {
+	ip_endpoint remote_endpoint;
+	uint8_t *ptr;
+	size_t len;
+	struct logger *logger;	/* of the sender */
+};
+
+struct udp_send_queue {
+	const struct iface_endpoint *ifp;
+	struct timeout *timeout;
+	unsigned nr;
+	struct udp_send send[IKE_SOCKET_BATCH_MAX];
+};
+
+#ifdef UDP_SEGMENT
+static bool udp_gso_ok = true; /* cleared when the kernel says no */
+#endif
+
+static void udp_send_failed(const struct iface_endpoint *ifp,
+			    const struct udp_send *send, int error)
+{
+	endpoint_buf lb;
+	endpoint_buf rb;
+	llog_error(send->logger, error,
+		   "send on %s from %s to %s using %s failed",
+		   ifp->ip_dev->id_rname,
+		   str_endpoint(&ifp->local_endpoint, &lb),
+		   str_endpoint_sensitive(&send->remote_endpoint, &rb),
+		   ifp->io->protocol->name);
+}
+
+static void udp_send_one(const struct iface_endpoint *ifp,
+			 const struct udp_send *send)
+{
+	ip_sockaddr remote_sa = sockaddr_from_endpoint(send->remote_endpoint);
+	ssize_t wlen = sendto(ifp->fd, send->ptr, send->len, 0,
+			      &remote_sa.sa.sa, remote_sa.len);
+	if (wlen != (ssize_t)send->len) {
+		udp_send_failed(ifp, send, errno);
+	}
+}
+
+static void udp_flush_send_queue(const struct iface_endpoint *ifp)
+{
+	struct udp_send_queue *queue = ifp->udp.send_queue;
+	if (queue == NULL) {
+		return;
+	}
+
+	destroy_timeout(&queue->timeout);
+	if (queue->nr == 0) {
+		return;
+	}
+
+#ifdef MSG_ERRQUEUE
+	if (pluto_sock_errqueue) {
+		check_msg_errqueue(ifp, POLLOUT, __func__, &global_logger);
+	}
+#endif
+
+	/*
+	 * Build one message per datagram, or per run of GSO
+	 * segments.
+	 */
+	struct mmsghdr msgs[IKE_SOCKET_BATCH_MAX];
+	struct iovec iovs[IKE_SOCKET_BATCH_MAX];
+	ip_sockaddr sas[IKE_SOCKET_BATCH_MAX];
+	unsigned first[IKE_SOCKET_BATCH_MAX];	/* first queued datagram */
+	unsigned nr_segments[IKE_SOCKET_BATCH_MAX];
+#ifdef UDP_SEGMENT
+	union {
+		char buf[CMSG_SPACE(sizeof(uint16_t))];
+		struct cmsghdr align;
+	} cmsgs[IKE_SOCKET_BATCH_MAX];
+#endif
+	unsigned nr_msgs = 0;
+	for (unsigned i = 0; i < queue->nr; /*see below*/) {
+		const struct udp_send *send = &queue->send[i];
+		iovs[i] = (struct iovec) {
+			.iov_base = send->ptr,
+			.iov_len = send->len,
+		};
+		unsigned n = 1;
+#ifdef UDP_SEGMENT
+		size_t total = send->len;
+		while (udp_gso_ok && i + n < queue->nr &&
+		       queue->send[i + n - 1].len == send->len &&
+		       queue->send[i + n].len <= send->len &&
+		       /* must fit in one IPv6 datagram */
+		       total + queue->send[i + n].len <= 0xffff - 40 - sizeof(struct udphdr) &&
+		       endpoint_eq_endpoint(queue->send[i + n].remote_endpoint,
+					    send->remote_endpoint)) {
+			iovs[i + n] = (struct iovec) {
+				.iov_base = queue->send[i + n].ptr,
+				.iov_len = queue->send[i + n].len,
+			};
+			total += queue->send[i + n].len;
+			n++;
+		}
+#endif
+		sas[nr_msgs] = sockaddr_from_endpoint(send->remote_endpoint);
+		msgs[nr_msgs] = (struct mmsghdr) {
+			.msg_hdr = {
+				.msg_name = &sas[nr_msgs].sa.sa,
+				.msg_namelen = sas[nr_msgs].len,
+				.msg_iov = &iovs[i],
+				.msg_iovlen = n,
+			},
+		};
+#ifdef UDP_SEGMENT
+		if (n > 1) {
+			struct msghdr *msg = &msgs[nr_msgs].msg_hdr;
+			msg->msg_control = cmsgs[nr_msgs].buf;
+			msg->msg_controllen = sizeof(cmsgs[nr_msgs].buf);
+			struct cmsghdr *cm = CMSG_FIRSTHDR(msg);
+			cm->cmsg_level = SOL_UDP;
+			cm->cmsg_type = UDP_SEGMENT;
+			cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+			uint16_t segment_size = send->len;
+			memcpy(CMSG_DATA(cm), &segment_size, sizeof(segment_size));
+		}
+#endif
+		first[nr_msgs] = i;
+		nr_segments[nr_msgs] = n;
+		nr_msgs++;
+		i += n;
+	}
+
+	/*
+	 * sendmmsg() stops at the first message that fails; report
+	 * it and carry on with the next.
+	 */
+	unsigned done = 0;
+	while (done < nr_msgs) {
+		int nr_sent = sendmmsg(ifp->fd, &msgs[done], nr_msgs - done, 0);
+		if (nr_sent > 0) {
+			for (int m = 0; m < nr_sent; m++) {
+				if (nr_segments[done + m] > 1) {
+					pstats_ike_send.gso += nr_segments[done + m];
+				}
+			}
+			done += nr_sent;
+			continue;
+		}
+		int error = errno;
+		if (nr_segments[done] > 1) {
+#ifdef UDP_SEGMENT
+			/*
+			 * EINVAL is returned when a segment is
+			 * larger than the MTU; anything else means
+			 * GSO isn't usable.
+			 */
+			if (error != EINVAL) {
+				dbg("UDP GSO failed (%s), disabling", strerror(error));
+				udp_gso_ok = false;
+			}
+#endif
+			for (unsigned s = 0; s < nr_segments[done]; s++) {
+				udp_send_one(ifp, &queue->send[first[done] + s]);
+			}
+		} else {
+			udp_send_failed(ifp, &queue->send[first[done]], error);
+		}
+		done++;
+	}
+
+	pstats_ike_send.flushes++;
+	pstats_ike_send.datagrams += queue->nr;
+	pstats_batch_add(&pstats_ike_send.batch, queue->nr);
+	dbg("flushed %u datagrams using %u messages on %s",
+	    queue->nr, nr_msgs, ifp->ip_dev->id_rname);
+
+	for (unsigned i = 0; i < queue->nr; i++) {
+		pfree(queue->send[i].ptr);
+		free_logger(&queue->send[i].logger, HERE);
+	}
+	zero(&queue->send);
+	queue->nr = 0;
+}
+
+static void udp_send_queue_timeout(void *arg, const struct timer_event *event UNUSED)
+{
+	struct udp_send_queue *queue = arg;
+	udp_flush_send_queue(queue->ifp);
+}
+
 static ssize_t udp_write_packet(const struct iface_endpoint *ifp,
 				const void *ptr, size_t len,
 				const ip_endpoint *remote_endpoint,
 				struct logger *logger)
 {
+	/*
+	 * Queue the datagram for sendmmsg().  Marked datagrams need
+	 * their own SO_MARK and keep-alives (which are sent quietly)
+	 * bypass the queue; flush it first so that order is kept.
+	 */
+	struct udp_send_queue *queue = ifp->udp.send_queue;
+	if (queue != NULL &&
+#ifdef USE_XFRM_INTERFACE
+	    remote_endpoint->mark_out == 0 &&
+#endif
+	    !(len == 1 && ((const uint8_t *)ptr)[0] == 0xff)) {
+		if (queue->nr >= pluto_sock_batch ||
+		    queue->nr >= elemsof(queue->send)) {
+			udp_flush_send_queue(ifp);
+		}
+		queue->send[queue->nr++] = (struct udp_send) {
+			.remote_endpoint = *remote_endpoint,
+			.ptr = clone_bytes(ptr, len, "udp send"),
+			.len = len,
+			.logger = clone_logger(logger, HERE),
+		};
+		if (queue->timeout == NULL) {
+			schedule_timeout("udp send", &queue->timeout, deltatime(0),
+					 udp_send_queue_timeout, queue);
+		}
+		return len;
+	}
+	udp_flush_send_queue(ifp);
+
 #ifdef MSG_ERRQUEUE
 	if (pluto_sock_errqueue) {
 		check_msg_errqueue(ifp, POLLOUT, __func__, logger);
@@ -306,11 +641,20 @@ static void udp_listen(struct iface_endpoint *ifp,
 		attach_fd_read_listener(&ifp->udp.read_listener, ifp->fd,
 					"udp", process_iface_packet, ifp);
 	}
+	if (ifp->udp.send_queue == NULL && pluto_sock_batch > 1) {
+		ifp->udp.send_queue = alloc_thing(struct udp_send_queue, "udp send queue");
+		ifp->udp.send_queue->ifp = ifp;
+	}
 }
 
 static void udp_cleanup(struct iface_endpoint *ifp)
 {
 	detach_fd_read_listener(&ifp->udp.read_listener);
+	if (ifp->udp.send_queue != NULL) {
+		udp_flush_send_queue(ifp);
+		pfree(ifp->udp.send_queue);
+		ifp->udp.send_queue = NULL;
+	}
 }
 
 const struct iface_io udp_iface_io = {
@@ -321,6 +665,7 @@ const struct iface_io udp_iface_io = {
 	},
 	.protocol = &ip_protocol_udp,
 	.read_packet = udp_read_packet,
+	.read_packets = udp_read_packets,
 	.write_packet = udp_write_packet,
 	.listen = udp_listen,
 #ifdef UDP_ENCAP
@@ -354,7 +354,9 @@ static diag_t verify_v2AUTH_and_log_using_pubkey(struct authby authby,
 						 const struct pbs_in *signature_pbs,
 						 const struct hash_desc *hash_algo,
 						 const struct pubkey_signer *pubkey_signer,
-						 const char *signature_payload_name)
+						 const char *signature_payload_name,
+						 v2_auth_verification_cb *cb,
+						 bool *submitted)
 {
 	statetime_t start = statetime_start(&ike->sa);
 
@@ -399,6 +401,16 @@ static diag_t verify_v2AUTH_and_log_using_pubkey(struct authby authby,
 
 	struct crypt_mac hash = v2_calculate_sighash(ike, idhash, hash_algo,
 						     REMOTE_PERSPECTIVE);
+	if (cb != NULL) {
+		/* the result is passed to CB */
+		submit_v2_auth_verification(ike, &hash, signature,
+					    hash_algo, pubkey_signer,
+					    signature_payload_name, cb, HERE);
+		*submitted = true;
+		statetime_stop(&start, "%s()", __func__);
+		return NULL;
+	}
+
 	diag_t d = authsig_and_log_using_pubkey(ike, &hash, signature,
 						hash_algo, pubkey_signer,
 						signature_payload_name);
@@ -406,11 +418,13 @@ static diag_t verify_v2AUTH_and_log_using_pubkey(struct authby authby,
 	return d;
 }
 
-diag_t verify_v2AUTH_and_log(enum ikev2_auth_method recv_auth,
-			     struct ike_sa *ike,
-			     const struct crypt_mac *idhash_in,
-			     struct pbs_in *signature_pbs,
-			     const enum keyword_auth that_auth)
+static diag_t verify_or_submit_v2AUTH(enum ikev2_auth_method recv_auth,
+				      struct ike_sa *ike,
+				      const struct crypt_mac *idhash_in,
+				      struct pbs_in *signature_pbs,
+				      const enum keyword_auth that_auth,
+				      v2_auth_verification_cb *cb,
+				      bool *submitted)
 {
 	enum_buf ramb, eanb;
 	dbg("verifying auth payload, remote sent v2AUTH=%s we want auth=%s",
@@ -429,7 +443,8 @@ diag_t verify_v2AUTH_and_log(enum ikev2_auth_method recv_auth,
 							  signature_pbs,
 							  &ike_alg_hash_sha1,
 							  &pubkey_signer_raw_pkcs1_1_5_rsa,
-							  NULL/*legacy-signature-name*/);
+							  NULL/*legacy-signature-name*/,
+							  cb, submitted);
 
 	case IKEv2_AUTH_ECDSA_SHA2_256_P256:
 		return verify_v2AUTH_and_log_using_pubkey((struct authby) { .ecdsa = true, },
@@ -437,7 +452,8 @@ diag_t verify_v2AUTH_and_log(enum ikev2_auth_method recv_auth,
 							  signature_pbs,
 							  &ike_alg_hash_sha2_256,
 							  &pubkey_signer_raw_ecdsa/*_p256*/,
-							  NULL/*legacy-signature-name*/);
+							  NULL/*legacy-signature-name*/,
+							  cb, submitted);
 
 	case IKEv2_AUTH_ECDSA_SHA2_384_P384:
 		return verify_v2AUTH_and_log_using_pubkey((struct authby) { .ecdsa = true, },
@@ -445,14 +461,16 @@ diag_t verify_v2AUTH_and_log(enum ikev2_auth_method recv_auth,
 							  signature_pbs,
 							  &ike_alg_hash_sha2_384,
 							  &pubkey_signer_raw_ecdsa/*_p384*/,
-							  NULL/*legacy-signature-name*/);
+							  NULL/*legacy-signature-name*/,
+							  cb, submitted);
 	case IKEv2_AUTH_ECDSA_SHA2_512_P521:
 		return verify_v2AUTH_and_log_using_pubkey((struct authby) { .ecdsa = true, },
 							  ike, idhash_in,
 							  signature_pbs,
 							  &ike_alg_hash_sha2_512,
 							  &pubkey_signer_raw_ecdsa/*_p521*/,
-							  NULL/*legacy-signature-name*/);
+							  NULL/*legacy-signature-name*/,
+							  cb, submitted);
 
 	case IKEv2_AUTH_PSK:
 	{
@@ -574,7 +592,8 @@ diag_t verify_v2AUTH_and_log(enum ikev2_auth_method recv_auth,
 									  signature_pbs,
 									  (*hash),
 									  s->signer,
-									  "digital signature");
+									  "digital signature",
+									  cb, submitted);
 			}
 		}
 
@@ -591,3 +610,26 @@ diag_t verify_v2AUTH_and_log(enum ikev2_auth_method recv_auth,
 	}
 	}
 }
+
+diag_t verify_v2AUTH_and_log(enum ikev2_auth_method recv_auth,
+			     struct ike_sa *ike,
+			     const struct crypt_mac *idhash_in,
+			     struct pbs_in *signature_pbs,
+			     const enum keyword_auth that_auth)
+{
+	return verify_or_submit_v2AUTH(recv_auth, ike, idhash_in, signature_pbs,
+				       that_auth, NULL/*verify-inline*/, NULL);
+}
+
+diag_t submit_v2AUTH_verification(enum ikev2_auth_method recv_auth,
+				  struct ike_sa *ike,
+				  const struct crypt_mac *idhash_in,
+				  struct pbs_in *signature_pbs,
+				  const enum keyword_auth that_auth,
+				  v2_auth_verification_cb *cb,
+				  bool *submitted)
+{
+	*submitted = false;
+	return verify_or_submit_v2AUTH(recv_auth, ike, idhash_in, signature_pbs,
+				       that_auth, cb, submitted);
+}
@@ -70,4 +70,34 @@ diag_t verify_v2AUTH_and_log(enum ikev2_auth_method recv_auth,
 			     struct pbs_in *signature_pbs,
 			     const enum keyword_auth that_authby);
 
+/*
+ * Called with the result of an offloaded verification; on failure
+ * *D is set (and should be consumed).
+ */
+typedef stf_status (v2_auth_verification_cb)(struct ike_sa *ike,
+					     struct msg_digest *md,
+					     diag_t *d);
+
+void submit_v2_auth_verification(struct ike_sa *ike,
+				 const struct crypt_mac *hash,
+				 shunk_t signature,
+				 const struct hash_desc *hash_algo,
+				 const struct pubkey_signer *signer,
+				 const char *signature_payload_name,
+				 v2_auth_verification_cb *cb,
+				 where_t where);
+
+/*
+ * Like verify_v2AUTH_and_log() except that, when the peer used a
+ * public key, the signature is verified by a helper thread: when
+ * *SUBMITTED is set CB will be called with the result.
+ */
+diag_t submit_v2AUTH_verification(enum ikev2_auth_method recv_auth,
+				  struct ike_sa *ike,
+				  const struct crypt_mac *idhash_in,
+				  struct pbs_in *signature_pbs,
+				  const enum keyword_auth that_authby,
+				  v2_auth_verification_cb *cb,
+				  bool *submitted);
+
 #endif
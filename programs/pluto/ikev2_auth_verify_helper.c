@@ -0,0 +1,90 @@
+/* IKEv2 AUTH signature verification helper, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ */
+
+#include "crypt_mac.h"
+
+#include "defs.h"
+#include "ikev2_auth.h"
+#include "keys.h"
+#include "server_pool.h"
+#include "state.h"
+#include "log.h"
+
+/*
+ * The candidate keys are collected, and the result logged, on the
+ * main thread; only the public key operations are run by the helper.
+ */
+
+struct task {
+	/* in */
+	struct pubkey_verification *verification;
+	const char *signature_payload_name;	/* static */
+	v2_auth_verification_cb *cb;
+};
+
+static task_computer_fn v2_auth_verification_computer; /* type check */
+static task_completed_cb v2_auth_verification_completed; /* type check */
+static task_cleanup_cb v2_auth_verification_cleanup; /* type check */
+
+struct task_handler v2_auth_verification_handler = {
+	.name = "verify signature",
+	.computer_fn = v2_auth_verification_computer,
+	.completed_cb = v2_auth_verification_completed,
+	.cleanup_cb = v2_auth_verification_cleanup,
+};
+
+void submit_v2_auth_verification(struct ike_sa *ike,
+				 const struct crypt_mac *hash,
+				 shunk_t signature,
+				 const struct hash_desc *hash_algo,
+				 const struct pubkey_signer *signer,
+				 const char *signature_payload_name,
+				 v2_auth_verification_cb *cb,
+				 where_t where)
+{
+	struct task task = {
+		.verification = start_pubkey_verification(ike, hash, signature,
+							  hash_algo, signer),
+		.signature_payload_name = signature_payload_name,
+		.cb = cb,
+	};
+
+	submit_task(ike->sa.st_logger, &ike->sa /*state to resume*/,
+		    clone_thing(task, "verify signature task"),
+		    &v2_auth_verification_handler, where);
+}
+
+static void v2_auth_verification_computer(struct logger *logger, struct task *task,
+					  int unused_my_thread UNUSED)
+{
+	logtime_t start = logtime_start(logger);
+	verify_pubkey_verification(task->verification, logger);
+	logtime_stop(&start, "%s()", __func__);
+}
+
+static stf_status v2_auth_verification_completed(struct state *st,
+						 struct msg_digest *md,
+						 struct task *task)
+{
+	struct ike_sa *ike = pexpect_ike_sa(st);
+	diag_t d = finish_pubkey_verification(ike, task->verification,
+					      task->signature_payload_name);
+	return task->cb(ike, md, &d);
+}
+
+static void v2_auth_verification_cleanup(struct task **task)
+{
+	free_pubkey_verification(&(*task)->verification);
+	pfreeany(*task);
+}
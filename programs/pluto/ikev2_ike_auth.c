@@ -83,6 +83,8 @@ static stf_status process_v2_IKE_AUTH_request_ipseckey_continue(struct ike_sa *i
 								bool err);
 
 static stf_status process_v2_IKE_AUTH_request_id_tail(struct ike_sa *ike, struct msg_digest *md);
+static v2_auth_verification_cb process_v2_IKE_AUTH_request_auth_continue; /* type check */
+static stf_status process_v2_IKE_AUTH_request_auth_tail(struct ike_sa *ike, struct msg_digest *md);
 
 static v2_auth_signature_cb process_v2_IKE_AUTH_request_auth_signature_continue; /* type check */
 
@@ -825,20 +827,47 @@ stf_status process_v2_IKE_AUTH_request_id_tail(struct ike_sa *ike, struct msg_di
 		dbg("NULL_AUTH verified");
 	} else {
 		dbg("responder verifying AUTH payload");
-		diag_t d = verify_v2AUTH_and_log(md->chain[ISAKMP_NEXT_v2AUTH]->payload.v2auth.isaa_auth_method,
-						 ike, &idhash_in, &md->chain[ISAKMP_NEXT_v2AUTH]->pbs,
-						 remote_auth);
-		if (d != NULL) {
-			llog_diag(RC_LOG_SERIOUS, ike->sa.st_logger, &d, "%s", "");
-			dbg("I2 Auth Payload failed");
-			record_v2N_response(ike->sa.st_logger, ike, md,
-					    v2N_AUTHENTICATION_FAILED, NULL/*no data*/,
-					    ENCRYPTED_PAYLOAD);
-			pstat_sa_failed(&ike->sa, REASON_AUTH_FAILED);
-			return STF_FATAL;
+		/*
+		 * Public key operations are handed to a helper
+		 * thread; the result is passed to
+		 * process_v2_IKE_AUTH_request_auth_continue().
+		 */
+		bool submitted;
+		diag_t d = submit_v2AUTH_verification(md->chain[ISAKMP_NEXT_v2AUTH]->payload.v2auth.isaa_auth_method,
+						      ike, &idhash_in, &md->chain[ISAKMP_NEXT_v2AUTH]->pbs,
+						      remote_auth,
+						      process_v2_IKE_AUTH_request_auth_continue,
+						      &submitted);
+		if (submitted) {
+			pexpect(d == NULL);
+			return STF_SUSPEND;
 		}
+		return process_v2_IKE_AUTH_request_auth_continue(ike, md, &d);
+	}
+
+	return process_v2_IKE_AUTH_request_auth_tail(ike, md);
+}
+
+static stf_status process_v2_IKE_AUTH_request_auth_continue(struct ike_sa *ike,
+							    struct msg_digest *md,
+							    diag_t *d)
+{
+	if (*d != NULL) {
+		llog_diag(RC_LOG_SERIOUS, ike->sa.st_logger, d, "%s", "");
+		dbg("I2 Auth Payload failed");
+		record_v2N_response(ike->sa.st_logger, ike, md,
+				    v2N_AUTHENTICATION_FAILED, NULL/*no data*/,
+				    ENCRYPTED_PAYLOAD);
+		pstat_sa_failed(&ike->sa, REASON_AUTH_FAILED);
+		return STF_FATAL;
 	}
 
+	return process_v2_IKE_AUTH_request_auth_tail(ike, md);
+}
+
+static stf_status process_v2_IKE_AUTH_request_auth_tail(struct ike_sa *ike,
+							struct msg_digest *md)
+{
 	/* AUTH succeeded */
 
 #ifdef USE_PAM_AUTH
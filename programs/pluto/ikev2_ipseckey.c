@@ -44,6 +44,7 @@
 #include "keys.h"
 #include "secrets.h"
 #include "ikev2_ike_auth.h"
+#include "pubkey_db.h"
 
 #define LDNS_RR_TYPE_A 1
 #define LDNS_RR_TYPE_IPSECKEY 45
@@ -70,9 +71,10 @@ static void add_dns_pubkeys_to_pluto(struct p_dns_req *dnsr, struct dns_pubkey *
 
 	/* algorithm is hardcoded RSA -- PUBKEY_ALG_RSA */
 	/* delete only once. then multiple keys could be added */
-	delete_public_keys(&pluto_pubkeys, keyid, &pubkey_type_rsa);
+	delete_pluto_pubkeys(keyid, &pubkey_type_rsa);
 
 	realtime_t install_time = realnow();
+	struct pubkey_list *pubkeys = NULL;
 	for (struct dns_pubkey *dns_pubkey = dns_pubkeys; dns_pubkey != NULL; dns_pubkey = dns_pubkey->next) {
 
 		/*
@@ -113,7 +115,7 @@ static void add_dns_pubkeys_to_pluto(struct p_dns_req *dnsr, struct dns_pubkey *
 					       realtimesum(install_time, deltatime(ttl_used)),
 					       ttl,
 					       dns_pubkey->pubkey,
-					       NULL/*don't-return-pubkey*/, &pluto_pubkeys);
+					       NULL/*don't-return-pubkey*/, &pubkeys);
 		if (d != NULL) {
 			id_buf thatidbuf;
 			llog_diag(RC_LOG_SERIOUS, dnsr->logger, &d,
@@ -122,6 +124,7 @@ static void add_dns_pubkeys_to_pluto(struct p_dns_req *dnsr, struct dns_pubkey *
 				  dnsr->log_buf);
 		}
 	}
+	add_pluto_pubkeys(&pubkeys);
 }
 
 static void validate_address(struct p_dns_req *dnsr, unsigned char *addr)
@@ -260,8 +260,9 @@ void record_newaddr(ip_address *ip, char *a_type)
 	}
 }
 
-void record_deladdr(ip_address *ip, char *a_type)
+bool record_deladdr(ip_address *ip, char *a_type)
 {
+	bool migrating = false;
 	address_buf ip_str;
 	dbg("XFRM RTM_DELADDR %s %s", str_address(ip, &ip_str), a_type);
 	struct state_filter sf = {
@@ -288,6 +289,7 @@ void record_deladdr(ip_address *ip, char *a_type)
 
 		ip_address ip_p = ike->sa.st_deleted_local_addr;
 		ike->sa.st_deleted_local_addr = local_address;
+		migrating = true;
 		struct child_sa *child = child_sa_by_serialno(ike->sa.st_connection->newest_ipsec_sa);
 		if (child == NULL) {
 			llog_pexpect(ike->sa.st_logger, HERE,
@@ -315,6 +317,7 @@ void record_deladdr(ip_address *ip, char *a_type)
 			    ike->sa.st_serialno, ipstr(ip, &n), ipstr(&ip_p, &o));
 		}
 	}
+	return migrating;
 }
 
 static void record_n_send_v2_mobike_probe_request(struct ike_sa *ike)
@@ -34,6 +34,7 @@
 #include "timer.h"
 #include "log.h"
 #include "host_pair.h"
+#include "host_lookup.h"
 #include "orient.h"
 #include "ikev1.h"			/* for aggr_outI1() and main_outI1() */
 #include "ikev1_spdb.h"
@@ -475,6 +476,38 @@ static bool same_host(const char *a_dnshostname, const ip_address *a_host_addr,
 		b_dnshostname != NULL && streq(a_dnshostname, b_dnshostname);
 }
 
+static void initiate_connections_by_peer(struct host_pair *hp,
+					 const char *dnshostname,
+					 const ip_address *host_addr,
+					 struct logger *logger)
+{
+	for (struct connection *d = hp->connections; d != NULL; d = d->hp_next) {
+		if (same_host(dnshostname, host_addr,
+			      d->config->dnshostname,
+			      &d->remote->host.addr)) {
+			initiate_connection(d, NULL/*remote-host*/,
+					    false/*background*/,
+					    logger);
+		}
+	}
+}
+
+static host_lookup_cb restart_resolved_peer;
+
+static void restart_resolved_peer(struct connection *c, ip_address new_addr,
+				  struct logger *logger)
+{
+	/* host_pair/host_addr changes with dynamic dns */
+	update_host_pairs(c, new_addr);
+	if (c->host_pair == NULL) {
+		ldbg(logger, "no host pair to restart after lookup of \"%s\"",
+		     c->config->dnshostname);
+		return;
+	}
+	initiate_connections_by_peer(c->host_pair, c->config->dnshostname,
+				     &c->remote->host.addr, logger);
+}
+
 void restart_connections_by_peer(struct connection *const c, struct logger *logger)
 {
 	/*
@@ -508,27 +541,19 @@ void restart_connections_by_peer(struct connection *const c, struct logger *logg
 		d = next;
 	}
 
-	if (!c_is_instance) {
-		/* reference to c is OK because not CK_INSTANCE */
-		update_host_pairs(c);
-		/* host_pair/host_addr changes with dynamic dns */
-		hp = c->host_pair;
-		host_addr = c->remote->host.addr;
-	}
-
-	if (c_is_instance && hp_next == NULL) {
+	if (!c_is_instance && dnshostname != NULL) {
+		/*
+		 * Reference to c is OK because not CK_INSTANCE.  The
+		 * peer may have moved; re-resolve it before restarting
+		 * (possibly after this returns).
+		 */
+		lookup_host(c, address_type(&host_addr),
+			    restart_resolved_peer, logger);
+	} else if (c_is_instance && hp_next == NULL) {
 		/* in simple cases this is a dangling hp */
 		dbg("no connection to restart after termination");
 	} else {
-		for (struct connection *d = hp->connections; d != NULL; d = d->hp_next) {
-			if (same_host(dnshostname, &host_addr,
-				      d->config->dnshostname,
-				      &d->remote->host.addr)) {
-				initiate_connection(d, NULL/*remote-host*/,
-						    false/*background*/,
-						    logger);
-			}
-		}
+		initiate_connections_by_peer(hp, dnshostname, &host_addr, logger);
 	}
 	pfreeany(dnshostname);
 }
@@ -541,10 +566,10 @@ void restart_connections_by_peer(struct connection *const c, struct logger *logg
  * The order matters, we try to do the cheapest checks first.
  */
 
+static host_lookup_cb connection_ddns_resolved;
+
 static void connection_check_ddns1(struct connection *c, struct logger *logger)
 {
-	const char *e;
-
 	/* this is the cheapest check, so do it first */
 	if (c->config->dnshostname == NULL) {
 		connection_buf cb;
@@ -587,14 +612,22 @@ static void connection_check_ddns1(struct connection *c, struct logger *logger)
 		return;
 	}
 
-	/* XXX: blocking call */
-	ip_address new_remote_addr;
-	e = ttoaddress_dns(shunk1(c->config->dnshostname), NULL/*UNSPEC*/, &new_remote_addr);
-	if (e != NULL) {
+	lookup_host(c, NULL/*UNSPEC*/, connection_ddns_resolved, logger);
+}
+
+/*
+ * The answer to connection_check_ddns1()'s lookup; possibly some time
+ * later so re-check the connection.
+ */
+
+static void connection_ddns_resolved(struct connection *c, ip_address new_remote_addr,
+				     struct logger *logger)
+{
+	if (address_is_specified(c->remote->host.addr)) {
 		connection_buf cib;
 		ldbg(c->logger,
-		     "pending ddns: connection "PRI_CONNECTION" lookup of \"%s\" failed: %s",
-		     pri_connection(c, &cib), c->config->dnshostname, e);
+		     "pending ddns: connection "PRI_CONNECTION" has address",
+		     pri_connection(c, &cib));
 		return;
 	}
 
@@ -681,7 +714,7 @@ static void connection_check_ddns1(struct connection *c, struct logger *logger)
 	 * lookup
 	 */
 	ldbg(c->logger, "  updating host pairs");
-	update_host_pairs(c);
+	update_host_pairs(c, new_remote_addr);
 
 	if (!(c->policy & POLICY_UP)) {
 		connection_buf cib;
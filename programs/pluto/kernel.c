@@ -54,6 +54,7 @@
 #include "id.h"
 #include "connections.h"        /* needs id.h */
 #include "state.h"
+#include "state_db.h"		/* for state_db_rehash_child_spis() */
 #include "timer.h"
 #include "kernel.h"
 #include "kernel_ops.h"
@@ -2052,6 +2053,7 @@ const struct kernel_ops *const kernel_stacks[] = {
 };
 
 const struct kernel_ops *kernel_ops = NULL/*kernel_stacks[0]*/;
+deltatime_t sa_stats_max_age;	/* zero: query each SA */
 
 deltatime_t bare_shunt_interval = DELTATIME_INIT(SHUNT_SCAN_INTERVAL);
 
@@ -2084,6 +2086,9 @@ void show_kernel_interface(struct show *s)
 	if (kernel_ops != NULL) {
 		show_comment(s, "using kernel interface: %s",
 			     kernel_ops->interface_name);
+		if (kernel_ops->show_kernel_state_cache != NULL) {
+			kernel_ops->show_kernel_state_cache(s);
+		}
 	}
 }
 
@@ -2096,6 +2101,9 @@ bool install_inbound_ipsec_sa(struct child_sa *child, where_t where)
 {
 	struct connection *c = child->sa.st_connection;
 
+	/* the SPIs are final; make them findable */
+	state_db_rehash_child_spis(&child->sa);
+
 	/*
 	 * If our peer has a fixed-address client, check if we already
 	 * have a route for that client that conflicts.  We will take
@@ -2376,6 +2384,9 @@ bool install_ipsec_sa(struct child_sa *child, lset_t direction, where_t where)
 	PASSERT(logger, (direction & (DIRECTION_INBOUND|DIRECTION_OUTBOUND)) != LEMPTY);
 	PASSERT(logger, (direction & ~(DIRECTION_INBOUND|DIRECTION_OUTBOUND)) == LEMPTY);
 
+	/* the SPIs are final; make them findable */
+	state_db_rehash_child_spis(&child->sa);
+
 	/*
 	 * Pass +0: Lookup the status of each SPD.
 	 *
@@ -286,6 +286,11 @@ struct kernel_ops {
 				 uint64_t *add_time,
 				 uint64_t *lastused,
 				 struct logger *logger);
+	/*
+	 * Optional; report on any cache sitting behind
+	 * get_kernel_state().
+	 */
+	void (*show_kernel_state_cache)(struct show *s);
 
 	/*
 	 * Allocate and delete IPsec ESP/AH (IPCOMP) SPIs. (creating a
@@ -405,6 +410,12 @@ void teardown_ipsec_kernel_policies(enum routing_event event, struct child_sa *c
 void uninstall_kernel_states(struct child_sa *child);
 
 extern bool was_eroute_idle(struct child_sa *child, deltatime_t idle_max);
+/*
+ * How stale SA statistics returned by get_ipsec_traffic() can be;
+ * zero means query the kernel for each SA.
+ */
+extern deltatime_t sa_stats_max_age;
+
 extern bool get_ipsec_traffic(struct child_sa *child, struct ipsec_proto_info *sa, enum direction direction);
 bool kernel_ops_migrate_ipsec_sa(struct child_sa *child);
 
@@ -110,6 +110,9 @@
 #include "ip_packet.h"
 #include "sparse_names.h"
 #include "kernel_iface.h"
+#include "list_entry.h"
+#include "hash_bytes.h"
+#include "show.h"
 
 /* required for Linux 2.6.26 kernel and later */
 #ifndef XFRM_STATE_AF_UNSPEC
@@ -118,8 +121,10 @@
 
 static void netlink_process_xfrm_messages(int fd, void *arg, struct logger *logger);
 static void netlink_process_rtm_messages(int fd, void *arg, struct logger *logger);
+static void process_xfrm_replies(int fd, void *arg, struct logger *logger);
 
 static int nl_send_fd = NULL_FD; /* to send to NETLINK_XFRM */
+static uint32_t nl_send_seq;	/* last sequence number sent on nl_send_fd */
 static int netlink_xfrm_fd = NULL_FD; /* listen to NETLINK_XFRM broadcast */
 static int netlink_rtm_fd = NULL_FD; /* listen to NETLINK_ROUTE broadcast */
 
@@ -292,6 +297,10 @@ static void init_netlink(struct logger *logger)
 			    "socket() in init_netlink()");
 	}
 
+	/* replies to pipelined requests; server.c will clean this up */
+	add_fd_read_listener(nl_send_fd, "xfrm replies",
+			     process_xfrm_replies, NULL);
+
 	init_netlink_rtm_fd(logger);
 	init_netlink_xfrm_fd(logger);
 
@@ -319,6 +328,289 @@ static void init_netlink(struct logger *logger)
 	}
 }
 
+/*
+ * Pipelined requests.
+ *
+ * Requests that pluto doesn't need to wait on (currently only SA
+ * deletes; SPI allocation, SA add and policy add/replace still need
+ * their answer before the install can continue) are queued with
+ * queue_xfrm_request() instead of being sent with
+ * sendrecv_xfrm_msg().  The queue is written to nl_send_fd with a
+ * single sendmsg() (the kernel then processes the messages in order)
+ * once a batch fills, on the next pass through the event loop, or
+ * before any synchronous request so that the kernel still sees
+ * requests in the order they were made.
+ *
+ * Each reply is matched to its request using nlmsg_seq and handed to
+ * the request's callback; either from the nl_send_fd listener or,
+ * when it turns up while a synchronous request is waiting for its
+ * own reply, from there.  Requests must set NLM_F_ACK and expect
+ * nothing but the ACK.
+ */
+
+#define XFRM_REQUEST_BATCH 32		/* messages per sendmsg() */
+#define XFRM_REQUEST_IN_FLIGHT 128	/* else wait; don't overflow the receive buffer */
+
+struct xfrm_request;
+typedef void (xfrm_reply_cb)(const struct xfrm_request *request, int error,
+			     struct logger *logger);
+
+struct xfrm_request {
+	struct list_entry entry;
+	uint32_t seq;
+	xfrm_reply_cb *cb;
+	const char *description;	/* static */
+	char *story;
+	size_t len;
+	uint8_t msg[];			/* struct nlmsghdr ... */
+};
+
+static void jam_xfrm_request(struct jambuf *buf, const void *data)
+{
+	if (data == NULL) {
+		jam(buf, "no xfrm request");
+	} else {
+		const struct xfrm_request *request = data;
+		jam(buf, "xfrm request %u %s %s",
+		    request->seq, request->description, request->story);
+	}
+}
+
+LIST_INFO(xfrm_request, entry, xfrm_request_info, jam_xfrm_request);
+
+static struct list_head queued_xfrm_requests =
+	INIT_LIST_HEAD(&queued_xfrm_requests, &xfrm_request_info);
+static struct list_head in_flight_xfrm_requests =
+	INIT_LIST_HEAD(&in_flight_xfrm_requests, &xfrm_request_info);
+
+static struct {
+	unsigned queued;
+	unsigned in_flight;
+	uintmax_t batches;
+	uintmax_t requests;
+	struct timeout *timeout;
+} xfrm_requests;
+
+static void reply_xfrm_request(struct xfrm_request *request, int error)
+{
+	/* the request outlives whatever queued it; log globally */
+	request->cb(request, error, &global_logger);
+	pfreeany(request->story);
+	pfree(request);
+}
+
+/*
+ * Pass the reply N to the pipelined request it belongs to.  Returns
+ * false when there is no such request (it was for an earlier,
+ * abandoned, synchronous request).
+ */
+
+static bool dispatch_xfrm_reply(const struct nlmsghdr *n)
+{
+	struct xfrm_request *request;
+	FOR_EACH_LIST_ENTRY_OLD2NEW(request, &in_flight_xfrm_requests) {
+		if (request->seq != n->nlmsg_seq) {
+			continue;
+		}
+		int error = 0;
+		if (n->nlmsg_type == NLMSG_ERROR &&
+		    n->nlmsg_len >= NLMSG_LENGTH(sizeof(struct nlmsgerr))) {
+			const struct nlmsgerr *err = NLMSG_DATA(n);
+			error = -err->error;
+		}
+		remove_list_entry(&request->entry);
+		xfrm_requests.in_flight--;
+		reply_xfrm_request(request, error);
+		return true;
+	}
+	return false;
+}
+
+static void abandon_xfrm_requests(int error, struct logger *logger)
+{
+	llog_error(logger, error,
+		   "netlink recvfrom() of replies to %u pipelined requests failed; abandoning them",
+		   xfrm_requests.in_flight);
+	struct xfrm_request *request;
+	FOR_EACH_LIST_ENTRY_OLD2NEW(request, &in_flight_xfrm_requests) {
+		remove_list_entry(&request->entry);
+		xfrm_requests.in_flight--;
+		reply_xfrm_request(request, error);
+	}
+}
+
+/*
+ * Read (at most) one batch of replies.  With MSG_DONTWAIT, returns
+ * immediately when there's nothing to read.
+ *
+ * Any other error abandons the in-flight requests (their replies
+ * can't be recovered) and returns false; callers waiting for
+ * .in_flight to drop therefore always make progress.
+ */
+
+static bool recv_xfrm_replies(int flags, struct logger *logger)
+{
+	struct nlm_resp rsp;
+	struct sockaddr_nl addr;
+	socklen_t alen = sizeof(addr);
+	ssize_t r;
+	do {
+		r = recvfrom(nl_send_fd, &rsp, sizeof(rsp), flags,
+			     (struct sockaddr *)&addr, &alen);
+	} while (r < 0 && errno == EINTR);
+
+	if (r < 0) {
+		if (errno == EAGAIN && (flags & MSG_DONTWAIT)) {
+			return true;
+		}
+		/*
+		 * For instance ENOBUFS: the kernel dropped replies;
+		 * which is unknown.
+		 */
+		abandon_xfrm_requests(errno, logger);
+		return false;
+	}
+
+	if (addr.nl_pid != 0) {
+		/* not for us: ignore */
+		return true;
+	}
+
+	size_t len = r;
+	for (const struct nlmsghdr *n = &rsp.n; NLMSG_OK(n, len); n = NLMSG_NEXT(n, len)) {
+		if (!dispatch_xfrm_reply(n)) {
+			sparse_buf sb;
+			ldbg(logger, "%s() ignoring unexpected %s message %u",
+			     __func__, str_sparse(xfrm_type_names, n->nlmsg_type, &sb),
+			     n->nlmsg_seq);
+		}
+	}
+	return true;
+}
+
+static void process_xfrm_replies(int fd UNUSED, void *arg UNUSED, struct logger *logger)
+{
+	recv_xfrm_replies(MSG_DONTWAIT, logger);
+}
+
+/*
+ * Send everything queued, XFRM_REQUEST_BATCH messages per
+ * sendmsg().
+ */
+
+static void send_xfrm_requests(struct logger *logger)
+{
+	destroy_timeout(&xfrm_requests.timeout);
+
+	while (xfrm_requests.queued > 0) {
+
+		/* don't let the ACKs overflow the receive buffer */
+		while (xfrm_requests.in_flight >= XFRM_REQUEST_IN_FLIGHT &&
+		       recv_xfrm_replies(0, logger)) {
+			/* false once the requests are abandoned */
+		}
+
+		struct xfrm_request *batch[XFRM_REQUEST_BATCH];
+		struct iovec iov[XFRM_REQUEST_BATCH];
+		unsigned nr = 0;
+		struct xfrm_request *request;
+		FOR_EACH_LIST_ENTRY_OLD2NEW(request, &queued_xfrm_requests) {
+			if (nr >= elemsof(batch)) {
+				break;
+			}
+			batch[nr] = request;
+			iov[nr] = (struct iovec) {
+				.iov_base = request->msg,
+				.iov_len = request->len,
+			};
+			nr++;
+		}
+
+		struct msghdr msg = {
+			.msg_iov = iov,
+			.msg_iovlen = nr,
+		};
+		ssize_t r;
+		do {
+			r = sendmsg(nl_send_fd, &msg, 0);
+		} while (r < 0 && errno == EINTR);
+		int error = (r < 0 ? errno : 0);
+		if (r < 0) {
+			llog_error(logger, error,
+				   "netlink sendmsg() of %u pipelined requests failed", nr);
+		}
+
+		xfrm_requests.batches++;
+		ldbg(logger, "%s() sent %u requests in one batch", __func__, nr);
+
+		for (unsigned i = 0; i < nr; i++) {
+			struct xfrm_request *request = batch[i];
+			remove_list_entry(&request->entry);
+			xfrm_requests.queued--;
+			if (error != 0) {
+				reply_xfrm_request(request, error);
+				continue;
+			}
+			insert_list_entry(&in_flight_xfrm_requests, &request->entry);
+			xfrm_requests.in_flight++;
+		}
+	}
+}
+
+static void send_xfrm_requests_cb(void *arg UNUSED, const struct timer_event *event)
+{
+	send_xfrm_requests(event->logger);
+}
+
+/*
+ * Queue HDR (which is copied) for sending; CB is called with the
+ * kernel's verdict.
+ */
+
+static void queue_xfrm_request(const struct nlmsghdr *hdr,
+			       const char *description, const char *story,
+			       xfrm_reply_cb *cb, struct logger *logger)
+{
+	PASSERT(logger, hdr->nlmsg_flags & NLM_F_ACK);
+	size_t len = NLMSG_ALIGN(hdr->nlmsg_len);
+	struct xfrm_request *request = over_alloc_thing(struct xfrm_request, len);
+	request->seq = ++nl_send_seq;
+	request->cb = cb;
+	request->description = description;
+	request->story = clone_str(story, "xfrm request story");
+	request->len = len;
+	memcpy(request->msg, hdr, hdr->nlmsg_len);
+	((struct nlmsghdr *)request->msg)->nlmsg_seq = request->seq;
+
+	init_list_entry(&xfrm_request_info, request, &request->entry);
+	insert_list_entry(&queued_xfrm_requests, &request->entry);
+	xfrm_requests.queued++;
+	xfrm_requests.requests++;
+
+	if (xfrm_requests.queued >= XFRM_REQUEST_BATCH) {
+		send_xfrm_requests(logger);
+	} else if (xfrm_requests.timeout == NULL) {
+		/* send with whatever else is queued by this event */
+		schedule_timeout("xfrm requests", &xfrm_requests.timeout,
+				 deltatime(0), send_xfrm_requests_cb, NULL);
+	}
+}
+
+/*
+ * Send everything queued and wait for the replies.
+ */
+
+static void flush_xfrm_requests(struct logger *logger)
+{
+	send_xfrm_requests(logger);
+	while (xfrm_requests.in_flight > 0 &&
+	       recv_xfrm_replies(0, logger)) {
+		/* false once the requests are abandoned */
+	}
+	ldbg(logger, "%s() %ju requests sent in %ju batches",
+	     __func__, xfrm_requests.requests, xfrm_requests.batches);
+}
+
 /*
  * sendrecv_xfrm_msg()
  *
@@ -345,11 +637,14 @@ static bool sendrecv_xfrm_msg(struct nlmsghdr *hdr,
 	}
 
 	ssize_t r;
-	static uint32_t seq = 0;	/* STATIC */
+	/* keep the kernel seeing requests in the order they were made */
+	send_xfrm_requests(logger);
+
+	uint32_t seq = ++nl_send_seq;
 
 	*recv_errno = 0;
 
-	hdr->nlmsg_seq = ++seq;
+	hdr->nlmsg_seq = seq;
 	do {
 		r = write(nl_send_fd, hdr, len);
 	} while (r < 0 && errno == EINTR);
@@ -414,6 +709,9 @@ static bool sendrecv_xfrm_msg(struct nlmsghdr *hdr,
 		}
 
 		if (rsp.n.nlmsg_seq != seq) {
+			if (dispatch_xfrm_reply(&rsp.n)) {
+				continue;
+			}
 			sparse_buf sb;
 			ldbg(logger, "%s() ignoring out of sequence (%u/%u) message %s",
 			     __func__, rsp.n.nlmsg_seq, seq,
@@ -1365,6 +1663,324 @@ static bool xfrm_detect_offload(const struct raw_iface *ifp, struct logger *logg
 	return ret;
 }
 
+/*
+ * Kernel SA statistics cache.
+ *
+ * With sa-stats-max-age= set, xfrm_get_kernel_state() answers from
+ * a table filled by a single XFRM_MSG_GETSA dump instead of sending
+ * one XFRM_MSG_GETSA per SA (trafficstatus, liveness and idle checks
+ * otherwise do a blocking round trip per SA per direction).
+ *
+ * The table is refilled once it is older than sa-stats-max-age.  An
+ * SA missing from the table (for instance, one added since the last
+ * dump) is queried individually.  Adding or deleting an SA drops its
+ * entry so that a re-used SPI can't pick up stale counters.
+ */
+
+struct sa_stats {
+	xfrm_address_t daddr;
+	uint32_t spi;		/* network order */
+	uint16_t family;
+	uint8_t proto;
+	bool forgotten;
+	uint64_t bytes;
+	uint64_t add_time;
+	uint64_t lastused;
+	unsigned next;		/* index+1 of next entry in bucket; 0 ends */
+};
+
+static struct {
+	bool valid;
+	monotime_t filled;
+	deltatime_t fill_time;
+	struct sa_stats *entries;
+	unsigned nr_entries;
+	unsigned max_entries;
+	unsigned *buckets;	/* index+1 of first entry; 0 is empty */
+	unsigned nr_buckets;
+	uint8_t *buf;
+	uintmax_t dumps;
+	uintmax_t failures;
+	uintmax_t hits;
+	uintmax_t misses;
+} sa_stats_cache;
+
+#define SA_STATS_DUMP_BUFSIZ (64 * 1024)
+
+static hash_t hash_sa_stats(const xfrm_address_t *daddr, uint32_t spi,
+			    uint8_t proto, uint16_t family)
+{
+	hash_t hash = zero_hash;
+	hash = hash_thing(spi, hash);
+	hash = hash_thing(proto, hash);
+	hash = hash_thing(family, hash);
+	/* only the IPv4 part of the address is significant */
+	hash = hash_bytes(daddr, (family == AF_INET ? sizeof(daddr->a4) :
+				  sizeof(daddr->a6)), hash);
+	return hash;
+}
+
+static struct sa_stats *find_sa_stats(const xfrm_address_t *daddr, uint32_t spi,
+				      uint8_t proto, uint16_t family)
+{
+	if (sa_stats_cache.nr_buckets == 0) {
+		return NULL;
+	}
+	size_t len = (family == AF_INET ? sizeof(daddr->a4) : sizeof(daddr->a6));
+	hash_t hash = hash_sa_stats(daddr, spi, proto, family);
+	for (unsigned i = sa_stats_cache.buckets[hash.hash % sa_stats_cache.nr_buckets];
+	     i != 0; i = sa_stats_cache.entries[i - 1].next) {
+		struct sa_stats *e = &sa_stats_cache.entries[i - 1];
+		if (e->spi == spi && e->proto == proto && e->family == family &&
+		    memeq(&e->daddr, daddr, len)) {
+			return e;
+		}
+	}
+	return NULL;
+}
+
+static void index_sa_stats(void)
+{
+	/* aim for a load factor of about one */
+	unsigned nr_buckets = 64;
+	while (nr_buckets < sa_stats_cache.nr_entries) {
+		nr_buckets *= 2;
+	}
+	if (nr_buckets != sa_stats_cache.nr_buckets) {
+		pfreeany(sa_stats_cache.buckets);
+		sa_stats_cache.buckets = alloc_things(unsigned, nr_buckets, "sa stats buckets");
+		sa_stats_cache.nr_buckets = nr_buckets;
+	} else {
+		memset(sa_stats_cache.buckets, 0, nr_buckets * sizeof(unsigned));
+	}
+	for (unsigned i = 0; i < sa_stats_cache.nr_entries; i++) {
+		struct sa_stats *e = &sa_stats_cache.entries[i];
+		hash_t hash = hash_sa_stats(&e->daddr, e->spi, e->proto, e->family);
+		unsigned *bucket = &sa_stats_cache.buckets[hash.hash % nr_buckets];
+		e->next = *bucket;
+		*bucket = i + 1;
+	}
+}
+
+/*
+ * Add the XFRM_MSG_NEWSA message N, from the dump, to the table.
+ */
+
+static void add_sa_stats(const struct nlmsghdr *n, struct logger *logger)
+{
+	if (n->nlmsg_len < NLMSG_SPACE(sizeof(struct xfrm_usersa_info))) {
+		ldbg(logger, "%s() XFRM_MSG_NEWSA truncated: %u bytes; ignored",
+		     __func__, n->nlmsg_len);
+		return;
+	}
+
+	const struct xfrm_usersa_info *info = NLMSG_DATA(n);
+
+	if (sa_stats_cache.nr_entries >= sa_stats_cache.max_entries) {
+		unsigned max = (sa_stats_cache.max_entries == 0 ? 64 :
+				sa_stats_cache.max_entries * 2);
+		realloc_things(sa_stats_cache.entries,
+			       sa_stats_cache.max_entries, max,
+			       "sa stats entries");
+		sa_stats_cache.max_entries = max;
+	}
+
+	struct sa_stats *e = &sa_stats_cache.entries[sa_stats_cache.nr_entries++];
+	*e = (struct sa_stats) {
+		.daddr = info->id.daddr,
+		.spi = info->id.spi,
+		.proto = info->id.proto,
+		.family = info->family,
+		.bytes = info->curlft.bytes,
+		.add_time = info->curlft.add_time,
+	};
+
+	/* run through rtattributes looking for XFRMA_LASTUSED */
+	const struct rtattr *attr = (const struct rtattr *)
+		((const uint8_t *)info + NLMSG_ALIGN(sizeof(*info)));
+	int remaining = n->nlmsg_len - NLMSG_SPACE(sizeof(*info));
+	for (; RTA_OK(attr, remaining); attr = RTA_NEXT(attr, remaining)) {
+		if (attr->rta_type == XFRMA_LASTUSED &&
+		    RTA_PAYLOAD(attr) >= sizeof(e->lastused)) {
+			memcpy(&e->lastused, RTA_DATA(attr), sizeof(e->lastused));
+		}
+	}
+}
+
+/*
+ * Refill the table using a single XFRM_MSG_GETSA dump; each chunk
+ * is parsed as it arrives so only one receive buffer is needed.
+ */
+
+static bool dump_sa_stats(struct logger *logger)
+{
+	send_xfrm_requests(logger);
+
+	struct nlmsghdr req = {
+		.nlmsg_len = NLMSG_LENGTH(0),
+		.nlmsg_type = XFRM_MSG_GETSA,
+		.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP,
+		.nlmsg_seq = ++nl_send_seq,
+	};
+
+	ssize_t r;
+	do {
+		r = write(nl_send_fd, &req, req.nlmsg_len);
+	} while (r < 0 && errno == EINTR);
+	if (r < 0) {
+		llog_error(logger, errno,
+			   "netlink write() of XFRM_MSG_GETSA dump request failed");
+		return false;
+	}
+	if ((size_t)r != req.nlmsg_len) {
+		llog_error(logger, 0/*no-errno*/,
+			   "netlink write() of XFRM_MSG_GETSA dump request truncated: %zd instead of %u",
+			   r, req.nlmsg_len);
+		return false;
+	}
+
+	if (sa_stats_cache.buf == NULL) {
+		sa_stats_cache.buf = alloc_bytes(SA_STATS_DUMP_BUFSIZ, "sa stats dump buffer");
+	}
+
+	sa_stats_cache.nr_entries = 0;
+	for (;;) {
+		struct sockaddr_nl addr;
+		socklen_t alen = sizeof(addr);
+		r = recvfrom(nl_send_fd, sa_stats_cache.buf, SA_STATS_DUMP_BUFSIZ, 0,
+			     (struct sockaddr *)&addr, &alen);
+		if (r < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			llog_error(logger, errno,
+				   "netlink recvfrom() of XFRM_MSG_GETSA dump failed");
+			return false;
+		}
+
+		if (addr.nl_pid != 0) {
+			/* not for us: ignore */
+			continue;
+		}
+
+		size_t len = r;
+		for (const struct nlmsghdr *n = (const struct nlmsghdr *)sa_stats_cache.buf;
+		     NLMSG_OK(n, len); n = NLMSG_NEXT(n, len)) {
+
+			if (n->nlmsg_seq != req.nlmsg_seq) {
+				if (dispatch_xfrm_reply(n)) {
+					continue;
+				}
+				sparse_buf sb;
+				ldbg(logger, "%s() ignoring out of sequence (%u/%u) message %s",
+				     __func__, n->nlmsg_seq, req.nlmsg_seq,
+				     str_sparse(xfrm_type_names, n->nlmsg_type, &sb));
+				continue;
+			}
+
+			switch (n->nlmsg_type) {
+			case NLMSG_DONE:
+				index_sa_stats();
+				return true;
+			case NLMSG_ERROR:
+			{
+				const struct nlmsgerr *err = NLMSG_DATA(n);
+				llog_error(logger, -err->error,
+					   "netlink XFRM_MSG_GETSA dump failed");
+				return false;
+			}
+			case XFRM_MSG_NEWSA:
+				add_sa_stats(n, logger);
+				break;
+			default:
+			{
+				sparse_buf sb;
+				ldbg(logger, "%s() ignoring unexpected %s message",
+				     __func__, str_sparse(xfrm_type_names, n->nlmsg_type, &sb));
+				break;
+			}
+			}
+		}
+	}
+}
+
+static void refill_sa_stats(monotime_t now, struct logger *logger)
+{
+	sa_stats_cache.dumps++;
+	/* on failure, wait for the next refill before trying again */
+	sa_stats_cache.filled = now;
+	sa_stats_cache.valid = dump_sa_stats(logger);
+	sa_stats_cache.fill_time = monotimediff(mononow(), now);
+	if (!sa_stats_cache.valid) {
+		sa_stats_cache.failures++;
+		sa_stats_cache.nr_entries = 0;
+		return;
+	}
+	deltatime_buf db;
+	ldbg(logger, "kernel: cached statistics for %u SAs in %s seconds",
+	     sa_stats_cache.nr_entries, str_deltatime(sa_stats_cache.fill_time, &db));
+}
+
+static const struct sa_stats *get_sa_stats(const struct kernel_state *sa,
+					   struct logger *logger)
+{
+	monotime_t now = mononow();
+	/* a failed dump is only retried after sa-stats-max-age */
+	if (sa_stats_cache.dumps == 0 ||
+	    monotime_cmp(monotime_add(sa_stats_cache.filled, sa_stats_max_age), <=, now)) {
+		refill_sa_stats(now, logger);
+	}
+	if (!sa_stats_cache.valid) {
+		return NULL;
+	}
+
+	xfrm_address_t daddr = xfrm_from_address(&sa->dst.address);
+	struct sa_stats *e = find_sa_stats(&daddr, sa->spi, sa->proto->ipproto,
+					   address_info(sa->src.address)->af);
+	if (e == NULL || e->forgotten) {
+		sa_stats_cache.misses++;
+		return NULL;
+	}
+	sa_stats_cache.hits++;
+	return e;
+}
+
+static void forget_sa_stats(ipsec_spi_t spi, const struct ip_protocol *proto,
+			    const ip_address *src, const ip_address *dst)
+{
+	if (!sa_stats_cache.valid) {
+		return;
+	}
+	xfrm_address_t daddr = xfrm_from_address(dst);
+	struct sa_stats *e = find_sa_stats(&daddr, spi, proto->ipproto,
+					   address_info(*src)->af);
+	if (e != NULL) {
+		e->forgotten = true;
+	}
+}
+
+static void free_sa_stats(void)
+{
+	pfreeany(sa_stats_cache.entries);
+	pfreeany(sa_stats_cache.buckets);
+	pfreeany(sa_stats_cache.buf);
+	zero(&sa_stats_cache);
+}
+
+static void xfrm_show_kernel_state_cache(struct show *s)
+{
+	if (deltatime_cmp(sa_stats_max_age, ==, deltatime(0))) {
+		return;
+	}
+	deltatime_buf mab, ftb;
+	show_comment(s, "SA statistics cache: max-age=%s, SAs=%u, dumps=%ju, failures=%ju, hits=%ju, misses=%ju, last-dump=%ss",
+		     str_deltatime(sa_stats_max_age, &mab),
+		     (sa_stats_cache.valid ? sa_stats_cache.nr_entries : 0),
+		     sa_stats_cache.dumps, sa_stats_cache.failures,
+		     sa_stats_cache.hits, sa_stats_cache.misses,
+		     str_deltatime(sa_stats_cache.fill_time, &ftb));
+}
+
 /*
  * netlink_add_sa - Add an SA into the kernel SPDB via netlink
  *
@@ -1382,6 +1998,8 @@ static bool netlink_add_sa(const struct kernel_state *sa, bool replace,
 	} req;
 	struct rtattr *attr;
 
+	forget_sa_stats(sa->spi, sa->proto, &sa->src.address, &sa->dst.address);
+
 	zero(&req);
 	req.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
 	req.n.nlmsg_type = replace ? XFRM_MSG_UPDSA : XFRM_MSG_NEWSA;
@@ -1741,6 +2359,15 @@ static bool netlink_add_sa(const struct kernel_state *sa, bool replace,
 	return ret;
 }
 
+static void xfrm_del_sa_reply(const struct xfrm_request *request, int error,
+			      struct logger *logger)
+{
+	if (error != 0) {
+		llog_error(logger, error, "netlink response for %s %s",
+			   request->description, request->story);
+	}
+}
+
 /*
  * netlink_del_sa - Delete an SA from the Kernel
  *
@@ -1760,6 +2387,8 @@ static bool xfrm_del_ipsec_spi(ipsec_spi_t spi,
 		char data[MAX_NETLINK_DATA_SIZE];
 	} req;
 
+	forget_sa_stats(spi, proto, src_address, dst_address);
+
 	zero(&req);
 	req.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
 	req.n.nlmsg_type = XFRM_MSG_DELSA;
@@ -1772,10 +2401,9 @@ static bool xfrm_del_ipsec_spi(ipsec_spi_t spi,
 
 	req.n.nlmsg_len = NLMSG_ALIGN(NLMSG_LENGTH(sizeof(req.id)));
 
-	int recv_errno;
-	return sendrecv_xfrm_msg(&req.n, NLMSG_NOOP, NULL,
-				 "Del SA", story,
-				 &recv_errno, logger);
+	/* nothing needs the result; pipeline it */
+	queue_xfrm_request(&req.n, "Del SA", story, xfrm_del_sa_reply, logger);
+	return true;
 }
 
 /*
@@ -2061,12 +2689,43 @@ static void netlink_shunt_expire(struct xfrm_userpolicy_info *pol,
 	}
 }
 
+/*
+ * Would find_raw_ifaces4() include the device?  It skips interfaces
+ * that are down and bonding slaves.
+ */
+
+static bool ipv4_iface_usable(const char *ifname, struct logger *logger)
+{
+	struct ifreq ifr = {0};
+	jam_str(ifr.ifr_name, sizeof(ifr.ifr_name), ifname);
+	if (ioctl(nl_send_fd, SIOCGIFFLAGS, &ifr) != 0) {
+		llog_error(logger, errno, "ignored interface %s - ioctl(SIOCGIFFLAGS) failed",
+			   ifname);
+		return false;
+	}
+	if (!(ifr.ifr_flags & IFF_UP)) {
+		ldbg(logger, "  ignoring non-up interface %s", ifname);
+		return false;
+	}
+#ifdef IFF_SLAVE
+	if (ifr.ifr_flags & IFF_SLAVE) {
+		ldbg(logger, "  ignoring slave interface %s", ifname);
+		return false;
+	}
+#endif
+	return true;
+}
+
 static void process_addr_change(struct nlmsghdr *n, struct logger *logger)
 {
 	struct ifaddrmsg *nl_msg = NLMSG_DATA(n);
 	struct rtattr *rta = IFLA_RTA(nl_msg);
 	size_t msg_size = IFA_PAYLOAD (n);
 	ip_address ip;
+	ip_address local = unset_address;
+	ip_address address = unset_address;
+	const char *label = NULL;
+	bool migrating = false;
 
 	sparse_buf sb;
 	ldbg(logger, "%s() xfrm netlink address change %s msg len %zu",
@@ -2084,8 +2743,9 @@ static void process_addr_change(struct nlmsghdr *n, struct logger *logger)
 				llog(RC_LOG, logger,
 					    "ERROR IFA_LOCAL invalid %s", ugh);
 			} else {
+				local = ip;
 				if (n->nlmsg_type == RTM_DELADDR)
-					record_deladdr(&ip, "IFA_LOCAL");
+					migrating = record_deladdr(&ip, "IFA_LOCAL");
 				else if (n->nlmsg_type == RTM_NEWADDR)
 					record_newaddr(&ip, "IFA_LOCAL");
 			}
@@ -2098,12 +2758,17 @@ static void process_addr_change(struct nlmsghdr *n, struct logger *logger)
 				llog(RC_LOG, logger,
 					    "ERROR IFA_ADDRESS invalid %s", ugh);
 			} else {
+				address = ip;
 				address_buf ip_str;
 				ldbg(logger, "%s() XFRM IFA_ADDRESS %s IFA_ADDRESS is this PPP?",
 				     __func__, str_address(&ip, &ip_str));
 			}
 			break;
 
+		case IFA_LABEL:
+			label = RTA_DATA(rta);
+			break;
+
 		default:
 		{
 			sparse_buf sb;
@@ -2116,7 +2781,107 @@ static void process_addr_change(struct nlmsghdr *n, struct logger *logger)
 
 		rta = RTA_NEXT(rta, msg_size);
 	}
+
+	/*
+	 * Now update the interface.  IFA_LOCAL, when present, is the
+	 * interface's address (IFA_ADDRESS is then the PPP peer);
+	 * IPv6 only sends IFA_ADDRESS.
+	 */
+
+	ip = (local.is_set ? local : address);
+	if (!address_is_specified(ip)) {
+		return;
+	}
+
+	char ifname[IF_NAMESIZE];
+	bool have_ifname = true;
+	int ifname_errno = 0;
+	if (label != NULL) {
+		jam_str(ifname, sizeof(ifname), label);
+	} else if (if_indextoname(nl_msg->ifa_index, ifname) == NULL) {
+		ifname_errno = errno; /* save!!! */
+		have_ifname = false;
+	}
+
+	if (n->nlmsg_type == RTM_DELADDR) {
+		address_buf ab;
+		if (migrating) {
+			ldbg(logger, "%s() leaving interface %s for MOBIKE",
+			     __func__, str_address(&ip, &ab));
+			return;
+		}
+		/* the link may already be gone; then match any */
+		struct iface_dev *ifd = find_live_iface_dev(have_ifname ? ifname : NULL, ip);
+		if (ifd == NULL) {
+			ldbg(logger, "%s() no interface with %s",
+			     __func__, str_address(&ip, &ab));
+			return;
+		}
+		delete_iface_address(ifd, logger);
+		return;
+	}
+
+	/* same filters as find_raw_ifaces[46]() */
+	if (!have_ifname) {
+		llog_error(logger, ifname_errno, "ignored address, no interface with index %u",
+			   nl_msg->ifa_index);
+		return;
+	}
+
+	if (nl_msg->ifa_family == AF_INET6) {
+		if (nl_msg->ifa_scope == RT_SCOPE_LINK) {
+			ldbg(logger, "  ignoring link-local address on %s", ifname);
+			return;
+		}
+		if (nl_msg->ifa_flags & (IFA_F_TENTATIVE|IFA_F_DADFAILED)) {
+			/* another RTM_NEWADDR follows DAD */
+			ldbg(logger, "  ignoring tentative address on %s", ifname);
+			return;
+		}
+	} else if (!ipv4_iface_usable(ifname, logger)) {
+		return;
+	}
+
+	add_iface_address(ifname, ip, logger);
+}
+
+/*
+ * A deleted (or downed) link takes its addresses with it; but, to
+ * match find_raw_ifaces6(), a downed link keeps its IPv6 addresses.
+ *
+ * A link coming up is ignored; its addresses arrive as RTM_NEWADDR
+ * (IPv4 addresses that survived the link going down are found by the
+ * next full scan).
+ */
+
+static void process_link_change(struct nlmsghdr *n, struct logger *logger)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(n);
+	struct rtattr *rta = IFLA_RTA(ifi);
+	size_t msg_size = IFLA_PAYLOAD(n);
+	const char *ifname = NULL;
+
+	while (RTA_OK(rta, msg_size)) {
+		if (rta->rta_type == IFLA_IFNAME) {
+			ifname = RTA_DATA(rta);
+		}
+		rta = RTA_NEXT(rta, msg_size);
+	}
+
+	if (ifname == NULL) {
+		ldbg(logger, "%s() link %d has no name", __func__, ifi->ifi_index);
+		return;
+	}
+
+	if (n->nlmsg_type == RTM_DELLINK) {
+		ldbg(logger, "%s() link %s deleted", __func__, ifname);
+		delete_iface_device(ifname, NULL, logger);
+	} else if (!(ifi->ifi_flags & IFF_UP)) {
+		ldbg(logger, "%s() link %s down", __func__, ifname);
+		delete_iface_device(ifname, &ipv4_info, logger);
+	}
 }
+
 static void netlink_kernel_sa_expire(struct nlmsghdr *n, struct logger *logger)
 {
 	struct xfrm_user_expire *ue = NLMSG_DATA(n);
@@ -2371,6 +3136,11 @@ static void netlink_rtm_message_processor(struct nlm_resp *rsp, struct logger *l
 		process_addr_change(&rsp->n, logger);
 		break;
 
+	case RTM_NEWLINK:
+	case RTM_DELLINK:
+		process_link_change(&rsp->n, logger);
+		break;
+
 	default:
 		/* ignored */
 		break;
@@ -2458,6 +3228,16 @@ static bool xfrm_get_kernel_state(const struct kernel_state *sa, uint64_t *bytes
 
 	struct nlm_resp rsp;
 
+	if (deltatime_cmp(sa_stats_max_age, >, deltatime(0))) {
+		const struct sa_stats *e = get_sa_stats(sa, logger);
+		if (e != NULL) {
+			*bytes = e->bytes;
+			*add_time = e->add_time;
+			*lastused = e->lastused;
+			return true;
+		}
+	}
+
 	zero(&req);
 	req.n.nlmsg_flags = NLM_F_REQUEST;
 	req.n.nlmsg_type = XFRM_MSG_GETSA;
@@ -2759,10 +3539,12 @@ static bool netlink_poke_ipsec_policy_hole(int fd, const struct ip_info *afi, st
 
 static void xfrm_shutdown(struct logger *logger)
 {
+	flush_xfrm_requests(logger);
+	free_sa_stats();
 #ifdef USE_XFRM_INTERFACE
 	free_xfrmi_ipsec1(logger);
 #else
-	ldbg(logger, "%s() called; nothing to do", __func__);
+	ldbg(logger, "%s() called", __func__);
 #endif
 }
 
@@ -2783,6 +3565,7 @@ const struct kernel_ops xfrm_kernel_ops = {
 	.policy_add = kernel_xfrm_policy_add,
 	.add_sa = netlink_add_sa,
 	.get_kernel_state = xfrm_get_kernel_state,
+	.show_kernel_state_cache = xfrm_show_kernel_state_cache,
 	.grp_sa = NULL,
 	.get_ipsec_spi = xfrm_get_ipsec_spi,
 	.del_ipsec_spi = xfrm_del_ipsec_spi,
@@ -67,18 +67,21 @@
 #include "ike_alg_hash.h"
 #include "pluto_timing.h"
 #include "show.h"
+#include "pubkey_db.h"
 
 static struct secret *pluto_secrets = NULL;
+static struct secret_index *pluto_secret_index = NULL;
 
 void load_preshared_secrets(struct logger *logger)
 {
 	const struct lsw_conf_options *oco = lsw_init_options();
-	lsw_load_preshared_secrets(&pluto_secrets, oco->secretsfile, logger);
+	lsw_load_preshared_secrets(&pluto_secrets, &pluto_secret_index,
+				   oco->secretsfile, logger);
 }
 
 void free_preshared_secrets(struct logger *logger)
 {
-	lsw_free_preshared_secrets(&pluto_secrets, logger);
+	lsw_free_preshared_secrets(&pluto_secrets, &pluto_secret_index, logger);
 }
 
 static int print_secrets(struct secret *secret,
@@ -148,175 +151,129 @@ void list_psks(struct show *s)
 }
 
 /*
- * Check signature against all RSA public keys we can find.  If we
- * need keys from DNS KEY records, and they haven't been fetched,
- * return STF_SUSPEND to ask for asynch DNS lookup.
+ * Check signature against all public keys we can find.
  *
- * Note: parameter keys_from_dns contains results of DNS lookup for
- * key or is NULL indicating lookup not yet tried.
+ * This is split into three steps so that the expensive middle step
+ * can be run by a helper thread:
  *
- * take_a_crack is a helper function.  Mostly forensic.  If only we
- * had coroutines. (XXX: generators).
+ *   start_pubkey_verification() (main thread) prunes expired keys and
+ *   collects (with a reference) each key that could have been used;
+ *
+ *   verify_pubkey_verification() (any thread) tries each collected
+ *   key until one works, or one fails fatally;
+ *
+ *   finish_pubkey_verification() (main thread) logs the result and,
+ *   on success, saves the key in .st_peer_pubkey.
  */
 
-struct tac_state {
+struct pubkey_candidate {
+	struct pubkey *key;
+	const char *cert_origin;	/* "peer" or "preloaded" */
+};
+
+struct pubkey_verification {
+	/* in */
 	const struct pubkey_signer *signer;
-	const struct crypt_mac *hash;
-	shunk_t signature;
 	const struct hash_desc *hash_algo;
-	realtime_t now;
-	struct logger *logger;
-	const struct spd_end *remote;
-	const char *cert_origin;
+	struct crypt_mac hash;
+	chunk_t signature;
+	struct pubkey_candidate *candidates;
+	unsigned nr_candidates;
+	unsigned max_candidates;
 
 	/*
-	 * Both accumulated across calls and used to return the final
-	 * result.
+	 * Returned:
 	 *
-	 * See below.
+	 *   FATAL_DIAG  KEY     tried_cnt
+	 *     NULL     NULL        0      no key
+	 *     NULL     NULL       >0      no key worked
+	 *   <valid>   <valid>     N/A     fatal error caused by KEY
+	 *     NULL    <valid>     N/A     KEY worked
 	 */
-
 	int tried_cnt;			/* number of keys tried */
 	char tried[50];			/* keyids of tried public keys */
-	struct jambuf tried_jambuf;	/* jambuf for same */
-	struct pubkey *key;		/* last key tried, if any */
+	const struct pubkey_candidate *key;	/* last key tried, if any */
 	diag_t fatal_diag;		/* fatal error from KEY, if any */
 };
 
 /*
- * Try all keys from PUBKEY_DB.
- *
- * Return true when searching should stop (not when it succeeded);
- * return false when searching can continue.
- *
- *   Returns  FATAL_DIAG  KEY     tried_cnt
- *    false     NULL     NULL        0      no key, try again
- *    false     NULL     NULL       >0      no key worked, try again
- *    true    <valid>   <valid>     N/A     fatal error caused by KEY
- *    true      NULL    <valid>     N/A     KEY worked
+ * Collect the KEY when it could have been used to create the
+ * signature.
  */
 
-static bool try_all_keys(const char *cert_origin,
-			 struct pubkey_list *pubkey_db,
-			 struct tac_state *s)
+static void collect_pubkey_candidate(const char *cert_origin,
+				     struct pubkey *key,
+				     const struct spd_end *remote,
+				     realtime_t now,
+				     struct pubkey_verification *v)
 {
-	id_buf thatid;
-	dbg("trying all '%s's for %s key using %s signature that matches ID: %s",
-	    cert_origin, s->signer->type->name, s->signer->name,
-	    str_id(&s->remote->host->id, &thatid));
-	s->cert_origin = cert_origin;
-
-	bool described = false;
-	for (struct pubkey_list *p = pubkey_db; p != NULL; p = p->next) {
-		struct pubkey *key = p->key;
-
-		if (key->content.type != s->signer->type) {
-			id_buf printkid;
-			dbg("  skipping '%s' with type %s",
-			    str_id(&key->id, &printkid), key->content.type->name);
-			continue;
-		}
-
-		int wildcards; /* value ignored */
-		if (!match_id("  ", &key->id, &s->remote->host->id, &wildcards)) {
-			id_buf printkid;
-			dbg("  skipping '%s' with wrong ID",
-			    str_id(&key->id, &printkid));
-			continue;
-		}
-
-		int pl;	/* value ignored */
-		if (!trusted_ca(key->issuer, ASN1(s->remote->config->host.ca), &pl)) {
-			id_buf printkid;
-			dn_buf buf;
-			dbg("  skipping '%s' with untrusted CA '%s'",
-			    str_id(&key->id, &printkid),
-			    str_dn_or_null(key->issuer, "%any", &buf));
-			continue;
-		}
+	if (key->content.type != v->signer->type) {
+		id_buf printkid;
+		dbg("  skipping '%s' with type %s",
+		    str_id(&key->id, &printkid), key->content.type->name);
+		return;
+	}
 
-		/*
-		 * XXX: even though loop above filtered out these
-		 * certs, keep this check, at some point the above
-		 * loop will be deleted.
-		 */
-		if (!is_realtime_epoch(key->until_time) &&
-		    realtime_cmp(key->until_time, <, s->now)) {
-			id_buf printkid;
-			realtime_buf buf;
-			dbg("  skipping '%s' which expired on %s",
-			    str_id(&key->id, &printkid),
-			    str_realtime(key->until_time, /*utc?*/false, &buf));
-			continue;
-		}
+	int wildcards; /* value ignored */
+	if (!match_id("  ", &key->id, &remote->host->id, &wildcards)) {
+		id_buf printkid;
+		dbg("  skipping '%s' with wrong ID",
+		    str_id(&key->id, &printkid));
+		return;
+	}
 
+	int pl;	/* value ignored */
+	if (!trusted_ca(key->issuer, ASN1(remote->config->host.ca), &pl)) {
 		id_buf printkid;
 		dn_buf buf;
-		const char *keyid_str = str_keyid(*pubkey_keyid(key));
-		dbg("  trying '%s' aka *%s issued by CA '%s'",
-		    str_id(&key->id, &printkid), keyid_str,
+		dbg("  skipping '%s' with untrusted CA '%s'",
+		    str_id(&key->id, &printkid),
 		    str_dn_or_null(key->issuer, "%any", &buf));
-		s->tried_cnt++;
-
-		if (!described) {
-			jam(&s->tried_jambuf, " %s:", cert_origin);
-			described = true;
-		}
-		jam(&s->tried_jambuf, " *%s", keyid_str);
-
-		logtime_t try_time = logtime_start(s->logger);
-		bool passed = (s->signer->authenticate_signature)(s->hash, s->signature,
-								  key, s->hash_algo,
-								  &s->fatal_diag, s->logger);
-		logtime_stop(&try_time, "%s() trying a pubkey", __func__);
-
-		if (s->fatal_diag != NULL) {
-			/* already logged */
-			dbg("  '%s' fatal", keyid_str);
-			jam(&s->tried_jambuf, "(fatal)");
-			s->key = key; /* also return failing key */
-			return true; /* stop searching; enough is enough */
-		}
-
-		if (passed) {
-			dbg("  '%s' passed", keyid_str);
-			s->key = key;
-			return true; /* stop searching */
-		}
+		return;
+	}
 
-		/* should have been logged */
-		dbg("  '%s' failed", keyid_str);
-		pexpect(s->key == NULL);
+	/*
+	 * XXX: even though loop above filtered out these
+	 * certs, keep this check, at some point the above
+	 * loop will be deleted.
+	 */
+	if (!is_realtime_epoch(key->until_time) &&
+	    realtime_cmp(key->until_time, <, now)) {
+		id_buf printkid;
+		realtime_buf buf;
+		dbg("  skipping '%s' which expired on %s",
+		    str_id(&key->id, &printkid),
+		    str_realtime(key->until_time, /*utc?*/false, &buf));
+		return;
 	}
 
-	return false; /* keep searching */
+	if (v->nr_candidates >= v->max_candidates) {
+		unsigned max = (v->max_candidates == 0 ? 4 : v->max_candidates * 2);
+		realloc_things(v->candidates, v->max_candidates, max,
+			       "pubkey candidates");
+		v->max_candidates = max;
+	}
+	v->candidates[v->nr_candidates++] = (struct pubkey_candidate) {
+		.key = pubkey_addref(key),
+		.cert_origin = cert_origin,
+	};
 }
 
-diag_t authsig_and_log_using_pubkey(struct ike_sa *ike,
-				    const struct crypt_mac *hash,
-				    shunk_t signature,
-				    const struct hash_desc *hash_algo,
-				    const struct pubkey_signer *signer,
-				    const char *signature_payload_name)
+struct pubkey_verification *start_pubkey_verification(struct ike_sa *ike,
+							const struct crypt_mac *hash,
+							shunk_t signature,
+							const struct hash_desc *hash_algo,
+							const struct pubkey_signer *signer)
 {
 	const struct connection *c = ike->sa.st_connection;
-	struct tac_state s = {
-		/* in */
-		.signer = signer,
-		.logger = ike->sa.st_logger,
-		.hash = hash,
-		.now = realnow(),
-		.signature = signature,
-		.hash_algo = hash_algo,
-		.remote = c->spd->remote,
-		/* out */
-		.tried_cnt = 0,
-		.key = NULL,
-		.fatal_diag = NULL,
-	};
-	s.tried_jambuf = ARRAY_AS_JAMBUF(s.tried);
+	realtime_t now = realnow();
 
-	/* try all appropriate Public keys */
+	struct pubkey_verification *v = alloc_thing(struct pubkey_verification,
+						     "pubkey verification");
+	v->signer = signer;
+	v->hash_algo = hash_algo;
+	v->hash = *hash;
+	v->signature = clone_hunk(signature, "signature");
 
 	dn_buf buf;
 	dbg("CA is '%s' for %s key using %s signature",
@@ -329,50 +286,131 @@ diag_t authsig_and_log_using_pubkey(struct ike_sa *ike,
 	 * Prune the expired public keys from the pre-loaded public
 	 * key list.  But why here, and why not as a separate job?
 	 * And why blame the IKE SA as it isn't really its fault?
+	 *
+	 * Only the keys that could match the peer's ID are looked at
+	 * (the rest are left for when their peer authenticates).
 	 */
-	for (struct pubkey_list **pp = &pluto_pubkeys; *pp != NULL; ) {
-		struct pubkey *key = (*pp)->key;
+	struct pubkey_filter expired = {
+		.match_id = &c->spd->remote->host->id,
+		.where = HERE,
+	};
+	while (next_pluto_pubkey(NEW2OLD, &expired)) {
+		struct pubkey *key = expired.key;
 		if (!is_realtime_epoch(key->until_time) &&
-		    realtime_cmp(key->until_time, <, s.now)) {
+		    realtime_cmp(key->until_time, <, now)) {
 			id_buf printkid;
 			llog_sa(RC_LOG_SERIOUS, ike,
 				  "cached %s public key '%s' has expired and has been deleted",
 				  key->content.type->name, str_id(&key->id, &printkid));
-			*pp = free_public_keyentry(*(pp));
-			continue; /* continue with next public key */
+			delete_pluto_pubkey(key);
 		}
-		pp = &(*pp)->next;
 	}
 
-	bool stop = try_all_keys("peer", ike->sa.st_remote_certs.pubkey_db, &s);
-	if (!stop) {
-		stop = try_all_keys("preloaded", pluto_pubkeys, &s);
+	id_buf thatid;
+	dbg("collecting all keys for %s key using %s signature that matches ID: %s",
+	    signer->type->name, signer->name,
+	    str_id(&c->spd->remote->host->id, &thatid));
+
+	/* peer keys are tried first */
+	for (struct pubkey_list *p = ike->sa.st_remote_certs.pubkey_db;
+	     p != NULL; p = p->next) {
+		collect_pubkey_candidate("peer", p->key, c->spd->remote, now, v);
+	}
+
+	/* only look at preloaded keys with a matching type and ID */
+	struct pubkey_filter preloaded = {
+		.type = signer->type,
+		.match_id = &c->spd->remote->host->id,
+		.where = HERE,
+	};
+	while (next_pluto_pubkey(NEW2OLD, &preloaded)) {
+		collect_pubkey_candidate("preloaded", preloaded.key,
+					 c->spd->remote, now, v);
+	}
+	return v;
+}
+
+void verify_pubkey_verification(struct pubkey_verification *v, struct logger *logger)
+{
+	struct jambuf tried_jambuf = ARRAY_AS_JAMBUF(v->tried);
+	const char *described = NULL;
+
+	for (unsigned i = 0; i < v->nr_candidates; i++) {
+		const struct pubkey_candidate *candidate = &v->candidates[i];
+		struct pubkey *key = candidate->key;
+
+		id_buf printkid;
+		dn_buf buf;
+		const char *keyid_str = str_keyid(*pubkey_keyid(key));
+		ldbg(logger, "  trying '%s' aka *%s issued by CA '%s'",
+		     str_id(&key->id, &printkid), keyid_str,
+		     str_dn_or_null(key->issuer, "%any", &buf));
+		v->tried_cnt++;
+
+		if (described != candidate->cert_origin) {
+			jam(&tried_jambuf, " %s:", candidate->cert_origin);
+			described = candidate->cert_origin;
+		}
+		jam(&tried_jambuf, " *%s", keyid_str);
+
+		logtime_t try_time = logtime_start(logger);
+		bool passed = (v->signer->authenticate_signature)(&v->hash,
+								  HUNK_AS_SHUNK(v->signature),
+								  key, v->hash_algo,
+								  &v->fatal_diag, logger);
+		logtime_stop(&try_time, "%s() trying a pubkey", __func__);
+
+		if (v->fatal_diag != NULL) {
+			/* already logged */
+			ldbg(logger, "  '%s' fatal", keyid_str);
+			jam(&tried_jambuf, "(fatal)");
+			v->key = candidate; /* also return failing key */
+			return; /* stop searching; enough is enough */
+		}
+
+		if (passed) {
+			ldbg(logger, "  '%s' passed", keyid_str);
+			v->key = candidate;
+			return; /* stop searching */
+		}
+
+		/* should have been logged */
+		ldbg(logger, "  '%s' failed", keyid_str);
+		pexpect(v->key == NULL);
 	}
+}
+
+diag_t finish_pubkey_verification(struct ike_sa *ike,
+				  struct pubkey_verification *v,
+				  const char *signature_payload_name)
+{
+	const struct connection *c = ike->sa.st_connection;
 
-	if (s.fatal_diag != NULL) {
-		passert(s.key != NULL);
+	if (v->fatal_diag != NULL) {
+		passert(v->key != NULL);
 		id_buf idb;
-		return diag_diag(&s.fatal_diag, "authentication aborted: problem with '%s': ",
-				 str_id(&s.key->id, &idb));
+		return diag_diag(&v->fatal_diag, "authentication aborted: problem with '%s': ",
+				 str_id(&v->key->key->id, &idb));
 	}
 
-	if (s.key == NULL) {
-		if (s.tried_cnt == 0) {
+	if (v->key == NULL) {
+		if (v->tried_cnt == 0) {
 			id_buf idb;
 			return diag("authentication failed: no certificate matched %s with %s and '%s'",
-				    signer->name, hash_algo->common.fqn,
+				    v->signer->name, v->hash_algo->common.fqn,
 				    str_id(&c->remote->host.id, &idb));
 		} else {
 			id_buf idb;
 			return diag("authentication failed: using %s with %s for '%s' tried%s",
-				    signer->name, hash_algo->common.fqn,
+				    v->signer->name, v->hash_algo->common.fqn,
 				    str_id(&c->remote->host.id, &idb),
-				    s.tried);
+				    v->tried);
 		}
 	}
 
-	pexpect(s.key != NULL);
-	pexpect(s.tried_cnt > 0);
+	pexpect(v->key != NULL);
+	pexpect(v->tried_cnt > 0);
+	struct pubkey *key = v->key->key;
 	LLOG_JAMBUF(RC_LOG_SERIOUS, ike->sa.st_logger, buf) {
 		if (ike->sa.st_ike_version == IKEv2) {
 			/*
@@ -388,7 +426,7 @@ diag_t authsig_and_log_using_pubkey(struct ike_sa *ike,
 		jam_string(buf, "authenticated peer ");
 		/* what is the AUTH method ... */
 		jam_string(buf, "'");
-		signer->jam_auth_method(buf, signer, s.key, hash_algo);
+		v->signer->jam_auth_method(buf, v->signer, key, v->hash_algo);
 		jam_string(buf, "'");
 		if (signature_payload_name != NULL) {
 			jam(buf, " %s", signature_payload_name);
@@ -396,23 +434,54 @@ diag_t authsig_and_log_using_pubkey(struct ike_sa *ike,
 			jam(buf, " signature");
 		}
 		/* ... and what was used to authenticate it */
-		jam(buf, " using %s certificate ", s.cert_origin);
+		jam(buf, " using %s certificate ", v->key->cert_origin);
 		jam_string(buf, "'");
-		jam_id_bytes(buf, &s.key->id, jam_sanitized_bytes);
+		jam_id_bytes(buf, &key->id, jam_sanitized_bytes);
 		jam_string(buf, "'");
 		/* this is so that the cert verified line can be deleted */
-		if (s.key->issuer.ptr != NULL) {
+		if (key->issuer.ptr != NULL) {
 			jam_string(buf, " issued by CA ");
 			jam_string(buf, "'");
-			jam_dn(buf, s.key->issuer, jam_sanitized_bytes);
+			jam_dn(buf, key->issuer, jam_sanitized_bytes);
 			jam_string(buf, "'");
 		}
 	}
 	pubkey_delref(&ike->sa.st_peer_pubkey);
-	ike->sa.st_peer_pubkey = pubkey_addref(s.key);
+	ike->sa.st_peer_pubkey = pubkey_addref(key);
 	return NULL;
 }
 
+void free_pubkey_verification(struct pubkey_verification **vp)
+{
+	struct pubkey_verification *v = *vp;
+	if (v == NULL) {
+		return;
+	}
+	for (unsigned i = 0; i < v->nr_candidates; i++) {
+		pubkey_delref(&v->candidates[i].key);
+	}
+	pfreeany(v->candidates);
+	free_chunk_content(&v->signature);
+	pfree_diag(&v->fatal_diag);
+	pfree(v);
+	*vp = NULL;
+}
+
+diag_t authsig_and_log_using_pubkey(struct ike_sa *ike,
+				    const struct crypt_mac *hash,
+				    shunk_t signature,
+				    const struct hash_desc *hash_algo,
+				    const struct pubkey_signer *signer,
+				    const char *signature_payload_name)
+{
+	struct pubkey_verification *v = start_pubkey_verification(ike, hash, signature,
+								  hash_algo, signer);
+	verify_pubkey_verification(v, ike->sa.st_logger);
+	diag_t d = finish_pubkey_verification(ike, v, signature_payload_name);
+	free_pubkey_verification(&v);
+	return d;
+}
+
 /*
  * Find the struct secret associated with the combination of me and
  * the peer.  We match the Id (if none, the IP address).  Failure is
@@ -468,7 +537,7 @@ static struct secret *lsw_get_secret(const struct connection *c,
 	    str_id(that_id, &that_buf),
 	    enum_name(&secret_kind_names, kind));
 
-	return lsw_find_secret_by_id(pluto_secrets, kind,
+	return lsw_find_secret_by_id(pluto_secrets, pluto_secret_index, kind,
 				     this_id, that_id, asym);
 }
 
@@ -489,7 +558,7 @@ struct secret *lsw_get_xauthsecret(char *xauthname)
 		}
 	};
 
-	best = lsw_find_secret_by_id(pluto_secrets,
+	best = lsw_find_secret_by_id(pluto_secrets, pluto_secret_index,
 				     SECRET_XAUTH,
 				     &xa_id, NULL, true);
 
@@ -523,7 +592,7 @@ const chunk_t *get_connection_psk(const struct connection *c)
  */
 static const chunk_t *get_ppk_by_id(const chunk_t *ppk_id)
 {
-	struct secret *s = lsw_get_ppk_by_id(pluto_secrets, *ppk_id);
+	struct secret *s = lsw_get_ppk_by_id(pluto_secrets, pluto_secret_index, *ppk_id);
 
 	if (s != NULL) {
 		const struct secret_stuff *pks = get_secret_stuff(s);
@@ -754,13 +823,11 @@ const struct secret_stuff *get_local_private_key(const struct connection *c,
  * public key machinery
  */
 
-/* root of chained public key list */
-
-struct pubkey_list *pluto_pubkeys = NULL;       /* keys from ipsec.conf */
+/* the public keys live in pubkey_db.c */
 
 void free_remembered_public_keys(void)
 {
-	free_public_keys(&pluto_pubkeys);
+	free_pluto_pubkeys();
 }
 
 /*
@@ -856,8 +923,11 @@ void show_pubkeys(struct show *s, bool utc, enum keys_to_show keys_to_show)
 		show_blank(s);
 	}
 
-	for (struct pubkey_list *p = pluto_pubkeys; p != NULL; p = p->next) {
-		struct pubkey *pubkey = p->key;
+	struct pubkey_filter pubkeys = {
+		.where = HERE,
+	};
+	while (next_pluto_pubkey(NEW2OLD, &pubkeys)) {
+		struct pubkey *pubkey = pubkeys.key;
 		expiry_buf eb;
 		const char *expiry_msg = check_expiry(pubkey->until_time, PUBKEY_WARNING_INTERVAL, &eb);
 		switch (keys_to_show) {
@@ -896,13 +966,27 @@ err_t preload_private_key_by_ckaid(const ckaid_t *ckaid, bool *load_needed, stru
 
 const struct pubkey *find_pubkey_by_ckaid(const char *ckaid)
 {
-	for (struct pubkey_list *p = pluto_pubkeys; p != NULL; p = p->next) {
-		DBG_log("looking at a PUBKEY");
-		struct pubkey *key = p->key;
-		const ckaid_t *key_ckaid = pubkey_ckaid(key);
+	/* try the CKAID table; only works when it isn't a prefix */
+	ckaid_t exact_ckaid;
+	if (string_to_ckaid(ckaid, &exact_ckaid) == NULL) {
+		struct pubkey_filter exact = {
+			.ckaid = &exact_ckaid,
+			.where = HERE,
+		};
+		if (next_pluto_pubkey(NEW2OLD, &exact)) {
+			dbg("ckaid matching pubkey");
+			return exact.key;
+		}
+	}
+
+	struct pubkey_filter pubkeys = {
+		.where = HERE,
+	};
+	while (next_pluto_pubkey(NEW2OLD, &pubkeys)) {
+		const ckaid_t *key_ckaid = pubkey_ckaid(pubkeys.key);
 		if (ckaid_starts_with(key_ckaid, ckaid)) {
 			dbg("ckaid matching pubkey");
-			return key;
+			return pubkeys.key;
 		}
 	}
 	return NULL;
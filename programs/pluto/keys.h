@@ -66,11 +66,25 @@ err_t preload_private_key_by_ckaid(const ckaid_t *ckaid, bool *load_needed, stru
 
 extern struct secret *lsw_get_xauthsecret(char *xauthname);
 
-/* keys from ipsec.conf */
-extern struct pubkey_list *pluto_pubkeys;
-
 const struct pubkey *find_pubkey_by_ckaid(const char *ckaid);
 
+/*
+ * Verify a signature using the peer's public keys; the middle step
+ * can be run by a helper thread (see keys.c).
+ */
+struct pubkey_verification;
+struct pubkey_verification *start_pubkey_verification(struct ike_sa *ike,
+							const struct crypt_mac *hash,
+							shunk_t signature,
+							const struct hash_desc *hash_algo,
+							const struct pubkey_signer *signer);
+void verify_pubkey_verification(struct pubkey_verification *v,
+				struct logger *logger);
+diag_t finish_pubkey_verification(struct ike_sa *ike,
+				  struct pubkey_verification *v,
+				  const char *signature_payload_name);
+void free_pubkey_verification(struct pubkey_verification **v);
+
 extern diag_t authsig_and_log_using_pubkey(struct ike_sa *ike,
 					   const struct crypt_mac *hash,
 					   shunk_t signature,
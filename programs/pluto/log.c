@@ -121,7 +121,7 @@ static void syslog_raw(int severity, const char *prefix, char *message)
 		syslog(severity, "%s%s", prefix, message);
 }
 
-static void jambuf_to_whack(struct jambuf *buf, const struct fd *whackfd, enum rc_type rc)
+static void jambuf_to_whack(struct jambuf *buf, struct fd *whackfd, enum rc_type rc)
 {
 	/*
 	 * XXX: use iovec as it's easier than trying to deal with
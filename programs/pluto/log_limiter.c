@@ -38,6 +38,7 @@ struct log_limiter {
 #define RATE_LIMIT 1000
 struct log_limiter md_log_limiter = LOG_LIMIT(RATE_LIMIT, "message digest");
 struct log_limiter certificate_log_limiter = LOG_LIMIT(10, "bad certificate");
+struct log_limiter crypto_log_limiter = LOG_LIMIT(RATE_LIMIT, "crypto helper");
 
 static unsigned log_limit(const struct log_limiter *limiter)
 {
@@ -99,7 +100,7 @@ static global_timer_cb reset_log_limiter;	/* type check */
 
 static void reset_log_limiter(struct logger *logger)
 {
-	FOR_EACH_THING(limiter, &md_log_limiter, &certificate_log_limiter) {
+	FOR_EACH_THING(limiter, &md_log_limiter, &certificate_log_limiter, &crypto_log_limiter) {
 		if (limiter->count > log_limit(limiter)) {
 			llog(RC_LOG, logger, "%s rate limited log reset",
 			     limiter->what);
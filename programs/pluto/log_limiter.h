@@ -28,6 +28,7 @@ struct log_limiter;
 
 extern struct log_limiter md_log_limiter;
 extern struct log_limiter certificate_log_limiter;
+extern struct log_limiter crypto_log_limiter;
 
 /*
  * Returns non-LEMPTY rc_flags when the message should be logged.  For
@@ -19,22 +19,160 @@
 #include "log.h"
 #include "demux.h"      /* needs packet.h */
 #include "iface.h"
+#include "show.h"
+
+/*
+ * Pool of message digests, along with their loggers.
+ *
+ * A digest is allocated with room for its packet rounded up to the
+ * next power of two (at least MD_POOL_MIN_SIZE bytes); when the last
+ * reference is released, it goes back on the free list for that
+ * size so that the next packet of a similar size can reuse it
+ * without a malloc() or a new logger.  Since a digest is only ever a
+ * little bigger than its packet, one that is kept (suspended,
+ * waiting for more fragments, ...) costs no more than before.
+ *
+ * Packets bigger than MAX_INPUT_UDP_SIZE (for instance a reassembled
+ * IKEv1 message) are allocated exactly and not pooled.  Only the
+ * main thread allocates and releases message digests so no locking
+ * is needed.
+ */
+
+#define MD_POOL_MIN_SIZE 512
+#define MD_POOL_CLASSES 8	/* 512 .. 64KiB */
+#define MD_POOL_MAX 16		/* per size */
+
+static const struct refcnt_base md_refcnt_base = {
+	.what = "struct msg_digest",
+};
+
+static struct {
+	struct md_pool_class {
+		struct msg_digest *free[MD_POOL_MAX];
+		unsigned nr_free;
+	} class[MD_POOL_CLASSES];
+	unsigned nr_busy;	/* pooled and in use */
+	uintmax_t allocs;	/* malloc()ed */
+	uintmax_t reuses;	/* taken from a free list */
+	uintmax_t releases;	/* returned to a free list */
+	uintmax_t frees;	/* free list full */
+} md_pool;
+
+/* smallest class that can hold PACKET_LEN, or MD_POOL_CLASSES */
+static unsigned md_pool_class(size_t packet_len)
+{
+	unsigned class = 0;
+	while (class < MD_POOL_CLASSES &&
+	       ((size_t)MD_POOL_MIN_SIZE << class) < packet_len) {
+		class++;
+	}
+	return class;
+}
+
+static struct msg_digest *alloc_pooled_md(unsigned class, where_t where)
+{
+	passert(in_main_thread());
+	passert(class < MD_POOL_CLASSES);
+	struct md_pool_class *pool = &md_pool.class[class];
+	struct msg_digest *md;
+	struct logger *logger;
+	if (pool->nr_free > 0) {
+		md = pool->free[--pool->nr_free];
+		logger = md->md_logger;
+		md_pool.reuses++;
+	} else {
+		/* the buffer is written before it is read */
+		md = uninitialized_malloc(sizeof(struct msg_digest) +
+					  ((size_t)MD_POOL_MIN_SIZE << class),
+					  "pooled msg_digest");
+		logger = alloc_logger(md, &logger_message_vec,
+				      /*debugging*/LEMPTY, null_fd,
+				      where);
+		md_pool.allocs++;
+	}
+	md_pool.nr_busy++;
+
+	/* zap everything but the buffer */
+	zero(md);
+	refcnt_init(md, &md->refcnt, &md_refcnt_base, where);
+	md->pooled = true;
+	md->pool_class = class;
+	md->md_logger = logger;
+	*logger = (struct logger) {
+		.object = md,
+		.object_vec = &logger_message_vec,
+		.where = where,
+	};
+	return md;
+}
+
+static void release_pooled_md(struct msg_digest *md, where_t where)
+{
+	passert(in_main_thread());
+	pexpect(md_pool.nr_busy > 0);
+	md_pool.nr_busy--;
+	/* drop any whack attached while processing the message */
+	release_whack(md->md_logger, where);
+	struct md_pool_class *pool = &md_pool.class[md->pool_class];
+	if (pool->nr_free < elemsof(pool->free)) {
+		pool->free[pool->nr_free++] = md;
+		md_pool.releases++;
+		return;
+	}
+	md_pool.frees++;
+	free_logger(&md->md_logger, where);
+	pfree(md);
+}
+
+void free_md_pool(void)
+{
+	FOR_EACH_ELEMENT(pool, md_pool.class) {
+		while (pool->nr_free > 0) {
+			struct msg_digest *md = pool->free[--pool->nr_free];
+			free_logger(&md->md_logger, HERE);
+			pfree(md);
+		}
+	}
+}
+
+void show_md_pool_status(struct show *s)
+{
+	unsigned nr_free = 0;
+	FOR_EACH_ELEMENT(pool, md_pool.class) {
+		nr_free += pool->nr_free;
+	}
+	show_raw(s, "current.md_pool.free=%u", nr_free);
+	show_raw(s, "current.md_pool.busy=%u", md_pool.nr_busy);
+	show_raw(s, "total.md_pool.allocs=%ju", md_pool.allocs);
+	show_raw(s, "total.md_pool.reuses=%ju", md_pool.reuses);
+	show_raw(s, "total.md_pool.releases=%ju", md_pool.releases);
+	show_raw(s, "total.md_pool.frees=%ju", md_pool.frees);
+}
 
 struct msg_digest *alloc_md(struct iface_endpoint *ifp,
 			    const ip_endpoint *sender,
 			    const uint8_t *packet, size_t packet_len,
 			    where_t where)
 {
-	struct msg_digest *md = refcnt_overalloc(struct msg_digest, packet_len, where);
+	struct msg_digest *md;
+	unsigned class = md_pool_class(packet_len);
+	if (class < MD_POOL_CLASSES) {
+		md = alloc_pooled_md(class, where);
+	} else {
+		md = refcnt_overalloc(struct msg_digest, packet_len, where);
+		md->md_logger = alloc_logger(md, &logger_message_vec,
+					     /*debugging*/LEMPTY, null_fd,
+					     where);
+	}
 	md->iface = iface_endpoint_addref_where(ifp, where);
 	md->sender = *sender;
-	md->md_logger = alloc_logger(md, &logger_message_vec,
-				     /*debugging*/LEMPTY, null_fd,
-				     where);
 	void *buffer = md + 1;
 	init_pbs(&md->packet_pbs, buffer, packet_len, "packet");
 	if (packet != NULL) {
 		memcpy(buffer, packet, packet_len);
+	} else if (md->pooled) {
+		/* caller fills it in; start clean */
+		memset(buffer, 0, packet_len);
 	}
 	return md;
 }
@@ -62,8 +200,12 @@ void md_delref_where(struct msg_digest **mdp, where_t where)
 	struct msg_digest *md = delref_where(mdp, logger, where);
 	if (md != NULL) {
 		free_chunk_content(&md->raw_packet);
-		free_logger(&md->md_logger, where);
 		iface_endpoint_delref_where(&md->iface, where);
+		if (md->pooled) {
+			release_pooled_md(md, where);
+			return;
+		}
+		free_logger(&md->md_logger, where);
 		pfree(md);
 	}
 }
@@ -6,6 +6,7 @@
 #include "keys.h"
 #include "log.h"
 #include "nss_cert_load.h"
+#include "nss_cert_verify.h"	/* for flush_cert_chain_cache() */
 #include "whack.h"
 
 static void reread_end_cert(struct host_end *host_end,
@@ -85,4 +86,5 @@ void reread_cert_connections(struct logger *logger)
 			reread_cert(c, logger);
 		}
 	}
+	flush_cert_chain_cache("certificates re-read", logger);
 }
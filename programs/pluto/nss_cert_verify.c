@@ -26,6 +26,7 @@
 #include <time.h>
 #include <limits.h>
 #include <sys/types.h>
+#include <pthread.h>
 #include "sysdep.h"
 #include "lswnss.h"
 #include "constants.h"
@@ -45,6 +46,10 @@
 #include "ip_info.h"
 #include "log.h"
 #include "log_limiter.h"
+#include "list_entry.h"
+#include "crypt_hash.h"
+#include "ike_alg_hash.h"
+#include "show.h"
 
 bool groundhogday;
 
@@ -507,6 +512,246 @@ static struct certs *decode_cert_payloads(CERTCertDBHandle *handle,
 	return certs;
 }
 
+/*
+ * Verified certificate chain cache.
+ *
+ * Road-warrior clients tend to re-authenticate using the same
+ * end-entity certificate and intermediates.  Chains that
+ * verify_end_cert() accepted are remembered, keyed by a SHA-256
+ * digest of the CERT payloads and the revocation options, so that
+ * the next time path validation and revocation checks can be
+ * skipped.
+ *
+ * An entry expires after CERT_CHAIN_CACHE_LIFETIME or when the
+ * certificate in the chain with the earliest notAfter does.
+ * Importing a CRL, re-reading the certificates, or discarding the
+ * root certificates (which are re-loaded, possibly with a CA removed
+ * or replaced, when next needed) flushes everything; the generation
+ * stops a verification that was in progress across the flush from
+ * adding its (possibly stale) result.  Only successful, non
+ * groundhog, verifications are cached.
+ *
+ * When OCSP is enabled nothing is cached: a hit would skip the OCSP
+ * check and hide a revocation for as long as the entry lives.
+ *
+ * Verification runs on the helper threads, hence the mutex.
+ */
+
+#define CERT_CHAIN_CACHE_LIFETIME deltatime(secs_per_hour)
+
+unsigned cert_chain_cache_size;	/* 0 disables */
+
+struct cert_chain_entry {
+	struct list_entry lru_entry;
+	struct cert_chain_entry *next;	/* in hash bucket */
+	struct crypt_mac digest;
+	realtime_t expires;
+};
+
+static void jam_cert_chain_entry(struct jambuf *buf, const void *data)
+{
+	if (data == NULL) {
+		jam(buf, "no cert chain");
+	} else {
+		const struct cert_chain_entry *entry = data;
+		jam(buf, "cert chain ");
+		jam_hex_hunk(buf, entry->digest);
+	}
+}
+
+LIST_INFO(cert_chain_entry, lru_entry, cert_chain_entry_info, jam_cert_chain_entry);
+
+static pthread_mutex_t cert_chain_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct {
+	struct list_head lru;	/* OLD2NEW is least to most recent */
+	struct cert_chain_entry **buckets;
+	unsigned nr_buckets;
+	unsigned nr_entries;
+	uintmax_t generation;
+	uintmax_t hits;
+	uintmax_t misses;
+	uintmax_t expired;
+	uintmax_t evictions;
+	uintmax_t flushes;
+} cert_chain_cache = {
+	.lru = INIT_LIST_HEAD(&cert_chain_cache.lru, &cert_chain_entry_info),
+};
+
+static struct crypt_mac cert_chain_digest(enum ike_version ike_version,
+					  struct payload_digest *cert_payloads,
+					  const struct rev_opts *rev_opts,
+					  struct logger *logger)
+{
+	struct crypt_hash *hash = crypt_hash_init("cert chain", &ike_alg_hash_sha2_256, logger);
+	crypt_hash_digest_thing(hash, "revocation options", *rev_opts);
+	for (struct payload_digest *p = cert_payloads; p != NULL; p = p->next) {
+		uint8_t cert_type = (ike_version == IKEv2 ? p->payload.v2cert.isac_enc :
+				     p->payload.cert.isacert_type);
+		shunk_t payload = pbs_in_left(&p->pbs);
+		uint32_t len = payload.len;
+		crypt_hash_digest_thing(hash, "type", cert_type);
+		crypt_hash_digest_thing(hash, "length", len);
+		crypt_hash_digest_hunk(hash, "payload", payload);
+	}
+	return crypt_hash_final_mac(&hash);
+}
+
+/* caller holds the mutex */
+static struct cert_chain_entry **cert_chain_bucket(const struct crypt_mac *digest)
+{
+	/* the digest is already well distributed */
+	uint32_t h;
+	memcpy(&h, digest->ptr, sizeof(h));
+	return &cert_chain_cache.buckets[h % cert_chain_cache.nr_buckets];
+}
+
+/* caller holds the mutex */
+static void remove_cert_chain_entry(struct cert_chain_entry *entry)
+{
+	for (struct cert_chain_entry **pp = cert_chain_bucket(&entry->digest);
+	     *pp != NULL; pp = &(*pp)->next) {
+		if (*pp == entry) {
+			*pp = entry->next;
+			break;
+		}
+	}
+	remove_list_entry(&entry->lru_entry);
+	cert_chain_cache.nr_entries--;
+	pfree(entry);
+}
+
+/*
+ * Return true when DIGEST is in the cache; also return the
+ * generation to pass to cache_cert_chain().
+ */
+
+static bool cert_chain_cached(const struct crypt_mac *digest, uintmax_t *generation)
+{
+	bool hit = false;
+	pthread_mutex_lock(&cert_chain_cache_mutex);
+	*generation = cert_chain_cache.generation;
+	if (cert_chain_cache.nr_entries > 0) {
+		for (struct cert_chain_entry *entry = *cert_chain_bucket(digest);
+		     entry != NULL; entry = entry->next) {
+			if (!hunk_eq(entry->digest, *digest)) {
+				continue;
+			}
+			if (realtime_cmp(entry->expires, <=, realnow())) {
+				cert_chain_cache.expired++;
+				remove_cert_chain_entry(entry);
+				break;
+			}
+			/* now the most recently used */
+			remove_list_entry(&entry->lru_entry);
+			insert_list_entry(&cert_chain_cache.lru, &entry->lru_entry);
+			hit = true;
+			break;
+		}
+	}
+	if (hit) {
+		cert_chain_cache.hits++;
+	} else {
+		cert_chain_cache.misses++;
+	}
+	pthread_mutex_unlock(&cert_chain_cache_mutex);
+	return hit;
+}
+
+static void cache_cert_chain(const struct crypt_mac *digest, uintmax_t generation,
+			     const struct certs *cert_chain)
+{
+	/* expire with the chain's earliest notAfter */
+	realtime_t expires = realtimesum(realnow(), CERT_CHAIN_CACHE_LIFETIME);
+	for (const struct certs *entry = cert_chain; entry != NULL; entry = entry->next) {
+		PRTime not_before, not_after;
+		if (CERT_GetCertTimes(entry->cert, &not_before, &not_after) != SECSuccess) {
+			return;
+		}
+		realtime_t until = realtime(not_after / PR_USEC_PER_SEC);
+		if (realtime_cmp(until, <, expires)) {
+			expires = until;
+		}
+	}
+
+	pthread_mutex_lock(&cert_chain_cache_mutex);
+	if (generation == cert_chain_cache.generation) {
+		if (cert_chain_cache.buckets == NULL) {
+			unsigned nr_buckets = 64;
+			while (nr_buckets < cert_chain_cache_size) {
+				nr_buckets *= 2;
+			}
+			cert_chain_cache.buckets = alloc_things(struct cert_chain_entry *,
+								nr_buckets, "cert chain buckets");
+			cert_chain_cache.nr_buckets = nr_buckets;
+		}
+		/* make space by dropping the least recently used */
+		while (cert_chain_cache.nr_entries >= cert_chain_cache_size) {
+			struct cert_chain_entry *oldest =
+				cert_chain_cache.lru.head.next[OLD2NEW]->data;
+			cert_chain_cache.evictions++;
+			remove_cert_chain_entry(oldest);
+		}
+		struct cert_chain_entry *entry = alloc_thing(struct cert_chain_entry, "cert chain");
+		entry->digest = *digest;
+		entry->expires = expires;
+		struct cert_chain_entry **bucket = cert_chain_bucket(digest);
+		entry->next = *bucket;
+		*bucket = entry;
+		init_list_entry(&cert_chain_entry_info, entry, &entry->lru_entry);
+		insert_list_entry(&cert_chain_cache.lru, &entry->lru_entry);
+		cert_chain_cache.nr_entries++;
+	}
+	pthread_mutex_unlock(&cert_chain_cache_mutex);
+}
+
+/* caller holds the mutex */
+static void empty_cert_chain_cache(void)
+{
+	struct cert_chain_entry *entry;
+	FOR_EACH_LIST_ENTRY_OLD2NEW(entry, &cert_chain_cache.lru) {
+		remove_cert_chain_entry(entry);
+	}
+	cert_chain_cache.generation++;
+}
+
+void flush_cert_chain_cache(const char *why, struct logger *logger)
+{
+	pthread_mutex_lock(&cert_chain_cache_mutex);
+	unsigned nr_entries = cert_chain_cache.nr_entries;
+	empty_cert_chain_cache();
+	cert_chain_cache.flushes++;
+	pthread_mutex_unlock(&cert_chain_cache_mutex);
+	ldbg(logger, "flushed %u verified certificate chains: %s", nr_entries, why);
+}
+
+void free_cert_chain_cache(void)
+{
+	pthread_mutex_lock(&cert_chain_cache_mutex);
+	empty_cert_chain_cache();
+	pfreeany(cert_chain_cache.buckets);
+	cert_chain_cache.nr_buckets = 0;
+	pthread_mutex_unlock(&cert_chain_cache_mutex);
+}
+
+void show_cert_chain_cache_status(struct show *s)
+{
+	if (cert_chain_cache_size == 0) {
+		return;
+	}
+	pthread_mutex_lock(&cert_chain_cache_mutex);
+	uintmax_t lookups = cert_chain_cache.hits + cert_chain_cache.misses;
+	show_raw(s, "current.certs.chain_cache.entries=%u", cert_chain_cache.nr_entries);
+	show_raw(s, "total.certs.chain_cache.hits=%ju", cert_chain_cache.hits);
+	show_raw(s, "total.certs.chain_cache.misses=%ju", cert_chain_cache.misses);
+	show_raw(s, "total.certs.chain_cache.hit_rate=%ju%%",
+		 (lookups == 0 ? 0 : cert_chain_cache.hits * 100 / lookups));
+	show_raw(s, "total.certs.chain_cache.expired=%ju", cert_chain_cache.expired);
+	show_raw(s, "total.certs.chain_cache.evictions=%ju", cert_chain_cache.evictions);
+	show_raw(s, "total.certs.chain_cache.flushes=%ju", cert_chain_cache.flushes);
+	pthread_mutex_unlock(&cert_chain_cache_mutex);
+}
+
 /*
  * Decode and verify the chain received by pluto.
  * ee_out is the resulting end cert
@@ -537,6 +782,22 @@ struct verified_certs find_and_verify_certs(struct logger *logger,
 		return result;
 	}
 
+	/*
+	 * Has this exact chain already been verified?  The chain
+	 * still needs decoding (the caller wants the certs) but path
+	 * validation can be skipped.
+	 */
+	struct crypt_mac chain_digest = empty_mac;
+	uintmax_t chain_generation = 0;
+	bool chain_cached = false;
+	if (cert_chain_cache_size > 0 && !rev_opts->ocsp) {
+		chain_digest = cert_chain_digest(ike_version, cert_payloads,
+						 rev_opts, logger);
+		chain_cached = cert_chain_cached(&chain_digest, &chain_generation);
+		ldbg(logger, "certificate chain %s the cache",
+		     (chain_cached ? "found in" : "not in"));
+	}
+
 	/*
 	 * CERT_GetDefaultCertDB() returns the contents of a static
 	 * variable set by NSS_Initialize().  It doesn't check the
@@ -598,8 +859,12 @@ struct verified_certs find_and_verify_certs(struct logger *logger,
 	}
 
 	logtime_t verify_time = logtime_start(logger);
-	bool end_ok = verify_end_cert(logger, root_certs->trustcl, rev_opts,
-				      0, end_cert);
+	bool end_ok = (chain_cached ||
+		       verify_end_cert(logger, root_certs->trustcl, rev_opts,
+				       0, end_cert));
+	if (end_ok && !chain_cached && cert_chain_cache_size > 0 && !rev_opts->ocsp) {
+		cache_cert_chain(&chain_digest, chain_generation, result.cert_chain);
+	}
 	if (!end_ok && groundhogday) {
 		/*
 		 * Go through the CA certs retrying any with an
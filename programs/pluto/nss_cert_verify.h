@@ -26,6 +26,7 @@ struct certs;
 struct payload_digest;
 struct root_certs;
 struct logger;
+struct show;
 
 /*
  * Try to find and verify the end cert.  Sets CRL_NEEDED and BAD (for
@@ -62,4 +63,14 @@ extern SECItem *nss_pkcs7_blob(const struct cert *cert, bool send_full_chain);
 
 extern bool groundhogday;
 
+/*
+ * Cache of verified certificate chains; flushed when trust changes
+ * (a CRL is imported, certificates are re-read).
+ */
+#define CERT_CHAIN_CACHE_MAX 100000
+extern unsigned cert_chain_cache_size;	/* 0 disables */
+void flush_cert_chain_cache(const char *why, struct logger *logger);
+void free_cert_chain_cache(void);
+void show_cert_chain_cache_status(struct show *s);
+
 #endif /* NSS_CERT_VFY_H */
@@ -29,6 +29,7 @@
 #include "log.h"
 #include "lswalloc.h"
 #include "lswnss.h"	/* for llog_nss_error() */
+#include "nss_cert_verify.h"	/* for flush_cert_chain_cache() */
 
 static const char crl_name[] = "_import_crl";
 
@@ -192,6 +193,8 @@ int send_crl_to_import(uint8_t *der, size_t len, const char *url, struct logger
 	/* update CRL cache */
 	if (ret == 0) {
 		CERT_CRLCacheRefreshIssuer(handle, &cacert->derSubject);
+		/* a verified chain may now be revoked */
+		flush_cert_chain_cache("CRL imported", logger);
 	}
 end:
 	if (cacert != NULL)
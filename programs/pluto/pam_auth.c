@@ -14,8 +14,12 @@
  */
 
 #include <stdlib.h>
+#include <unistd.h>		/* for read() et.al. */
+#include <errno.h>
+#include <sys/socket.h>		/* for socketpair() */
 #include <sys/wait.h>		/* for WIFEXITED() et.al. */
 #include <signal.h>		/* for kill() and signals in general */
+#include <dirent.h>		/* for opendir() */
 
 #include "constants.h"
 #include "defs.h"
@@ -32,7 +36,41 @@
 #include "demux.h"
 #include "deltatime.h"
 #include "monotime.h"
+#include "server.h"
 #include "server_fork.h"
+#include "pluto_shutdown.h"	/* for exiting_pluto */
+#include "show.h"
+
+/*
+ * PAM authentication is performed by a small pool of long-lived
+ * worker processes, started on first use.
+ *
+ * Each worker is connected to pluto by a SOCK_SEQPACKET socketpair
+ * and handles one request at a time: pluto sends a request message,
+ * the worker runs the PAM conversation and sends back the result.
+ * When all workers are busy requests are queued (up to a limit).
+ *
+ * A worker that doesn't answer within PAM_AUTH_TIMEOUT is killed; a
+ * worker that dies is restarted when there is next work for it.
+ */
+
+#define PAM_AUTH_WORKERS 4
+#define PAM_AUTH_QUEUE_MAX 1024
+#define PAM_AUTH_TIMEOUT deltatime(60)
+#define PAM_AUTH_MSG_MAX 4096
+
+struct pam_auth_request_msg {
+	uint32_t id;
+	so_serial_t st_serialno;
+	unsigned long c_instance_serial;
+	ip_address rhost;
+	/* followed by NUL terminated name, password, c_name and atype */
+};
+
+struct pam_auth_reply_msg {
+	uint32_t id;
+	bool success;
+};
 
 /* information for tracking pamauth PAM work in flight */
 
@@ -41,10 +79,53 @@ struct pam_auth {
 	struct pam_thread_arg ptarg;
 	monotime_t start_time;
 	pam_auth_callback_fn *callback;
-	pid_t child;
+	struct logger *logger;
 	const char *aborted;
+	bool success;
+	enum { PAM_AUTH_QUEUED, PAM_AUTH_RUNNING, PAM_AUTH_DONE, } stage;
+	struct pam_worker *worker;	/* when RUNNING */
+	struct pam_auth *next;		/* when QUEUED */
 };
 
+struct pam_worker {
+	unsigned nr;
+	pid_t pid;			/* 0 when not running */
+	int fd;				/* pluto's end */
+	int child_fd;			/* worker's end; only during fork */
+	struct fd_read_listener *fdl;
+	/* the request being processed */
+	bool busy;
+	uint32_t id;
+	struct pam_auth *request;	/* NULL when abandoned */
+	monotime_t dispatch_time;
+	struct timeout *timeout;
+};
+
+static struct pam_worker pam_workers[PAM_AUTH_WORKERS];
+static bool pam_workers_initialized;
+static uint32_t pam_auth_id;
+
+static struct {
+	struct pam_auth *head;
+	struct pam_auth **tail;
+	unsigned len;
+} pam_auth_queue = { .tail = &pam_auth_queue.head, };
+
+static struct {
+	uintmax_t requests;
+	uintmax_t dispatched;		/* handed to a worker */
+	uintmax_t queue_full;
+	uintmax_t timeouts;
+	uintmax_t workers_started;
+	deltatime_t wait;		/* total time queued */
+	deltatime_t wait_max;
+	deltatime_t latency;		/* total time in a worker */
+	deltatime_t latency_max;
+	uintmax_t completed;
+} pam_auth_stats;
+
+static void pam_auth_dispatch(struct logger *logger);
+
 static void pam_auth_free(struct pam_auth **p)
 {
 	struct pam_auth *x = *p;
@@ -52,9 +133,77 @@ static void pam_auth_free(struct pam_auth **p)
 	pfree(x->ptarg.name);
 	pfree(x->ptarg.password);
 	pfree(x->ptarg.c_name);
+	free_logger(&x->logger, HERE);
 	pfree(x);
 }
 
+/*
+ * On the main thread; notify the state (if it is present) of the
+ * pamauth result, and then release everything.
+ */
+
+static resume_cb pam_auth_resume; /* type assertion */
+
+static stf_status pam_auth_resume(struct state *st,
+				  struct msg_digest *md,
+				  void *arg)
+{
+	struct pam_auth *pamauth = arg;
+
+	pstats_pamauth_stopped++;
+
+	bool success = (pamauth->aborted == NULL && pamauth->success);
+
+	LLOG_JAMBUF(RC_LOG, pamauth->logger, buf) {
+		jam(buf, "PAM: authentication of user '%s' ", pamauth->ptarg.name);
+		if (success) {
+			jam(buf, "SUCCEEDED");
+		} else if (pamauth->aborted == NULL) {
+			jam(buf, "FAILED");
+		} else {
+			jam(buf, "ABORTED (%s)", pamauth->aborted);
+		}
+		jam(buf, " after ");
+		jam_deltatime(buf, monotimediff(mononow(), pamauth->start_time));
+		jam(buf, " seconds");
+	}
+
+	/*
+	 * If there is still a state, notify it.  Since this is
+	 * running on the main thread, it and pam_auth_abort() can't
+	 * get into a race.
+	 */
+
+	stf_status ret = STF_SKIP_COMPLETE_STATE_TRANSITION;
+	if (st != NULL) {
+		if (st->st_pam_auth == pamauth) {
+			st->st_pam_auth = NULL; /* all done */
+		}
+		ret = pamauth->callback(st, md, pamauth->ptarg.name, success);
+	}
+
+	pam_auth_free(&pamauth);
+	return ret;
+}
+
+/*
+ * Hand the result back to the state (when shutting down there's no
+ * event-loop left to do that).
+ */
+
+static void pam_auth_done(struct pam_auth *pamauth)
+{
+	pamauth->stage = PAM_AUTH_DONE;
+	pamauth->worker = NULL;
+	if (exiting_pluto) {
+		pstats_pamauth_stopped++;
+		pam_auth_free(&pamauth);
+		return;
+	}
+	schedule_resume("pam auth", pamauth->serialno,
+			pam_auth_resume, pamauth);
+}
+
 /*
  * Abort the transaction, disconnecting it from state.
  *
@@ -80,91 +229,392 @@ void pam_auth_abort(struct state *st, const char *story)
 	    pamauth->serialno, story, pamauth->ptarg.name);
 
 	/*
-	 * Don't hold back.
-	 *
-	 * XXX: need to fix child so that more friendly SIGTERM is
-	 * handled - currently the forked process has it blocked by
-	 * libevent.
-	 */
-	kill(pamauth->child, SIGKILL);
-	/*
-	 * PAMAUTH is deleted by pam_auth_callback() _after_ the
-	 * process exits and the callback has been called.
-	 *
 	 * Free ST of any responsibility for releasing .st_pam_auth
-	 * (the fork handler will do that later).
+	 * (the resume will do that later).
 	 */
 	st->st_pam_auth = NULL; /* aborted */
 
+	switch (pamauth->stage) {
+	case PAM_AUTH_QUEUED:
+		for (struct pam_auth **pp = &pam_auth_queue.head; *pp != NULL; pp = &(*pp)->next) {
+			if (*pp == pamauth) {
+				*pp = pamauth->next;
+				if (pam_auth_queue.tail == &pamauth->next) {
+					pam_auth_queue.tail = pp;
+				}
+				pam_auth_queue.len--;
+				break;
+			}
+		}
+		pamauth->next = NULL;
+		pam_auth_done(pamauth);
+		break;
+	case PAM_AUTH_RUNNING:
+		/*
+		 * Leave the worker to finish (it's cheaper than
+		 * restarting it); its answer will be discarded.
+		 */
+		pamauth->worker->request = NULL;
+		pam_auth_done(pamauth);
+		break;
+	case PAM_AUTH_DONE:
+		/* resume already scheduled */
+		break;
+	}
 }
 
 /*
- * This is the callback from server_fork() when the process dies.
- *
- * On the main thread; notify the state (if it is present) of the
- * pamauth result, and then release everything.
+ * The worker process.
+ */
+
+static bool split_pam_auth_string(char **cursor, const char *end, char **string)
+{
+	char *nul = memchr(*cursor, '\0', end - *cursor);
+	if (nul == NULL) {
+		return false;
+	}
+	*string = *cursor;
+	*cursor = nul + 1;
+	return true;
+}
+
+/*
+ * The worker lives as long as pluto so it mustn't hold open anything
+ * it inherited: the other workers' sockets, and, in particular, any
+ * whack socket (whack would never see EOF).  Keep stdin, stdout and
+ * stderr, and KEEP.
  */
 
-static server_fork_cb pam_callback; /* type assertion */
+static void close_inherited_fds(int keep)
+{
+	DIR *dir = opendir("/proc/self/fd");
+	if (dir != NULL) {
+		int dir_fd = dirfd(dir);
+		struct dirent *d;
+		while ((d = readdir(dir)) != NULL) {
+			int fd = atoi(d->d_name);
+			if (fd > STDERR_FILENO && fd != keep && fd != dir_fd) {
+				close(fd);
+			}
+		}
+		closedir(dir);
+		return;
+	}
+	long max = sysconf(_SC_OPEN_MAX);
+	for (int fd = STDERR_FILENO + 1; fd < (max < 0 ? 1024 : max); fd++) {
+		if (fd != keep) {
+			close(fd);
+		}
+	}
+}
 
-static stf_status pam_callback(struct state *st,
-			       struct msg_digest *md,
-			       int status, void *arg,
-			       struct logger *logger)
+static int pam_worker(void *arg, struct logger *logger)
 {
-	struct pam_auth *pamauth = arg;
+	struct pam_worker *w = arg;
 
-	pstats_pamauth_stopped++;
+	close_inherited_fds(w->child_fd);
+
+	while (true) {
+		char buf[PAM_AUTH_MSG_MAX];
+		ssize_t n = read(w->child_fd, buf, sizeof(buf));
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n < 0) {
+			llog_error(logger, errno, "PAM: worker %u read failed", w->nr);
+			return 1;
+		}
+		if (n == 0) {
+			dbg("PAM: worker %u: pluto closed the socket", w->nr);
+			return 0;
+		}
 
-	bool success = (pamauth->aborted == NULL &&
-			WIFEXITED(status) &&
-			WEXITSTATUS(status) == 0);
+		struct pam_auth_request_msg request;
+		if ((size_t)n < sizeof(request)) {
+			llog(RC_LOG_SERIOUS, logger,
+			     "PAM: worker %u: truncated request of %zd bytes", w->nr, n);
+			return 1;
+		}
+		memcpy(&request, buf, sizeof(request));
 
-	LLOG_JAMBUF(RC_LOG, logger, buf) {
-		jam(buf, "PAM: authentication of user '%s' ", pamauth->ptarg.name);
-		if (success) {
-			jam(buf, "SUCCEEDED");
-		} else if (pamauth->aborted == NULL) {
-			jam(buf, "FAILED");
-		} else {
-			jam(buf, "ABORTED (%s)", pamauth->aborted);
+		struct pam_thread_arg ptarg = {
+			.st_serialno = request.st_serialno,
+			.c_instance_serial = request.c_instance_serial,
+			.rhost = request.rhost,
+		};
+		char *cursor = buf + sizeof(request);
+		const char *end = buf + n;
+		char *atype;
+		if (!split_pam_auth_string(&cursor, end, &ptarg.name) ||
+		    !split_pam_auth_string(&cursor, end, &ptarg.password) ||
+		    !split_pam_auth_string(&cursor, end, &ptarg.c_name) ||
+		    !split_pam_auth_string(&cursor, end, &atype)) {
+			llog(RC_LOG_SERIOUS, logger,
+			     "PAM: worker %u: malformed request", w->nr);
+			return 1;
 		}
-		jam(buf, " after ");
-		jam_deltatime(buf, monotimediff(mononow(), pamauth->start_time));
-		jam(buf, " seconds");
+		ptarg.atype = atype;
+
+		dbg("PAM: #%lu: PAM-process authenticating user '%s'",
+		    ptarg.st_serialno, ptarg.name);
+		bool success = do_pam_authentication(&ptarg, logger);
+		dbg("PAM: #%lu: PAM-process completed for user '%s' with result %s",
+		    ptarg.st_serialno, ptarg.name,
+		    success ? "SUCCESS" : "FAILURE");
+		memset(buf, 0, n); /* wipe the password */
+
+		struct pam_auth_reply_msg reply = {
+			.id = request.id,
+			.success = success,
+		};
+		if (write(w->child_fd, &reply, sizeof(reply)) != sizeof(reply)) {
+			llog_error(logger, errno, "PAM: worker %u write failed", w->nr);
+			return 1;
+		}
+	}
+}
+
+/*
+ * The main process's side of a worker.
+ */
+
+static void pam_worker_idle(struct pam_worker *w)
+{
+	w->busy = false;
+	w->request = NULL;
+	destroy_timeout(&w->timeout);
+}
+
+static void pam_worker_reply(int fd, void *arg, struct logger *logger)
+{
+	struct pam_worker *w = arg;
+	passert(w->fd == fd);
+
+	struct pam_auth_reply_msg reply;
+	ssize_t n = read(fd, &reply, sizeof(reply));
+	if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+		return;
+	}
+	if (n <= 0) {
+		/* the SIGCHLD handler will clean up */
+		ldbg(logger, "PAM: worker %u pid %d hung up", w->nr, w->pid);
+		detach_fd_read_listener(&w->fdl);
+		return;
+	}
+	if (n != sizeof(reply) || !w->busy || reply.id != w->id) {
+		llog(RC_LOG_SERIOUS, logger,
+		     "PAM: worker %u pid %d sent an unexpected reply; killing it",
+		     w->nr, w->pid);
+		kill(w->pid, SIGKILL);
+		detach_fd_read_listener(&w->fdl);
+		return;
+	}
+
+	deltatime_t latency = monotimediff(mononow(), w->dispatch_time);
+	pam_auth_stats.latency = deltatime_add(pam_auth_stats.latency, latency);
+	pam_auth_stats.latency_max = deltatime_max(pam_auth_stats.latency_max, latency);
+	pam_auth_stats.completed++;
+
+	struct pam_auth *pamauth = w->request;
+	pam_worker_idle(w);
+	if (pamauth == NULL) {
+		ldbg(logger, "PAM: worker %u: discarding answer for aborted request", w->nr);
+	} else {
+		pamauth->success = reply.success;
+		pam_auth_done(pamauth);
+	}
+
+	pam_auth_dispatch(logger);
+}
+
+static void pam_worker_timeout(void *arg, const struct timer_event *event)
+{
+	struct pam_worker *w = arg;
+	destroy_timeout(&w->timeout);
+	pam_auth_stats.timeouts++;
+	llog(RC_LOG_SERIOUS, event->logger,
+	     "PAM: worker %u pid %d did not answer within %jd seconds; killing it",
+	     w->nr, w->pid, deltasecs(PAM_AUTH_TIMEOUT));
+	/* the SIGCHLD handler fails the request */
+	kill(w->pid, SIGKILL);
+}
+
+static server_fork_cb pam_worker_exited; /* type assertion */
+
+static stf_status pam_worker_exited(struct state *st UNUSED,
+				    struct msg_digest *md UNUSED,
+				    int status, void *arg,
+				    struct logger *logger)
+{
+	struct pam_worker *w = arg;
+
+	if (!exiting_pluto) {
+		llog(RC_LOG, logger, "PAM: worker %u pid %d exited%s",
+		     w->nr, w->pid,
+		     (WIFEXITED(status) ? "" :
+		      WIFSIGNALED(status) ? " (killed)" : " (unexpected status)"));
+	}
+
+	detach_fd_read_listener(&w->fdl);
+	close(w->fd);
+	w->fd = -1;
+	w->pid = 0;
+
+	struct pam_auth *pamauth = (w->busy ? w->request : NULL);
+	pam_worker_idle(w);
+	if (pamauth != NULL) {
+		pamauth->success = false;
+		pam_auth_done(pamauth);
+	}
+
+	if (!exiting_pluto) {
+		pam_auth_dispatch(logger);
+	}
+	return STF_OK;
+}
+
+static bool start_pam_worker(struct pam_worker *w, struct logger *logger)
+{
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0, fds) < 0) {
+		llog_error(logger, errno, "PAM: socketpair() for worker %u failed", w->nr);
+		return false;
 	}
 
+	w->fd = fds[0];
+	w->child_fd = fds[1];
 	/*
-	 * If there is still a state, notify it.  Since this is
-	 * running on the main thread, it and pam_auth_abort() can't
-	 * get into a race.
+	 * The worker outlives the state that caused it to be started,
+	 * so don't give it (or the exit callback) that state's logger
+	 * (and its whack).
 	 */
+	w->pid = server_fork("pam worker", SOS_NOBODY, pam_worker,
+			     pam_worker_exited, w, &global_logger);
+	close(w->child_fd);
+	w->child_fd = -1;
+	if (w->pid < 0) {
+		llog(RC_LOG_SERIOUS, logger,
+		     "PAM: creation of PAM worker process %u failed", w->nr);
+		close(w->fd);
+		w->fd = -1;
+		w->pid = 0;
+		return false;
+	}
 
-	stf_status ret = STF_OK;
-	if (st != NULL) {
-		st->st_pam_auth = NULL; /* all done */
-		ret = pamauth->callback(st, md, pamauth->ptarg.name, success);
+	attach_fd_read_listener(&w->fdl, w->fd, "pam worker",
+				pam_worker_reply, w);
+	pam_auth_stats.workers_started++;
+	ldbg(logger, "PAM: started worker %u pid %d", w->nr, w->pid);
+	return true;
+}
+
+static struct pam_worker *idle_pam_worker(struct logger *logger)
+{
+	if (!pam_workers_initialized) {
+		for (unsigned i = 0; i < elemsof(pam_workers); i++) {
+			pam_workers[i] = (struct pam_worker) {
+				.nr = i + 1,
+				.fd = -1,
+				.child_fd = -1,
+			};
+		}
+		pam_workers_initialized = true;
 	}
 
-	pam_auth_free(&pamauth);
-	return ret;
+	/* prefer a running worker */
+	FOR_EACH_ELEMENT(w, pam_workers) {
+		if (w->pid > 0 && w->fdl != NULL && !w->busy) {
+			return w;
+		}
+	}
+	FOR_EACH_ELEMENT(w, pam_workers) {
+		if (w->pid == 0 && start_pam_worker(w, logger)) {
+			return w;
+		}
+	}
+	return NULL;
 }
 
-/*
- * Perform the authentication in the child process.
- */
-static int pam_child(void *arg, struct logger *logger)
+static bool send_pam_auth_request(struct pam_worker *w, struct pam_auth *pamauth,
+				  struct logger *logger)
 {
-	struct pam_auth *pamauth = arg;
+	struct pam_auth_request_msg request = {
+		.id = ++pam_auth_id,
+		.st_serialno = pamauth->ptarg.st_serialno,
+		.c_instance_serial = pamauth->ptarg.c_instance_serial,
+		.rhost = pamauth->ptarg.rhost,
+	};
+
+	char buf[PAM_AUTH_MSG_MAX];
+	struct jambuf jb = ARRAY_AS_JAMBUF(buf);
+	jam_raw_bytes(&jb, &request, sizeof(request));
+	const char *strings[] = {
+		pamauth->ptarg.name,
+		pamauth->ptarg.password,
+		pamauth->ptarg.c_name,
+		pamauth->ptarg.atype,
+	};
+	FOR_EACH_ELEMENT(string, strings) {
+		jam_raw_bytes(&jb, *string, strlen(*string) + 1);
+	}
+	shunk_t msg = jambuf_as_shunk(&jb);
+	bool ok = jambuf_ok(&jb);
+	if (ok) {
+		ok = (write(w->fd, msg.ptr, msg.len) == (ssize_t)msg.len);
+		if (!ok) {
+			llog_error(logger, errno, "PAM: write to worker %u failed", w->nr);
+		}
+	} else {
+		llog(RC_LOG_SERIOUS, logger,
+		     "PAM: request for user '%s' is too big", pamauth->ptarg.name);
+	}
+	memset(buf, 0, sizeof(buf)); /* wipe the password */
+	if (!ok) {
+		return false;
+	}
+
+	w->busy = true;
+	w->id = request.id;
+	w->request = pamauth;
+	w->dispatch_time = mononow();
+	schedule_timeout("pam auth", &w->timeout, PAM_AUTH_TIMEOUT,
+			 pam_worker_timeout, w);
+
+	deltatime_t wait = monotimediff(w->dispatch_time, pamauth->start_time);
+	pam_auth_stats.wait = deltatime_add(pam_auth_stats.wait, wait);
+	pam_auth_stats.dispatched++;
+	pam_auth_stats.wait_max = deltatime_max(pam_auth_stats.wait_max, wait);
+
+	pamauth->stage = PAM_AUTH_RUNNING;
+	pamauth->worker = w;
+	return true;
+}
+
+static void pam_auth_dispatch(struct logger *logger)
+{
+	while (pam_auth_queue.head != NULL) {
+		struct pam_worker *w = idle_pam_worker(logger);
+		if (w == NULL) {
+			ldbg(logger, "PAM: all workers busy; %u requests queued",
+			     pam_auth_queue.len);
+			return;
+		}
 
-	dbg("PAM: #%lu: PAM-process authenticating user '%s'",
-	    pamauth->serialno,
-	    pamauth->ptarg.name);
-	bool success = do_pam_authentication(&pamauth->ptarg, logger);
-	dbg("PAM: #%lu: PAM-process completed for user '%s' with result %s",
-	    pamauth->serialno, pamauth->ptarg.name,
-	    success ? "SUCCESS" : "FAILURE");
-	return success ? 0 : 1;
+		struct pam_auth *pamauth = pam_auth_queue.head;
+		pam_auth_queue.head = pamauth->next;
+		if (pam_auth_queue.head == NULL) {
+			pam_auth_queue.tail = &pam_auth_queue.head;
+		}
+		pam_auth_queue.len--;
+		pamauth->next = NULL;
+
+		dbg("PAM: #%lu: main-process passing user '%s' to PAM worker %u",
+		    pamauth->serialno, pamauth->ptarg.name, w->nr);
+		if (!send_pam_auth_request(w, pamauth, logger)) {
+			pamauth->success = false;
+			pam_auth_done(pamauth);
+		}
+	}
 }
 
 bool pam_auth_fork_request(struct state *st,
@@ -175,15 +625,22 @@ bool pam_auth_fork_request(struct state *st,
 {
 	so_serial_t serialno = st->st_serialno;
 
-	/* now start the pamauth child process */
+	if (pam_auth_queue.len >= PAM_AUTH_QUEUE_MAX) {
+		pam_auth_stats.queue_full++;
+		log_state(RC_LOG, st,
+			  "PAM: too many pending authentications; rejecting user '%s'",
+			  name);
+		return false;
+	}
 
 	struct pam_auth *pamauth = alloc_thing(struct pam_auth, "pamauth arg");
 
 	pamauth->callback = callback;
 	pamauth->serialno = serialno;
 	pamauth->start_time = mononow();
+	pamauth->logger = clone_logger(st->st_logger, HERE);
 
-	/* fill in pam_thread_arg with info for the child process */
+	/* fill in pam_thread_arg with info for the worker process */
 
 	pamauth->ptarg.name = clone_str(name, "pam name");
 
@@ -194,20 +651,65 @@ bool pam_auth_fork_request(struct state *st,
 	pamauth->ptarg.c_instance_serial = st->st_connection->instance_serial;
 	pamauth->ptarg.atype = atype;
 
-	dbg("PAM: #%lu: main-process starting PAM-process for authenticating user '%s'",
+	dbg("PAM: #%lu: main-process queueing PAM authentication of user '%s'",
 	    pamauth->serialno, pamauth->ptarg.name);
-	pamauth->child = server_fork("pamauth", pamauth->serialno,
-				     pam_child, pam_callback, pamauth,
-				     st->st_logger);
-	if (pamauth->child < 0) {
-		log_state(RC_LOG, st,
-			  "PAM: creation of PAM authentication process for user '%s' failed",
-			  pamauth->ptarg.name);
-		pam_auth_free(&pamauth);
-		return false;
-	}
+	pamauth->stage = PAM_AUTH_QUEUED;
+	*pam_auth_queue.tail = pamauth;
+	pam_auth_queue.tail = &pamauth->next;
+	pam_auth_queue.len++;
 
 	st->st_pam_auth = pamauth;
+	pam_auth_stats.requests++;
 	pstats_pamauth_started++;
+
+	pam_auth_dispatch(st->st_logger);
 	return true;
 }
+
+void show_pam_auth_status(struct show *s)
+{
+	if (pam_auth_stats.workers_started == 0) {
+		return;
+	}
+	unsigned running = 0, busy = 0;
+	FOR_EACH_ELEMENT(w, pam_workers) {
+		running += (w->pid > 0);
+		busy += w->busy;
+	}
+	uintmax_t completed = pam_auth_stats.completed;
+	uintmax_t dispatched = pam_auth_stats.dispatched;
+	show_raw(s, "current.pamauth.workers=%u", running);
+	show_raw(s, "current.pamauth.busy=%u", busy);
+	show_raw(s, "current.pamauth.queued=%u", pam_auth_queue.len);
+	show_raw(s, "total.pamauth.workers.started=%ju", pam_auth_stats.workers_started);
+	show_raw(s, "total.pamauth.queue_full=%ju", pam_auth_stats.queue_full);
+	show_raw(s, "total.pamauth.timeouts=%ju", pam_auth_stats.timeouts);
+	show_raw(s, "total.pamauth.wait.avg_ms=%jd",
+		 (dispatched == 0 ? 0 : deltamillisecs(pam_auth_stats.wait) / (intmax_t)dispatched));
+	show_raw(s, "total.pamauth.wait.max_ms=%jd",
+		 deltamillisecs(pam_auth_stats.wait_max));
+	show_raw(s, "total.pamauth.latency.avg_ms=%jd",
+		 (completed == 0 ? 0 : deltamillisecs(pam_auth_stats.latency) / (intmax_t)completed));
+	show_raw(s, "total.pamauth.latency.max_ms=%jd",
+		 deltamillisecs(pam_auth_stats.latency_max));
+}
+
+void free_pam_auth_workers(struct logger *logger)
+{
+	/* states are gone so nothing should be waiting */
+	while (pam_auth_queue.head != NULL) {
+		struct pam_auth *pamauth = pam_auth_queue.head;
+		pam_auth_queue.head = pamauth->next;
+		pam_auth_queue.len--;
+		pam_auth_free(&pamauth);
+	}
+	pam_auth_queue.tail = &pam_auth_queue.head;
+
+	FOR_EACH_ELEMENT(w, pam_workers) {
+		if (w->pid > 0) {
+			/* don't wait on a PAM conversation */
+			kill(w->pid, SIGKILL);
+			server_fork_wait(w->pid, logger);
+		}
+	}
+}
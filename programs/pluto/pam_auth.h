@@ -24,6 +24,8 @@
 
 struct state;
 struct msg_digest;
+struct show;
+struct logger;
 
 typedef stf_status pam_auth_callback_fn(struct state *st,
 					struct msg_digest *md,
@@ -41,4 +43,8 @@ bool pam_auth_fork_request(struct state *st,
 			   const char *atype,
 			   pam_auth_callback_fn *callback);
 
+/* the worker pool; status only shown once it has been used */
+void show_pam_auth_status(struct show *s);
+void free_pam_auth_workers(struct logger *logger);
+
 #endif
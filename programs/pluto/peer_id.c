@@ -45,6 +45,7 @@
 #include "nss_cert_verify.h"
 #include "pluto_x509.h"
 #include "instantiate.h"
+#include "pubkey_db.h"
 
 /*
  * This is to support certificates with SAN using wildcard, eg SAN
@@ -191,7 +192,14 @@ static struct connection *refine_host_connection_on_responder(int indent,
 	asn1_t peer_ca = get_peer_ca(&st->st_remote_certs.pubkey_db, peer_id);
 
 	if (hunk_isempty(peer_ca)) {
-		peer_ca = get_peer_ca(&pluto_pubkeys, peer_id);
+		struct pubkey_filter pubkeys = {
+			.type = &pubkey_type_rsa,
+			.same_id = peer_id,
+			.where = HERE,
+		};
+		if (next_pluto_pubkey(NEW2OLD, &pubkeys)) {
+			peer_ca = pubkeys.key->issuer;
+		}
 	}
 
 	/*
@@ -114,11 +114,13 @@ static void init_seccomp(uint32_t def_action, bool main, struct logger *logger)
 		LSW_SECCOMP_ADD(readlinkat);
 		LSW_SECCOMP_ADD(recvfrom);
 		LSW_SECCOMP_ADD(recvmsg);
+		LSW_SECCOMP_ADD(recvmmsg);	/* ike-socket-batch= */
 #if SCMP_SYS(rseq)
 		LSW_SECCOMP_ADD(rseq);
 #endif
 		LSW_SECCOMP_ADD(select);
 		LSW_SECCOMP_ADD(sendmsg);
+		LSW_SECCOMP_ADD(sendmmsg);	/* ike-socket-batch= */
 		LSW_SECCOMP_ADD(set_robust_list);
 		LSW_SECCOMP_ADD(setsockopt);
 		LSW_SECCOMP_ADD(socket);
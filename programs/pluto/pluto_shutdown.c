@@ -42,6 +42,7 @@
 #include "server_pool.h"	/* for stop_crypto_helpers() */
 #include "pluto_sd.h"		/* for pluto_sd() */
 #include "root_certs.h"		/* for free_root_certs() */
+#include "nss_cert_verify.h"	/* for free_cert_chain_cache() */
 #include "keys.h"		/* for free_preshared_secrets() */
 #include "connections.h"	/* for delete_every_connection() */
 #include "fetch.h"		/* for stop_crl_fetch_helper() et.al. */
@@ -49,6 +50,11 @@
 #include "iface.h"		/* for shutdown_ifaces() */
 #include "kernel.h"		/* for kernel_ops.shutdown() and free_kernel() */
 #include "virtual_ip.h"		/* for free_virtual_ip() */
+#include "updown.h"		/* for flush_updown_commands() */
+#include "timer.h"		/* for free_state_event_wheel() */
+#ifdef KERNEL_XFRM
+#include "updown_native.h"	/* for free_native_updown() */
+#endif
 #include "server.h"		/* for free_server() */
 #include "revival.h"		/* for free_revivals() */
 #ifdef USE_DNSSEC
@@ -56,10 +62,18 @@
 #endif
 #include "demux.h"		/* for free_demux() */
 #include "impair_message.h"	/* for free_impair_message() */
+#include "hash_table.h"		/* for free_hash_tables() */
+#include "state.h"		/* for free_state_listings() */
 #include "state_db.h"		/* for check_state_db() */
 #include "connection_db.h"	/* for check_connection_db() */
 #include "spd_route_db.h"	/* for check_spd_db() */
+#include "pubkey_db.h"		/* for pluto_pubkey_db_check() */
+#include "host_lookup.h"		/* for free_host_lookups() */
+#include "crypt_ke.h"		/* for free_ke_pools() */
 #include "server_fork.h"	/* for check_server_fork() */
+#ifdef USE_PAM_AUTH
+#include "pam_auth.h"		/* for free_pam_auth_workers() */
+#endif
 
 volatile bool exiting_pluto = false;
 static enum pluto_exit_code pluto_exit_code;
@@ -122,8 +136,16 @@ void exit_epilogue(void)
 	state_db_check(logger);
 	connection_db_check(logger);
 	spd_route_db_check(logger);
+	pluto_pubkey_db_check(logger);
+	host_lookup_db_check(logger);
 	check_server_fork(logger); /*pid_entry_db_check()*/
 
+	/*
+	 * Finish any queued updown commands before the down/unroute
+	 * commands that deleting the connections triggers.
+	 */
+	flush_updown_commands(logger);
+
 	/*
 	 * This should wipe pretty much everything: states, revivals,
 	 * ...
@@ -131,8 +153,13 @@ void exit_epilogue(void)
 	delete_every_connection();
 
 	free_server_helper_jobs(logger);
+	free_ke_pools();		/* needs NSS */
+#ifdef USE_PAM_AUTH
+	free_pam_auth_workers(logger);
+#endif
 
 	free_root_certs(logger);
+	free_cert_chain_cache();
 	free_preshared_secrets(logger);
 	free_remembered_public_keys();
 	/*
@@ -164,12 +191,20 @@ void exit_epilogue(void)
 	shutdown_demux();
 	shutdown_ifaces(logger);	/* free interface list from memory */
 	shutdown_kernel(logger);
+#ifdef KERNEL_XFRM
+	free_native_updown();
+#endif
 	lsw_nss_shutdown();
 	delete_lock();	/* delete any lock files */
+	free_host_lookups();		/* cancels unbound queries */
 #ifdef USE_DNSSEC
 	unbound_ctx_free();	/* needs event-loop aka server */
 #endif
 
+	free_state_listings();		/* needs event-loop aka server */
+	free_hash_tables(logger);	/* needs event-loop aka server */
+	free_state_event_wheel();	/* needs event-loop aka server */
+
 	/*
 	 * No libevent events beyond this point.
 	 */
@@ -65,6 +65,8 @@ unsigned long pstats_ikev1_ipsec_integ[AUTH_ALGORITHM_PSTATS_ROOF];
 unsigned long pstats_ikev2_ipsec_integ[IKEv2_INTEG_PSTATS_ROOF];
 
 struct pstats_bytes pstats_ike_bytes;	/* total IKE traffic */
+struct pstats_recv pstats_ike_recv;
+struct pstats_send pstats_ike_send;
 struct pstats_bytes pstats_esp_bytes;
 struct pstats_bytes pstats_ah_bytes;
 struct pstats_bytes pstats_ipcomp_bytes;
@@ -395,6 +397,30 @@ static void show_bytes(struct show *s, const char *prefix, const struct pstats_b
 	show_raw(s, "%s.out=%"PRIu64, prefix, bytes->out);
 }
 
+void pstats_batch_add(struct pstats_batch *batch, unsigned nr)
+{
+	batch->max = max(batch->max, (unsigned long)nr);
+	/* 0, 1, 2, 3-4, 5-8, ... */
+	unsigned bucket = 0;
+	while (nr > (1U << bucket) / 2 &&
+	       bucket < elemsof(batch->count) - 1) {
+		bucket++;
+	}
+	batch->count[bucket]++;
+}
+
+static void show_batch(struct show *s, const char *prefix, const struct pstats_batch *batch)
+{
+	static const char *const names[] = {
+		"0", "1", "2", "3-4", "5-8", "9-16", "17-32", "33-64",
+	};
+	passert(elemsof(names) == elemsof(batch->count));
+	show_raw(s, "%s.batch.max=%lu", prefix, batch->max);
+	for (unsigned i = 0; i < elemsof(batch->count); i++) {
+		show_raw(s, "%s.batch.%s=%lu", prefix, names[i], batch->count[i]);
+	}
+}
+
 void show_pluto_stats(struct show *s)
 {
 	show_raw(s, "total.ipsec.type.all=%lu", pstats_ipsec_sa);
@@ -455,6 +481,13 @@ void show_pluto_stats(struct show *s)
 	show_raw(s, "total.ike.dpd.replied=%lu", pstats_ike_dpd_replied);
 
 	show_bytes(s, "total.ike.traffic", &pstats_ike_bytes);
+	show_raw(s, "total.ike.recv.wakeups=%lu", pstats_ike_recv.wakeups);
+	show_raw(s, "total.ike.recv.datagrams=%lu", pstats_ike_recv.datagrams);
+	show_batch(s, "total.ike.recv", &pstats_ike_recv.batch);
+	show_raw(s, "total.ike.send.flushes=%lu", pstats_ike_send.flushes);
+	show_raw(s, "total.ike.send.datagrams=%lu", pstats_ike_send.datagrams);
+	show_raw(s, "total.ike.send.gso=%lu", pstats_ike_send.gso);
+	show_batch(s, "total.ike.send", &pstats_ike_send.batch);
 
 	show_raw(s, "total.pamauth.started=%lu", pstats_pamauth_started);
 	show_raw(s, "total.pamauth.stopped=%lu", pstats_pamauth_stopped);
@@ -509,6 +542,8 @@ void clear_pluto_stats(void)
 	memset(pstats_sa_established, 0, sizeof pstats_sa_established);
 
 	zero(&pstats_ike_bytes);
+	zero(&pstats_ike_recv);
+	zero(&pstats_ike_send);
 	zero(&pstats_esp_bytes);
 	zero(&pstats_ah_bytes);
 	zero(&pstats_ipcomp_bytes);
@@ -47,6 +47,28 @@ extern struct pstats_bytes pstats_ah_bytes;
 extern struct pstats_bytes pstats_ipcomp_bytes;
 extern struct pstats_bytes pstats_ike_bytes;	/* total IKE traffic */
 
+/* datagrams per IKE socket system call; see ike-socket-batch= */
+struct pstats_batch {
+	unsigned long max;
+	unsigned long count[8];	/* 0, 1, 2, 3-4, 5-8, 9-16, 17-32, 33-64 */
+};
+void pstats_batch_add(struct pstats_batch *batch, unsigned nr);
+
+struct pstats_recv {
+	unsigned long wakeups;
+	unsigned long datagrams;
+	struct pstats_batch batch;
+};
+extern struct pstats_recv pstats_ike_recv;
+
+struct pstats_send {
+	unsigned long flushes;
+	unsigned long datagrams;
+	unsigned long gso;	/* datagrams sent as UDP GSO segments */
+	struct pstats_batch batch;
+};
+extern struct pstats_send pstats_ike_send;
+
 extern unsigned long pstats_ikev1_sent_notifies_e[v1N_ERROR_PSTATS_ROOF]; /* types of NOTIFY ERRORS */
 extern unsigned long pstats_ikev1_recv_notifies_e[v1N_ERROR_PSTATS_ROOF]; /* types of NOTIFY ERRORS */
 extern const struct pluto_stat pstats_ikev2_sent_notifies_e; /* types of NOTIFY ERRORS */
@@ -45,6 +45,7 @@
 #include "lswversion.h"
 #include "lswconf.h"
 #include "lswfips.h"
+#include "rnd.h"			/* for enable_rnd_reservoir() */
 #include "lswnss.h"
 #include "defs.h"
 #include "nss_ocsp.h"
@@ -65,6 +66,8 @@
 #include "state_db.h"		/* for init_state_db() */
 #include "connection_db.h"	/* for init_connection_db() */
 #include "spd_route_db.h"	/* for init_spd_route_db() */
+#include "pubkey_db.h"		/* for pluto_pubkey_db_init() */
+#include "host_lookup.h"		/* for host_lookup_db_init() */
 #include "nat_traversal.h"
 #include "ike_alg.h"
 #include "ikev2_redirect.h"
@@ -77,7 +80,10 @@
 #include "pending.h"		/* for init_pending() */
 #include "iface.h"		/* for pluto_listen; */
 #include "server_pool.h"
+#include "updown.h"		/* for pluto_updown_concurrency */
+#include "nss_cert_verify.h"	/* for cert_chain_cache_size */
 #include "show.h"
+#include "hash_bytes.h"		/* for init_hash_bytes_key() */
 
 #ifndef IPSECDIR
 #define IPSECDIR "/etc/ipsec.d"
@@ -434,6 +440,12 @@ static void pluto_init_nss(const char *nssdir, struct logger *logger)
 		messupn(buf, seedbytes);
 		pfree(buf);
 	}
+
+	/*
+	 * Key the hash tables; must happen before anything is added
+	 * to them.
+	 */
+	init_hash_bytes_key();
 }
 
 /* 0 is special and default: do not check crls dynamically */
@@ -481,6 +493,11 @@ enum {
 	OPT_IMPAIR,
 	OPT_DNSSEC_ROOTKEY_FILE,
 	OPT_DNSSEC_TRUSTED,
+	OPT_IKE_SOCKET_BATCH,
+	OPT_UPDOWN_CONCURRENCY,
+	OPT_SA_STATS_MAX_AGE,
+	OPT_CERT_CHAIN_CACHE,
+	OPT_CRL_FETCH_THREADS,
 };
 
 static const struct option long_opts[] = {
@@ -530,6 +547,7 @@ static const struct option long_opts[] = {
 	{ "no-listen-udp\0", no_argument, NULL, 'p' },
 	{ "ike-socket-bufsize\0<buf-size>", required_argument, NULL, 'W' },
 	{ "ike-socket-no-errqueue\0", no_argument, NULL, '1' },
+	{ "ike-socket-batch\0<count>", required_argument, NULL, OPT_IKE_SOCKET_BATCH },
 	{ "nflog-all\0<group-number>", required_argument, NULL, 'G' },
 	{ "rundir\0<path>", required_argument, NULL, 'b' }, /* was ctlbase */
 	{ "secretsfile\0<secrets-file>", required_argument, NULL, 's' },
@@ -544,6 +562,10 @@ static const struct option long_opts[] = {
 	{ "keep-alive\0<delay_secs>", required_argument, NULL, '2' },
 	{ "virtual-private\0<network_list>", required_argument, NULL, '6' },
 	{ "nhelpers\0<number>", required_argument, NULL, 'j' },
+	{ "updown-concurrency\0<number>", required_argument, NULL, OPT_UPDOWN_CONCURRENCY },
+	{ "sa-stats-max-age\0<secs>", required_argument, NULL, OPT_SA_STATS_MAX_AGE },
+	{ "cert-chain-cache\0<number>", required_argument, NULL, OPT_CERT_CHAIN_CACHE },
+	{ "crl-fetch-threads\0<number>", required_argument, NULL, OPT_CRL_FETCH_THREADS },
 	{ "expire-shunt-interval\0<secs>", required_argument, NULL, '9' },
 	{ "seedbits\0<number>", required_argument, NULL, 'c' },
 	/* really an attribute type, not a value */
@@ -838,6 +860,38 @@ int main(int argc, char **argv)
 			}
 			continue;
 
+		case OPT_UPDOWN_CONCURRENCY:	/* --updown-concurrency <number> */
+		{
+			unsigned long u;
+			check_err(ttoulb(optarg, 0, 10, UPDOWN_CONCURRENCY_MAX, &u),
+				  longindex, logger);
+			pluto_updown_concurrency = u;
+			continue;
+		}
+
+		case OPT_SA_STATS_MAX_AGE:	/* --sa-stats-max-age <seconds> */
+			check_diag(ttodeltatime(optarg, &sa_stats_max_age, &timescale_seconds),
+				   longindex, logger);
+			continue;
+
+		case OPT_CERT_CHAIN_CACHE:	/* --cert-chain-cache <number> */
+		{
+			unsigned long u;
+			check_err(ttoulb(optarg, 0, 10, CERT_CHAIN_CACHE_MAX, &u),
+				  longindex, logger);
+			cert_chain_cache_size = u;
+			continue;
+		}
+
+		case OPT_CRL_FETCH_THREADS:	/* --crl-fetch-threads <number> */
+		{
+			unsigned long u;
+			check_err(ttoulb(optarg, 0, 10, CRL_FETCH_THREADS_MAX, &u),
+				  longindex, logger);
+			crl_fetch_threads = (u == 0 ? 1 : u); /* always at least one */
+			continue;
+		}
+
 		case 'c':	/* --seedbits */
 			pluto_nss_seedbits = atoi(optarg);
 			if (pluto_nss_seedbits == 0) {
@@ -1105,6 +1159,17 @@ int main(int argc, char **argv)
 			continue;
 		}
 
+		case OPT_IKE_SOCKET_BATCH:	/* --ike-socket-batch <count> */
+		{
+			unsigned long u;
+			check_err(ttoulb(optarg, 0, 10, IKE_SOCKET_BATCH_MAX, &u), longindex, logger);
+			if (u == 0) {
+				fatal_opt(longindex, logger, "must not be 0");
+			}
+			pluto_sock_batch = u;
+			continue;
+		}
+
 		case 'p':	/* --no-listen-udp */
 			pluto_listen_udp = false;
 			continue;
@@ -1289,6 +1354,15 @@ int main(int argc, char **argv)
 			/* ike-socket-bufsize= */
 			pluto_sock_bufsize = cfg->setup.options[KBF_IKEBUF];
 			pluto_sock_errqueue = cfg->setup.options[KBF_IKE_ERRQUEUE];
+			/* ike-socket-batch=; 1 disables recvmmsg() */
+			pluto_sock_batch = cfg->setup.options[KBF_IKE_BATCH];
+			if (pluto_sock_batch < 1 || pluto_sock_batch > IKE_SOCKET_BATCH_MAX) {
+				llog(RC_LOG, logger,
+				     "ike-socket-batch=%u invalid, must be between 1 and %u; using %u",
+				     pluto_sock_batch, IKE_SOCKET_BATCH_MAX,
+				     IKE_SOCKET_BATCH_DEFAULT);
+				pluto_sock_batch = IKE_SOCKET_BATCH_DEFAULT;
+			}
 
 			/* listen-tcp= / listen-udp= */
 			pluto_listen_tcp = cfg->setup.options[KBF_LISTEN_TCP];
@@ -1364,6 +1438,34 @@ int main(int argc, char **argv)
 			set_global_redirect_dests(cfg->setup.strings[KSF_GLOBAL_REDIRECT_TO]);
 
 			nhelpers = cfg->setup.options[KBF_NHELPERS];
+			/* updown-concurrency=; 0 runs updown synchronously */
+			pluto_updown_concurrency = cfg->setup.options[KBF_UPDOWN_CONCURRENCY];
+			if (pluto_updown_concurrency > UPDOWN_CONCURRENCY_MAX) {
+				llog(RC_LOG, logger,
+				     "updown-concurrency=%u invalid, must be between 0 and %u; using %u",
+				     pluto_updown_concurrency, UPDOWN_CONCURRENCY_MAX,
+				     UPDOWN_CONCURRENCY_MAX);
+				pluto_updown_concurrency = UPDOWN_CONCURRENCY_MAX;
+			}
+			/* sa-stats-max-age=; 0 queries each SA */
+			sa_stats_max_age = deltatime_ms(cfg->setup.options[KBF_SA_STATS_MAX_AGE_MS]);
+			/* cert-chain-cache=; 0 verifies each chain */
+			cert_chain_cache_size = cfg->setup.options[KBF_CERT_CHAIN_CACHE];
+			if (cert_chain_cache_size > CERT_CHAIN_CACHE_MAX) {
+				llog(RC_LOG, logger,
+				     "cert-chain-cache=%u invalid, must be between 0 and %u; using %u",
+				     cert_chain_cache_size, CERT_CHAIN_CACHE_MAX,
+				     CERT_CHAIN_CACHE_MAX);
+				cert_chain_cache_size = CERT_CHAIN_CACHE_MAX;
+			}
+			/* crl-fetch-threads=; default 1 */
+			crl_fetch_threads = cfg->setup.options[KBF_CRL_FETCH_THREADS];
+			if (crl_fetch_threads < 1 || crl_fetch_threads > CRL_FETCH_THREADS_MAX) {
+				llog(RC_LOG, logger,
+				     "crl-fetch-threads=%u invalid, must be between 1 and %u; using 1",
+				     crl_fetch_threads, CRL_FETCH_THREADS_MAX);
+				crl_fetch_threads = 1;
+			}
 			secctx_attr_type = cfg->setup.options[KBF_SECCTX];
 			cur_debugging = cfg->setup.options[KBF_PLUTODEBUG];
 
@@ -1614,7 +1716,9 @@ int main(int argc, char **argv)
 	state_db_init(logger);
 	connection_db_init(logger);
 	spd_route_db_init(logger);
+	pluto_pubkey_db_init(logger);
 	host_pair_db_init(logger);
+	host_lookup_db_init(logger);
 
 	pluto_init_nss(oco->nssdir, logger);
 	if (libreswan_fipsmode()) {
@@ -1668,6 +1772,8 @@ int main(int argc, char **argv)
 		}
 	}
 
+	enable_rnd_reservoir(logger);
+
 	if (ocsp_enable) {
 		/* may not return */
 		diag_t d = init_nss_ocsp(ocsp_uri, ocsp_trust_name,
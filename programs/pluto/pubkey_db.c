@@ -0,0 +1,289 @@
+/* Preloaded public key database, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include "pubkey_db.h"
+#include "defs.h"
+#include "log.h"
+#include "hash_table.h"
+#include "secrets.h"
+#include "id.h"
+
+struct pluto_pubkey {
+	struct pubkey *key;
+	struct {
+		struct list_entry list;
+		struct list_entry id;
+		struct list_entry ckaid;
+	} pluto_pubkey_db_entries;
+};
+
+/*
+ * Keys with an ID_NONE ID match every same_id() query so, while
+ * there are any, same_id() lookups can't use the ID table.
+ */
+static unsigned nr_wildcard_pubkeys;
+
+static void jam_pluto_pubkey(struct jambuf *buf, const struct pluto_pubkey *p)
+{
+	jam_string(buf, p->key->content.type->name);
+	jam_string(buf, " ");
+	jam_id_bytes(buf, &p->key->id, jam_sanitized_bytes);
+}
+
+/*
+ * A table hashed by ID.
+ *
+ * The hash must agree with id_eq(): FQDNs ignore case and trailing
+ * dots.  DNs can't be hashed (same_dn() is fuzzy and match_id()
+ * allows wildcards) so they all land in the one bucket.
+ */
+
+static hash_t hash_pluto_pubkey_id(const struct id *id)
+{
+	hash_t hash = hash_thing(id->kind, zero_hash);
+	switch (id->kind) {
+	case ID_IPV4_ADDR:
+	case ID_IPV6_ADDR:
+		hash = hash_hunk(address_as_shunk(&id->ip_addr), hash);
+		break;
+	case ID_FQDN:
+	case ID_USER_FQDN:
+	{
+		const char *name = (const char *)id->name.ptr;
+		size_t len = id->name.len;
+		while (len > 0 && name[len - 1] == '.') {
+			len--;
+		}
+		for (size_t i = 0; i < len; i++) {
+			char c = char_tolower(name[i]);
+			hash = hash_thing(c, hash);
+		}
+		break;
+	}
+	case ID_KEY_ID:
+		hash = hash_hunk(id->name, hash);
+		break;
+	default:
+		/* ID_NULL, ID_NONE, DNs: kind only */
+		break;
+	}
+	return hash;
+}
+
+HASH_TABLE(pluto_pubkey, id, .key->id, 23);
+
+/*
+ * A table hashed by CKAID.
+ */
+
+static hash_t hash_pluto_pubkey_ckaid(const ckaid_t *ckaid)
+{
+	return hash_bytes(ckaid->ptr, ckaid->len, zero_hash);
+}
+
+HASH_TABLE(pluto_pubkey, ckaid, .key->content.ckaid, 23);
+
+HASH_DB(pluto_pubkey,
+	&pluto_pubkey_id_hash_table,
+	&pluto_pubkey_ckaid_hash_table);
+
+/*
+ * Iterate.
+ */
+
+static struct list_head *pubkey_filter_head(struct pubkey_filter *filter)
+{
+	/* select list head */
+	if (filter->ckaid != NULL) {
+		ckaid_buf cb;
+		dbg("FOR_EACH_PUBKEY[ckaid=%s]... in "PRI_WHERE,
+		    str_ckaid(filter->ckaid, &cb), pri_where(filter->where));
+		hash_t hash = hash_pluto_pubkey_ckaid(filter->ckaid);
+		return hash_table_bucket(&pluto_pubkey_ckaid_hash_table, hash);
+	}
+
+	if (filter->match_id != NULL && filter->match_id->kind != ID_NONE) {
+		/* match_id() requires the kinds to match */
+		id_buf ib;
+		dbg("FOR_EACH_PUBKEY[match_id=%s]... in "PRI_WHERE,
+		    str_id(filter->match_id, &ib), pri_where(filter->where));
+		hash_t hash = hash_pluto_pubkey_id(filter->match_id);
+		return hash_table_bucket(&pluto_pubkey_id_hash_table, hash);
+	}
+
+	if (filter->same_id != NULL && filter->same_id->kind != ID_NONE &&
+	    nr_wildcard_pubkeys == 0) {
+		id_buf ib;
+		dbg("FOR_EACH_PUBKEY[same_id=%s]... in "PRI_WHERE,
+		    str_id(filter->same_id, &ib), pri_where(filter->where));
+		hash_t hash = hash_pluto_pubkey_id(filter->same_id);
+		return hash_table_bucket(&pluto_pubkey_id_hash_table, hash);
+	}
+
+	/* else other queries? */
+	dbg("FOR_EACH_PUBKEY_... in "PRI_WHERE, pri_where(filter->where));
+	return &pluto_pubkey_db_list_head;
+}
+
+static bool matches_pubkey_filter(const struct pubkey *key,
+				  const struct pubkey_filter *filter)
+{
+	if (filter->type != NULL && key->content.type != filter->type) {
+		return false;
+	}
+	if (filter->ckaid != NULL && !hunk_eq(key->content.ckaid, *filter->ckaid)) {
+		return false;
+	}
+	if (filter->same_id != NULL && !same_id(filter->same_id, &key->id)) {
+		return false;
+	}
+	if (filter->match_id != NULL) {
+		int wildcards; /* value ignored */
+		if (!match_id("  ", &key->id, filter->match_id, &wildcards)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool next_pluto_pubkey(enum chrono order, struct pubkey_filter *filter)
+{
+	if (filter->internal == NULL) {
+		/*
+		 * Advance to first entry of the circular list (if the
+		 * list is entry it ends up back on HEAD which has no
+		 * data).
+		 */
+		filter->internal = pubkey_filter_head(filter)->head.next[order];
+	}
+	/* Walk list until an entry matches */
+	filter->key = NULL;
+	for (struct list_entry *entry = filter->internal;
+	     entry->data != NULL /* head has DATA == NULL */;
+	     entry = entry->next[order]) {
+		struct pluto_pubkey *p = entry->data;
+		if (matches_pubkey_filter(p->key, filter)) {
+			/* save key; but step off current entry */
+			filter->internal = entry->next[order];
+			filter->count++;
+			filter->key = p->key;
+			return true;
+		}
+	}
+	dbg("  matches: %d", filter->count);
+	return false;
+}
+
+/*
+ * Maintain the database.
+ */
+
+static void add_pluto_pubkey(struct pubkey **key)
+{
+	struct pluto_pubkey *p = alloc_thing(struct pluto_pubkey, "pluto pubkey");
+	p->key = *key;
+	*key = NULL; /* stolen */
+	pluto_pubkey_db_init_pluto_pubkey(p);
+	pluto_pubkey_db_add(p);
+	if (p->key->id.kind == ID_NONE) {
+		nr_wildcard_pubkeys++;
+	}
+}
+
+static void free_pluto_pubkey(struct pluto_pubkey **pp)
+{
+	struct pluto_pubkey *p = *pp;
+	*pp = NULL;
+	if (p->key->id.kind == ID_NONE) {
+		pexpect(nr_wildcard_pubkeys > 0);
+		nr_wildcard_pubkeys--;
+	}
+	pluto_pubkey_db_del(p);
+	pubkey_delref(&p->key);
+	pfree(p);
+}
+
+void delete_pluto_pubkey(struct pubkey *key)
+{
+	hash_t hash = hash_pluto_pubkey_ckaid(&key->content.ckaid);
+	struct list_head *bucket = hash_table_bucket(&pluto_pubkey_ckaid_hash_table, hash);
+	struct pluto_pubkey *p;
+	FOR_EACH_LIST_ENTRY_NEW2OLD(p, bucket) {
+		if (p->key == key) {
+			free_pluto_pubkey(&p);
+			return;
+		}
+	}
+	llog_pexpect(&global_logger, HERE, "pubkey not in database");
+}
+
+void delete_pluto_pubkeys(const struct id *id, const struct pubkey_type *type)
+{
+	struct pubkey_filter filter = {
+		.same_id = id,
+		.type = type,
+		.where = HERE,
+	};
+	while (next_pluto_pubkey(NEW2OLD, &filter)) {
+		delete_pluto_pubkey(filter.key);
+	}
+}
+
+/*
+ * The list is newest first; install oldest first so that the
+ * database ends up in the same order.
+ */
+
+static struct pubkey_list *reverse_pubkeys(struct pubkey_list *keys)
+{
+	struct pubkey_list *reversed = NULL;
+	while (keys != NULL) {
+		struct pubkey_list *next = keys->next;
+		keys->next = reversed;
+		reversed = keys;
+		keys = next;
+	}
+	return reversed;
+}
+
+static void install_pluto_pubkeys(struct pubkey_list **keys, bool replace)
+{
+	struct pubkey_list *p = reverse_pubkeys(*keys);
+	*keys = NULL;
+	while (p != NULL) {
+		if (replace) {
+			delete_pluto_pubkeys(&p->key->id, p->key->content.type);
+		}
+		add_pluto_pubkey(&p->key);
+		p = free_public_keyentry(p);
+	}
+}
+
+void replace_pluto_pubkeys(struct pubkey_list **keys)
+{
+	install_pluto_pubkeys(keys, true);
+}
+
+void add_pluto_pubkeys(struct pubkey_list **keys)
+{
+	install_pluto_pubkeys(keys, false);
+}
+
+void free_pluto_pubkeys(void)
+{
+	struct pluto_pubkey *p;
+	FOR_EACH_LIST_ENTRY_NEW2OLD(p, &pluto_pubkey_db_list_head) {
+		free_pluto_pubkey(&p);
+	}
+	pexpect(nr_wildcard_pubkeys == 0);
+}
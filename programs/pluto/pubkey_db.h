@@ -0,0 +1,94 @@
+/* Preloaded public key database, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef PUBKEY_DB_H
+#define PUBKEY_DB_H
+
+#include <stdbool.h>
+
+#include "where.h"
+#include "ckaid.h"
+#include "id.h"
+#include "list_entry.h"		/* for enum chrono */
+
+struct pubkey;
+struct pubkey_list;
+struct pubkey_type;
+struct pluto_pubkey;
+struct logger;
+
+/*
+ * The public keys pluto has been told about (raw keys from
+ * ipsec.conf and whack, keys fetched using DNS IPSECKEY, keys
+ * extracted from the local certs).
+ *
+ * Each key is indexed by its ID and by its CKAID; the database holds
+ * one reference to each key.
+ */
+
+void pluto_pubkey_db_init(struct logger *logger);
+void pluto_pubkey_db_check(struct logger *logger);
+
+void pluto_pubkey_db_init_pluto_pubkey(struct pluto_pubkey *p);
+void pluto_pubkey_db_add(struct pluto_pubkey *p);
+void pluto_pubkey_db_del(struct pluto_pubkey *p);
+
+/*
+ * Move the keys in *KEYS (newest first, as built by
+ * replace_public_key() et.al.) into the database.
+ *
+ * replace_pluto_pubkeys() first deletes any existing key with the
+ * same ID and type (same as replace_public_key()) while
+ * add_pluto_pubkeys() adds the keys alongside what is already there
+ * (for instance, multiple IPSECKEY records).
+ */
+
+void replace_pluto_pubkeys(struct pubkey_list **keys);
+void add_pluto_pubkeys(struct pubkey_list **keys);
+
+/* same_id() semantics; an ID_NONE ID matches everything */
+void delete_pluto_pubkeys(const struct id *id, const struct pubkey_type *type);
+/* delete the key returned by next_pluto_pubkey() */
+void delete_pluto_pubkey(struct pubkey *key);
+void free_pluto_pubkeys(void);
+
+/*
+ * For iterating over the pubkey DB.
+ *
+ * - parameters are only matched when non-NULL
+ * - .key can be deleted (using delete_pluto_pubkey()) between calls
+ * - .same_id, .match_id and .ckaid are looked up using the hash
+ *   tables; otherwise all keys are scanned
+ *
+ * Note: NEW2OLD is the order that the old list was kept in.
+ */
+
+struct pubkey_filter {
+	/* filters */
+	const struct pubkey_type *type;
+	const struct id *same_id;	/* same_id(), ID_NONE is a wildcard */
+	const struct id *match_id;	/* match_id(), DNs can be wild */
+	const ckaid_t *ckaid;		/* exact */
+	/* current result (can be safely deleted) */
+	struct pubkey *key;
+	/* internal: handle on next entry */
+	struct list_entry *internal;
+	/* internal: total matches so far */
+	unsigned count;
+	/* .where MUST BE LAST (See GCC bug 102288) */
+	where_t where;
+};
+
+bool next_pluto_pubkey(enum chrono order, struct pubkey_filter *filter);
+
+#endif
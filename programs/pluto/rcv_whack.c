@@ -39,6 +39,7 @@
 #include "acquire.h"			/* for initiate_ondemand() */
 #include "keys.h"			/* for load_preshared_secrets() */
 #include "crl_queue.h"			/* for submit_crl_fetch_requests() */
+#include "fetch.h"			/* for list_crl_fetch_sources() */
 #include "nss_cert_reread.h"		/* for reread_cert_connections() */
 #include "root_certs.h"			/* for free_root_certs() */
 #include "server.h"			/* for call_global_event_inline() */
@@ -65,6 +66,8 @@
 #include "whack_trafficstatus.h"
 #include "whack_down.h"
 #include "whack_route.h"
+#include "pubkey_db.h"
+#include "host_lookup.h"
 
 static void whack_rereadsecrets(struct show *s)
 {
@@ -312,7 +315,7 @@ static void key_add_request(const struct whack_message *msg, struct logger *logg
 			llog(LOG_STREAM/*not-whack*/, logger,
 			     "delete keyid %s", msg->keyid);
 		}
-		delete_public_keys(&pluto_pubkeys, &keyid, type);
+		delete_pluto_pubkeys(&keyid, type);
 		/* XXX: what about private keys; suspect not easy as not 1:1? */
 	}
 
@@ -336,18 +339,20 @@ static void key_add_request(const struct whack_message *msg, struct logger *logg
 
 		/* add the public key */
 		struct pubkey *pubkey = NULL; /* must-delref */
+		struct pubkey_list *pubkeys = NULL;
 		diag_t d = unpack_dns_ipseckey(&keyid, PUBKEY_LOCAL, msg->pubkey_alg,
 					       /*install_time*/realnow(),
 					       /*until_time*/realtime_epoch,
 					       /*ttl*/0,
 					       HUNK_AS_SHUNK(msg->keyval),
 					       &pubkey/*new-public-key:must-delref*/,
-					       &pluto_pubkeys);
+					       &pubkeys);
 		if (d != NULL) {
 			llog_diag(RC_LOG_SERIOUS, logger, &d, "%s", "");
 			free_id_content(&keyid);
 			return;
 		}
+		add_pluto_pubkeys(&pubkeys);
 
 		/* try to pre-load the private key */
 		bool load_needed;
@@ -704,6 +709,7 @@ static void whack_process(const struct whack_message *const m, struct show *s)
 	if (m->whack_ddns) {
 		dbg_whack(s, "ddns: start: %d", m->whack_ddns);
 		llog(RC_LOG, logger, "updating pending dns lookups");
+		flush_host_lookups();
 		connection_check_ddns(show_logger(s));
 		dbg_whack(s, "ddns: stop: %d", m->whack_ddns);
 	}
@@ -769,6 +775,7 @@ static void whack_process(const struct whack_message *const m, struct show *s)
 		list_crls(s);
 #if defined(LIBCURL) || defined(LIBLDAP)
 		list_crl_fetch_requests(s, m->whack_utc);
+		list_crl_fetch_sources(s, m->whack_utc);
 #endif
 		dbg_whack(s, "listcrls: stop:");
 	}
@@ -872,7 +879,7 @@ static void whack_process(const struct whack_message *const m, struct show *s)
 
 	if (m->whack_status) {
 		dbg_whack(s, "status: start:");
-		whack_status(s, now);
+		whack_status(s);
 		dbg_whack(s, "status: stop:");
 	}
 
@@ -940,10 +947,16 @@ static void whack_process(const struct whack_message *const m, struct show *s)
 
 	if (m->whack_show_states) {
 		dbg_whack(s, "showstates: start:");
-		show_states(s, now);
+		show_states(s, NULL);
 		dbg_whack(s, "showstates: stop:");
 	}
 
+	if (m->whack_list_states) {
+		dbg_whack(s, "liststates: start:");
+		whack_list_states(m, s);
+		dbg_whack(s, "liststates: stop:");
+	}
+
 #ifdef USE_SECCOMP
 	if (m->whack_seccomp_crashtest) {
 		dbg_whack(s, "seccomp_crashtest: start:");
@@ -1109,7 +1122,7 @@ static void whack_handle(struct fd *whackfd, struct logger *whack_logger)
 			/* Only basic commands.  Simpler inter-version compatibility. */
 			if (msg.whack_status) {
 				struct show *s = alloc_show(whack_logger);
-				whack_status(s, mononow());
+				whack_status(s);
 				free_show(&s);
 			}
 			/* bail early, but without complaint */
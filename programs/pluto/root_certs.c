@@ -23,6 +23,7 @@
 #include "server.h"
 #include "pluto_timing.h"
 #include "log.h"
+#include "nss_cert_verify.h"	/* for flush_cert_chain_cache() */
 
 static struct root_certs *root_cert_db;
 
@@ -104,6 +105,8 @@ void root_certs_delref_where(struct root_certs **root_certsp,
 		llog(RC_LOG, logger, "freeing root certificate cache");
 		CERT_DestroyCertList(root_certs->trustcl);
 		pfreeany(root_certs);
+		/* chains were verified against these trust anchors */
+		flush_cert_chain_cache("root certificates freed", logger);
 	}
 }
 
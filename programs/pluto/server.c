@@ -193,6 +193,7 @@ deltatime_t pluto_shunt_lifetime = DELTATIME_INIT(PLUTO_SHUNT_LIFE_DURATION_DEFA
 
 unsigned int pluto_sock_bufsize = IKE_BUF_AUTO; /* use system values */
 bool pluto_sock_errqueue = true; /* Enable MSG_ERRQUEUE on IKE socket */
+unsigned int pluto_sock_batch = IKE_SOCKET_BATCH_DEFAULT; /* see recvmmsg(2) */
 
 /*
  * Embedded events.
@@ -475,6 +476,73 @@ struct fd_read_listener {
 	struct fd_read_listener *next;
 };
 
+/*
+ * Whack output that couldn't be written immediately (see
+ * fd_sendmsg()) is written out when the socket becomes writable.
+ *
+ * The listener holds a reference to the FD so that the socket isn't
+ * closed (and whack doesn't see EOF) until everything has been sent.
+ */
+
+struct fd_output_listener {
+	struct fd *fd;
+	struct event ev;		/* libevent data structure */
+	struct fd_output_listener *next;
+};
+
+static struct fd_output_listener *fd_output_listeners = NULL;
+
+static void detach_fd_output_listener(struct fd_output_listener *fdo)
+{
+	for (struct fd_output_listener **pp = &fd_output_listeners;
+	     *pp != NULL; pp = &(*pp)->next) {
+		if (*pp == fdo) {
+			*pp = fdo->next;
+			break;
+		}
+	}
+	EVENT_DEL(fdo);
+	fd_delref(&fdo->fd);
+	dbg_free("fdo", fdo, HERE);
+	pfree(fdo);
+}
+
+static void fd_output_listener_event_handler(evutil_socket_t fd UNUSED,
+					     short events UNUSED,
+					     void *arg)
+{
+	struct fd_output_listener *fdo = arg;
+	uintmax_t dropped;
+	bool drained = fd_flush_output(fdo->fd, &dropped);
+	if (dropped > 0) {
+		llog(RC_LOG, &global_logger,
+		     "whack "PRI_FD" is not keeping up; %ju bytes of output dropped",
+		     pri_fd(fdo->fd), dropped);
+	}
+	if (drained) {
+		detach_fd_output_listener(fdo);
+	}
+}
+
+static bool attach_fd_output_listener(struct fd *fd)
+{
+	if (!in_main_thread()) {
+		/* helper thread; let it block */
+		return false;
+	}
+	struct fd_output_listener *fdo = alloc_thing(struct fd_output_listener,
+						     "fd output listener");
+	dbg_alloc("fdo", fdo, HERE);
+	fdo->fd = fd_addref(fd);
+	fdo->next = fd_output_listeners;
+	fd_output_listeners = fdo;
+	EVENT_ADD(fdo, EV_WRITE|EV_PERSIST,
+		  (evutil_socket_t)fd_fileno(fd),
+		  (struct timeval*)NULL,
+		  fd_output_listener_event_handler);
+	return true;
+}
+
 void free_server(void)
 {
 	if (pluto_eb == NULL) {
@@ -487,6 +555,12 @@ void free_server(void)
 		return;
 	}
 
+	/* from here on whack output blocks */
+	fd_set_output_listener(NULL);
+	while (fd_output_listeners != NULL) {
+		detach_fd_output_listener(fd_output_listeners);
+	}
+
 	while (pluto_events_head != NULL) {
 		struct fd_read_listener *tbd = pluto_events_head;
 		pluto_events_head = tbd->next;
@@ -888,6 +962,7 @@ void list_timers(struct show *s, const monotime_t now)
 		     monosecs(now));
 
 	list_global_timers(s, now);
+	show_state_event_wheel(s);
 	list_signal_handlers(s);
 
 	for (struct fd_read_listener *ev = pluto_events_head;
@@ -1009,6 +1084,7 @@ void init_server(struct logger *logger)
 	int s = evthread_make_base_notifiable(pluto_eb);
 	passert(s >= 0);
 	dbg("libevent initialized");
+	fd_set_output_listener(attach_fd_output_listener);
 }
 
 /*
@@ -68,6 +68,7 @@ extern unsigned int pluto_ddos_threshold; /* Max incoming IKE before activating
 extern deltatime_t pluto_shunt_lifetime; /* lifetime before we cleanup bare shunts (for OE) */
 extern unsigned int pluto_sock_bufsize; /* pluto IKE socket buffer */
 extern bool pluto_sock_errqueue; /* Enable MSG_ERRQUEUE on IKE socket */
+extern unsigned int pluto_sock_batch; /* max datagrams read per IKE socket wakeup */
 
 extern enum pluto_ddos_mode ddos_mode;
 extern bool pluto_drop_oppo_null;
@@ -247,6 +247,72 @@ static void jam_status(struct jambuf *buf, int status)
 	jam_string(buf, ")");
 }
 
+static void server_fork_exited(pid_t child, int status, struct logger *logger)
+{
+	LDBGP_JAMBUF(DBG_BASE, logger, buf) {
+		jam(buf, "waitpid returned pid %d",
+			child);
+		jam_status(buf, status);
+	}
+	struct pid_entry *pid_entry = pid_entry_by_pid(child);
+	if (pid_entry == NULL) {
+		LLOG_JAMBUF(RC_LOG, logger, buf) {
+			jam(buf, "waitpid return unknown child pid %d",
+				child);
+			jam_status(buf, status);
+		}
+		return;
+	}
+	/* log against pid_entry->logger; must cleanup */
+	struct state *st = state_by_serialno(pid_entry->serialno);
+	if (pid_entry->serialno == SOS_NOBODY) {
+		pid_entry->callback(NULL, NULL, status,
+				    pid_entry->context,
+				    pid_entry->logger);
+	} else if (st == NULL) {
+		LDBGP_JAMBUF(DBG_BASE, logger, buf) {
+			jam_pid_entry(buf, pid_entry);
+			jam_string(buf, " disappeared");
+		}
+		pid_entry->callback(NULL, NULL, status,
+				    pid_entry->context,
+				    pid_entry->logger);
+	} else {
+		struct msg_digest *md = unsuspend_any_md(st);
+		if (DBGP(DBG_CPU_USAGE)) {
+			deltatime_t took = monotimediff(mononow(), pid_entry->start_time);
+			deltatime_buf dtb;
+			DBG_log("#%lu waited %s for '%s' fork()",
+				st->st_serialno, str_deltatime(took, &dtb),
+				pid_entry->name);
+		}
+		statetime_t start = statetime_start(st);
+		const enum ike_version ike_version = st->st_ike_version;
+		stf_status ret = pid_entry->callback(st, md, status,
+						     pid_entry->context,
+						     pid_entry->logger);
+		if (ret == STF_SKIP_COMPLETE_STATE_TRANSITION) {
+			/* MD.ST may have been freed! */
+			dbg("resume %s for #%lu skipped complete_v%d_state_transition()",
+			    pid_entry->name, pid_entry->serialno, ike_version);
+		} else {
+			complete_state_transition(st, md, ret);
+		}
+		md_delref(&md);
+		statetime_stop(&start, "callback for %s",
+			       pid_entry->name);
+	}
+	/* drain output using blocking read */
+	if (pid_entry->fdl != NULL) {
+		int flags = fcntl(pid_entry->fd, F_GETFL);
+		fcntl(pid_entry->fd, F_SETFL, flags & ~O_NONBLOCK);
+		while (dump_fd(pid_entry));
+	}
+	/* clean it up */
+	pid_entry_db_del(pid_entry);
+	free_pid_entry(&pid_entry);
+}
+
 void server_fork_sigchld_handler(struct logger *logger)
 {
 	while (true) {
@@ -265,73 +331,27 @@ void server_fork_sigchld_handler(struct logger *logger)
 			dbg("waitpid returned nothing left to do (all child processes are busy)");
 			return;
 		default:
-			LDBGP_JAMBUF(DBG_BASE, logger, buf) {
-				jam(buf, "waitpid returned pid %d",
-					child);
-				jam_status(buf, status);
-			}
-			struct pid_entry *pid_entry = pid_entry_by_pid(child);
-			if (pid_entry == NULL) {
-				LLOG_JAMBUF(RC_LOG, logger, buf) {
-					jam(buf, "waitpid return unknown child pid %d",
-						child);
-					jam_status(buf, status);
-				}
-				continue;
-			}
-			/* log against pid_entry->logger; must cleanup */
-			struct state *st = state_by_serialno(pid_entry->serialno);
-			if (pid_entry->serialno == SOS_NOBODY) {
-				pid_entry->callback(NULL, NULL, status,
-						    pid_entry->context,
-						    pid_entry->logger);
-			} else if (st == NULL) {
-				LDBGP_JAMBUF(DBG_BASE, logger, buf) {
-					jam_pid_entry(buf, pid_entry);
-					jam_string(buf, " disappeared");
-				}
-				pid_entry->callback(NULL, NULL, status,
-						    pid_entry->context,
-						    pid_entry->logger);
-			} else {
-				struct msg_digest *md = unsuspend_any_md(st);
-				if (DBGP(DBG_CPU_USAGE)) {
-					deltatime_t took = monotimediff(mononow(), pid_entry->start_time);
-					deltatime_buf dtb;
-					DBG_log("#%lu waited %s for '%s' fork()",
-						st->st_serialno, str_deltatime(took, &dtb),
-						pid_entry->name);
-				}
-				statetime_t start = statetime_start(st);
-				const enum ike_version ike_version = st->st_ike_version;
-				stf_status ret = pid_entry->callback(st, md, status,
-								     pid_entry->context,
-								     pid_entry->logger);
-				if (ret == STF_SKIP_COMPLETE_STATE_TRANSITION) {
-					/* MD.ST may have been freed! */
-					dbg("resume %s for #%lu skipped complete_v%d_state_transition()",
-					    pid_entry->name, pid_entry->serialno, ike_version);
-				} else {
-					complete_state_transition(st, md, ret);
-				}
-				md_delref(&md);
-				statetime_stop(&start, "callback for %s",
-					       pid_entry->name);
-			}
-			/* drain output using blocking read */
-			if (pid_entry->fdl != NULL) {
-				int flags = fcntl(pid_entry->fd, F_GETFL);
-				fcntl(pid_entry->fd, F_SETFL, flags & ~O_NONBLOCK);
-				while (dump_fd(pid_entry));
-			}
-			/* clean it up */
-			pid_entry_db_del(pid_entry);
-			free_pid_entry(&pid_entry);
+			server_fork_exited(child, status, logger);
 			continue;
 		}
 	}
 }
 
+void server_fork_wait(pid_t pid, struct logger *logger)
+{
+	int status;
+	pid_t child;
+	do {
+		errno = 0;
+		child = waitpid(pid, &status, 0);
+	} while (child < 0 && errno == EINTR);
+	if (child < 0) {
+		llog_error(logger, errno, "waitpid(%d) unexpectedly failed", pid);
+		return;
+	}
+	server_fork_exited(child, status, logger);
+}
+
 /*
  * fork()+exec().
  */
@@ -344,10 +364,10 @@ static void child_output_listener(int fd, void *arg, struct logger *logger)
 	dump_fd(pid_entry);
 }
 
-void server_fork_exec(const char *path,
-		      char *argv[], char *envp[],
-		      server_fork_cb *callback, void *callback_context,
-		      struct logger *logger)
+int server_fork_exec(const char *path,
+		     char *argv[], char *envp[],
+		     server_fork_cb *callback, void *callback_context,
+		     struct logger *logger)
 {
 	const char *what = argv[0];
 	/*
@@ -358,7 +378,7 @@ void server_fork_exec(const char *path,
 	int fds[2]; /*0=read,1=write*/
 	if (pipe2(fds, O_CLOEXEC) < 0) {
 		llog_error(logger, errno, "pipe2() failed");
-		return;
+		return -1;
 	}
 
 #if USE_VFORK
@@ -370,7 +390,9 @@ void server_fork_exec(const char *path,
 #endif
 	if (pid < 0) {
 		llog_error(logger, errno, "fork failed");
-		return;
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
 	}
 
 	if (pid == 0) {
@@ -408,6 +430,7 @@ void server_fork_exec(const char *path,
 	/* listen */
 	attach_fd_read_listener(&entry->fdl, entry->fd, "fork-exec",
 				child_output_listener, entry);
+	return pid;
 }
 
 void init_server_fork(struct logger *logger)
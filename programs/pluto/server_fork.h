@@ -50,12 +50,14 @@ typedef int server_fork_op(void *context, struct logger *logger);
 extern int server_fork(const char *name, so_serial_t serialno, server_fork_op *op,
 		       server_fork_cb *callback, void *callback_context,
 		       struct logger *logger);
-void server_fork_exec(const char *path,
-		      char *argv[], char *envp[],
-		      server_fork_cb *callback, void *callback_context,
-		      struct logger *logger);
+int server_fork_exec(const char *path,
+		     char *argv[], char *envp[],
+		     server_fork_cb *callback, void *callback_context,
+		     struct logger *logger);
 
 void server_fork_sigchld_handler(struct logger *logger);
+/* block until PID exits and then make its callback; for shutdown */
+void server_fork_wait(pid_t pid, struct logger *logger);
 void init_server_fork(struct logger *logger);
 void check_server_fork(struct logger *logger);
 void show_process_status(struct show *s);
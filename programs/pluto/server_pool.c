@@ -27,7 +27,10 @@
  *
  */
 
+#define _GNU_SOURCE		/* for pthread_attr_setaffinity_np() */
+
 #include <pthread.h>    /* Must be the first include file */
+#include <sched.h>	/* for sched_getaffinity() */
 #include <unistd.h>	/* for sleep() */
 #include <limits.h>	/* for UINT_MAX, ULONG_MAX */
 
@@ -42,6 +45,8 @@
 #include "server_pool.h"
 #include "list_entry.h"
 #include "pluto_timing.h"
+#include "show.h"
+#include "log_limiter.h"
 
 #ifdef USE_SECCOMP
 # include "pluto_seccomp.h"
@@ -51,6 +56,7 @@ static callback_cb helper_thread_stopped_callback;	/* type assertion */
 static resume_cb handle_helper_answer;			/* type assertion */
 static callback_cb inline_worker;			/* type assertion */
 static callback_cb call_server_helpers_stopped_callback; /* type assertion */
+static callback_cb handle_background_answer;		/* type assertion */
 /*
  * The job structure
  *
@@ -75,10 +81,65 @@ static callback_cb call_server_helpers_stopped_callback; /* type assertion */
 typedef enum { JOB_ID_MIN = 1, JOB_ID_MAX = UINT_MAX, } job_id_t;
 typedef enum { HELPER_ID_MIN = 1, HELPER_ID_MAX = UINT_MAX, } helper_id_t;
 
+/*
+ * Job classes, in priority order.
+ *
+ * Rekeys, and other work for already established SAs, go ahead of
+ * everything else and are never dropped.  Work for half-open IKE SAs
+ * that the peer initiated (i.e., what an IKE_SA_INIT flood generates)
+ * goes next and is bounded; when full the oldest is dropped.
+ * Background work, not tied to any state, is only picked up by a
+ * helper that has nothing else to do.
+ */
+
+enum job_class {
+	JOB_CLASS_ESTABLISHED,
+	JOB_CLASS_OPEN,
+	JOB_CLASS_HALF_OPEN,
+	JOB_CLASS_IDLE,
+#define JOB_CLASS_ROOF (JOB_CLASS_IDLE + 1)
+};
+
+static const char *const job_class_names[JOB_CLASS_ROOF] = {
+	[JOB_CLASS_ESTABLISHED] = "established",
+	[JOB_CLASS_OPEN] = "open",
+	[JOB_CLASS_HALF_OPEN] = "half-open",
+	[JOB_CLASS_IDLE] = "idle",
+};
+
+static enum job_class job_class(const struct state *st)
+{
+	if (IS_CHILD_SA(st)) {
+		/* parent is established */
+		return JOB_CLASS_ESTABLISHED;
+	}
+	switch (st->st_state->category) {
+	case CAT_ESTABLISHED_IKE_SA:
+	case CAT_ESTABLISHED_CHILD_SA:
+		return JOB_CLASS_ESTABLISHED;
+	case CAT_HALF_OPEN_IKE_SA:
+		return (st->st_sa_role == SA_RESPONDER ? JOB_CLASS_HALF_OPEN :
+			JOB_CLASS_OPEN);
+	default:
+		return JOB_CLASS_OPEN;
+	}
+}
+
+/*
+ * Jobs, per class, submitted but not yet returned to the main thread.
+ * Only accessed by the main thread.
+ */
+
+static unsigned jobs_outstanding[JOB_CLASS_ROOF];
+static uintmax_t jobs_dropped;
+
 struct job {
 	struct task *task;
 	const struct task_handler *handler;
 	struct list_entry backlog;
+	enum job_class class;
+	bool dropped;				/* never run; queue was full */
+	monotime_t queued;			/* when added to a helper's queue */
 	so_serial_t so_serialno;		/* sponsoring state-object's serial number */
 	bool cancelled;
 	where_t where;
@@ -126,40 +187,275 @@ static void jam_backlog(struct jambuf *buf, const void *data)
 
 LIST_INFO(job, backlog, backlog_info, jam_backlog);
 
-static pthread_mutex_t backlog_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t backlog_cond = PTHREAD_COND_INITIALIZER;
+/*
+ * Once the helpers have exited, any jobs still queued end up here.
+ */
 
 struct list_head backlog = INIT_LIST_HEAD(&backlog, &backlog_info);
-static int backlog_queue_len = 0;
 
-static void message_helpers(struct job *job)
-{
-	pthread_mutex_lock(&backlog_mutex);
-	if (job != NULL) {
-		insert_list_entry(&backlog, &job->backlog);
-		backlog_queue_len++;
-	}
-	/* wake up threads waiting for work */
-	pthread_cond_signal(&backlog_cond);
-	pthread_mutex_unlock(&backlog_mutex);
-}
+/*
+ * Each helper has its own queue, protected by its own lock, so that
+ * helpers don't all contend on a single mutex.
+ *
+ * The main thread hands each new job to an idle helper or, when all
+ * are busy, round-robin.  A helper that runs out of work steals the
+ * highest priority oldest job from its siblings before going to
+ * sleep.
+ *
+ * Locks are only ever held one at a time.
+ */
+
+struct helper_queue {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct list_head jobs[JOB_CLASS_ROOF];
+	bool waiting;		/* helper is (about to) wait for work */
+	/* statistics */
+	unsigned depth;
+	unsigned max_depth;
+	uintmax_t nr_jobs;
+	uintmax_t nr_steals;	/* jobs taken from other helpers */
+	uintmax_t wait_ms;	/* total time jobs spent queued */
+	uintmax_t max_wait_ms;
+};
 
 /*
- * Note: this per-helper struct is never modified in a helper thread
+ * Note: other than QUEUE, which is locked, this per-helper struct is
+ * never modified in a helper thread
  */
 
 struct helper_thread {
 	struct logger *logger;
 	helper_id_t helper_id;
 	pthread_t pid;
+	int cpu;		/* pinned to; -1 when not */
+	struct helper_queue queue;
 };
 
 /* may be NULL if we are to do all the work ourselves */
 
 static struct helper_thread *helper_threads = NULL;
+static unsigned nr_helper_threads = 0;
 static unsigned helper_threads_started = 0;
 static unsigned helper_threads_stopped = 0;
 
+/* caller holds Q's lock */
+static void enqueue_job(struct helper_queue *q, struct job *job)
+{
+	job->queued = mononow();
+	insert_list_entry(&q->jobs[job->class], &job->backlog);
+	q->depth++;
+	q->max_depth = max(q->max_depth, q->depth);
+	pthread_cond_signal(&q->cond);
+}
+
+/* caller holds Q's lock */
+static struct job *dequeue_job(struct helper_queue *q)
+{
+	for (enum job_class c = 0; c < JOB_CLASS_ROOF; c++) {
+		struct job *job;
+		FOR_EACH_LIST_ENTRY_OLD2NEW(job, &q->jobs[c]) {
+			remove_list_entry(&job->backlog);
+			q->depth--;
+			return job;
+		}
+	}
+	return NULL;
+}
+
+/* caller holds Q's lock */
+static void start_job(struct helper_queue *q, struct job *job,
+		      helper_id_t helper_id)
+{
+	uintmax_t wait_ms = deltamillisecs(monotimediff(mononow(), job->queued));
+	q->nr_jobs++;
+	q->wait_ms += wait_ms;
+	q->max_wait_ms = max(q->max_wait_ms, wait_ms);
+	/* XXX: logged when job started */
+	job->helper_id = helper_id;
+}
+
+static void message_helpers(struct job *job)
+{
+	passert(nr_helper_threads > 0);
+	static unsigned next_helper = 0;
+
+	if (job == NULL) {
+		/* wake up all threads waiting for work */
+		for (unsigned h = 0; h < nr_helper_threads; h++) {
+			struct helper_queue *q = &helper_threads[h].queue;
+			pthread_mutex_lock(&q->mutex);
+			pthread_cond_broadcast(&q->cond);
+			pthread_mutex_unlock(&q->mutex);
+		}
+		return;
+	}
+
+	/* prefer an idle helper */
+	for (unsigned i = 0; i < nr_helper_threads; i++) {
+		unsigned h = (next_helper + i) % nr_helper_threads;
+		struct helper_queue *q = &helper_threads[h].queue;
+		pthread_mutex_lock(&q->mutex);
+		bool idle = (q->waiting && q->depth == 0);
+		if (idle) {
+			enqueue_job(q, job);
+		}
+		pthread_mutex_unlock(&q->mutex);
+		if (idle) {
+			next_helper = h + 1;
+			return;
+		}
+	}
+
+	/* all busy; the first to finish will steal */
+	struct helper_queue *q = &helper_threads[next_helper++ % nr_helper_threads].queue;
+	pthread_mutex_lock(&q->mutex);
+	enqueue_job(q, job);
+	pthread_mutex_unlock(&q->mutex);
+}
+
+/*
+ * Admission control for half-open work.
+ *
+ * The bound shrinks as pluto comes under attack: first when cookies
+ * are required, and again once new exchanges are being dropped.
+ */
+
+#define HALF_OPEN_JOBS_PER_HELPER 16
+
+static unsigned half_open_job_limit(void)
+{
+	unsigned per_helper = (drop_new_exchanges() ? 1 :
+			       require_ddos_cookies() ? HALF_OPEN_JOBS_PER_HELPER / 4 :
+			       HALF_OPEN_JOBS_PER_HELPER);
+	return per_helper * nr_helper_threads;
+}
+
+bool crypto_helpers_congested(void)
+{
+	return (nr_helper_threads > 0 &&
+		jobs_outstanding[JOB_CLASS_HALF_OPEN] >=
+		HALF_OPEN_JOBS_PER_HELPER * nr_helper_threads / 2);
+}
+
+/*
+ * Find, and remove, the oldest half-open job still waiting in a
+ * queue.  Jobs are only freed by the main thread so JOB stays valid
+ * after the lock is dropped; but a helper may start it.
+ */
+
+static struct job *dequeue_oldest_half_open_job(void)
+{
+	struct job *oldest = NULL;
+	struct helper_queue *oldest_q = NULL;
+	for (unsigned h = 0; h < nr_helper_threads; h++) {
+		struct helper_queue *q = &helper_threads[h].queue;
+		pthread_mutex_lock(&q->mutex);
+		struct job *job;
+		FOR_EACH_LIST_ENTRY_OLD2NEW(job, &q->jobs[JOB_CLASS_HALF_OPEN]) {
+			if (oldest == NULL ||
+			    monotime_cmp(job->queued, <, oldest->queued)) {
+				oldest = job;
+				oldest_q = q;
+			}
+			break;
+		}
+		pthread_mutex_unlock(&q->mutex);
+	}
+
+	if (oldest == NULL) {
+		return NULL;
+	}
+
+	pthread_mutex_lock(&oldest_q->mutex);
+	if (detached_list_entry(&oldest->backlog)) {
+		/* lost the race */
+		oldest = NULL;
+	} else {
+		remove_list_entry(&oldest->backlog);
+		oldest_q->depth--;
+	}
+	pthread_mutex_unlock(&oldest_q->mutex);
+	return oldest;
+}
+
+static void drop_job(struct job *job)
+{
+	dbg(PRI_JOB": dropping %s job", pri_job(job), job_class_names[job->class]);
+	job->dropped = true;
+	jobs_dropped++;
+	schedule_resume("dropping job", job->so_serialno,
+			handle_helper_answer, job);
+}
+
+/* IN A HELPER THREAD */
+static struct job *steal_job(struct helper_thread *w)
+{
+	unsigned self = w->helper_id - 1;
+	for (unsigned i = 1; i < nr_helper_threads; i++) {
+		struct helper_queue *victim =
+			&helper_threads[(self + i) % nr_helper_threads].queue;
+		pthread_mutex_lock(&victim->mutex);
+		struct job *job = dequeue_job(victim);
+		pthread_mutex_unlock(&victim->mutex);
+		if (job != NULL) {
+			return job;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * IN A HELPER THREAD
+ *
+ * Find something to do: first this helper's queue; then other
+ * helper's queues; and finally wait.  Returns NULL when pluto is
+ * exiting.
+ */
+
+static struct job *next_job(struct helper_thread *w)
+{
+	struct helper_queue *q = &w->queue;
+	while (true) {
+		pthread_mutex_lock(&q->mutex);
+		struct job *job = (exiting_pluto ? NULL : dequeue_job(q));
+		if (job != NULL) {
+			start_job(q, job, w->helper_id);
+		} else {
+			/* tell message_helpers() to send work here */
+			q->waiting = true;
+		}
+		pthread_mutex_unlock(&q->mutex);
+		if (job != NULL) {
+			return job;
+		}
+		if (exiting_pluto) {
+			/*
+			 * No JOB implies pluto is exiting but not
+			 * reverse - could grab a JOB in parallel to
+			 * pluto starting to exit.
+			 */
+			return NULL;
+		}
+
+		job = steal_job(w);
+
+		pthread_mutex_lock(&q->mutex);
+		if (job != NULL) {
+			q->nr_steals++;
+			start_job(q, job, w->helper_id);
+		} else if (q->depth == 0 && !exiting_pluto) {
+			dbg("helper %u: waiting for work", w->helper_id);
+			pthread_cond_wait(&q->cond, &q->mutex);
+		}
+		q->waiting = false;
+		pthread_mutex_unlock(&q->mutex);
+		if (job != NULL) {
+			return job;
+		}
+	}
+}
+
 /*
  * If there are any helper threads, this code is always executed IN A HELPER
  * THREAD. Otherwise it is executed in the main (only) thread.
@@ -186,14 +482,19 @@ static void do_job(struct job *job, helper_id_t helper_id)
 	}
 
 	job->time_used = logtime_stop(&start, PRI_JOB, pri_job(job));
-	schedule_resume("sending job back to main thread",
-			job->so_serialno, handle_helper_answer, job);
+	if (job->so_serialno == SOS_NOBODY) {
+		schedule_callback("sending background job back to main thread",
+				  SOS_NOBODY, handle_background_answer, job);
+	} else {
+		schedule_resume("sending job back to main thread",
+				job->so_serialno, handle_helper_answer, job);
+	}
 }
 
 /* IN A HELPER THREAD */
 static void *helper_thread(void *arg)
 {
-	const struct helper_thread *w = arg;
+	struct helper_thread *w = arg;
 	ldbg(w->logger, "starting thread");
 
 #ifdef USE_SECCOMP
@@ -209,44 +510,7 @@ static void *helper_thread(void *arg)
 #endif
 
 	while (true) {
-		struct job *job = NULL;
-		pthread_mutex_lock(&backlog_mutex);
-		{
-			/*
-			 * Search the backlog[] for something to do.
-			 * If needed wait.
-			 */
-			pexpect(job == NULL);
-			while (!exiting_pluto) {
-				/* grab the next entry, if there is one */
-				pexpect(job == NULL);
-				FOR_EACH_LIST_ENTRY_OLD2NEW(job, &backlog) { break; }
-				if (job != NULL) {
-					/*
-					 * Assign the entry to this
-					 * thread, removing it from
-					 * the backlog.
-					 *
-					 * XXX: logged when job
-					 * started.
-					 */
-					remove_list_entry(&job->backlog);
-					job->helper_id = w->helper_id;
-					break;
-				}
-				dbg("helper %u: waiting for work", w->helper_id);
-				pthread_cond_wait(&backlog_cond, &backlog_mutex);
-			}
-			if (job == NULL) {
-				/*
-				 * No JOB implies pluto is exiting but
-				 * not reverse - could grab a JOB in
-				 * parallel to pluto starting to exit.
-				 */
-				pexpect(exiting_pluto);
-			}
-		}
-		pthread_mutex_unlock(&backlog_mutex);
+		struct job *job = next_job(w);
 		if (job == NULL) {
 			/* per above, must be shutting down */
 			break;
@@ -312,19 +576,12 @@ static void inline_worker(const char *story UNUSED, struct state *unused_st UNUS
  *
  */
 
-void submit_task(const struct logger *logger,
-		 struct state *st,
-		 struct task *task,
-		 const struct task_handler *handler,
-		 where_t where)
+static struct job *alloc_job(const struct logger *logger,
+			     struct state *st,
+			     struct task *task,
+			     const struct task_handler *handler,
+			     where_t where)
 {
-	if (st->st_offloaded_task != NULL) {
-		llog_pexpect(st->st_logger, where,
-			     "state already has outstanding crypto ["PRI_WHERE"]",
-			     pri_where(st->st_offloaded_task->where));
-		return;
-	}
-
 	struct job *job = alloc_thing(struct job, where->func);
 	dbg_alloc("job", job, HERE);
 	job->cancelled = false;
@@ -332,9 +589,14 @@ void submit_task(const struct logger *logger,
 	init_list_entry(&backlog_info, job, &job->backlog);
 	job->so_serialno = SOS_NOBODY;
 
-	passert(st->st_serialno != SOS_NOBODY);
-	passert(job->so_serialno == SOS_NOBODY);
-	job->so_serialno = st->st_serialno;
+	if (st == NULL) {
+		job->class = JOB_CLASS_IDLE;
+	} else {
+		passert(st->st_serialno != SOS_NOBODY);
+		job->so_serialno = st->st_serialno;
+		job->class = job_class(st);
+	}
+	jobs_outstanding[job->class]++;
 
 	/*
 	 * set up the id
@@ -348,12 +610,31 @@ void submit_task(const struct logger *logger,
 	job->handler = handler;
 	job->task = task;
 
-	/*
-	 * Save in case it needs to be cancelled.
-	 */
-	st->st_offloaded_task = job;
-	st->st_offloaded_task_in_background = false;
+	if (st != NULL) {
+		/*
+		 * Save in case it needs to be cancelled.
+		 */
+		st->st_offloaded_task = job;
+		st->st_offloaded_task_in_background = false;
+	}
 	job->logger = clone_logger(logger, HERE);
+	return job;
+}
+
+void submit_task(const struct logger *logger,
+		 struct state *st,
+		 struct task *task,
+		 const struct task_handler *handler,
+		 where_t where)
+{
+	if (st->st_offloaded_task != NULL) {
+		llog_pexpect(st->st_logger, where,
+			     "state already has outstanding crypto ["PRI_WHERE"]",
+			     pri_where(st->st_offloaded_task->where));
+		return;
+	}
+
+	struct job *job = alloc_job(logger, st, task, handler, where);
 	dbg(PRI_JOB": added to pending queue", pri_job(job));
 
 	/*
@@ -378,11 +659,59 @@ void submit_task(const struct logger *logger,
 		delete_event(st);
 		clear_retransmits(st);
 		event_schedule(EVENT_CRYPTO_TIMEOUT, EVENT_CRYPTO_TIMEOUT_DELAY, st);
-		/* add to backlog */
-		message_helpers(job);
+		/*
+		 * Add to backlog.  When there's too much half-open
+		 * work, make space by dropping the oldest.
+		 */
+		if (job->class == JOB_CLASS_HALF_OPEN &&
+		    jobs_outstanding[JOB_CLASS_HALF_OPEN] > half_open_job_limit()) {
+			struct job *oldest = dequeue_oldest_half_open_job();
+			if (oldest != NULL) {
+				message_helpers(job);
+				drop_job(oldest);
+			} else {
+				drop_job(job);
+			}
+		} else {
+			message_helpers(job);
+		}
 	}
 }
 
+void submit_completed_task(const struct logger *logger,
+			   struct state *st,
+			   struct task *task,
+			   const struct task_handler *handler,
+			   where_t where)
+{
+	if (st->st_offloaded_task != NULL) {
+		llog_pexpect(st->st_logger, where,
+			     "state already has outstanding crypto ["PRI_WHERE"]",
+			     pri_where(st->st_offloaded_task->where));
+		return;
+	}
+
+	struct job *job = alloc_job(logger, st, task, handler, where);
+	dbg(PRI_JOB": already computed; resuming", pri_job(job));
+	schedule_resume("completed job", job->so_serialno,
+			handle_helper_answer, job);
+}
+
+bool submit_background_task(const struct logger *logger,
+			    struct task *task,
+			    const struct task_handler *handler,
+			    where_t where)
+{
+	if (helper_threads == NULL) {
+		/* no point tying up the event-loop */
+		return false;
+	}
+	struct job *job = alloc_job(logger, NULL, task, handler, where);
+	dbg(PRI_JOB": added to background queue", pri_job(job));
+	message_helpers(job);
+	return true;
+}
+
 void delete_cryptographic_continuation(struct state *st)
 {
 	passert(in_main_thread());
@@ -406,6 +735,8 @@ void delete_cryptographic_continuation(struct state *st)
 static void free_job(struct job **jobp)
 {
 	struct job *job = *jobp;
+	passert(jobs_outstanding[job->class] > 0);
+	jobs_outstanding[job->class]--;
 	passert(job->handler->cleanup_cb != NULL);
 	job->handler->cleanup_cb(&job->task);
 	pexpect(job->task == NULL); /* did your job */
@@ -437,6 +768,18 @@ static stf_status handle_helper_answer(struct state *st,
 		/* oops, the state disappeared! */
 		llog_pexpect(job->logger, HERE, PRI_JOB": state disappeared!", pri_job(job));
 		status = STF_SKIP_COMPLETE_STATE_TRANSITION;
+	} else if (job->dropped) {
+		/* never run; give up on the half-open SA */
+		lset_t rc_flags = log_limiter_rc_flags(st->st_logger, &crypto_log_limiter);
+		if (rc_flags != LEMPTY) {
+			llog(rc_flags, st->st_logger,
+			     "dropping %s crypto request; too many half-open requests queued",
+			     job->handler->name);
+		}
+		pexpect(st->st_offloaded_task == job);
+		st->st_offloaded_task = NULL;
+		st->st_offloaded_task_in_background = false;
+		status = STF_FATAL;
 	} else {
 		dbg(PRI_JOB": calling state's callback function", pri_job(job));
 		pexpect(st->st_offloaded_task == job);
@@ -456,6 +799,22 @@ static stf_status handle_helper_answer(struct state *st,
 	return status;
 }
 
+static void handle_background_answer(const char *story UNUSED,
+				     struct state *st UNUSED,
+				     void *arg)
+{
+	passert(in_main_thread());
+	struct job *job = arg;
+	if (job->cancelled) {
+		dbg(PRI_JOB": background job cancelled!", pri_job(job));
+	} else {
+		dbg(PRI_JOB": calling background callback function", pri_job(job));
+		passert(job->handler->completed_cb != NULL);
+		job->handler->completed_cb(NULL, NULL, job->task);
+	}
+	free_job(&job);
+}
+
 /*
  * Initialize helper debug delay value from environment variable.
  * This function is NOT thread safe (getenv).
@@ -528,16 +887,66 @@ void start_server_helpers(int nhelpers, struct logger *logger)
 		 */
 		helper_threads = alloc_things(struct helper_thread, nhelpers,
 					      "pluto helpers");
+		nr_helper_threads = nhelpers;
+
+		/*
+		 * When there are fewer helpers than usable CPUs, pin
+		 * each helper to its own CPU, leaving the first for
+		 * the main thread.
+		 */
+		int cpus[nhelpers];
+		for (int n = 0; n < nhelpers; n++) {
+			cpus[n] = -1;
+		}
+#ifdef __linux__
+		cpu_set_t allowed;
+		if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0 &&
+		    CPU_COUNT(&allowed) > nhelpers) {
+			int n = -1; /* skip first */
+			for (int cpu = 0; cpu < CPU_SETSIZE && n < nhelpers; cpu++) {
+				if (CPU_ISSET(cpu, &allowed)) {
+					if (n >= 0) {
+						cpus[n] = cpu;
+					}
+					n++;
+				}
+			}
+		}
+#endif
+
 		for (int n = 0; n < nhelpers; n++) {
 			struct helper_thread *w = &helper_threads[n];
 			w->helper_id = n + 1; /* i.e., not 0 */
 			w->logger = string_logger(null_fd, HERE, "helper(%d) ", w->helper_id);
-			int thread_status = pthread_create(&w->pid, NULL,
+			w->cpu = cpus[n];
+			pthread_mutex_init(&w->queue.mutex, NULL);
+			pthread_cond_init(&w->queue.cond, NULL);
+			for (enum job_class c = 0; c < JOB_CLASS_ROOF; c++) {
+				w->queue.jobs[c] = (struct list_head) INIT_LIST_HEAD(&w->queue.jobs[c], &backlog_info);
+			}
+		}
+
+		for (int n = 0; n < nhelpers; n++) {
+			struct helper_thread *w = &helper_threads[n];
+			pthread_attr_t attr;
+			pthread_attr_init(&attr);
+#ifdef __linux__
+			if (w->cpu >= 0) {
+				cpu_set_t cpuset;
+				CPU_ZERO(&cpuset);
+				CPU_SET(w->cpu, &cpuset);
+				pthread_attr_setaffinity_np(&attr, sizeof(cpuset), &cpuset);
+			}
+#endif
+			int thread_status = pthread_create(&w->pid, &attr,
 							   helper_thread, (void *)w);
+			pthread_attr_destroy(&attr);
 			if (thread_status != 0) {
 				llog(RC_LOG_SERIOUS, logger,
 					    "failed to start child thread for helper %d, error = %d",
 					    n, thread_status);
+			} else if (w->cpu >= 0) {
+				llog(RC_LOG, logger, "started thread for helper %d on CPU %d", n, w->cpu);
 			} else {
 				llog(RC_LOG, logger, "started thread for helper %d", n);
 			}
@@ -574,14 +983,21 @@ static void helper_thread_stopped_callback(const char *story UNUSED,
 		return;
 	}
 
-	/* all done; cleanup */
+	/* all done; cleanup; save any unstarted jobs for free_server_helper_jobs() */
 	for (unsigned h = 0; h < helper_threads_started; h++) {
 		struct helper_thread *w = &helper_threads[h];
+		struct job *job;
+		while ((job = dequeue_job(&w->queue)) != NULL) {
+			insert_list_entry(&backlog, &job->backlog);
+		}
+		pthread_cond_destroy(&w->queue.cond);
+		pthread_mutex_destroy(&w->queue.mutex);
 		free_logger(&w->logger, HERE);
 	}
 
 	pfreeany(helper_threads);
 	helper_threads = NULL;
+	nr_helper_threads = 0;
 	server_helpers_stopped_callback();
 }
 
@@ -623,3 +1039,42 @@ void free_server_helper_jobs(struct logger *logger)
 		llog(RC_LOG, logger, "WARNING: helper threads still running");
 	}
 }
+
+void show_helper_status(struct show *s)
+{
+	show_separator(s);
+	if (nr_helper_threads == 0) {
+		show_comment(s, "no helper threads; cryptographic operations are done inline");
+		return;
+	}
+	SHOW_JAMBUF(RC_COMMENT, s, buf) {
+		jam(buf, "helper jobs:");
+		for (enum job_class c = 0; c < JOB_CLASS_ROOF; c++) {
+			jam(buf, " %s=%u", job_class_names[c], jobs_outstanding[c]);
+		}
+		jam(buf, " half-open-limit=%u dropped=%ju",
+		    half_open_job_limit(), jobs_dropped);
+	}
+	for (unsigned h = 0; h < nr_helper_threads; h++) {
+		struct helper_thread *w = &helper_threads[h];
+		struct helper_queue *q = &w->queue;
+		pthread_mutex_lock(&q->mutex);
+		unsigned depth = q->depth;
+		unsigned max_depth = q->max_depth;
+		uintmax_t nr_jobs = q->nr_jobs;
+		uintmax_t nr_steals = q->nr_steals;
+		uintmax_t wait_ms = q->wait_ms;
+		uintmax_t max_wait_ms = q->max_wait_ms;
+		pthread_mutex_unlock(&q->mutex);
+		SHOW_JAMBUF(RC_COMMENT, s, buf) {
+			jam(buf, "helper %u:", w->helper_id);
+			if (w->cpu >= 0) {
+				jam(buf, " cpu=%d", w->cpu);
+			}
+			jam(buf, " queued=%u max-queued=%u jobs=%ju steals=%ju",
+			    depth, max_depth, nr_jobs, nr_steals);
+			jam(buf, " avg-wait-ms=%ju max-wait-ms=%ju",
+			    (nr_jobs == 0 ? 0 : wait_ms / nr_jobs), max_wait_ms);
+		}
+	}
+}
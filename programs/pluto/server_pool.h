@@ -40,6 +40,7 @@
 struct state;
 struct msg_digest;
 struct logger;
+struct show;
 
 struct task; /*struct job*/
 
@@ -66,8 +67,31 @@ extern void submit_task(const struct logger *logger,
 			const struct task_handler *handler,
 			where_t where);
 
+/*
+ * TASK has already been computed (for instance, it was taken from a
+ * pool); skip the helpers and resume ST with the result.
+ */
+void submit_completed_task(const struct logger *logger,
+			   struct state *st,
+			   struct task *task,
+			   const struct task_handler *handler,
+			   where_t where);
+
+/*
+ * Work that isn't tied to a state; helpers only pick it up when they
+ * have nothing else to do.  The completed_cb is called with a NULL
+ * state and message digest (and its result ignored).  Returns false,
+ * and does nothing, when there are no helper threads.
+ */
+bool submit_background_task(const struct logger *logger,
+			    struct task *task,
+			    const struct task_handler *handler,
+			    where_t where);
+
 extern void start_server_helpers(int nhelpers, struct logger *logger);
 void stop_server_helpers(void (*all_server_helpers_stopped)(void));
 void free_server_helper_jobs(struct logger *logger);
+void show_helper_status(struct show *s);
+bool crypto_helpers_congested(void);
 
 #endif
@@ -71,6 +71,10 @@
 #include "ikev1_replace.h"
 #include "ikev2_replace.h"
 #include "routing.h"
+#include "server_pool.h"		/* for crypto_helpers_congested() */
+#include "server.h"			/* for schedule_timeout() */
+#include "whack.h"			/* for struct whack_message */
+#include "fd.h"				/* for fd_output_backlog() */
 
 bool uniqueIDs = false;
 
@@ -1792,13 +1796,15 @@ struct child_sa *find_v2_child_sa_by_spi(ipsec_spi_t spi, int8_t protoid,
 		.inbound_spi = spi,
 		.dst = dst,
 	};
-	struct state_filter sf = { .where = HERE, };
-	while (next_state_new2old(&sf)) {
-		struct state *st = sf.st;
-		if (v2_spi_predicate(st, &filter))
-			break;
-	};
-	return pexpect_child_sa(sf.st);
+	struct state *st = state_by_outbound_spi(protoid, spi,
+						 v2_spi_predicate, &filter,
+						 __func__);
+	if (st == NULL) {
+		st = state_by_inbound_spi(protoid, spi,
+					  v2_spi_predicate, &filter,
+					  __func__);
+	}
+	return pexpect_child_sa(st);
 }
 
 struct child_sa *find_v2_child_sa_by_outbound_spi(struct ike_sa *ike,
@@ -2332,29 +2338,232 @@ void show_brief_status(struct show *s)
 		  cat_count_child_sa[CAT_ANONYMOUS]);
 }
 
-void show_states(struct show *s, const monotime_t now)
+static void show_state_details(struct show *s, struct state *st, const monotime_t now)
 {
-	show_separator(s);
-	struct state **array = sort_states(HERE);
+	show_state(s, st, now);
+	if (IS_IPSEC_SA_ESTABLISHED(st)) {
+		/* print out SPIs if SAs are established */
+		show_established_child_details(s, pexpect_child_sa(st), now);
+	}  else if (IS_IKE_SA(st)) {
+		/* show any associated pending Phase 2s */
+		show_pending_child_details(s, st->st_connection,
+					   pexpect_ike_sa(st));
+	}
+}
 
-	if (array != NULL) {
-		/* now print sorted results */
-		int i;
-		for (i = 0; array[i] != NULL; i++) {
-			struct state *st = array[i];
-			show_state(s, st, now);
-			if (IS_IPSEC_SA_ESTABLISHED(st)) {
-				/* print out SPIs if SAs are established */
-				show_established_child_details(s, pexpect_child_sa(st), now);
-			}  else if (IS_IKE_SA(st)) {
-				/* show any associated pending Phase 2s */
-				show_pending_child_details(s, st->st_connection,
-							   pexpect_ike_sa(st));
+/*
+ * List the states (whack --liststates, --showstates, --status and
+ * --trafficstatus).
+ *
+ * --liststates lists states in serial number (creation) order so
+ * that a listing can be resumed from a cursor: the serial number of
+ * the last state looked at.  The other listings keep their sorted
+ * order (see sort_states()): the serial numbers are sorted up front
+ * and then each is looked up as it is listed, skipping any state
+ * that has since been deleted.
+ *
+ * Rather than block the event-loop, the listing is generated a slice
+ * at a time and, between slices, pluto gets on with processing IKE
+ * messages.  When whack falls behind reading the output, the next
+ * slice is held back.
+ *
+ * The listing holds a reference to whack so whack only sees EOF once
+ * the listing, and the DONE callback, have finished.
+ */
+
+#define STATE_LISTING_SLICE 64			/* states per slice */
+#define STATE_LISTING_BACKLOG (64 * 1024)	/* bytes */
+#define STATE_LISTING_BACKOFF_MS 10
+
+struct state_listing {
+	struct logger *logger;		/* holds a reference to whack */
+	struct show *s;
+	/* filters */
+	char *name;
+	ip_address peer;
+	enum whack_sa_kind kind;
+	uintmax_t pagesize;
+	/* output */
+	list_state_fn *show_state;
+	show_fn *done;
+	/* progress */
+	bool sorted;
+	so_serial_t *serialnos;		/* when sorted */
+	unsigned nr_serialnos;
+	unsigned next_serialno;
+	so_serial_t cursor;
+	uintmax_t count;
+	struct timeout *timeout;
+	struct state_listing *next;
+};
+
+static struct state_listing *state_listings;
+
+static void free_state_listing(struct state_listing **lp)
+{
+	struct state_listing *l = *lp;
+	*lp = NULL;
+	for (struct state_listing **pp = &state_listings; *pp != NULL; pp = &(*pp)->next) {
+		if (*pp == l) {
+			*pp = l->next;
+			break;
+		}
+	}
+	destroy_timeout(&l->timeout);
+	free_show(&l->s);
+	free_logger(&l->logger, HERE);
+	pfreeany(l->name);
+	pfreeany(l->serialnos);
+	pfree(l);
+}
+
+void free_state_listings(void)
+{
+	while (state_listings != NULL) {
+		struct state_listing *l = state_listings;
+		free_state_listing(&l);
+	}
+}
+
+static bool state_listing_matches(const struct state *st,
+				  const struct state_listing *l)
+{
+	if (l->name != NULL && !streq(st->st_connection->name, l->name)) {
+		return false;
+	}
+	if (address_is_specified(l->peer) &&
+	    !address_eq_address(endpoint_address(st->st_remote_endpoint), l->peer)) {
+		return false;
+	}
+	switch (l->kind) {
+	case WHACK_ANY_SA:
+		return true;
+	case WHACK_IKE_SA:
+		return IS_IKE_SA(st);
+	case WHACK_CHILD_SA:
+		return IS_CHILD_SA(st);
+	}
+	return false;
+}
+
+static void list_states_slice(void *arg, const struct timer_event *event UNUSED)
+{
+	struct state_listing *l = arg;
+	destroy_timeout(&l->timeout);
+
+	struct fd *whackfd = l->logger->global_whackfd;
+	if (whackfd != NULL && fd_output_backlog(whackfd) > STATE_LISTING_BACKLOG) {
+		dbg("list states: whack is behind, holding back");
+		schedule_timeout("list states", &l->timeout,
+				 deltatime_ms(STATE_LISTING_BACKOFF_MS),
+				 list_states_slice, l);
+		return;
+	}
+
+	const monotime_t now = mononow();
+
+	if (l->sorted) {
+		for (unsigned n = 0; l->next_serialno < l->nr_serialnos; n++) {
+			if (n >= STATE_LISTING_SLICE) {
+				/* yield */
+				schedule_timeout("list states", &l->timeout, deltatime(0),
+						 list_states_slice, l);
+				return;
+			}
+			struct state *st = state_by_serialno(l->serialnos[l->next_serialno++]);
+			if (st != NULL) {
+				l->show_state(l->s, st, now);
 			}
+		}
+		if (l->done != NULL) {
+			l->done(l->s);
+		}
+		free_state_listing(&l);
+		return;
+	}
 
+	struct state_filter sf = {
+		.after_serialno = l->cursor,
+		.where = HERE,
+	};
+	while (next_state_old2new(&sf)) {
+		struct state *st = sf.st;
+		if (state_listing_matches(st, l)) {
+			if (l->pagesize > 0 && l->count >= l->pagesize) {
+				/* page full; tell whack where to resume */
+				show_separator(l->s);
+				show_comment(l->s, "more states; resume with --cursor %lu",
+					     l->cursor);
+				free_state_listing(&l);
+				return;
+			}
+			l->show_state(l->s, st, now);
+			l->count++;
+		}
+		l->cursor = st->st_serialno;
+		if (sf.count >= STATE_LISTING_SLICE) {
+			/* yield; resume after the last state looked at */
+			schedule_timeout("list states", &l->timeout, deltatime(0),
+					 list_states_slice, l);
+			return;
+		}
+	}
+	if (l->done != NULL) {
+		l->done(l->s);
+	}
+	free_state_listing(&l);
+}
+
+static struct state_listing *alloc_state_listing(struct show *s,
+						 list_state_fn *show_state,
+						 show_fn *done)
+{
+	struct state_listing *l = alloc_thing(struct state_listing, "state listing");
+	l->logger = clone_logger(show_logger(s), HERE);
+	l->s = alloc_show(l->logger);
+	l->show_state = show_state;
+	l->done = done;
+	l->next = state_listings;
+	state_listings = l;
+	return l;
+}
+
+void list_states(struct show *s, list_state_fn *show_state, show_fn *done)
+{
+	struct state_listing *l = alloc_state_listing(s, show_state, done);
+	l->sorted = true;
+	struct state **array = sort_states(HERE);
+	if (array != NULL) {
+		while (array[l->nr_serialnos] != NULL) {
+			l->nr_serialnos++;
+		}
+		l->serialnos = alloc_things(so_serial_t, l->nr_serialnos, "sorted serialnos");
+		for (unsigned i = 0; i < l->nr_serialnos; i++) {
+			l->serialnos[i] = array[i]->st_serialno;
 		}
 		pfree(array);
 	}
+	/* small listings finish here */
+	list_states_slice(l, NULL);
+}
+
+void show_states(struct show *s, show_fn *done)
+{
+	show_separator(s);
+	list_states(s, show_state_details, done);
+}
+
+void whack_list_states(const struct whack_message *m, struct show *s)
+{
+	struct state_listing *l = alloc_state_listing(s, show_state_details, NULL);
+	l->name = clone_str(m->name, "state listing name");
+	l->peer = m->list_states.peer;
+	l->kind = m->list_states.kind;
+	l->pagesize = m->list_states.pagesize;
+	l->cursor = m->list_states.cursor;
+	show_separator(l->s);
+	/* small listings finish here */
+	list_states_slice(l, NULL);
 }
 
 /*
@@ -2882,9 +3091,14 @@ bool verbose_state_busy(const struct state *st)
 
 bool require_ddos_cookies(void)
 {
+	/*
+	 * Also insist on cookies when the crypto helpers are
+	 * congested by half-open work.
+	 */
 	return pluto_ddos_mode == DDOS_FORCE_BUSY ||
 		(pluto_ddos_mode == DDOS_AUTO &&
-		 cat_count[CAT_HALF_OPEN_IKE_SA] >= pluto_ddos_threshold);
+		 (cat_count[CAT_HALF_OPEN_IKE_SA] >= pluto_ddos_threshold ||
+		  crypto_helpers_congested()));
 }
 
 bool drop_new_exchanges(void)
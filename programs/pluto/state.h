@@ -322,6 +322,7 @@ struct state {
 	reqid_t st_reqid;			/* bundle of 4 (out,in, compout,compin */
 
 	bool st_outbound_done;			/* if true, then outgoing SA already installed */
+	bool st_spis_hashed;			/* SPIs are final and in the State DB */
 
 	const struct dh_desc *st_pfs_group;   /*group for Phase 2 PFS */
 	lset_t st_policy;                       /* policy for IPsec SA */
@@ -680,6 +681,10 @@ struct state {
 		struct list_entry reqid;
 		struct list_entry ike_spis;
 		struct list_entry ike_initiator_spi;
+		struct list_entry esp_inbound_spi;
+		struct list_entry esp_outbound_spi;
+		struct list_entry ah_inbound_spi;
+		struct list_entry ah_outbound_spi;
 	} state_db_entries;
 
 	struct hidden_variables hidden_variables;
@@ -942,7 +947,18 @@ extern struct state *find_v1_info_state(const ike_spis_t *ike_spis,
 extern void initialize_new_state(struct state *st, lset_t policy);
 
 extern void show_brief_status(struct show *s);
-extern void show_states(struct show *s, const monotime_t now);
+
+/*
+ * List states, sorted by connection then serial number, in slices,
+ * yielding to the event-loop (see state.c); DONE, when non-NULL, is
+ * called once the listing completes.
+ */
+typedef void (list_state_fn)(struct show *s, struct state *st, const monotime_t now);
+typedef void (show_fn)(struct show *s);
+void list_states(struct show *s, list_state_fn *show_state, show_fn *done);
+void show_states(struct show *s, show_fn *done);
+void whack_list_states(const struct whack_message *m, struct show *s);
+void free_state_listings(void);
 
 void v2_migrate_children(struct ike_sa *from, struct child_sa *to);
 
@@ -1011,6 +1027,7 @@ struct state_filter {
 	const ike_spis_t *ike_spis;	/* hashed */
 	const struct ike_sa *ike;
 	co_serial_t connection_serialno;
+	so_serial_t after_serialno;	/* skip states up to and including this */
 	/* current result (can be safely deleted) */
 	struct state *st;
 	/* internal: handle on next entry */
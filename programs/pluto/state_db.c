@@ -260,6 +260,152 @@ struct state *state_by_ike_spis(enum ike_version ike_version,
 	return NULL;
 }
 
+/*
+ * Hash tables indexed by a Child SA's inbound (our) and outbound
+ * (their) SPIs; one per protocol as an IKEv1 Child SA can have both
+ * AH and ESP.
+ *
+ * States without an SPI (IKE SAs, larval Child SAs) are hashed using
+ * their serialno so that they don't all pile up in the one bucket.
+ * Since the SPIs are only final once the SA is installed, that is
+ * when .st_spis_hashed is set and the state is rehashed.
+ */
+
+static hash_t hash_state_spi(const struct state *st, ipsec_spi_t spi)
+{
+	if (!st->st_spis_hashed || spi == 0) {
+		return hash_state_serialno(&st->st_serialno);
+	}
+	return hash_thing(spi, zero_hash);
+}
+
+static hash_t hash_state_esp_inbound_spi(const struct state *st)
+{
+	return hash_state_spi(st, st->st_esp.inbound.spi);
+}
+
+static hash_t hash_state_esp_outbound_spi(const struct state *st)
+{
+	return hash_state_spi(st, st->st_esp.outbound.spi);
+}
+
+static hash_t hash_state_ah_inbound_spi(const struct state *st)
+{
+	return hash_state_spi(st, st->st_ah.inbound.spi);
+}
+
+static hash_t hash_state_ah_outbound_spi(const struct state *st)
+{
+	return hash_state_spi(st, st->st_ah.outbound.spi);
+}
+
+HASH_TABLE(state, esp_inbound_spi, , STATE_TABLE_SIZE);
+HASH_TABLE(state, esp_outbound_spi, , STATE_TABLE_SIZE);
+HASH_TABLE(state, ah_inbound_spi, , STATE_TABLE_SIZE);
+HASH_TABLE(state, ah_outbound_spi, , STATE_TABLE_SIZE);
+
+static struct state *state_by_spi(struct hash_table *table,
+				  ipsec_spi_t spi,
+				  const struct ipsec_flow *(*flow)(const struct state *st),
+				  state_by_predicate *predicate,
+				  void *predicate_context,
+				  const char *reason)
+{
+	if (spi == 0) {
+		/* never hashed */
+		dbg("State DB: zero SPI not found (%s)", reason);
+		return NULL;
+	}
+	hash_t hash = hash_thing(spi, zero_hash);
+	struct list_head *bucket = hash_table_bucket(table, hash);
+	struct state *st = NULL;
+	FOR_EACH_LIST_ENTRY_NEW2OLD(st, bucket) {
+		if (!st->st_spis_hashed || flow(st)->spi != spi) {
+			continue;
+		}
+		if (predicate != NULL &&
+		    !predicate(st, predicate_context)) {
+			continue;
+		}
+		dbg("State DB: found state #%lu in %s using SPI "PRI_IPSEC_SPI" (%s)",
+		    st->st_serialno, st->st_state->short_name,
+		    pri_ipsec_spi(spi), reason);
+		return st;
+	}
+	dbg("State DB: SPI "PRI_IPSEC_SPI" not found (%s)",
+	    pri_ipsec_spi(spi), reason);
+	return NULL;
+}
+
+static const struct ipsec_flow *esp_inbound(const struct state *st)
+{
+	return &st->st_esp.inbound;
+}
+
+static const struct ipsec_flow *esp_outbound(const struct state *st)
+{
+	return &st->st_esp.outbound;
+}
+
+static const struct ipsec_flow *ah_inbound(const struct state *st)
+{
+	return &st->st_ah.inbound;
+}
+
+static const struct ipsec_flow *ah_outbound(const struct state *st)
+{
+	return &st->st_ah.outbound;
+}
+
+struct state *state_by_inbound_spi(uint8_t protoid, ipsec_spi_t spi,
+				   state_by_predicate *predicate,
+				   void *predicate_context,
+				   const char *reason)
+{
+	switch (protoid) {
+	case PROTO_IPSEC_ESP:
+		return state_by_spi(&state_esp_inbound_spi_hash_table, spi, esp_inbound,
+				    predicate, predicate_context, reason);
+	case PROTO_IPSEC_AH:
+		return state_by_spi(&state_ah_inbound_spi_hash_table, spi, ah_inbound,
+				    predicate, predicate_context, reason);
+	}
+	dbg("State DB: protocol %u has no SPI table (%s)", protoid, reason);
+	return NULL;
+}
+
+struct state *state_by_outbound_spi(uint8_t protoid, ipsec_spi_t spi,
+				    state_by_predicate *predicate,
+				    void *predicate_context,
+				    const char *reason)
+{
+	switch (protoid) {
+	case PROTO_IPSEC_ESP:
+		return state_by_spi(&state_esp_outbound_spi_hash_table, spi, esp_outbound,
+				    predicate, predicate_context, reason);
+	case PROTO_IPSEC_AH:
+		return state_by_spi(&state_ah_outbound_spi_hash_table, spi, ah_outbound,
+				    predicate, predicate_context, reason);
+	}
+	dbg("State DB: protocol %u has no SPI table (%s)", protoid, reason);
+	return NULL;
+}
+
+static REHASH_DB_ENTRY(state, esp_inbound_spi, );
+static REHASH_DB_ENTRY(state, esp_outbound_spi, );
+static REHASH_DB_ENTRY(state, ah_inbound_spi, );
+static REHASH_DB_ENTRY(state, ah_outbound_spi, );
+
+void state_db_rehash_child_spis(struct state *st)
+{
+	dbg("State DB: re-hashing state #%lu SPIs", st->st_serialno);
+	st->st_spis_hashed = true;
+	state_db_rehash_esp_inbound_spi(st);
+	state_db_rehash_esp_outbound_spi(st);
+	state_db_rehash_ah_inbound_spi(st);
+	state_db_rehash_ah_outbound_spi(st);
+}
+
 /*
  * Maintain the contents of the hash tables.
  *
@@ -271,7 +417,11 @@ HASH_DB(state,
 	&state_connection_serialno_hash_table,
 	&state_reqid_hash_table,
 	&state_ike_initiator_spi_hash_table,
-	&state_ike_spis_hash_table);
+	&state_ike_spis_hash_table,
+	&state_esp_inbound_spi_hash_table,
+	&state_esp_outbound_spi_hash_table,
+	&state_ah_inbound_spi_hash_table,
+	&state_ah_outbound_spi_hash_table);
 
 void rehash_state_cookies_in_db(struct state *st)
 {
@@ -317,6 +467,27 @@ static struct list_head *filter_head(struct state_filter *filter)
 	return bucket;
 }
 
+/*
+ * The state list is in serial number order (states are added as they
+ * are created) so, when resuming after a state that still exists,
+ * start with the entry following it.
+ */
+
+static struct list_entry *filter_start(enum chrono adv, struct state_filter *filter)
+{
+	struct list_head *bucket = filter_head(filter);
+	if (adv == OLD2NEW &&
+	    bucket == &state_db_list_head &&
+	    filter->after_serialno != SOS_NOBODY) {
+		struct state *st = state_by_serialno(filter->after_serialno);
+		if (st != NULL) {
+			dbg("  resuming after "PRI_SO, pri_so(st->st_serialno));
+			return st->state_db_entries.list.next[adv];
+		}
+	}
+	return bucket->head.next[adv];
+}
+
 static bool matches_filter(struct state *st, struct state_filter *filter)
 {
 	if (filter->ike_version != 0 &&
@@ -335,6 +506,10 @@ static bool matches_filter(struct state *st, struct state_filter *filter)
 	    filter->connection_serialno != st->st_connection->serialno) {
 		return false;
 	}
+	if (filter->after_serialno != SOS_NOBODY &&
+	    st->st_serialno <= filter->after_serialno) {
+		return false;
+	}
 	return true;
 }
 
@@ -346,7 +521,7 @@ static bool next_state(enum chrono adv, struct state_filter *filter)
 		 * list is entry it ends up back on HEAD which has no
 		 * data).
 		 */
-		filter->internal = filter_head(filter)->head.next[adv];
+		filter->internal = filter_start(adv, filter);
 	}
 	filter->st = NULL;
 	/* Walk list until an entry matches */
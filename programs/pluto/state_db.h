@@ -18,6 +18,7 @@
 
 #include "ike_spi.h"
 #include "reqid.h"
+#include "ipsec_spi.h"
 
 struct state;
 struct connection;
@@ -63,4 +64,21 @@ struct state *state_by_reqid(reqid_t reqid,
 			     const char *reason);
 void state_db_rehash_reqid(struct state *st);
 
+/*
+ * Child SAs by protocol (ESP or AH) and SPI.
+ *
+ * The SPIs are hashed when the SA is installed in the kernel (after
+ * which they don't change).
+ */
+
+struct state *state_by_inbound_spi(uint8_t protoid, ipsec_spi_t spi,
+				   state_by_predicate *predicate /*optional*/,
+				   void *predicate_context,
+				   const char *reason);
+struct state *state_by_outbound_spi(uint8_t protoid, ipsec_spi_t spi,
+				    state_by_predicate *predicate /*optional*/,
+				    void *predicate_context,
+				    const char *reason);
+void state_db_rehash_child_spis(struct state *st);
+
 #endif
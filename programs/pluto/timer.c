@@ -70,6 +70,7 @@
 #include "ikev2_delete.h"		/* for submit_v2_delete_exchange() */
 #include "ikev1_replace.h"
 #include "ikev2_replace.h"
+#include "show.h"
 
 static int state_event_cmp(const void *lp, const void *rp)
 {
@@ -149,6 +150,251 @@ struct state_event **state_event_slot(struct state *st, enum event_type type)
 	bad_case(type);
 }
 
+/*
+ * State events are kept in a hashed hierarchical timer wheel.
+ *
+ * Time is measured in millisecond ticks.  Level L has WHEEL_SLOTS
+ * slots, each covering WHEEL_SLOTS^L ticks.  An event is put in the
+ * lowest level that can hold its expiry; each time a level wraps, the
+ * next level up's current slot is cascaded down a level.  Level 0
+ * slots are dispatched as a batch.
+ *
+ * Insert and delete are O(1) and, instead of a libevent timer per
+ * event, there is a single timer set for the next tick that has work
+ * (a level 0 slot to dispatch, or a higher slot to cascade).
+ */
+
+#define WHEEL_BITS 8
+#define WHEEL_SLOTS (1U << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 4		/* 2^32 ms is ~49 days */
+#define WHEEL_SHIFT(LEVEL) (WHEEL_BITS * (LEVEL))
+#define WHEEL_SPAN(LEVEL) (UINT64_C(1) << WHEEL_SHIFT(LEVEL))
+
+static void jam_state_event(struct jambuf *buf, const struct state_event *ev)
+{
+	jam(buf, "%s-event@%p", enum_name_short(&event_type_names, ev->ev_type), ev);
+	if (ev->ev_state != NULL) {
+		jam(buf, " #%lu", ev->ev_state->st_serialno);
+	}
+}
+
+LIST_INFO(state_event, ev_wheel_entry, state_event_info, jam_state_event);
+
+static struct {
+	bool initialized;
+	bool dispatching;	/* inside wheel_advance() */
+	uint64_t now;		/* last tick processed */
+	uint64_t wakeup;	/* tick .timeout is set for */
+	struct timeout *timeout;
+	uintmax_t dispatched;
+	uintmax_t cascaded;
+	uintmax_t wakeups;
+	unsigned nr_events[WHEEL_LEVELS];
+	unsigned nr_slot_events[WHEEL_LEVELS][WHEEL_SLOTS];
+	struct list_head slots[WHEEL_LEVELS][WHEEL_SLOTS];
+} wheel;
+
+static uint64_t floor_tick(monotime_t t)
+{
+	return deltamillisecs(monotimediff(t, monotime_epoch));
+}
+
+static uint64_t ceil_tick(monotime_t t)
+{
+	intmax_t ms = deltamillisecs(monotimediff(t, monotime_epoch));
+	if (monotime_cmp(monotime_ms(ms), <, t)) {
+		ms++;
+	}
+	return ms;
+}
+
+static void init_state_event_wheel(void)
+{
+	for (unsigned level = 0; level < WHEEL_LEVELS; level++) {
+		for (unsigned slot = 0; slot < WHEEL_SLOTS; slot++) {
+			wheel.slots[level][slot] = (struct list_head)
+				INIT_LIST_HEAD(&wheel.slots[level][slot], &state_event_info);
+		}
+	}
+	wheel.initialized = true;
+}
+
+static bool wheel_empty(void)
+{
+	for (unsigned level = 0; level < WHEEL_LEVELS; level++) {
+		if (wheel.nr_events[level] > 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * EARLIEST is the first tick that is yet to be dispatched: wheel.now+1
+ * for new events (wheel.now's slot may have been dispatched already);
+ * but wheel.now when cascading (wheel.now's slot is dispatched next).
+ */
+
+static void wheel_add(struct state_event *ev, uint64_t earliest)
+{
+	uint64_t tick = max(ev->ev_tick, earliest);
+	uint64_t delta = tick - wheel.now;
+	unsigned level = 0;
+	while (level < WHEEL_LEVELS - 1 && delta >= WHEEL_SPAN(level + 1)) {
+		level++;
+	}
+	if (delta >= WHEEL_SPAN(WHEEL_LEVELS)) {
+		/* can't happen; see pexpect() in event_schedule_where() */
+		tick = wheel.now + WHEEL_SPAN(WHEEL_LEVELS) - 1;
+	}
+	ev->ev_level = level;
+	ev->ev_slot = (tick >> WHEEL_SHIFT(level)) & WHEEL_MASK;
+	insert_list_entry(&wheel.slots[level][ev->ev_slot], &ev->ev_wheel_entry);
+	wheel.nr_slot_events[level][ev->ev_slot]++;
+	wheel.nr_events[level]++;
+}
+
+static void wheel_remove(struct state_event *ev)
+{
+	remove_list_entry(&ev->ev_wheel_entry);
+	wheel.nr_slot_events[ev->ev_level][ev->ev_slot]--;
+	wheel.nr_events[ev->ev_level]--;
+}
+
+static struct state_event *wheel_first(unsigned level, unsigned slot)
+{
+	/* the head's .data is NULL, so an empty slot returns NULL */
+	return wheel.slots[level][slot].head.next[OLD2NEW]->data;
+}
+
+/*
+ * When is the next tick with work?  For level 0 that is the next
+ * occupied slot; for higher levels it is when the next occupied slot
+ * is cascaded.
+ */
+
+static uint64_t wheel_next_tick(void)
+{
+	uint64_t next = UINT64_MAX;
+	for (unsigned level = 0; level < WHEEL_LEVELS; level++) {
+		if (wheel.nr_events[level] == 0) {
+			continue;
+		}
+		uint64_t base = wheel.now >> WHEEL_SHIFT(level);
+		for (uint64_t t = base + 1; t <= base + WHEEL_SLOTS; t++) {
+			if (wheel.nr_slot_events[level][t & WHEEL_MASK] > 0) {
+				next = min(next, t << WHEEL_SHIFT(level));
+				break;
+			}
+		}
+	}
+	return next;
+}
+
+static void state_event_wheel_cb(void *arg, const struct timer_event *event);
+
+static void wheel_schedule(void)
+{
+	uint64_t next = wheel_next_tick();
+	if (wheel.timeout != NULL) {
+		if (next >= wheel.wakeup) {
+			/* already set for then, or earlier */
+			return;
+		}
+		destroy_timeout(&wheel.timeout);
+	}
+	if (next == UINT64_MAX) {
+		return;
+	}
+	uint64_t now = floor_tick(mononow());
+	deltatime_t delay = deltatime_ms(next > now ? next - now : 0);
+	wheel.wakeup = next;
+	schedule_timeout("state event wheel", &wheel.timeout, delay,
+			 state_event_wheel_cb, NULL);
+}
+
+static void dispatch_state_event(struct state_event *ev, const struct timer_event *event);
+
+static void wheel_advance(uint64_t target, const struct timer_event *event)
+{
+	passert(!wheel.dispatching);
+	wheel.dispatching = true;
+	while (wheel.now < target) {
+		if (wheel.nr_events[0] == 0) {
+			/* nothing to dispatch until the next cascade */
+			uint64_t skip = wheel.now | WHEEL_MASK;
+			if (skip >= target) {
+				wheel.now = target;
+				break;
+			}
+			wheel.now = skip;
+		}
+		wheel.now++;
+
+		/* when level 0 wraps, cascade, top level down */
+		for (unsigned level = WHEEL_LEVELS - 1; level > 0; level--) {
+			if ((wheel.now & (WHEEL_SPAN(level) - 1)) != 0) {
+				continue;
+			}
+			unsigned slot = (wheel.now >> WHEEL_SHIFT(level)) & WHEEL_MASK;
+			struct state_event *ev;
+			while ((ev = wheel_first(level, slot)) != NULL) {
+				wheel_remove(ev);
+				wheel_add(ev, wheel.now);
+				wheel.cascaded++;
+			}
+		}
+
+		/*
+		 * Dispatch the slot.  A handler can delete other
+		 * events, including ones in this slot, so always
+		 * take the first; new events always land in a later
+		 * slot.
+		 */
+		unsigned slot = wheel.now & WHEEL_MASK;
+		struct state_event *ev;
+		while ((ev = wheel_first(0, slot)) != NULL) {
+			wheel_remove(ev);
+			dispatch_state_event(ev, event);
+			wheel.dispatched++;
+		}
+	}
+	wheel.dispatching = false;
+}
+
+static void state_event_wheel_cb(void *arg UNUSED, const struct timer_event *event)
+{
+	/* the timeout has fired; it needs to be re-armed */
+	destroy_timeout(&wheel.timeout);
+	wheel.wakeups++;
+	wheel_advance(floor_tick(mononow()), event);
+	wheel_schedule();
+}
+
+void show_state_event_wheel(struct show *s)
+{
+	if (!wheel.initialized) {
+		return;
+	}
+	SHOW_JAMBUF(RC_COMMENT, s, buf) {
+		jam(buf, "state event wheel:");
+		for (unsigned level = 0; level < WHEEL_LEVELS; level++) {
+			jam(buf, " level%u=%u", level, wheel.nr_events[level]);
+		}
+		jam(buf, " wakeups=%ju dispatched=%ju cascaded=%ju",
+		    wheel.wakeups, wheel.dispatched, wheel.cascaded);
+	}
+}
+
+void free_state_event_wheel(void)
+{
+	for (unsigned level = 0; level < WHEEL_LEVELS; level++) {
+		pexpect(wheel.nr_events[level] == 0);
+	}
+	destroy_timeout(&wheel.timeout);
+}
+
 void delete_state_event(struct state_event **evp, where_t where)
 {
 	struct state_event *e = (*evp);
@@ -162,8 +408,10 @@ void delete_state_event(struct state_event **evp, where_t where)
 	    e->ev_state->st_serialno,
 	    enum_name(&event_type_names, e->ev_type));
 
-	/* first the event */
-	destroy_timeout(&e->timeout);
+	/* first the event; already removed when dispatched */
+	if (!detached_list_entry(&e->ev_wheel_entry)) {
+		wheel_remove(e);
+	}
 	/* then the structure */
 	dbg_free("state-event", e, where);
 	pfree(e);
@@ -181,7 +429,7 @@ void delete_state_event(struct state_event **evp, where_t where)
 static void dispatch_event(struct state *st, enum event_type event_type,
 			   deltatime_t event_delay);
 
-static void timer_event_cb(void *arg, const struct timer_event *event)
+static void dispatch_state_event(struct state_event *ev, const struct timer_event *wheel_event)
 {
 	/*
 	 * Get rid of the old timer event before calling the timer
@@ -191,9 +439,12 @@ static void timer_event_cb(void *arg, const struct timer_event *event)
 	enum event_type event_type;
 	const char *event_name;
 	deltatime_t event_delay;
+	const struct timer_event event[1] = {{
+		.inception = threadtime_start(),
+		.logger = wheel_event->logger,
+	}};
 
 	{
-		struct state_event *ev = arg;
 		passert(ev != NULL);
 		event_type = ev->ev_type;
 		event_name = enum_name(&event_type_names, event_type);
@@ -224,7 +475,7 @@ static void timer_event_cb(void *arg, const struct timer_event *event)
 
 		/* everything useful has been extracted */
 		delete_state_event(evp, HERE);
-		arg = ev = *evp = NULL; /* all gone */
+		ev = *evp = NULL; /* all gone */
 	}
 
 	statetime_t start = statetime_backdate(st, &event->inception);
@@ -513,6 +764,7 @@ void event_schedule_where(enum event_type type, deltatime_t delay, struct state
 	ev->ev_epoch = mononow();
 	ev->ev_delay = delay;
 	ev->ev_time = monotime_add(ev->ev_epoch, delay);
+	ev->ev_tick = ceil_tick(ev->ev_time);
 	*evp = ev;
 
 	deltatime_buf buf;
@@ -520,7 +772,21 @@ void event_schedule_where(enum event_type type, deltatime_t delay, struct state
 	    __func__, event_name, ev, str_deltatime(delay, &buf),
 	    ev->ev_state->st_serialno);
 
-	schedule_timeout(event_name, &ev->timeout, delay, timer_event_cb, ev);
+	if (!wheel.initialized) {
+		init_state_event_wheel();
+	}
+	if (wheel_empty() && !wheel.dispatching) {
+		/*
+		 * The wheel only advances while it has events.  But
+		 * not while a slot is being dispatched: jumping .now
+		 * forward would map a new event onto the slot being
+		 * drained and fire it early.
+		 */
+		wheel.now = floor_tick(ev->ev_epoch);
+	}
+	init_list_entry(&state_event_info, ev, &ev->ev_wheel_entry);
+	wheel_add(ev, wheel.now + 1);
+	wheel_schedule();
 }
 
 /*
@@ -569,7 +835,7 @@ void call_state_event_handler(struct logger *logger, struct state *st,
 	}
 
 	/*
-	 * Like timer_event_cb(), delete the old event before calling
+	 * Like dispatch_state_event(), delete the old event before calling
 	 * the event handler.
 	 */
 	deltatime_t event_delay = deltatime(1);
@@ -23,6 +23,7 @@
 #include "deltatime.h"
 #include "monotime.h"
 #include "where.h"
+#include "list_entry.h"
 
 struct state;   /* forward declaration */
 struct fd;
@@ -32,10 +33,14 @@ struct show;
 struct state_event {
 	enum event_type ev_type;        /* Event type if time based */
 	struct state *ev_state;     	/* Pointer to relevant state (if any) */
-	struct timeout *timeout;	/* Underlying timer */
 	monotime_t ev_epoch;		/* it was scheduled ... */
 	deltatime_t ev_delay;		/* ... with the delay ... */
 	monotime_t ev_time;		/* ... so should happen after ...*/
+	/* timer wheel; see timer.c */
+	struct list_entry ev_wheel_entry;
+	uint64_t ev_tick;
+	unsigned ev_level;
+	unsigned ev_slot;
 };
 
 void state_event_sort(const struct state_event **events, unsigned nr_events);
@@ -57,6 +62,8 @@ void call_state_event_handler(struct logger *logger, struct state *st,
 			      enum event_type type);
 
 extern void list_timers(struct show *s, const monotime_t now);
+void show_state_event_wheel(struct show *s);
+void free_state_event_wheel(void);
 extern char *revive_conn;
 
 /*
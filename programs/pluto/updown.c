@@ -26,8 +26,11 @@
  * for more details.
  */
 
+#define _GNU_SOURCE		/* for environ */
+
 #include <errno.h>
 #include <stdio.h>
+#include <unistd.h>		/* for environ */
 #include <sys/wait.h>		/* WIFEXITED() et.al. */
 
 #include "ip_info.h"
@@ -40,8 +43,17 @@
 #include "kernel.h"
 #include "kernel_xfrm_interface.h"
 #include "iface.h"
-#include "keys.h"		/* for pluto_pubkeys */
+#include "keys.h"
+#include "pubkey_db.h"		/* for next_pluto_pubkey() */
 #include "secrets.h"		/* for struct pubkey_list */
+#include "list_entry.h"
+#include "server_fork.h"
+#include "pluto_shutdown.h"	/* for exiting_pluto */
+#include "show.h"
+#ifdef KERNEL_XFRM
+#include "updown_native.h"
+#endif
+#include "ipsecconf/confread.h"	/* for DEFAULT_UPDOWN */
 
 /*
  * Remove all characters but [-_.0-9a-zA-Z] from a character string.
@@ -158,12 +170,15 @@ static bool fmt_common_shell_out(char *buf,
 	JDuint("PLUTO_PEER_PROTOCOL", sr->remote->client.ipproto);
 
 	jam_string(&jb, "PLUTO_PEER_CA='");
-	for (struct pubkey_list *p = pluto_pubkeys; p != NULL; p = p->next) {
-		struct pubkey *key = p->key;
+	struct pubkey_filter pubkeys = {
+		.type = &pubkey_type_rsa,
+		.same_id = &c->remote->host.id,
+		.where = HERE,
+	};
+	while (next_pluto_pubkey(NEW2OLD, &pubkeys)) {
+		struct pubkey *key = pubkeys.key;
 		int pathlen;	/* value ignored */
-		if (key->content.type == &pubkey_type_rsa &&
-		    same_id(&c->remote->host.id, &key->id) &&
-		    trusted_ca(key->issuer, ASN1(sr->remote->host->config->ca), &pathlen)) {
+		if (trusted_ca(key->issuer, ASN1(sr->remote->host->config->ca), &pathlen)) {
 			jam_dn_or_null(&jb, key->issuer, "", jam_shell_quoted_bytes);
 			break;
 		}
@@ -395,13 +410,360 @@ static bool invoke_command(const char *verb, const char *verb_suffix, const char
 	return true;
 }
 
-static bool do_updown_verb(const char *verb,
+/*
+ * Per-verb statistics.
+ *
+ * LATENCY[] is a log2 histogram of how long each command took to run
+ * (not counting time spent queued), in milliseconds: <=1, <=2, <=4,
+ * ... <=1024, and then everything longer.
+ */
+
+#define UPDOWN_LATENCY_ROOF 12
+
+static const struct updown_verb {
+	const char *name;
+	const char *what;	/* static; server_fork_exec() keeps a pointer */
+	bool routes;		/* changes the routing table; run inline */
+} updown_verbs[UPDOWN_ROOF] = {
+#define V(E,N,R) [E] = { .name = N, .what = "updown " N, .routes = R, }
+	V(UPDOWN_PREPARE, "prepare", true),
+	V(UPDOWN_ROUTE, "route", true),
+	V(UPDOWN_UNROUTE, "unroute", true),
+	V(UPDOWN_UP, "up", false),
+	V(UPDOWN_DOWN, "down", false),
+#ifdef HAVE_NM
+	V(UPDOWN_DISCONNECT_NM, "disconnectNM", false),
+#endif
+#undef V
+};
+
+static struct updown_stats {
+	uintmax_t runs;
+	uintmax_t failures;
+	uintmax_t latency[UPDOWN_LATENCY_ROOF];
+} updown_stats[UPDOWN_ROOF];
+
+static void updown_stats_add(enum updown verb, monotime_t start, bool ok)
+{
+	struct updown_stats *stats = &updown_stats[verb];
+	stats->runs++;
+	if (!ok) {
+		stats->failures++;
+	}
+	intmax_t ms = deltamillisecs(monotimediff(mononow(), start));
+	unsigned bucket = 0;
+	while (bucket < UPDOWN_LATENCY_ROOF - 1 && ms > (INTMAX_C(1) << bucket)) {
+		bucket++;
+	}
+	stats->latency[bucket]++;
+}
+
+/*
+ * Asynchronous updown.
+ *
+ * When updown-concurrency= is non-zero the fully expanded command is
+ * queued and, later, run using server_fork_exec() so that the event
+ * loop isn't blocked while the script runs.
+ *
+ * At most updown-concurrency= commands are run at once.  A
+ * connection never has more than one command running, and its
+ * commands are started in the order they were queued (so "down" can
+ * never overtake "up").
+ *
+ * Only "up" and "down" style verbs are queued.  The route affecting
+ * verbs ("prepare", "route", "unroute") are run inline: connections
+ * sharing a client subnet or sourceip would otherwise race to update
+ * the kernel's routing table, and the caller needs their result to
+ * decide the connection's routing.  Before one is run, the
+ * connection's own queued commands are drained so that, for instance,
+ * "unroute" can't overtake "down".
+ *
+ * Since the command is expanded when it is queued, it still runs
+ * correctly when the connection or state is deleted in the meantime
+ * (for instance "down" followed by "unroute").
+ */
+
+unsigned pluto_updown_concurrency = 0;	/* 0: run inline */
+
+struct updown_command {
+	struct list_entry entry;
+	enum updown verb;
+	const char *verb_suffix;
+	co_serial_t co_serialno;
+	char *cmd;
+	pid_t pid;		/* once running */
+	monotime_t queued;
+	monotime_t started;
+	struct logger *logger;
+};
+
+static void jam_updown_command(struct jambuf *buf, const void *data)
+{
+	if (data == NULL) {
+		jam(buf, "no updown command");
+	} else {
+		const struct updown_command *command = data;
+		jam(buf, "updown %s%s "PRI_CO,
+		    updown_verbs[command->verb].name, command->verb_suffix,
+		    pri_co(command->co_serialno));
+	}
+}
+
+LIST_INFO(updown_command, entry, updown_command_info, jam_updown_command);
+
+static struct list_head pending_updown_commands =
+	INIT_LIST_HEAD(&pending_updown_commands, &updown_command_info);
+static struct list_head running_updown_commands =
+	INIT_LIST_HEAD(&running_updown_commands, &updown_command_info);
+
+static unsigned nr_pending_updown_commands;
+static unsigned nr_running_updown_commands;
+static unsigned max_pending_updown_commands;
+static uintmax_t max_updown_queue_ms;
+
+static void free_updown_command(struct updown_command **command)
+{
+	pfree((*command)->cmd);
+	free_logger(&(*command)->logger, HERE);
+	pfree(*command);
+	*command = NULL;
+}
+
+static void run_updown_commands(struct logger *logger);
+
+static stf_status updown_command_exited(struct state *st UNUSED,
+					struct msg_digest *md UNUSED,
+					int status, void *context,
+					struct logger *logger)
+{
+	struct updown_command *command = context;
+	const char *verb = updown_verbs[command->verb].name;
+
+	bool ok = false;
+	if (WIFEXITED(status)) {
+		if (WEXITSTATUS(status) == 0) {
+			ok = true;
+		} else {
+			llog(RC_LOG_SERIOUS, logger,
+			     "%s%s command exited with status %d",
+			     verb, command->verb_suffix, WEXITSTATUS(status));
+		}
+	} else if (WIFSIGNALED(status)) {
+		llog(RC_LOG_SERIOUS, logger,
+		     "%s%s command exited with signal %d",
+		     verb, command->verb_suffix, WTERMSIG(status));
+	} else {
+		llog(RC_LOG_SERIOUS, logger,
+		     "%s%s command exited with unknown status %d",
+		     verb, command->verb_suffix, status);
+	}
+	updown_stats_add(command->verb, command->started, ok);
+
+	remove_list_entry(&command->entry);
+	nr_running_updown_commands--;
+	free_updown_command(&command);
+
+	/* this connection's next command, if any, can now run */
+	if (!exiting_pluto) {
+		run_updown_commands(logger);
+	}
+	return STF_OK; /* ignored; there's no state */
+}
+
+static struct updown_command *find_updown_command(struct list_head *commands,
+						  co_serial_t co_serialno)
+{
+	struct updown_command *command;
+	FOR_EACH_LIST_ENTRY_OLD2NEW(command, commands) {
+		if (command->co_serialno == co_serialno) {
+			return command;
+		}
+	}
+	return NULL;
+}
+
+static bool updown_connection_busy(co_serial_t co_serialno)
+{
+	return find_updown_command(&running_updown_commands, co_serialno) != NULL;
+}
+
+static void run_updown_commands(struct logger *logger)
+{
+	struct updown_command *command;
+	FOR_EACH_LIST_ENTRY_OLD2NEW(command, &pending_updown_commands) {
+		if (nr_running_updown_commands >= pluto_updown_concurrency) {
+			break;
+		}
+		/*
+		 * When the connection already has a command running,
+		 * leave this one (and, by induction, any later
+		 * commands for the connection) queued.
+		 */
+		if (updown_connection_busy(command->co_serialno)) {
+			continue;
+		}
+
+		remove_list_entry(&command->entry);
+		nr_pending_updown_commands--;
+
+		command->started = mononow();
+		uintmax_t queue_ms = deltamillisecs(monotimediff(command->started,
+									      command->queued));
+		max_updown_queue_ms = max(max_updown_queue_ms, queue_ms);
+
+		const struct updown_verb *verb = &updown_verbs[command->verb];
+		ldbg(command->logger, "kernel: starting %s%s command, queued %jums",
+		     verb->name, command->verb_suffix, queue_ms);
+		char *argv[] = {
+			DISCARD_CONST(char *, verb->what),
+			DISCARD_CONST(char *, "-c"),
+			command->cmd,
+			NULL,
+		};
+		pid_t pid = server_fork_exec("/bin/sh", argv, environ,
+					     updown_command_exited, command,
+					     command->logger);
+		if (pid < 0) {
+			/* already logged */
+			updown_stats_add(command->verb, command->started, false);
+			free_updown_command(&command);
+			continue;
+		}
+		command->pid = pid;
+		insert_list_entry(&running_updown_commands, &command->entry);
+		nr_running_updown_commands++;
+	}
+	ldbg(logger, "kernel: %u updown commands running, %u pending",
+	     nr_running_updown_commands, nr_pending_updown_commands);
+}
+
+static void queue_updown_command(enum updown verb, const char *verb_suffix,
+				 const struct connection *c, char *cmd,
+				 struct logger *logger)
+{
+	struct updown_command *command = alloc_thing(struct updown_command, "updown command");
+	command->verb = verb;
+	command->verb_suffix = verb_suffix;
+	command->co_serialno = c->serialno;
+	command->cmd = cmd; /* stolen */
+	command->queued = mononow();
+	command->logger = clone_logger(logger, HERE);
+	init_list_entry(&updown_command_info, command, &command->entry);
+	insert_list_entry(&pending_updown_commands, &command->entry);
+	nr_pending_updown_commands++;
+	max_pending_updown_commands = max(max_pending_updown_commands,
+					  nr_pending_updown_commands);
+	run_updown_commands(logger);
+}
+
+static void run_updown_command_inline(struct updown_command **command)
+{
+	const char *verb = updown_verbs[(*command)->verb].name;
+	monotime_t start = mononow();
+	bool ok = invoke_command(verb, (*command)->verb_suffix,
+				 (*command)->cmd, (*command)->logger);
+	updown_stats_add((*command)->verb, start, ok);
+	free_updown_command(command);
+}
+
+/*
+ * Before running a route affecting verb inline, wait for the
+ * connection's running command and then run anything it still has
+ * queued, in order.
+ */
+
+static void drain_connection_updown_commands(co_serial_t co_serialno,
+					     struct logger *logger)
+{
+	while (true) {
+		struct updown_command *command =
+			find_updown_command(&running_updown_commands, co_serialno);
+		if (command != NULL) {
+			ldbg(logger, "kernel: waiting for %s%s command",
+			     updown_verbs[command->verb].name, command->verb_suffix);
+			/* calls updown_command_exited(), which may
+			 * start the connection's next command */
+			server_fork_wait(command->pid, logger);
+			continue;
+		}
+		command = find_updown_command(&pending_updown_commands, co_serialno);
+		if (command != NULL) {
+			remove_list_entry(&command->entry);
+			nr_pending_updown_commands--;
+			run_updown_command_inline(&command);
+			continue;
+		}
+		return;
+	}
+}
+
+/*
+ * During shutdown the event loop is no longer running; wait for any
+ * running commands and then run what's left in order, inline.
+ */
+
+void flush_updown_commands(struct logger *logger)
+{
+	while (nr_running_updown_commands > 0) {
+		siginfo_t info;
+		if (waitid(P_ALL, 0, &info, WEXITED|WNOWAIT) < 0) {
+			llog_error(logger, errno, "waiting for updown commands failed");
+			break;
+		}
+		/* reaps the child, calls updown_command_exited() */
+		server_fork_sigchld_handler(logger);
+	}
+
+	struct updown_command *command;
+	FOR_EACH_LIST_ENTRY_OLD2NEW(command, &pending_updown_commands) {
+		remove_list_entry(&command->entry);
+		nr_pending_updown_commands--;
+		run_updown_command_inline(&command);
+	}
+}
+
+void show_updown_status(struct show *s)
+{
+	show_separator(s);
+	if (pluto_updown_concurrency == 0) {
+		show_comment(s, "updown commands: run inline");
+	} else {
+		show_comment(s, "updown commands: concurrency=%u running=%u pending=%u max-pending=%u max-queued-ms=%ju",
+			     pluto_updown_concurrency,
+			     nr_running_updown_commands,
+			     nr_pending_updown_commands,
+			     max_pending_updown_commands,
+			     max_updown_queue_ms);
+	}
+	for (enum updown verb = 0; verb < UPDOWN_ROOF; verb++) {
+		const struct updown_stats *stats = &updown_stats[verb];
+		if (stats->runs == 0) {
+			continue;
+		}
+		SHOW_JAMBUF(RC_COMMENT, s, buf) {
+			jam(buf, "updown %s: runs=%ju failures=%ju ms:",
+			    updown_verbs[verb].name, stats->runs, stats->failures);
+			for (unsigned b = 0; b < UPDOWN_LATENCY_ROOF; b++) {
+				if (b < UPDOWN_LATENCY_ROOF - 1) {
+					jam(buf, " <=%ju=%ju", (UINTMAX_C(1) << b), stats->latency[b]);
+				} else {
+					jam(buf, " more=%ju", stats->latency[b]);
+				}
+			}
+		}
+	}
+}
+
+static bool do_updown_verb(enum updown updown_verb,
+			   const char *updown,
 			   const struct connection *c,
 			   const struct spd_route *sr,
 			   struct state *st,
 			   /* either st, or c's logger */
 			   struct logger *logger)
 {
+	const char *verb = updown_verbs[updown_verb].name;
+
 	/*
 	 * Figure out which verb suffix applies.
 	 */
@@ -461,7 +823,7 @@ static bool do_updown_verb(const char *verb,
 				 "%s",        /* actual script */
 				 verb, verb_suffix,
 				 common_shell_out_str,
-				 c->local->config->child.updown);
+				 updown);
 	if (cmd == NULL) {
 		llog(RC_LOG_SERIOUS, logger,
 			    "%s%s command too long!", verb,
@@ -469,7 +831,22 @@ static bool do_updown_verb(const char *verb,
 		return false;
 	}
 
+	/*
+	 * Once pluto starts shutting down the event loop isn't
+	 * around to reap the command, run it inline.
+	 */
+	if (pluto_updown_concurrency > 0 && !exiting_pluto) {
+		if (!updown_verbs[updown_verb].routes) {
+			/* the result isn't known; assume success */
+			queue_updown_command(updown_verb, verb_suffix, c, cmd, logger);
+			return true;
+		}
+		drain_connection_updown_commands(c->serialno, logger);
+	}
+
+	monotime_t start = mononow();
 	bool ok = invoke_command(verb, verb_suffix, cmd, logger);
+	updown_stats_add(updown_verb, start, ok);
 	pfree(cmd);
 	return ok;
 }
@@ -492,21 +869,8 @@ bool do_updown(enum updown updown_verb,
 			 (st != NULL && st->st_logger == logger)));
 #endif
 
-	const char *verb;
-	switch (updown_verb) {
-#define C(E,N) case E: verb = N; break
-		C(UPDOWN_PREPARE, "prepare");
-		C(UPDOWN_ROUTE, "route");
-		C(UPDOWN_UNROUTE, "unroute");
-		C(UPDOWN_UP, "up");
-		C(UPDOWN_DOWN, "down");
-#ifdef HAVE_NM
-		C(UPDOWN_DISCONNECT_NM, "disconnectNM");
-#endif
-#undef C
-	default:
-		bad_case(updown_verb);
-	}
+	passert(updown_verb < UPDOWN_ROOF);
+	const char *verb = updown_verbs[updown_verb].name;
 
 	/*
 	 * Support for skipping updown, eg leftupdown=""
@@ -527,7 +891,20 @@ bool do_updown(enum updown updown_verb,
 		ldbg(logger, "kernel: running updown command \"%s\" for verb %s ", updown, verb);
 	}
 
-	return do_updown_verb(verb, c, spd, st, logger);
+	if (streq(updown, UPDOWN_NATIVE)) {
+#ifdef KERNEL_XFRM
+		if (native_updown_supported(c, spd, logger)) {
+			monotime_t start = mononow();
+			bool ok = native_updown(updown_verb, c, spd, st, logger);
+			updown_stats_add(updown_verb, start, ok);
+			return ok;
+		}
+#endif
+		/* fall back to the script */
+		updown = DEFAULT_UPDOWN;
+	}
+
+	return do_updown_verb(updown_verb, updown, c, spd, st, logger);
 }
 
 void do_updown_spds(enum updown updown_verb,
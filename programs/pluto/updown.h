@@ -35,6 +35,20 @@ struct spd_route;
 struct spds;
 struct logger;
 struct child_sa;
+struct show;
+
+/*
+ * updown-concurrency=: when non-zero, updown commands are queued and
+ * run in the background, at most this many at once.
+ */
+#define UPDOWN_CONCURRENCY_MAX 1000
+extern unsigned pluto_updown_concurrency;
+
+/*
+ * leftupdown=%native: pluto makes the route and source address
+ * changes itself, using rtnetlink.
+ */
+#define UPDOWN_NATIVE "%native"
 
 /* many bits reach in to use this, but maybe shouldn't */
 enum updown {
@@ -46,6 +60,7 @@ enum updown {
 #ifdef HAVE_NM
 	UPDOWN_DISCONNECT_NM,
 #endif
+	UPDOWN_ROOF,
 };
 
 bool do_updown(enum updown updown_verb,
@@ -59,4 +74,7 @@ void do_updown_spds(enum updown updown_verb,
 
 void do_updown_unroute(const struct connection *c, struct child_sa *child);
 
+void show_updown_status(struct show *s);
+void flush_updown_commands(struct logger *logger);
+
 #endif
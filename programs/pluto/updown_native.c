@@ -0,0 +1,607 @@
+/* native (rtnetlink) updown, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/*
+ * leftupdown=%native performs the route and source address changes
+ * that the default _updown.xfrm script makes for a plain connection,
+ * but directly over NETLINK_ROUTE instead of forking "ip".
+ *
+ * The messages for one verb are sent as a single batch and then the
+ * ACKs are collected.  Since the kernel processes rtnetlink requests
+ * synchronously, the ACKs are already queued when sendto() returns
+ * so reading them never blocks the event loop.
+ *
+ * Everything is idempotent: adding something that is already there,
+ * or deleting something that has gone, is not an error.
+ *
+ * Like _updown.xfrm, a source address is only deleted when it was
+ * added by updown (it is on "lo" with updown's scope) and no route
+ * in the kernel still uses it as "src".  An address configured by the
+ * administrator is left alone.
+ */
+
+#include <errno.h>
+#include <unistd.h>
+#include <ifaddrs.h>
+#include <net/if.h>		/* for if_nametoindex() */
+#include <sys/socket.h>
+
+#include "netlink_attrib.h"	/* must be first; see GRRR */
+#include <linux/rtnetlink.h>
+
+#include "lsw_socket.h"		/* for cloexec_socket() */
+#include "ip_info.h"
+
+#include "defs.h"
+#include "log.h"
+#include "connections.h"
+#include "state.h"
+#include "iface.h"
+#include "routing.h"		/* for routed() */
+#include "updown.h"
+#include "updown_native.h"
+
+#define RTNL_BATCH_MAX 6	/* 0/0 needs two routes, plus an address */
+#define RTNL_SCOPE_SOURCEIP 50	/* same as _updown.xfrm; marks addresses it added */
+
+static int rtnl_fd = NULL_FD;
+static uint32_t rtnl_seq;
+
+struct rtnl_batch {
+	size_t len;
+	unsigned nr;
+	struct rtnl_op {
+		uint32_t seq;
+		int ignore;	/* errno that means it is already done */
+		const char *what;
+	} op[RTNL_BATCH_MAX];
+	char buf[RTNL_BATCH_MAX * NLMSG_ALIGN(NLMSG_LENGTH(sizeof(struct rtmsg)) + 128)];
+};
+
+struct rtnl_req {
+	struct nlmsghdr n;
+	union {
+		struct rtmsg r;
+		struct ifaddrmsg a;
+	} u;
+	char data[128];
+};
+
+static void add_to_batch(struct rtnl_batch *batch, struct rtnl_req *req,
+			 int ignore, const char *what)
+{
+	passert(batch->nr < RTNL_BATCH_MAX);
+	passert(batch->len + NLMSG_ALIGN(req->n.nlmsg_len) <= sizeof(batch->buf));
+	req->n.nlmsg_seq = ++rtnl_seq;
+	batch->op[batch->nr++] = (struct rtnl_op) {
+		.seq = req->n.nlmsg_seq,
+		.ignore = ignore,
+		.what = what,
+	};
+	memcpy(batch->buf + batch->len, req, req->n.nlmsg_len);
+	batch->len += NLMSG_ALIGN(req->n.nlmsg_len);
+}
+
+/*
+ * ip route {replace,del} DST/BITS [via GW] dev OIF [src SRC] [mtu] [metric]
+ */
+
+static void batch_route(struct rtnl_batch *batch, uint16_t type,
+			const struct ip_info *afi, const void *dst, unsigned bits,
+			const ip_address *gw, unsigned oif, const ip_address *src,
+			const struct connection *c)
+{
+	struct rtnl_req req;
+	zero(&req);
+	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(req.u.r));
+	req.n.nlmsg_type = type;
+	req.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+	req.u.r.rtm_family = afi->af;
+	req.u.r.rtm_dst_len = bits;
+	req.u.r.rtm_table = RT_TABLE_MAIN;
+	if (type == RTM_NEWROUTE) {
+		req.n.nlmsg_flags |= NLM_F_CREATE | NLM_F_REPLACE;
+		req.u.r.rtm_protocol = RTPROT_BOOT;
+		req.u.r.rtm_scope = (gw != NULL ? RT_SCOPE_UNIVERSE : RT_SCOPE_LINK);
+		req.u.r.rtm_type = RTN_UNICAST;
+	} else {
+		req.u.r.rtm_scope = RT_SCOPE_NOWHERE;
+	}
+
+	nl_addattr_l(&req.n, sizeof(req), RTA_DST, dst, afi->ip_size);
+	nl_addattr32(&req.n, sizeof(req), RTA_OIF, oif);
+	if (type == RTM_NEWROUTE) {
+		if (gw != NULL) {
+			shunk_t g = address_as_shunk(gw);
+			nl_addattr_l(&req.n, sizeof(req), RTA_GATEWAY, g.ptr, g.len);
+		}
+		if (src != NULL) {
+			shunk_t s = address_as_shunk(src);
+			nl_addattr_l(&req.n, sizeof(req), RTA_PREFSRC, s.ptr, s.len);
+		}
+		if (c->metric != 0) {
+			nl_addattr32(&req.n, sizeof(req), RTA_PRIORITY, c->metric);
+		}
+		if (c->connmtu != 0) {
+			struct rtattr *metrics = nl_addattr_nest(&req.n, sizeof(req), RTA_METRICS);
+			nl_addattr32(&req.n, sizeof(req), RTAX_MTU, c->connmtu);
+			nl_addattr_nest_end(&req.n, metrics);
+		}
+		add_to_batch(batch, &req, 0, "add route");
+	} else {
+		add_to_batch(batch, &req, ESRCH, "delete route");
+	}
+}
+
+static uint8_t sourceip_scope(const struct ip_info *afi)
+{
+	/* IPv6 ignores the scope; _updown.xfrm uses global */
+	return (afi == &ipv4_info ? RTNL_SCOPE_SOURCEIP : RT_SCOPE_UNIVERSE);
+}
+
+/*
+ * ip addr {add,del} SRC/MAX dev IFINDEX scope SCOPE
+ */
+
+static void batch_addr(struct rtnl_batch *batch, uint16_t type,
+		       const ip_address *addr, unsigned ifindex)
+{
+	const struct ip_info *afi = address_info(*addr);
+	shunk_t a = address_as_shunk(addr);
+
+	struct rtnl_req req;
+	zero(&req);
+	req.n.nlmsg_len = NLMSG_LENGTH(sizeof(req.u.a));
+	req.n.nlmsg_type = type;
+	req.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+	req.u.a.ifa_family = afi->af;
+	req.u.a.ifa_prefixlen = afi->mask_cnt;
+	req.u.a.ifa_scope = sourceip_scope(afi);
+	req.u.a.ifa_index = ifindex;
+	nl_addattr_l(&req.n, sizeof(req), IFA_LOCAL, a.ptr, a.len);
+	nl_addattr_l(&req.n, sizeof(req), IFA_ADDRESS, a.ptr, a.len);
+
+	if (type == RTM_NEWADDR) {
+		req.n.nlmsg_flags |= NLM_F_CREATE | NLM_F_EXCL;
+		add_to_batch(batch, &req, EEXIST, "add source address");
+	} else {
+		add_to_batch(batch, &req, EADDRNOTAVAIL, "delete source address");
+	}
+}
+
+static bool open_rtnl_socket(const char *verb, struct logger *logger)
+{
+	if (rtnl_fd == NULL_FD) {
+		rtnl_fd = cloexec_socket(AF_NETLINK, SOCK_DGRAM, NETLINK_ROUTE);
+		if (rtnl_fd < 0) {
+			llog_error(logger, errno, "native updown %s: socket() failed", verb);
+			rtnl_fd = NULL_FD;
+			return false;
+		}
+	}
+	/* drain any stale replies from an earlier failed request */
+	char rsp[4096] __attribute__((aligned(NLMSG_ALIGNTO)));
+	while (recv(rtnl_fd, rsp, sizeof(rsp), MSG_DONTWAIT) > 0);
+	return true;
+}
+
+static bool send_batch(struct rtnl_batch *batch, const char *verb,
+		       struct logger *logger)
+{
+	if (batch->nr == 0) {
+		ldbg(logger, "native updown %s: nothing to do", verb);
+		return true;
+	}
+
+	if (!open_rtnl_socket(verb, logger)) {
+		return false;
+	}
+
+	char rsp[4096] __attribute__((aligned(NLMSG_ALIGNTO)));
+
+	struct sockaddr_nl addr = { .nl_family = AF_NETLINK, };
+	ssize_t r;
+	do {
+		r = sendto(rtnl_fd, batch->buf, batch->len, 0,
+			   (struct sockaddr *)&addr, sizeof(addr));
+	} while (r < 0 && errno == EINTR);
+	if (r < 0) {
+		llog_error(logger, errno, "native updown %s: netlink sendto() failed", verb);
+		return false;
+	}
+	ldbg(logger, "native updown %s: sent %u requests in %zu bytes",
+	     verb, batch->nr, batch->len);
+
+	bool ok = true;
+	unsigned acked = 0;
+	while (acked < batch->nr) {
+		ssize_t len = recv(rtnl_fd, rsp, sizeof(rsp), MSG_DONTWAIT);
+		if (len < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			llog_error(logger, errno,
+				   "native updown %s: netlink recv() failed after %u of %u replies",
+				   verb, acked, batch->nr);
+			return false;
+		}
+		for (struct nlmsghdr *n = (struct nlmsghdr *)rsp;
+		     NLMSG_OK(n, (size_t)len); n = NLMSG_NEXT(n, len)) {
+			if (n->nlmsg_type != NLMSG_ERROR) {
+				continue;
+			}
+			const struct nlmsgerr *e = NLMSG_DATA(n);
+			for (unsigned i = 0; i < batch->nr; i++) {
+				const struct rtnl_op *op = &batch->op[i];
+				if (op->seq != n->nlmsg_seq) {
+					continue;
+				}
+				acked++;
+				if (e->error == 0) {
+					ldbg(logger, "native updown %s: %s", verb, op->what);
+				} else if (-e->error == op->ignore) {
+					ldbg(logger, "native updown %s: %s: already done",
+					     verb, op->what);
+				} else {
+					llog_error(logger, -e->error,
+						   "native updown %s: %s failed", verb, op->what);
+					ok = false;
+				}
+				break;
+			}
+		}
+	}
+	return ok;
+}
+
+/*
+ * Dump the kernel's addresses or routes looking for one that
+ * matches.  When the dump fails, assume there's a match so that
+ * nothing is deleted.
+ */
+
+typedef bool (rtnl_match_fn)(const struct nlmsghdr *n, const ip_address *address,
+			     unsigned ifindex);
+
+static bool rtnl_attr_is_address(const struct rtattr *rta, const ip_address *address)
+{
+	shunk_t a = address_as_shunk(address);
+	return (RTA_PAYLOAD(rta) == a.len &&
+		memeq(RTA_DATA(rta), a.ptr, a.len));
+}
+
+/* ip -o addr list dev IFINDEX scope SCOPE | grep ADDRESS/MAX */
+
+static bool match_sourceip_addr(const struct nlmsghdr *n, const ip_address *address,
+				unsigned ifindex)
+{
+	const struct ip_info *afi = address_info(*address);
+	const struct ifaddrmsg *ifa = NLMSG_DATA(n);
+	if (n->nlmsg_type != RTM_NEWADDR ||
+	    ifa->ifa_family != afi->af ||
+	    ifa->ifa_index != ifindex ||
+	    ifa->ifa_prefixlen != afi->mask_cnt ||
+	    ifa->ifa_scope != sourceip_scope(afi)) {
+		return false;
+	}
+	int len = IFA_PAYLOAD(n);
+	for (const struct rtattr *rta = IFA_RTA(ifa); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if ((rta->rta_type == IFA_LOCAL || rta->rta_type == IFA_ADDRESS) &&
+		    rtnl_attr_is_address(rta, address)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* ip -o route list src ADDRESS */
+
+static bool match_route_src(const struct nlmsghdr *n, const ip_address *address,
+			    unsigned ifindex UNUSED)
+{
+	const struct ip_info *afi = address_info(*address);
+	const struct rtmsg *rtm = NLMSG_DATA(n);
+	if (n->nlmsg_type != RTM_NEWROUTE ||
+	    rtm->rtm_family != afi->af ||
+	    rtm->rtm_table != RT_TABLE_MAIN) {
+		return false;
+	}
+	int len = RTM_PAYLOAD(n);
+	for (const struct rtattr *rta = RTM_RTA(rtm); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		if (rta->rta_type == RTA_PREFSRC &&
+		    rtnl_attr_is_address(rta, address)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool rtnl_dump_matches(uint16_t type, rtnl_match_fn *match,
+			      const ip_address *address, unsigned ifindex,
+			      const char *verb, struct logger *logger)
+{
+	if (!open_rtnl_socket(verb, logger)) {
+		return true;
+	}
+
+	struct rtnl_req req;
+	zero(&req);
+	req.n.nlmsg_type = type;
+	req.n.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.n.nlmsg_seq = ++rtnl_seq;
+	if (type == RTM_GETADDR) {
+		req.n.nlmsg_len = NLMSG_LENGTH(sizeof(req.u.a));
+		req.u.a.ifa_family = address_info(*address)->af;
+	} else {
+		req.n.nlmsg_len = NLMSG_LENGTH(sizeof(req.u.r));
+		req.u.r.rtm_family = address_info(*address)->af;
+	}
+
+	struct sockaddr_nl addr = { .nl_family = AF_NETLINK, };
+	ssize_t r;
+	do {
+		r = sendto(rtnl_fd, &req, req.n.nlmsg_len, 0,
+			   (struct sockaddr *)&addr, sizeof(addr));
+	} while (r < 0 && errno == EINTR);
+	if (r < 0) {
+		llog_error(logger, errno, "native updown %s: netlink dump sendto() failed", verb);
+		return true;
+	}
+
+	/* read the entire dump, even after a match */
+	bool matched = false;
+	char rsp[8192] __attribute__((aligned(NLMSG_ALIGNTO)));
+	while (true) {
+		ssize_t len = recv(rtnl_fd, rsp, sizeof(rsp), 0);
+		if (len < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			llog_error(logger, errno, "native updown %s: netlink dump recv() failed", verb);
+			return true;
+		}
+		for (struct nlmsghdr *n = (struct nlmsghdr *)rsp;
+		     NLMSG_OK(n, (size_t)len); n = NLMSG_NEXT(n, len)) {
+			if (n->nlmsg_seq != req.n.nlmsg_seq) {
+				continue;
+			}
+			if (n->nlmsg_type == NLMSG_DONE) {
+				return matched;
+			}
+			if (n->nlmsg_type == NLMSG_ERROR) {
+				const struct nlmsgerr *e = NLMSG_DATA(n);
+				llog_error(logger, -e->error, "native updown %s: netlink dump failed", verb);
+				return true;
+			}
+			matched = matched || match(n, address, ifindex);
+		}
+	}
+}
+
+static bool address_is_local(const ip_address *address)
+{
+	struct ifaddrs *ifap;
+	if (getifaddrs(&ifap) != 0) {
+		return false;
+	}
+	bool local = false;
+	for (const struct ifaddrs *ifa = ifap; ifa != NULL && !local; ifa = ifa->ifa_next) {
+		if (ifa->ifa_addr == NULL) {
+			continue;
+		}
+		ip_address a;
+		switch (ifa->ifa_addr->sa_family) {
+		case AF_INET:
+			a = address_from_in_addr(&((const struct sockaddr_in *)ifa->ifa_addr)->sin_addr);
+			break;
+		case AF_INET6:
+			a = address_from_in6_addr(&((const struct sockaddr_in6 *)ifa->ifa_addr)->sin6_addr);
+			break;
+		default:
+			continue;
+		}
+		local = address_eq_address(a, *address);
+	}
+	freeifaddrs(ifap);
+	return local;
+}
+
+/*
+ * Is SOURCEIP still needed by some other routed connection?  This is
+ * what "ip route list src SOURCEIP" checks in _updown.xfrm.
+ */
+
+static bool sourceip_in_use(const ip_address *sourceip, const struct spd_route *sr)
+{
+	struct spd_route_filter srf = {
+		.where = HERE,
+	};
+	while (next_spd_route(NEW2OLD, &srf)) {
+		const struct spd_route *spd = srf.spd;
+		if (spd == sr || !routed(spd->connection)) {
+			continue;
+		}
+		ip_address other = spd_end_sourceip(spd->local);
+		if (other.is_set && address_eq_address(other, *sourceip)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Anything beyond plain routes and source addresses (VTI, XFRMi
+ * marks and rules, NFLOG, CAT, resolv.conf, NetworkManager, ...)
+ * still needs the script.
+ */
+
+bool native_updown_supported(const struct connection *c,
+			     const struct spd_route *sr,
+			     struct logger *logger)
+{
+	const char *why =
+		(c->vti_iface != NULL ? "vti-interface=" :
+		 c->xfrmi != NULL ? "ipsec-interface=" :
+		 c->nflog_group != 0 ? "nflog-group=" :
+		 c->sa_marks.in.val != 0 || c->sa_marks.out.val != 0 ? "mark=" :
+		 c->local->child.has_cat ? "cat=" :
+		 c->remotepeertype == CISCO ? "remote-peer-type=cisco" :
+		 sr->local->host->config->modecfg.client ? "modecfgclient=" :
+#ifdef HAVE_NM
+		 c->nmconfigured ? "nm-configured=" :
+#endif
+		 NULL);
+	if (why != NULL) {
+		ldbg(logger, "native updown: %s requires the updown script", why);
+		return false;
+	}
+	return true;
+}
+
+bool native_updown(enum updown updown_verb,
+		   const struct connection *c,
+		   const struct spd_route *sr,
+		   struct state *st,
+		   struct logger *logger)
+{
+	const char *verb;
+	bool route;	/* else unroute */
+	bool source;	/* else delete */
+	switch (updown_verb) {
+	case UPDOWN_ROUTE:
+		verb = "route"; route = true; source = true;
+		break;
+	case UPDOWN_UNROUTE:
+		verb = "unroute"; route = true; source = false;
+		break;
+	case UPDOWN_UP:
+		verb = "up"; route = false; source = true;
+		break;
+	default:
+		/* prepare and down only touch VTI, NFLOG, ... */
+		return true;
+	}
+
+	const ip_address sourceip = spd_end_sourceip(sr->local);
+	const struct ip_info *afi = selector_info(sr->local->client);
+	if (afi == NULL) {
+		llog_pexpect(logger, HERE, "native updown %s: unknown address family", verb);
+		return false;
+	}
+
+	/*
+	 * Like _updown.xfrm, the route is only needed when it
+	 * changes something: the source address or the MTU.
+	 */
+	bool need_route = (route && (sourceip.is_set || c->connmtu != 0));
+	/* up-host doesn't add the source address */
+	bool need_source = (sourceip.is_set &&
+			    (updown_verb != UPDOWN_UP ||
+			     !selector_range_eq_address(sr->local->client, sr->local->host->addr)));
+
+	struct rtnl_batch batch = { .nr = 0, };
+
+	unsigned lo = if_nametoindex("lo");
+	if (need_source && lo == 0) {
+		llog_error(logger, errno, "native updown %s: loopback device", verb);
+		return false;
+	}
+
+	if (need_source && source && !address_is_local(&sourceip)) {
+		batch_addr(&batch, RTM_NEWADDR, &sourceip, lo);
+	}
+
+	if (need_route) {
+		if (c->interface == NULL) {
+			llog_pexpect(logger, HERE, "native updown %s: no interface", verb);
+			return false;
+		}
+		unsigned oif = if_nametoindex(c->interface->ip_dev->id_rname);
+		if (oif == 0) {
+			llog_error(logger, errno, "native updown %s: device %s",
+				   verb, c->interface->ip_dev->id_rname);
+			return false;
+		}
+
+		/* for transport mode, things are complicated */
+		const bool tunneling = LIN(POLICY_TUNNEL, c->policy);
+		ip_subnet peer = (!tunneling && st != NULL &&
+				  LHAS(st->hidden_variables.st_nat_traversal, NATED_PEER) ?
+				  subnet_from_address(sr->remote->host->addr) :
+				  selector_subnet(sr->remote->client));
+		ip_address peer_prefix = subnet_prefix(peer);
+		unsigned peer_bits = subnet_prefix_bits(peer);
+
+		ip_address nexthop = sr->local->host->nexthop;
+		const ip_address *gw = (address_is_specified(nexthop) &&
+					address_info(nexthop) == afi &&
+					!address_eq_address(nexthop, sr->remote->host->addr) ?
+					&nexthop : NULL);
+		const ip_address *src = (source && sourceip.is_set ? &sourceip : NULL);
+		uint16_t type = (source ? RTM_NEWROUTE : RTM_DELROUTE);
+
+		if (peer_bits == 0) {
+			/* eclipse the default route without replacing it */
+			if (afi == &ipv4_info) {
+				static const uint8_t lo_half[4] = { 0, };
+				static const uint8_t hi_half[4] = { 128, };
+				batch_route(&batch, type, afi, lo_half, 1, gw, oif, src, c);
+				batch_route(&batch, type, afi, hi_half, 1, gw, oif, src, c);
+			} else {
+				static const uint8_t global[16] = { 0x20, };
+				batch_route(&batch, type, afi, global, 3, gw, oif, src, c);
+			}
+		} else {
+			shunk_t p = address_as_shunk(&peer_prefix);
+			batch_route(&batch, type, afi, p.ptr, peer_bits, gw, oif, src, c);
+		}
+	}
+
+	if (!send_batch(&batch, verb, logger)) {
+		return false;
+	}
+
+	/*
+	 * Delete the source address last, once the route using it is
+	 * gone; but only when updown added it and nothing else uses
+	 * it.
+	 */
+	if (need_source && !source &&
+	    !(st != NULL && st->st_mobike_del_src_ip) &&
+	    !sourceip_in_use(&sourceip, sr)) {
+		address_buf ab;
+		if (!rtnl_dump_matches(RTM_GETADDR, match_sourceip_addr, &sourceip, lo, verb, logger)) {
+			ldbg(logger, "native updown %s: source address %s was not added by updown",
+			     verb, str_address(&sourceip, &ab));
+			return true;
+		}
+		if (rtnl_dump_matches(RTM_GETROUTE, match_route_src, &sourceip, lo, verb, logger)) {
+			ldbg(logger, "native updown %s: source address %s is still used by a route",
+			     verb, str_address(&sourceip, &ab));
+			return true;
+		}
+		struct rtnl_batch del = { .nr = 0, };
+		batch_addr(&del, RTM_DELADDR, &sourceip, lo);
+		return send_batch(&del, verb, logger);
+	}
+
+	return true;
+}
+
+void free_native_updown(void)
+{
+	if (rtnl_fd != NULL_FD) {
+		close(rtnl_fd);
+		rtnl_fd = NULL_FD;
+	}
+}
@@ -43,6 +43,15 @@
 #include "kernel_xfrm_interface.h"
 #include "iface.h"
 #include "show.h"
+#include "hash_table.h"		/* for show_hash_tables_status() */
+#include "server_pool.h"		/* for show_helper_status() */
+#include "crypt_ke.h"			/* for show_ke_pool_status() */
+#ifdef USE_PAM_AUTH
+#include "pam_auth.h"			/* for show_pam_auth_status() */
+#endif
+#include "updown.h"		/* for show_updown_status() */
+#include "nss_cert_verify.h"	/* for show_cert_chain_cache_status() */
+#include "demux.h"		/* for show_md_pool_status() */
 #ifdef USE_SECCOMP
 #include "pluto_seccomp.h"
 #endif
@@ -70,9 +79,15 @@ void whack_globalstatus(struct show *s)
 {
 	show_globalstate_status(s);
 	show_pluto_stats(s);
+	show_cert_chain_cache_status(s);
+	show_md_pool_status(s);
+	show_ke_pool_status(s);
+#ifdef USE_PAM_AUTH
+	show_pam_auth_status(s);
+#endif
 }
 
-void whack_status(struct show *s, const monotime_t now)
+void whack_status(struct show *s)
 {
 	show_kernel_interface(s);
 	show_ifaces_status(s);
@@ -84,10 +99,15 @@ void whack_status(struct show *s, const monotime_t now)
 	show_kernel_alg_status(s);
 	show_ike_alg_status(s);
 	show_db_ops_status(s);
+	show_hash_tables_status(s);
+	show_helper_status(s);
+	show_updown_status(s);
 	show_connection_statuses(s);
 	show_brief_status(s);
-	show_states(s, now);
+	/* the states are listed in slices; shunts follow */
 #if defined(KERNEL_XFRM)
-	show_shunt_status(s);
+	show_states(s, show_shunt_status);
+#else
+	show_states(s, NULL);
 #endif
 }
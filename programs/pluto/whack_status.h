@@ -24,7 +24,7 @@
 
 struct show;
 
-void whack_status(struct show *s, const monotime_t now);
+void whack_status(struct show *s);
 void whack_globalstatus(struct show *s);
 
 #endif
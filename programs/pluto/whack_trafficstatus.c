@@ -114,6 +114,27 @@ static void jam_child_sa_traffic(struct jambuf *buf, struct child_sa *child)
 	}
 }
 
+static void show_child_sa_traffic(struct show *s, struct state *st,
+				  const monotime_t now UNUSED)
+{
+	/* ignore non-IPsec states (XXX: redundant?) */
+	if (IS_IKE_SA(st)) {
+		return;
+	}
+
+	/* ignore non established states */
+	if (!IS_IPSEC_SA_ESTABLISHED(st)) {
+		return;
+	}
+
+	/* whack-log-global - no prefix */
+	SHOW_JAMBUF(RC_INFORMATIONAL_TRAFFIC, s, buf) {
+		/* note: this mutates *st by calling
+		 * get_sa_bundle_info */
+		jam_child_sa_traffic(buf, pexpect_child_sa(st));
+	}
+}
+
 static bool whack_trafficstatus_connection(struct show *s, struct connection **c,
 					   const struct whack_message *m UNUSED)
 {
@@ -121,26 +142,9 @@ static bool whack_trafficstatus_connection(struct show *s, struct connection **c
 		.connection_serialno = (*c)->serialno,
 		.where = HERE,
 	};
+	const monotime_t now = mononow();
 	while (next_state_old2new(&state_by_connection)) {
-
-		struct state *st = state_by_connection.st;
-
-		/* ignore non-IPsec states (XXX: redundant?) */
-		if (IS_IKE_SA(st)) {
-			continue;
-		}
-
-		/* ignore non established states */
-		if (!IS_IPSEC_SA_ESTABLISHED(st)) {
-			continue;
-		}
-
-		/* whack-log-global - no prefix */
-		SHOW_JAMBUF(RC_INFORMATIONAL_TRAFFIC, s, buf) {
-			/* note: this mutates *st by calling
-			 * get_sa_bundle_info */
-			jam_child_sa_traffic(buf, pexpect_child_sa(st));
-		}
+		show_child_sa_traffic(s, state_by_connection.st, now);
 	}
 
 	return true;
@@ -149,7 +153,8 @@ static bool whack_trafficstatus_connection(struct show *s, struct connection **c
 void whack_trafficstatus(const struct whack_message *m, struct show *s)
 {
 	if (m->name == NULL) {
-		whack_all_connections(m, s, whack_trafficstatus_connection);
+		/* everything; list the states in slices */
+		list_states(s, show_child_sa_traffic, NULL);
 	} else {
 		whack_each_connection(m, s, whack_trafficstatus_connection,
 				      (struct each) {
@@ -87,6 +87,7 @@
 #include "crypt_hash.h"
 #include "crl_queue.h"
 #include "ip_info.h"
+#include "pubkey_db.h"
 
 bool crl_strict = false;
 bool ocsp_strict = false;
@@ -94,6 +95,7 @@ bool ocsp_enable = false;
 bool ocsp_post = false;
 char *curl_iface = NULL;
 long curl_timeout = -1;
+unsigned crl_fetch_threads = 1;
 
 SECItem same_shunk_as_dercert_secitem(shunk_t shunk)
 {
@@ -696,13 +698,15 @@ bool remote_has_preloaded_pubkey(const struct state *st)
 	 */
 	if (is_permanent(c)) {
 		/* look for a matching RSA public key */
-		for (const struct pubkey_list *p = pluto_pubkeys; p != NULL;
-		     p = p->next) {
-			const struct pubkey *key = p->key;
+		struct pubkey_filter pubkeys = {
+			.same_id = &c->remote->host.id,
+			.where = HERE,
+		};
+		while (next_pluto_pubkey(NEW2OLD, &pubkeys)) {
+			const struct pubkey *key = pubkeys.key;
 
 			if ((key->content.type == &pubkey_type_rsa ||
 			     key->content.type == &pubkey_type_ecdsa) &&
-			    same_id(&c->remote->host.id, &key->id) &&
 			    is_realtime_epoch(key->until_time)) {
 				/* found a preloaded public key */
 				return true;
@@ -204,6 +204,10 @@ static void help(void)
 		"       [--processstatus] | [--shuntstatus] | [--trafficstatus] | \\\n"
 		"	[--showstates]\n"
 		"\n"
+		"states: whack --liststates [--name <connection_name>] \\\n"
+		"	[--peer <ip-address>] [--kind ike|child] \\\n"
+		"	[--cursor <state_object_number>] [--pagesize <count>]\n"
+		"\n"
 		"statistics: [--globalstatus] | [--clearstats]\n"
 		"\n"
 		"refresh dns: whack --ddns\n"
@@ -366,6 +370,11 @@ enum option_enums {
 	OPT_TRAFFICSTATUS,
 	OPT_SHUNT_STATUS,
 	OPT_SHOW_STATES,
+	OPT_LIST_STATES,
+	OPT_LIST_STATES_PEER,
+	OPT_LIST_STATES_KIND,
+	OPT_LIST_STATES_CURSOR,
+	OPT_LIST_STATES_PAGESIZE,
 	OPT_ADDRESSPOOL_STATUS,
 	OPT_CONNECTION_STATUS,
 	OPT_FIPS_STATUS,
@@ -665,6 +674,11 @@ static const struct option long_opts[] = {
 	{ "processstatus", no_argument, NULL, OPT_PROCESS_STATUS + OO },
 	{ "statestatus", no_argument, NULL, OPT_SHOW_STATES + OO }, /* alias to catch typos */
 	{ "showstates", no_argument, NULL, OPT_SHOW_STATES + OO },
+	{ "liststates", no_argument, NULL, OPT_LIST_STATES + OO },
+	{ "peer", required_argument, NULL, OPT_LIST_STATES_PEER + OO },
+	{ "kind", required_argument, NULL, OPT_LIST_STATES_KIND + OO },
+	{ "cursor", required_argument, NULL, OPT_LIST_STATES_CURSOR + OO + NUMERIC_ARG },
+	{ "pagesize", required_argument, NULL, OPT_LIST_STATES_PAGESIZE + OO + NUMERIC_ARG },
 
 #ifdef USE_SECCOMP
 	{ "seccomp-crashtest", no_argument, NULL, OPT_SECCOMP_CRASHTEST + OO },
@@ -1499,6 +1513,33 @@ int main(int argc, char **argv)
 			msg.whack_show_states = true;
 			ignore_errors = true;
 			continue;
+
+		case OPT_LIST_STATES:	/* --liststates */
+			msg.whack_list_states = true;
+			ignore_errors = true;
+			continue;
+
+		case OPT_LIST_STATES_PEER:	/* --peer <ip-address> */
+			opt_to_address(&host_family, &msg.list_states.peer);
+			continue;
+
+		case OPT_LIST_STATES_KIND:	/* --kind ike|child */
+			if (streq(optarg, "ike")) {
+				msg.list_states.kind = WHACK_IKE_SA;
+			} else if (streq(optarg, "child")) {
+				msg.list_states.kind = WHACK_CHILD_SA;
+			} else {
+				diagq("--kind must be \"ike\" or \"child\"", optarg);
+			}
+			continue;
+
+		case OPT_LIST_STATES_CURSOR:	/* --cursor <state_object_number> */
+			msg.list_states.cursor = opt_whole;
+			continue;
+
+		case OPT_LIST_STATES_PAGESIZE:	/* --pagesize <count> */
+			msg.list_states.pagesize = opt_whole;
+			continue;
 #ifdef USE_SECCOMP
 		case OPT_SECCOMP_CRASHTEST:	/* --seccomp-crashtest */
 			msg.whack_seccomp_crashtest = true;
@@ -2565,6 +2606,13 @@ int main(int argc, char **argv)
 		diagw("--oppohere and --oppothere must be used together");
 	}
 
+	/* the listing filters only make sense with --liststates */
+	if (!seen[OPT_LIST_STATES] &&
+	    (seen[OPT_LIST_STATES_PEER] || seen[OPT_LIST_STATES_KIND] ||
+	     seen[OPT_LIST_STATES_CURSOR] || seen[OPT_LIST_STATES_PAGESIZE])) {
+		diagw("--peer, --kind, --cursor and --pagesize require --liststates");
+	}
+
 	/* check connection description */
 	if (opts_seen & OPTS_SEEN_CD) {
 		if (!seen[CD_TO]) {
@@ -2670,6 +2718,7 @@ int main(int argc, char **argv)
 	      !lmod_empty(msg.debugging) ||
 	      msg.nr_impairments > 0 ||
 	      msg.whack_shutdown || msg.whack_purgeocsp || msg.whack_seccomp_crashtest || msg.whack_show_states ||
+	      msg.whack_list_states ||
 	      msg.whack_rekey_ike || msg.whack_rekey_ipsec ||
 	      msg.whack_listpubkeys || msg.whack_checkpubkeys))
 		diagw("no action specified; try --help for hints");
@@ -18,6 +18,7 @@ cmp ../../programs/_enumcheck/OUTPUT.enumcheck.txt OUTPUT/enumcheck.out || echo
 ipsec _jambufcheck > /dev/null || echo failed
 ipsec _timecheck > /dev/null || echo failed
 ipsec _hunkcheck > /dev/null || echo failed
+ipsec _hashcheck > /dev/null || echo failed
 ipsec _dncheck > /dev/null || echo failed
 ipsec _keyidcheck > /dev/null || echo failed
 ipsec _asn1check > /dev/null || echo failed
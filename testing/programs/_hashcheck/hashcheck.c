@@ -0,0 +1,226 @@
+/* test hash_bytes(), for libreswan
+ *
+ * Copyright (C) 2019 Andrew Cagney
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>		/* for exit() */
+#include <stdint.h>
+#include <time.h>		/* for clock_gettime() */
+#include <arpa/inet.h>		/* for htonl() */
+
+#include "lswtool.h"
+#include "lswlog.h"
+#include "lswnss.h"
+#include "hash_bytes.h"
+#include "ike_spi.h"
+#include "ip_address.h"
+#include "id.h"
+
+#define ERROR 124
+
+/*
+ * Mimic pluto's STATE_TABLE_SIZE tables, loaded with enough entries
+ * to give long chains.
+ */
+
+#define NR_SLOTS 499
+#define NR_KEYS (NR_SLOTS * 100)
+#define NR_CHOSEN_KEYS 1000
+#define NR_OPS 1000000
+
+unsigned fails;
+
+typedef hash_t (hash_bytes_fn)(const void *ptr, size_t len, hash_t hash);
+
+/*
+ * The old hash_bytes(), for comparison.
+ */
+
+static hash_t hash_bytes_251(const void *ptr, size_t len, hash_t hash)
+{
+	const uint8_t *bytes = ptr;
+	for (unsigned j = 0; j < len; j++) {
+		hash.hash = hash.hash * 251 + bytes[j];
+	}
+	return hash;
+}
+
+/*
+ * The keys, generated up front so that only the hash is timed, and
+ * hashed the way pluto's tables do.
+ */
+
+static ike_spis_t ike_spis[NR_KEYS];
+static ike_spis_t chosen_ike_spis[NR_CHOSEN_KEYS];
+static ip_address addresses[NR_KEYS];
+static struct {
+	char name[32];
+	struct id id;
+} ids[NR_KEYS];
+
+static void init_keys(void)
+{
+	for (unsigned i = 0; i < NR_KEYS; i++) {
+		ike_spis[i].initiator.bytes[6] = i >> 8;
+		ike_spis[i].initiator.bytes[7] = i;
+
+		struct in_addr in = { .s_addr = htonl(0x0a000000 + i), };
+		addresses[i] = address_from_in_addr(&in);
+
+		snprintf(ids[i].name, sizeof(ids[i].name), "user%u@example.com", i);
+		ids[i].id = (struct id) {
+			.kind = ID_USER_FQDN,
+			.name = shunk1(ids[i].name),
+		};
+	}
+	/*
+	 * What a peer, knowing the old hash, could send: SPIs that
+	 * all land in bucket 0.
+	 */
+	unsigned n = 0;
+	for (uint32_t spi = 0; n < NR_CHOSEN_KEYS; spi++) {
+		ike_spis_t spis = {0};
+		spis.initiator.bytes[4] = spi >> 24;
+		spis.initiator.bytes[5] = spi >> 16;
+		spis.initiator.bytes[6] = spi >> 8;
+		spis.initiator.bytes[7] = spi;
+		if (hash_bytes_251(&spis, sizeof(spis), zero_hash).hash % NR_SLOTS == 0) {
+			chosen_ike_spis[n++] = spis;
+		}
+	}
+}
+
+static hash_t hash_ike_spis(unsigned i, hash_bytes_fn *hasher)
+{
+	return hasher(&ike_spis[i], sizeof(ike_spis[i]), zero_hash);
+}
+
+static hash_t hash_chosen_ike_spis(unsigned i, hash_bytes_fn *hasher)
+{
+	return hasher(&chosen_ike_spis[i], sizeof(chosen_ike_spis[i]), zero_hash);
+}
+
+static hash_t hash_address(unsigned i, hash_bytes_fn *hasher)
+{
+	shunk_t bytes = address_as_shunk(&addresses[i]);
+	return hasher(bytes.ptr, bytes.len, zero_hash);
+}
+
+static hash_t hash_id(unsigned i, hash_bytes_fn *hasher)
+{
+	shunk_t body;
+	enum ike_id_type type = id_to_payload(&ids[i].id, &unset_address, &body);
+	hash_t hash = hasher(&type, sizeof(type), zero_hash);
+	return hasher(body.ptr, body.len, hash);
+}
+
+static void check_hash(const char *name, unsigned nr_keys,
+		       hash_t (*hash_key)(unsigned i, hash_bytes_fn *hasher),
+		       const char *hasher_name, hash_bytes_fn *hasher, bool check)
+{
+	/* bucket distribution */
+	static unsigned slots[NR_SLOTS];
+	for (unsigned s = 0; s < NR_SLOTS; s++) {
+		slots[s] = 0;
+	}
+	for (unsigned i = 0; i < nr_keys; i++) {
+		slots[hash_key(i, hasher).hash % NR_SLOTS]++;
+	}
+	unsigned max = 0, empty = 0;
+	for (unsigned s = 0; s < NR_SLOTS; s++) {
+		max = (slots[s] > max ? slots[s] : max);
+		empty += (slots[s] == 0);
+	}
+
+	/* speed */
+	struct timespec start, stop;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	unsigned sink = 0;
+	for (unsigned i = 0; i < NR_OPS; i++) {
+		sink ^= hash_key(i % nr_keys, hasher).hash;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	uintmax_t ns = ((uintmax_t) (stop.tv_sec - start.tv_sec) * 1000000000 +
+			stop.tv_nsec - start.tv_nsec);
+
+	printf("%-17s %-8s keys=%u average=%u max=%u empty=%u %ju.%02juns/op (%08x)\n",
+	       name, hasher_name, nr_keys, nr_keys / NR_SLOTS, max, empty,
+	       ns / NR_OPS, (ns * 100 / NR_OPS) % 100, sink);
+
+	/* very generous; a keyed hash comes in well under this */
+	if (check && max > 2 * (nr_keys / NR_SLOTS) + 16) {
+		fprintf(stderr, "%s: %s distribution is bad: max=%u empty=%u\n",
+			name, hasher_name, max, empty);
+		fails++;
+	}
+}
+
+static void check_chaining(void)
+{
+	static const char bytes[] = "libreswan";
+	hash_t h1 = hash_bytes(bytes, sizeof(bytes), zero_hash);
+	hash_t h2 = hash_bytes(bytes, sizeof(bytes), zero_hash);
+	hash_t h3 = hash_bytes(bytes, sizeof(bytes), h1);
+	if (h1.hash != h2.hash) {
+		fprintf(stderr, "hash_bytes() is not repeatable\n");
+		fails++;
+	}
+	if (h1.hash == h3.hash) {
+		fprintf(stderr, "hash_bytes() ignores the incoming hash\n");
+		fails++;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct logger *logger = tool_logger(argc, argv);
+
+	if (argc != 1) {
+		fprintf(stderr, "usage: %s\n", argv[0]);
+		exit(1);
+	}
+
+	/* the key comes from NSS */
+	diag_t d = lsw_nss_setup(NULL, LSW_NSS_READONLY, logger);
+	if (d != NULL) {
+		fatal_diag(ERROR, logger, &d, "%s", "");
+	}
+	init_hash_bytes_key();
+
+	check_chaining();
+	init_keys();
+
+	static const struct {
+		const char *name;
+		unsigned nr_keys;
+		hash_t (*hash_key)(unsigned i, hash_bytes_fn *hasher);
+	} keys[] = {
+		{ "ike_spis_t", NR_KEYS, hash_ike_spis, },
+		{ "chosen ike_spis_t", NR_CHOSEN_KEYS, hash_chosen_ike_spis, },
+		{ "ip_address", NR_KEYS, hash_address, },
+		{ "struct id", NR_KEYS, hash_id, },
+	};
+	FOR_EACH_ELEMENT(k, keys) {
+		check_hash(k->name, k->nr_keys, k->hash_key, "251", hash_bytes_251, false);
+		check_hash(k->name, k->nr_keys, k->hash_key, "siphash", hash_bytes, true);
+	}
+
+	lsw_nss_shutdown();
+
+	if (fails > 0) {
+		fprintf(stderr, "TOTAL FAILURES: %d\n", fails);
+		return 1;
+	}
+	return 0;
+}
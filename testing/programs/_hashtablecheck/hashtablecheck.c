@@ -0,0 +1,256 @@
+/* test pluto's hash table resizing, for libreswan
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.  See <https://www.gnu.org/licenses/gpl2.txt>.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>		/* for exit() */
+
+#include "lswtool.h"
+#include "lswlog.h"
+#include "jambuf.h"
+
+#include "defs.h"
+#include "hash_table.h"
+#include "server.h"		/* for schedule_timeout() */
+#include "show.h"
+
+/*
+ * Lookups such as state_by_reqid() rely on each bucket being ordered
+ * newest-first so that, for a given key, the most recent entry wins.
+ * Check that this holds before, during, and after resizes.
+ */
+
+#define NR_KEYS 37
+#define NR_THINGS 5000
+
+unsigned fails;
+
+struct thing {
+	unsigned key;
+	unsigned serial;
+	struct {
+		struct list_entry key;
+	} thing_db_entries;
+};
+
+static void jam_thing(struct jambuf *buf, const struct thing *t)
+{
+	jam(buf, "key %u serial %u", t->key, t->serial);
+}
+
+static hash_t hash_thing_key(const unsigned *key)
+{
+	/* spread the keys out */
+	return (hash_t) { .hash = *key * 2654435761U, };
+}
+
+HASH_TABLE(thing, key, .key, 7);
+
+static struct thing things[NR_THINGS];
+static unsigned nr_things;
+
+/*
+ * Stand in for the event-loop; resize steps are only run when the
+ * test says so.
+ */
+
+static struct timeout {
+	void (*cb)(void *arg, const struct timer_event *event);
+	void *arg;
+} pending_timeout;
+
+void schedule_timeout(const char *name UNUSED,
+		      struct timeout **to, const deltatime_t delay UNUSED,
+		      void (*cb)(void *arg, const struct timer_event *event),
+		      void *arg)
+{
+	if (pending_timeout.cb != NULL) {
+		fprintf(stderr, "FAIL: timeout already pending\n");
+		exit(1);
+	}
+	pending_timeout = (struct timeout) { .cb = cb, .arg = arg, };
+	*to = &pending_timeout;
+}
+
+void destroy_timeout(struct timeout **to)
+{
+	if (*to != NULL) {
+		pending_timeout = (struct timeout) {0};
+		*to = NULL;
+	}
+}
+
+struct event_base *get_pluto_event_base(void)
+{
+	/* never dereferenced */
+	return (struct event_base *) &pending_timeout;
+}
+
+static bool run_resize_step(void)
+{
+	if (pending_timeout.cb == NULL) {
+		return false;
+	}
+	struct timeout t = pending_timeout;
+	t.cb(t.arg, NULL);
+	return true;
+}
+
+/* not used; but hash_table.c needs them */
+
+struct jambuf *show_jambuf(struct show *s UNUSED)
+{
+	return NULL;
+}
+
+void jambuf_to_show(struct jambuf *buf UNUSED, struct show *s UNUSED,
+		    enum rc_type rc UNUSED)
+{
+}
+
+void show_separator(struct show *s UNUSED)
+{
+}
+
+/*
+ * For each key, walking the bucket NEW2OLD must see serials
+ * decreasing, and the first match must be the newest thing with that
+ * key.
+ */
+
+static void check_order(const char *what)
+{
+	struct hash_table *table = &thing_key_hash_table;
+	unsigned newest[NR_KEYS] = {0};
+	for (unsigned i = 0; i < nr_things; i++) {
+		struct thing *t = &things[i];
+		if (!detached_list_entry(&t->thing_db_entries.key) &&
+		    t->serial > newest[t->key]) {
+			newest[t->key] = t->serial;
+		}
+	}
+
+	FOR_EACH_HASH_TABLE_BUCKET(bucket, table) {
+		unsigned last[NR_KEYS] = {0};
+		struct thing *t;
+		FOR_EACH_LIST_ENTRY_NEW2OLD(t, bucket) {
+			if (last[t->key] != 0 && t->serial > last[t->key]) {
+				fprintf(stderr, "FAIL: %s: key %u serial %u is ahead of serial %u (slots=%lu old=%lu cursor=%lu)\n",
+					what, t->key, last[t->key], t->serial,
+					table->nr_slots, table->old.nr_slots, table->old.cursor);
+				fails++;
+			}
+			last[t->key] = t->serial;
+		}
+	}
+
+	for (unsigned key = 0; key < NR_KEYS; key++) {
+		if (newest[key] == 0) {
+			continue;
+		}
+		struct list_head *bucket = hash_table_bucket(table, hash_thing_key(&key));
+		struct thing *t = NULL;
+		FOR_EACH_LIST_ENTRY_NEW2OLD(t, bucket) {
+			if (t->key == key) {
+				break;
+			}
+		}
+		if (t == NULL || t->serial != newest[key]) {
+			fprintf(stderr, "FAIL: %s: key %u found serial %u expecting %u\n",
+				what, key, (t == NULL ? 0 : t->serial), newest[key]);
+			fails++;
+		}
+	}
+
+	check_hash_table(table, &global_logger);
+}
+
+static void add_things(unsigned n)
+{
+	for (unsigned i = 0; i < n && nr_things < NR_THINGS; i++) {
+		struct thing *t = &things[nr_things++];
+		t->key = nr_things % NR_KEYS;
+		t->serial = nr_things;
+		init_hash_table_entry(&thing_key_hash_table, t);
+		add_hash_table_entry(&thing_key_hash_table, t);
+	}
+}
+
+static void del_things(unsigned n)
+{
+	/* oldest first, like states expiring */
+	for (unsigned i = 0; i < nr_things && n > 0; i++) {
+		struct thing *t = &things[i];
+		if (!detached_list_entry(&t->thing_db_entries.key)) {
+			del_hash_table_entry(&thing_key_hash_table, t);
+			n--;
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct logger *logger = tool_logger(argc, argv);
+
+	if (argc != 1) {
+		fprintf(stderr, "usage: %s\n", argv[0]);
+		exit(1);
+	}
+
+	init_hash_table(&thing_key_hash_table, logger);
+
+	/* grow, adding things between each resize step */
+	unsigned long grows = 0;
+	while (nr_things < NR_THINGS) {
+		add_things(17);
+		check_order("growing");
+		if (run_resize_step()) {
+			check_order("grow step");
+		}
+	}
+	while (run_resize_step()) {
+		check_order("grow step");
+	}
+	grows = thing_key_hash_table.nr_grows;
+	if (grows == 0) {
+		fprintf(stderr, "FAIL: table never grew\n");
+		fails++;
+	}
+
+	/* shrink, interleaving deletes and resize steps */
+	for (unsigned n = 0; n < NR_THINGS; n += 23) {
+		del_things(23);
+		check_order("shrinking");
+		if (run_resize_step()) {
+			check_order("shrink step");
+		}
+	}
+	while (run_resize_step()) {
+		check_order("shrink step");
+	}
+	if (thing_key_hash_table.nr_shrinks == 0) {
+		fprintf(stderr, "FAIL: table never shrank\n");
+		fails++;
+	}
+
+	free_hash_tables(logger);
+	check_order("freed");
+
+	printf("grows=%lu shrinks=%lu slots=%lu\n", grows,
+	       thing_key_hash_table.nr_shrinks, thing_key_hash_table.nr_slots);
+
+	if (fails > 0) {
+		fprintf(stderr, "TOTAL FAILURES: %d\n", fails);
+		return 1;
+	}
+	return 0;
+}